@@ -1,7 +1,12 @@
 #include <Client.h>
+#include <AsyncClient.h>
+#include <SharedClient.h>
+#include <ShardedClient.h>
+#include <ReplicaClient.h>
 #include <Logger.h>
 #include <cmath>
 #include <Cycles.h>
+#include <thread>
 #include <vector>
 #include <OptionConfig.h>
 
@@ -72,9 +77,31 @@ struct TimeDist {
 class YCSBWorkload {
 public:
     YCSBWorkload(Client *client, uint32_t readPercent, uint64_t targetOps, uint32_t objectCount,
-                 uint32_t objectSize = 128) :
-        client(client), readPercent(readPercent), targetOps(targetOps), objectSize(objectSize)
-        , samples(), zipfianGenerator(), experimentStartTime(0) {
+                 uint32_t objectSize = 128, AsyncClient *async = nullptr) :
+        client(client), sharded(nullptr), asyncs(), replicas(nullptr), constraint(), readPercent(readPercent)
+        , targetOps(targetOps), objectSize(objectSize), samples(), zipfianGenerator(), experimentStartTime(0) {
+        zipfianGenerator = new ZipfianGenerator(objectCount);
+        if (async != nullptr)
+            asyncs.push_back(async);
+    }
+
+    /// Spreads the operations over the shards of sharded; asyncs is empty,
+    /// or holds an AsyncClient for each shard.
+    YCSBWorkload(ShardedClient *sharded, std::vector<AsyncClient *> asyncs, uint32_t readPercent,
+                 uint64_t targetOps, uint32_t objectCount, uint32_t objectSize = 128) :
+        client(nullptr), sharded(sharded), asyncs(std::move(asyncs)), replicas(nullptr), constraint()
+        , readPercent(readPercent), targetOps(targetOps), objectSize(objectSize), samples(), zipfianGenerator()
+        , experimentStartTime(0) {
+        zipfianGenerator = new ZipfianGenerator(objectCount);
+    }
+
+    /// Spreads the reads over the primary and the backups of replicas,
+    /// which must meet constraint; writes go to the primary.
+    YCSBWorkload(ReplicaClient *replicas, const ReadConstraint &constraint, uint32_t readPercent,
+                 uint64_t targetOps, uint32_t objectCount, uint32_t objectSize = 128) :
+        client(replicas->getPrimary()), sharded(nullptr), asyncs(), replicas(replicas), constraint(constraint)
+        , readPercent(readPercent), targetOps(targetOps), objectSize(objectSize), samples(), zipfianGenerator()
+        , experimentStartTime(0) {
         zipfianGenerator = new ZipfianGenerator(objectCount);
     }
 
@@ -97,17 +124,29 @@ public:
             uint64_t start = Cycles::rdtsc();
             SampleType type;
             uint64_t key = zipfianGenerator->nextNumber();
+            uint32_t shard = sharded != nullptr ? sharded->shardOf(key) : 0;
+            Client *target = sharded != nullptr ? sharded->getShard(shard) : client;
+            AsyncClient *async = asyncs.empty() ? nullptr : asyncs[shard];
             if (choice < readPercent) {
                 type = GET;
-                client->get(key, &buffer, &exists);
+                if (async != nullptr)
+                    async->get(key, record(start, type));
+                else if (replicas != nullptr)
+                    replicas->get(key, &buffer, constraint, &exists);
+                else
+                    target->get(key, &buffer, &exists);
             } else {
                 type = PUT;
-                client->put(key, value, objectSize);
+                if (async != nullptr)
+                    async->put(key, value, objectSize, record(start, type));
+                else
+                    target->put(key, value, objectSize);
             }
 
             uint64_t stop = Cycles::rdtsc();
 
-            samples.emplace_back(start, stop, type);
+            if (async == nullptr)
+                samples.emplace_back(start, stop, type);
 
             if (experimentStartTime + seconds * oneSecond < stop)
                 break;
@@ -121,6 +160,12 @@ public:
                 while (Cycles::rdtsc() < nextStop);
             }
         }
+        for (AsyncClient *async: asyncs)
+            async->waitAll();
+    }
+
+    /// Prints the results of run and returns its throughput in kops.
+    double report() {
         std::vector<TimeDist> result;
         statistics(result);
 
@@ -131,6 +176,25 @@ public:
                 i, result[i].p50, result[i].p999, result[i].avg,
                 static_cast<double>(result[i].throughput) / 100.);
         }
+
+        std::vector<uint64_t> times;
+        for (Sample &sample: samples)
+            times.push_back(sample.endTicks - sample.startTicks);
+        TimeDist total{};
+        getDist(times, &total);
+        double elapsed = samples.empty() ? 0 : Cycles::toSeconds(samples.back().endTicks - experimentStartTime);
+        double kops = elapsed > 0 ? static_cast<double>(times.size()) / elapsed / 1000. : 0.;
+        printf("total: %lu ops, median %lu, 99th %lu, %.1lf kops\n",
+               times.size(), total.p50, total.p99, kops);
+        return kops;
+    }
+
+    /// Returns a callback that records the sample of an asynchronous
+    /// operation issued at start.
+    AsyncClient::Callback record(uint64_t start, SampleType type) {
+        return [this, start, type](AsyncClient::Operation &) {
+            samples.emplace_back(start, Cycles::rdtsc(), type);
+        };
     }
 
     static void getDist(std::vector<uint64_t> &times, TimeDist *dist) {
@@ -213,6 +277,16 @@ public:
 
 private:
     Client *client;
+
+    /// Routes the operations to several servers, or NULL.
+    ShardedClient *sharded;
+
+    /// Issue the operations when they are pipelined: one per shard.
+    std::vector<AsyncClient *> asyncs;
+
+    /// Serves the reads from the primary and its backups, or NULL.
+    ReplicaClient *replicas;
+    ReadConstraint constraint;
     uint32_t readPercent;
     uint64_t targetOps;
     uint32_t objectSize;
@@ -231,14 +305,75 @@ int main(int argc, char *argv[]) {
 
     Logger::log("client connect to %s", optionConfig.connectLocator.c_str());
 
+    if (optionConfig.clientThreads > 1) {
+        // Each thread runs a workload of its own on one shared client.
+        SharedClient client(optionConfig, optionConfig.connectLocator, optionConfig.ioThreads);
+        std::vector<std::unique_ptr<AsyncClient>> asyncs;
+        std::vector<std::unique_ptr<YCSBWorkload>> workloads;
+        for (uint32_t i = 0; i < optionConfig.clientThreads; i++) {
+            asyncs.emplace_back(optionConfig.window > 1 ? new AsyncClient(&client, optionConfig.window) : nullptr);
+            workloads.emplace_back(new YCSBWorkload(&client, optionConfig.readPercent, optionConfig.targetOps,
+                                                    optionConfig.objectCount, optionConfig.objectSize,
+                                                    asyncs.back().get()));
+        }
+        std::vector<std::thread> threads;
+        for (auto &workload: workloads)
+            threads.emplace_back(&YCSBWorkload::run, workload.get(), optionConfig.time);
+        for (auto &thread: threads)
+            thread.join();
+
+        double kops = 0;
+        for (auto &workload: workloads)
+            kops += workload->report();
+        printf("aggregate: %.1lf kops\n", kops);
+        Logger::log("Benchmark finished");
+        return 0;
+    }
+
     Context context(optionConfig, true);
 
+    std::vector<std::string> locators = ShardedClient::splitLocators(optionConfig.connectLocator);
+    if (locators.size() > 1) {
+        // A list of servers: spread the keys over them.
+        ShardedClient sharded(&context, locators);
+        std::vector<std::unique_ptr<AsyncClient>> asyncs;
+        std::vector<AsyncClient *> shardAsyncs;
+        for (uint32_t i = 0; optionConfig.window > 1 && i < sharded.getShardCount(); i++) {
+            asyncs.emplace_back(new AsyncClient(sharded.getShard(i), optionConfig.window));
+            shardAsyncs.push_back(asyncs.back().get());
+        }
+        YCSBWorkload workload(&sharded, shardAsyncs, optionConfig.readPercent, optionConfig.targetOps,
+                              optionConfig.objectCount, optionConfig.objectSize);
+        workload.run(optionConfig.time);
+        workload.report();
+        Logger::log("Benchmark finished");
+        return 0;
+    }
+
+    std::vector<std::string> backups = ShardedClient::splitLocators(optionConfig.backupLocators);
+    if (!backups.empty()) {
+        // Reads are spread over the server and its backups.
+        ReplicaClient replicas(&context, optionConfig.connectLocator, backups);
+        YCSBWorkload workload(&replicas, ReadConstraint{0, optionConfig.maxStalenessMicros},
+                              optionConfig.readPercent, optionConfig.targetOps, optionConfig.objectCount,
+                              optionConfig.objectSize);
+        workload.run(optionConfig.time);
+        workload.report();
+        Logger::log("Benchmark finished");
+        return 0;
+    }
+
     Client client(&context, optionConfig.connectLocator);
 
 
+    std::unique_ptr<AsyncClient> async;
+    if (optionConfig.window > 1)
+        async.reset(new AsyncClient(&client, optionConfig.window));
+
     YCSBWorkload workload(&client, optionConfig.readPercent, optionConfig.targetOps, optionConfig.objectCount,
-                          optionConfig.objectSize);
+                          optionConfig.objectSize, async.get());
 
     workload.run(optionConfig.time);
+    workload.report();
     Logger::log("Benchmark finished");
 }
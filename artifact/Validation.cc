@@ -3,6 +3,9 @@
 #include <Context.h>
 #include <Client.h>
 
+#include <memory>
+#include <vector>
+
 using namespace Gungnir;
 
 const std::string DOESNT_EXISTS = "DOESN'T EXISTS";
@@ -57,6 +60,28 @@ int main(int argc, char *argv[]) {
 
     assert(key==5001);
 
+    Iterator reverse = client.scan(2000, 5000, 100, 0, true);
+    assert(reverse.getKey() == 5000 && reverse.hasMore && reverse.nextKey == 4900);
+
+    Iterator stream = client.scanStream(2000, 5000, 4096);
+    for (key = 2000; !stream.isDone(); stream.next()) {
+        assert(key == stream.getKey());
+        key++;
+    }
+    assert(key == 5001);
+
+    // Pipelined requests on one connection; replies may come back in any
+    // order.
+    std::vector<std::unique_ptr<GetRpc>> gets;
+    std::vector<Buffer> values(100);
+    for (int i = 0; i < 100; i++) {
+        gets.emplace_back(new GetRpc(&client, 3000 + i, &values[i]));
+    }
+    for (int i = 0; i < 100; i++) {
+        gets[i]->wait(nullptr);
+        assert(std::string(values[i].getStart<char>(), values[i].size()) == std::to_string(3000 + i));
+    }
+
     Logger::log("validation finished");
 }
 
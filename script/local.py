@@ -0,0 +1,32 @@
+#!/usr/bin/env python
+import re
+import subprocess
+import time
+
+server_binary = "./build/gungnir"
+client_binary = "./build/benchmark --time 3 --targetOps 0 --objectCount 100000"
+
+locators = [
+    ("tcp", "127.0.0.1:8080"),
+    ("unix", "unix:path=/tmp/gungnir.sock"),
+]
+
+
+def run(locator):
+    server = subprocess.Popen(server_binary.split() + ["-l", locator])
+    time.sleep(2)
+    try:
+        output = subprocess.check_output(client_binary.split() + ["-c", locator])
+    finally:
+        server.kill()
+        server.wait()
+    match = re.search(r"total: (\d+) ops, median (\d+), 99th (\d+), ([\d.]+) kops",
+                      output.decode())
+    return match.groups() if match else ("-", "-", "-", "-")
+
+
+if __name__ == '__main__':
+    results = [(name, run(locator)) for name, locator in locators]
+    print("%-6s %10s %10s %10s" % ("", "kops", "median", "99th"))
+    for name, (ops, p50, p99, kops) in results:
+        print("%-6s %10s %10s %10s" % (name, kops, p50, p99))
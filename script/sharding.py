@@ -0,0 +1,31 @@
+#!/usr/bin/env python
+import re
+import subprocess
+import time
+
+server_binary = "./build/gungnir"
+client_binary = "./build/benchmark --time 3 --targetOps 0 --objectCount 100000 --window 32"
+
+shard_counts = [1, 2, 4]
+first_port = 8090
+
+
+def run(shard_count):
+    locators = ["127.0.0.1:%d" % (first_port + i) for i in range(shard_count)]
+    servers = [subprocess.Popen(server_binary.split() + ["-l", locator]) for locator in locators]
+    time.sleep(2)
+    try:
+        output = subprocess.check_output(client_binary.split() + ["-c", ",".join(locators)])
+    finally:
+        for server in servers:
+            server.kill()
+            server.wait()
+    match = re.search(r"total: (\d+) ops, median (\d+), 99th (\d+), ([\d.]+) kops", output.decode())
+    return match.group(4) if match else "-"
+
+
+if __name__ == '__main__':
+    results = [(shard_count, run(shard_count)) for shard_count in shard_counts]
+    print("%-8s %10s" % ("shards", "kops"))
+    for shard_count, kops in results:
+        print("%-8d %10s" % (shard_count, kops))
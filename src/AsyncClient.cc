@@ -0,0 +1,241 @@
+#include "AsyncClient.h"
+#include "ClientException.h"
+#include "Dispatch.h"
+
+namespace Gungnir {
+
+namespace {
+
+class GetOperation : public AsyncClient::Operation {
+public:
+    GetOperation(AsyncClient *owner, AsyncClient::Callback callback, Client *client, uint64_t key)
+        : Operation(owner, std::move(callback)), getRpc(client, key, &value) {}
+
+protected:
+    RpcWrapper &rpc() override {
+        return getRpc;
+    }
+
+    void finish() override {
+        getRpc.wait(&exists, &version);
+    }
+
+private:
+    GetRpc getRpc;
+};
+
+class PutOperation : public AsyncClient::Operation {
+public:
+    PutOperation(AsyncClient *owner, AsyncClient::Callback callback, Client *client, uint64_t key,
+                 const void *buf, uint32_t length)
+        : Operation(owner, std::move(callback)), putRpc(client, key, buf, length) {}
+
+protected:
+    RpcWrapper &rpc() override {
+        return putRpc;
+    }
+
+    void finish() override {
+        putRpc.wait(&version);
+    }
+
+private:
+    PutRpc putRpc;
+};
+
+class EraseOperation : public AsyncClient::Operation {
+public:
+    EraseOperation(AsyncClient *owner, AsyncClient::Callback callback, Client *client, uint64_t key)
+        : Operation(owner, std::move(callback)), eraseRpc(client, key) {}
+
+protected:
+    RpcWrapper &rpc() override {
+        return eraseRpc;
+    }
+
+    void finish() override {
+        eraseRpc.wait();
+    }
+
+private:
+    EraseRpc eraseRpc;
+};
+
+class ScanOperation : public AsyncClient::Operation {
+public:
+    ScanOperation(AsyncClient *owner, AsyncClient::Callback callback, Client *client, uint64_t start,
+                  uint64_t end, uint32_t maxCount, uint32_t maxBytes)
+        : Operation(owner, std::move(callback))
+          , scanRpc(client, start, end, maxCount, maxBytes, false, &iterator) {}
+
+protected:
+    RpcWrapper &rpc() override {
+        return scanRpc;
+    }
+
+    void finish() override {
+        scanRpc.wait();
+    }
+
+private:
+    ScanRpc scanRpc;
+};
+
+}
+
+AsyncClient::AsyncClient(Client *client, uint32_t window)
+    : client(client), window(std::max(1u, window)), outstanding() {
+    outstanding.reserve(this->window);
+}
+
+/**
+ * Waits for the outstanding operations, so that their callbacks still run.
+ */
+AsyncClient::~AsyncClient() {
+    waitAll();
+}
+
+/**
+ * Read the object at key. Once the operation is ready, its value, exists
+ * and version are set.
+ */
+AsyncClient::Future AsyncClient::get(uint64_t key, Callback callback) {
+    makeRoom();
+    Future operation = std::make_shared<GetOperation>(this, std::move(callback), client, key);
+    outstanding.push_back(operation);
+    return operation;
+}
+
+/**
+ * Write the object at key. The value is copied before this returns. Once
+ * the operation is ready, its version is set.
+ */
+AsyncClient::Future AsyncClient::put(uint64_t key, const void *buf, uint32_t length, Callback callback) {
+    makeRoom();
+    Future operation = std::make_shared<PutOperation>(this, std::move(callback), client, key, buf, length);
+    outstanding.push_back(operation);
+    return operation;
+}
+
+AsyncClient::Future AsyncClient::erase(uint64_t key, Callback callback) {
+    makeRoom();
+    Future operation = std::make_shared<EraseOperation>(this, std::move(callback), client, key);
+    outstanding.push_back(operation);
+    return operation;
+}
+
+/**
+ * Read one page of the objects in [start, end]; see Client::scan. Once the
+ * operation is ready, its iterator holds the page.
+ */
+AsyncClient::Future AsyncClient::scan(uint64_t start, uint64_t end, uint32_t maxCount, uint32_t maxBytes,
+                                      Callback callback) {
+    makeRoom();
+    Future operation = std::make_shared<ScanOperation>(this, std::move(callback), client, start, end,
+                                                       maxCount, maxBytes);
+    outstanding.push_back(operation);
+    return operation;
+}
+
+/**
+ * Finish every outstanding operation whose RPC has completed and run the
+ * callbacks of those operations. When invoked on the dispatch thread this
+ * also makes a pass of the dispatch loop, so that replies get received.
+ *
+ * \return
+ *      The number of operations finished.
+ */
+uint32_t AsyncClient::poll() {
+    Dispatch *dispatch = client->context->dispatch;
+    if (dispatch->isDispatchThread())
+        dispatch->poll();
+
+    // Take the finished operations out of outstanding before running any
+    // callback, since callbacks may issue (and so poll) again.
+    std::vector<Future> ready;
+    size_t kept = 0;
+    for (size_t i = 0; i < outstanding.size(); i++) {
+        Future &operation = outstanding[i];
+        Status status = STATUS_OK;
+        bool isReady;
+        try {
+            isReady = operation->rpc().isReady();
+        } catch (ClientException &e) {
+            isReady = true;
+            status = e.status;
+        }
+        if (isReady) {
+            complete(operation.get(), status);
+            ready.push_back(std::move(operation));
+        } else {
+            if (kept != i)
+                outstanding[kept] = std::move(operation);
+            kept++;
+        }
+    }
+    outstanding.resize(kept);
+
+    for (Future &operation: ready) {
+        if (operation->callback) {
+            operation->callback(*operation);
+            operation->callback = nullptr;
+        }
+    }
+    return static_cast<uint32_t>(ready.size());
+}
+
+/**
+ * Return once every operation issued so far has finished and its callback
+ * has run, including operations issued by those callbacks.
+ */
+void AsyncClient::waitAll() {
+    while (!outstanding.empty())
+        poll();
+}
+
+/**
+ * Wait until fewer than window operations are outstanding.
+ */
+void AsyncClient::makeRoom() {
+    while (outstanding.size() >= window)
+        poll();
+}
+
+/**
+ * Record the results of an operation whose RPC is ready.
+ *
+ * \param status
+ *      STATUS_OK, or the error that made the RPC ready.
+ */
+void AsyncClient::complete(Operation *operation, Status status) {
+    if (status == STATUS_OK) {
+        try {
+            operation->finish();
+        } catch (ClientException &e) {
+            status = e.status;
+        }
+    }
+    operation->status = status;
+    operation->owner = nullptr;
+    operation->done = true;
+}
+
+AsyncClient::Operation::Operation(AsyncClient *owner, Callback callback)
+    : status(STATUS_OK), value(), exists(false), version(0), iterator(), owner(owner)
+      , callback(std::move(callback)), done(false) {}
+
+/**
+ * Wait for the operation to finish, running the callbacks of any others
+ * that finish meanwhile.
+ *
+ * \throw ClientException
+ *      The operation failed.
+ */
+void AsyncClient::Operation::wait() {
+    while (!done)
+        owner->poll();
+    if (status != STATUS_OK)
+        ClientException::throwException(HERE, status);
+}
+
+}
@@ -0,0 +1,125 @@
+#ifndef GUNGNIR_ASYNCCLIENT_H
+#define GUNGNIR_ASYNCCLIENT_H
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "Client.h"
+
+namespace Gungnir {
+
+/**
+ * Issues operations on a Client's session without waiting for them. Each
+ * call sends its RPC and returns a Future at once; at most `window` RPCs
+ * are outstanding, and a call made while the window is full first waits
+ * for one of them to finish. Replies may complete in any order.
+ *
+ * Completions are picked up by poll(), which the waiting calls invoke, and
+ * each one's callback runs there, on the thread that owns the AsyncClient;
+ * a callback may issue further operations. An AsyncClient must only be
+ * used by one thread.
+ */
+class AsyncClient {
+
+public:
+    class Operation;
+
+    /// Handle to an operation, valid after the AsyncClient is gone.
+    typedef std::shared_ptr<Operation> Future;
+
+    /// Invoked once an operation has finished, successfully or not. It
+    /// must not throw.
+    typedef std::function<void(Operation &)> Callback;
+
+    /// Number of outstanding RPCs unless the constructor is told otherwise.
+    static const uint32_t DEFAULT_WINDOW = 64;
+
+    explicit AsyncClient(Client *client, uint32_t window = DEFAULT_WINDOW);
+
+    ~AsyncClient();
+
+    Future get(uint64_t key, Callback callback = Callback());
+
+    Future put(uint64_t key, const void *buf, uint32_t length, Callback callback = Callback());
+
+    Future erase(uint64_t key, Callback callback = Callback());
+
+    Future scan(uint64_t startKey, uint64_t lastKey, uint32_t maxCount, uint32_t maxBytes = 0,
+                Callback callback = Callback());
+
+    uint32_t poll();
+
+    void waitAll();
+
+    /// Number of operations issued but not finished.
+    uint32_t outstandingCount() const {
+        return static_cast<uint32_t>(outstanding.size());
+    }
+
+    /**
+     * One operation issued through an AsyncClient, together with its
+     * results once it has finished.
+     */
+    class Operation {
+        friend class AsyncClient;
+
+    public:
+        virtual ~Operation() = default;
+
+        /// True once the operation has finished and its results are set.
+        bool isReady() const {
+            return done;
+        }
+
+        void wait();
+
+        /// STATUS_OK, or the error the operation failed with.
+        Status status;
+
+        /// Value read by a GET.
+        Buffer value;
+
+        /// Whether the object of a GET exists.
+        bool exists;
+
+        /// Version read by a GET or written by a PUT.
+        uint64_t version;
+
+        /// Objects returned by a SCAN.
+        Iterator iterator;
+
+    protected:
+        Operation(AsyncClient *owner, Callback callback);
+
+        virtual RpcWrapper &rpc() = 0;
+
+        /// Parse the RPC's response into the results.
+        virtual void finish() = 0;
+
+    private:
+        /// AsyncClient the operation was issued through; NULL once done.
+        AsyncClient *owner;
+
+        Callback callback;
+
+        bool done;
+    };
+
+private:
+    void makeRoom();
+
+    void complete(Operation *operation, Status status);
+
+    Client *client;
+
+    /// Most operations outstanding at once.
+    uint32_t window;
+
+    /// Operations issued but not finished, oldest first.
+    std::vector<Future> outstanding;
+};
+
+}
+
+#endif //GUNGNIR_ASYNCCLIENT_H
@@ -1,5 +1,6 @@
 #include <cstring>
 #include <cassert>
+#include <typeinfo>
 #include "Buffer.h"
 #include "Exception.h"
 
@@ -14,6 +15,15 @@ Buffer::Chunk::Chunk(void *data, uint32_t length)
 
 Buffer::Chunk::~Chunk() = default;
 
+/**
+ * Return another chunk referring to the same memory, which stays valid for
+ * as long as the new chunk lives, or NULL if the memory belongs to this
+ * chunk's buffer alone and must be copied instead.
+ */
+Buffer::Chunk *Buffer::Chunk::share() {
+    return nullptr;
+}
+
 Buffer::Buffer() :
     totalLength(0), firstChunk(nullptr), lastChunk(nullptr), cursorChunk(nullptr), cursorOffset(~0u), allocations() {
 
@@ -31,15 +41,68 @@ Buffer::~Buffer() {
 void *Buffer::alloc(size_t numBytes) {
     uint32_t byteAllocated;
     auto *chunk = new Chunk(getNewAllocation(numBytes, &byteAllocated), numBytes);
+    appendChunk(chunk);
+    return chunk->data;
+}
 
-    totalLength += numBytes;
+/**
+ * Add a chunk at the end of the buffer. The buffer takes ownership of the
+ * chunk, but not of the memory it refers to: the chunk is deleted when the
+ * buffer is reset or destroyed, so a subclass of Chunk can release memory
+ * it borrowed in its destructor.
+ */
+void Buffer::appendChunk(Chunk *chunk) {
+    chunk->next = nullptr;
+    totalLength += chunk->length;
     if (lastChunk != nullptr) {
         lastChunk->next = chunk;
     } else {
         firstChunk = chunk;
     }
     lastChunk = chunk;
-    return chunk->data;
+}
+
+/**
+ * Move the contents of src to the end of this buffer, leaving src empty.
+ * When src refers only to storage it allocated itself, the chunks and the
+ * storage change hands without copying; memory src merely borrows (such as
+ * views of a receive ring) is copied, so that it isn't held for the life of
+ * this buffer.
+ */
+void Buffer::adopt(Buffer *src) {
+    for (Chunk *chunk = src->firstChunk; chunk != nullptr; chunk = chunk->next) {
+        if (typeid(*chunk) != typeid(Chunk)) {
+            append(src);
+            src->reset();
+            return;
+        }
+    }
+    Chunk *chunk = src->firstChunk;
+    while (chunk != nullptr) {
+        Chunk *next = chunk->next;
+        appendChunk(chunk);
+        chunk = next;
+    }
+    allocations.insert(allocations.end(), src->allocations.begin(), src->allocations.end());
+    src->allocations.clear();
+    src->firstChunk = src->lastChunk = src->cursorChunk = nullptr;
+    src->totalLength = 0;
+    src->cursorOffset = ~0u;
+}
+
+/**
+ * Append the contents of src, leaving src as it is. Chunks that can share
+ * their memory (see Chunk::share()) are referred to in place; the rest is
+ * copied.
+ */
+void Buffer::appendShared(Buffer *src) {
+    for (Chunk *chunk = src->firstChunk; chunk != nullptr; chunk = chunk->next) {
+        Chunk *shared = chunk->share();
+        if (shared != nullptr)
+            appendChunk(shared);
+        else
+            append(chunk->data, chunk->length);
+    }
 }
 
 void Buffer::append(const void *data, uint32_t numBytes) {
@@ -89,6 +152,20 @@ void Buffer::reset() {
     resetInternal(true);
 }
 
+/**
+ * Empty the buffer like reset(), and also free the storage it allocated,
+ * which reset() keeps until the buffer is destroyed. Meant for long-lived
+ * buffers that are refilled over and over, such as the response of a
+ * streamed scan, which would otherwise grow with everything they held.
+ */
+void Buffer::release() {
+    resetInternal(true);
+    for (auto allocation: allocations) {
+        delete[] allocation;
+    }
+    allocations.clear();
+}
+
 void Buffer::truncate(uint32_t newLength) {
     uint32_t bytesLeft = newLength;
     if (bytesLeft >= totalLength) {
@@ -15,6 +15,8 @@ public:
 
         virtual ~Chunk();
 
+        virtual Chunk *share();
+
         /// Next Chunk in Buffer, or NULL if this is the last Chunk.
         Chunk *next;
 
@@ -31,7 +33,7 @@ public:
 
     Buffer();
 
-    ~Buffer();
+    virtual ~Buffer();
 
     Buffer(const Buffer &) = delete;
 
@@ -39,10 +41,16 @@ public:
 
     void *alloc(size_t numBytes);
 
+    void appendChunk(Chunk *chunk);
+
     void append(const void *data, uint32_t numBytes);
 
     void append(Buffer *src, uint32_t offset = 0, uint32_t length = ~0);
 
+    void adopt(Buffer *src);
+
+    void appendShared(Buffer *src);
+
     inline uint32_t
     size() const {
         return totalLength;
@@ -52,6 +60,8 @@ public:
 
     virtual void reset();
 
+    void release();
+
     void truncate(uint32_t newLength);
 
     void truncateFront(uint32_t bytesToDelete);
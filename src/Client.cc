@@ -1,6 +1,10 @@
+#include <utility>
+
 #include "Client.h"
 #include "ClientException.h"
+#include "Cycles.h"
 #include "Logger.h"
+#include "Dispatch.h"
 
 namespace Gungnir {
 
@@ -8,14 +12,61 @@ Client::Client(Context *context, const std::string &connectLocator) : context(co
     session = context->transport->getSession(connectLocator);
 }
 
-void Client::get(uint64_t key, Buffer *value, bool *objectExists) {
+/**
+ * Construct a Client that sends its RPCs on an existing session.
+ */
+Client::Client(Context *context, Transport::SessionRef session) : context(context), session(std::move(session)) {
+}
+
+void Client::get(uint64_t key, Buffer *value, bool *objectExists, uint64_t *version) {
     GetRpc rpc(this, key, value);
-    rpc.wait(objectExists);
+    rpc.wait(objectExists, version);
 }
 
-void Client::put(uint64_t key, const void *buf, uint32_t length) {
+void Client::put(uint64_t key, const void *buf, uint32_t length, uint64_t *version) {
     PutRpc rpc(this, key, buf, length);
-    rpc.wait();
+    rpc.wait(version);
+}
+
+/**
+ * Atomically add delta to the 64-bit little-endian integer stored at key,
+ * creating it (from 0) if it doesn't exist.
+ *
+ * \param[out] version
+ *      If not NULL, receives the version written.
+ * \return
+ *      The value after the increment.
+ * \throw InvalidObjectException
+ *      The object's value isn't 8 bytes long.
+ */
+int64_t Client::increment(uint64_t key, int64_t delta, uint64_t *version) {
+    IncrementRpc rpc(this, key, delta);
+    return rpc.wait(version);
+}
+
+/**
+ * Write the object at key only if its version is still expectedVersion;
+ * 0 means the object must not exist yet.
+ *
+ * \param[out] version
+ *      If not NULL, receives the version written or, on failure, the
+ *      current version (0 if the object doesn't exist).
+ * \return
+ *      False means the versions didn't match and nothing was written.
+ */
+bool Client::compareAndSwap(uint64_t key, uint64_t expectedVersion, const void *buf, uint32_t length,
+                            uint64_t *version) {
+    CompareAndSwapRpc rpc(this, key, expectedVersion, buf, length);
+    return rpc.wait(version);
+}
+
+/**
+ * Atomically append data to the value of the object at key, creating the
+ * object if it doesn't exist.
+ */
+void Client::append(uint64_t key, const void *buf, uint32_t length, uint64_t *version) {
+    AppendRpc rpc(this, key, buf, length);
+    rpc.wait(version);
 }
 
 void Client::erase(uint64_t key) {
@@ -23,23 +74,133 @@ void Client::erase(uint64_t key) {
     rpc.wait();
 }
 
+/**
+ * Read several objects with as few RPCs as possible: one per
+ * WireFormat::MultiGet::MAX_COUNT objects.
+ */
+void Client::multiGet(MultiGetObject *objects, uint32_t count) {
+    for (uint32_t i = 0; i < count; i += WireFormat::MultiGet::MAX_COUNT) {
+        uint32_t n = count - i;
+        if (n > WireFormat::MultiGet::MAX_COUNT)
+            n = WireFormat::MultiGet::MAX_COUNT;
+        MultiGetRpc rpc(this, objects + i, n);
+        rpc.wait();
+    }
+}
+
+/**
+ * Write several objects with as few RPCs as possible: one per
+ * WireFormat::MultiPut::MAX_COUNT objects. The writes are not atomic; if a
+ * key appears more than once, the last value wins.
+ */
+void Client::multiPut(MultiPutObject *objects, uint32_t count) {
+    for (uint32_t i = 0; i < count; i += WireFormat::MultiPut::MAX_COUNT) {
+        uint32_t n = count - i;
+        if (n > WireFormat::MultiPut::MAX_COUNT)
+            n = WireFormat::MultiPut::MAX_COUNT;
+        MultiPutRpc rpc(this, objects + i, n);
+        rpc.wait();
+    }
+}
+
+/**
+ * Apply a set of puts and erases atomically: either all of them take
+ * effect, also across a crash, or none does. If a key appears more than
+ * once, the last operation on it wins.
+ *
+ * \throw MessageErrorException
+ *      There are more than WireFormat::Transact::MAX_COUNT operations.
+ */
+void Client::transact(TransactOperation *operations, uint32_t count) {
+    if (count > WireFormat::Transact::MAX_COUNT)
+        throw MessageErrorException(HERE);
+    TransactRpc rpc(this, operations, count);
+    rpc.wait();
+}
+
+/**
+ * Return every object in [start, end]. The server bounds the size of each
+ * reply, so this follows continuation keys until the range is exhausted.
+ */
 Iterator Client::scan(uint64_t start, uint64_t end) {
     Iterator iterator;
-    ScanRpc rpc(this, start, end, &iterator);
+    while (true) {
+        Iterator page = scan(start, end, 0);
+        iterator.buffer->append(page.buffer.get());
+        iterator.size += page.size;
+        if (!page.hasMore)
+            break;
+        start = page.nextKey;
+    }
+    return iterator;
+}
+
+/**
+ * Return one page of the objects in [start, end]. If the returned iterator
+ * hasMore, the next page starts at its nextKey (which replaces start, or end
+ * when scanning in reverse).
+ */
+Iterator Client::scan(uint64_t start, uint64_t end, uint32_t maxCount, uint32_t maxBytes, bool reverse) {
+    Iterator iterator;
+    ScanRpc rpc(this, start, end, maxCount, maxBytes, reverse, &iterator);
     rpc.wait();
     return iterator;
 }
 
-GetRpc::GetRpc(Client *client, uint64_t key, Buffer *value)
+/**
+ * Return an iterator over [start, end] that the server streams in frames of
+ * about chunkBytes. Frames are fetched lazily as the iterator advances, and
+ * consumed frames are released, so memory stays bounded on both ends.
+ */
+Iterator Client::scanStream(uint64_t start, uint64_t end, uint32_t chunkBytes) {
+    Iterator iterator;
+    iterator.stream = std::make_shared<ScanStreamRpc>(this, start, end, chunkBytes, iterator.buffer.get());
+    return iterator;
+}
+
+/**
+ * Compute an aggregate over the objects in [start, end] on the server,
+ * without transferring them.
+ *
+ * \param function
+ *      COUNT counts the objects; SUM, MIN and MAX combine an unsigned
+ *      little-endian field of fieldWidth bytes at fieldOffset in each value.
+ *      Values too short to hold the field are counted but not combined.
+ * \param prefix
+ *      If not NULL, only objects whose value starts with these prefixLength
+ *      bytes take part.
+ * \param[out] count
+ *      If not NULL, receives the number of objects that took part.
+ * \param[out] fieldCount
+ *      If not NULL, receives the number of fields that were combined.
+ * \return
+ *      The aggregate.
+ */
+uint64_t Client::aggregate(uint64_t start, uint64_t end, WireFormat::ScanAggregate::Function function,
+                           uint32_t fieldOffset, uint8_t fieldWidth, const void *prefix, uint32_t prefixLength,
+                           uint64_t *count, uint64_t *fieldCount) {
+    ScanAggregateRpc rpc(this, start, end, function, fieldOffset, fieldWidth, prefix, prefixLength);
+    return rpc.wait(count, fieldCount);
+}
+
+GetRpc::GetRpc(Client *client, uint64_t key, Buffer *value, const ReadConstraint &constraint)
     : RpcWrapper(client->context, client->session, sizeof(WireFormat::Get::Response), value) {
     value->reset();
     WireFormat::Get::Request *reqHdr(allocHeader<WireFormat::Get>());
     reqHdr->key = key;
+    reqHdr->minLsn = constraint.minLsn;
+    reqHdr->maxStalenessMicros = constraint.maxStalenessMicros;
     send();
 
 }
 
-void GetRpc::wait(bool *objectExists) {
+/**
+ * \param[out] lsn
+ *      If not NULL, receives the LSN the reply reflects; see ReadConstraint.
+ * \throw StaleReplicaException
+ *      The server is a backup that doesn't meet the ReadConstraint.
+ */
+void GetRpc::wait(bool *objectExists, uint64_t *version, uint64_t *lsn) {
 
     if (objectExists != nullptr)
         *objectExists = true;
@@ -58,8 +219,13 @@ void GetRpc::wait(bool *objectExists) {
         }
     }
 
+    uint32_t length = respHdr->length;
+    if (version != nullptr)
+        *version = respHdr->common.status == STATUS_OK ? respHdr->version : 0;
+    if (lsn != nullptr)
+        *lsn = respHdr->lsn;
     response->truncateFront(sizeof(*respHdr));
-    assert(respHdr->length == response->size());
+    assert(length == response->size());
 }
 
 PutRpc::PutRpc(Client *client, uint64_t key, const void *buf, uint32_t length)
@@ -73,12 +239,74 @@ PutRpc::PutRpc(Client *client, uint64_t key, const void *buf, uint32_t length)
     send();
 }
 
-void PutRpc::wait() {
+void PutRpc::wait(uint64_t *version) {
     waitInternal(context->dispatch);
     const WireFormat::Put::Response *respHdr(
         getResponseHeader<WireFormat::Put>());
     if (respHdr->common.status != STATUS_OK)
         ClientException::throwException(HERE, respHdr->common.status);
+    if (version != nullptr)
+        *version = respHdr->version;
+}
+
+IncrementRpc::IncrementRpc(Client *client, uint64_t key, int64_t delta)
+    : RpcWrapper(client->context, client->session, sizeof(WireFormat::Increment::Response)) {
+    WireFormat::Increment::Request *reqHdr(allocHeader<WireFormat::Increment>());
+    reqHdr->key = key;
+    reqHdr->delta = delta;
+    send();
+}
+
+int64_t IncrementRpc::wait(uint64_t *version) {
+    waitInternal(context->dispatch);
+    const WireFormat::Increment::Response *respHdr(
+        getResponseHeader<WireFormat::Increment>());
+    if (respHdr->common.status != STATUS_OK)
+        ClientException::throwException(HERE, respHdr->common.status);
+    if (version != nullptr)
+        *version = respHdr->version;
+    return respHdr->value;
+}
+
+CompareAndSwapRpc::CompareAndSwapRpc(Client *client, uint64_t key, uint64_t expectedVersion, const void *buf,
+                                     uint32_t length)
+    : RpcWrapper(client->context, client->session, sizeof(WireFormat::CompareAndSwap::Response)) {
+    WireFormat::CompareAndSwap::Request *reqHdr(allocHeader<WireFormat::CompareAndSwap>());
+    reqHdr->key = key;
+    reqHdr->version = expectedVersion;
+    reqHdr->length = length;
+    request.append(buf, length);
+    send();
+}
+
+bool CompareAndSwapRpc::wait(uint64_t *version) {
+    waitInternal(context->dispatch);
+    const WireFormat::CompareAndSwap::Response *respHdr(
+        getResponseHeader<WireFormat::CompareAndSwap>());
+    if (respHdr->common.status != STATUS_OK && respHdr->common.status != STATUS_WRONG_VERSION)
+        ClientException::throwException(HERE, respHdr->common.status);
+    if (version != nullptr)
+        *version = respHdr->version;
+    return respHdr->common.status == STATUS_OK;
+}
+
+AppendRpc::AppendRpc(Client *client, uint64_t key, const void *buf, uint32_t length)
+    : RpcWrapper(client->context, client->session, sizeof(WireFormat::Append::Response)) {
+    WireFormat::Append::Request *reqHdr(allocHeader<WireFormat::Append>());
+    reqHdr->key = key;
+    reqHdr->length = length;
+    request.append(buf, length);
+    send();
+}
+
+void AppendRpc::wait(uint64_t *version) {
+    waitInternal(context->dispatch);
+    const WireFormat::Append::Response *respHdr(
+        getResponseHeader<WireFormat::Append>());
+    if (respHdr->common.status != STATUS_OK)
+        ClientException::throwException(HERE, respHdr->common.status);
+    if (version != nullptr)
+        *version = respHdr->version;
 }
 
 EraseRpc::EraseRpc(Client *client, uint64_t key)
@@ -96,12 +324,140 @@ void EraseRpc::wait() {
         ClientException::throwException(HERE, respHdr->common.status);
 }
 
-ScanRpc::ScanRpc(Client *client, uint64_t start, uint64_t end, Iterator *iterator)
+MultiGetRpc::MultiGetRpc(Client *client, MultiGetObject *objects, uint32_t count)
+    : RpcWrapper(client->context, client->session, sizeof(WireFormat::MultiGet::Response)), objects(objects)
+      , count(count) {
+    WireFormat::MultiGet::Request *reqHdr(allocHeader<WireFormat::MultiGet>());
+    reqHdr->count = count;
+    for (uint32_t i = 0; i < count; i++)
+        request.append(&objects[i].key, sizeof(objects[i].key));
+    send();
+}
+
+void MultiGetRpc::wait() {
+    waitInternal(context->dispatch);
+    const WireFormat::MultiGet::Response *respHdr(
+        getResponseHeader<WireFormat::MultiGet>());
+    if (respHdr->common.status != STATUS_OK)
+        ClientException::throwException(HERE, respHdr->common.status);
+    if (respHdr->count != count)
+        throw MessageErrorException(HERE);
+
+    uint32_t offset = sizeof(*respHdr);
+    for (uint32_t i = 0; i < count; i++) {
+        WireFormat::MultiGet::Part part{};
+        if (response->copy(offset, sizeof(part), &part) != sizeof(part))
+            throw MessageErrorException(HERE);
+        offset += sizeof(part);
+        objects[i].exists = part.status == STATUS_OK;
+        objects[i].version = part.version;
+        objects[i].value->reset();
+        objects[i].value->append(response, offset, part.length);
+        offset += part.length;
+    }
+}
+
+MultiPutRpc::MultiPutRpc(Client *client, MultiPutObject *objects, uint32_t count)
+    : RpcWrapper(client->context, client->session, sizeof(WireFormat::MultiPut::Response)), objects(objects)
+      , count(count) {
+    WireFormat::MultiPut::Request *reqHdr(allocHeader<WireFormat::MultiPut>());
+    reqHdr->count = count;
+    for (uint32_t i = 0; i < count; i++) {
+        auto *part = request.emplaceAppend<WireFormat::MultiPut::Part>();
+        part->key = objects[i].key;
+        part->length = objects[i].length;
+        request.append(objects[i].value, objects[i].length);
+    }
+    send();
+}
+
+void MultiPutRpc::wait() {
+    waitInternal(context->dispatch);
+    const WireFormat::MultiPut::Response *respHdr(
+        getResponseHeader<WireFormat::MultiPut>());
+    if (respHdr->common.status != STATUS_OK)
+        ClientException::throwException(HERE, respHdr->common.status);
+    if (respHdr->count != count)
+        throw MessageErrorException(HERE);
+    for (uint32_t i = 0; i < count; i++)
+        response->copy(static_cast<uint32_t>(sizeof(*respHdr) + i * sizeof(uint64_t)), sizeof(uint64_t),
+                       &objects[i].version);
+}
+
+TransactRpc::TransactRpc(Client *client, TransactOperation *operations, uint32_t count)
+    : RpcWrapper(client->context, client->session, sizeof(WireFormat::Transact::Response)), operations(operations)
+      , count(count) {
+    WireFormat::Transact::Request *reqHdr(allocHeader<WireFormat::Transact>());
+    reqHdr->count = count;
+    for (uint32_t i = 0; i < count; i++) {
+        auto *part = request.emplaceAppend<WireFormat::Transact::Part>();
+        part->operation = operations[i].operation;
+        part->key = operations[i].key;
+        part->length = 0;
+        if (operations[i].operation == WireFormat::Transact::TX_PUT) {
+            part->length = operations[i].length;
+            request.append(operations[i].value, operations[i].length);
+        }
+    }
+    send();
+}
+
+void TransactRpc::wait() {
+    waitInternal(context->dispatch);
+    const WireFormat::Transact::Response *respHdr(
+        getResponseHeader<WireFormat::Transact>());
+    if (respHdr->common.status != STATUS_OK)
+        ClientException::throwException(HERE, respHdr->common.status);
+    if (respHdr->count != count)
+        throw MessageErrorException(HERE);
+    for (uint32_t i = 0; i < count; i++)
+        response->copy(static_cast<uint32_t>(sizeof(*respHdr) + i * sizeof(uint64_t)), sizeof(uint64_t),
+                       &operations[i].version);
+}
+
+ReplicateRpc::ReplicateRpc(Client *client, uint64_t offset, Buffer *entries, uint64_t primaryLsn)
+    : RpcWrapper(client->context, client->session, sizeof(WireFormat::Replicate::Response)) {
+    WireFormat::Replicate::Request *reqHdr(allocHeader<WireFormat::Replicate>());
+    reqHdr->offset = offset;
+    reqHdr->length = entries->size();
+    reqHdr->primaryLsn = primaryLsn;
+    request.append(entries);
+    send();
+}
+
+/**
+ * \param[out] appliedLsn
+ *      Receives the end of what the backup has applied.
+ * \return
+ *      True means the batch was applied; false means it would have left a
+ *      gap, and the backup needs what follows appliedLsn first.
+ * \throw TransportException
+ *      The backup couldn't be reached.
+ */
+bool ReplicateRpc::wait(uint64_t *appliedLsn) {
+    waitInternal(context->dispatch);
+    if (getState() == FAILED)
+        throw TransportException(HERE, "replication to " + session->serviceLocator + " failed");
+    const WireFormat::Replicate::Response *respHdr(
+        getResponseHeader<WireFormat::Replicate>());
+    if (respHdr->common.status != STATUS_OK && respHdr->common.status != STATUS_LOG_GAP)
+        ClientException::throwException(HERE, respHdr->common.status);
+    *appliedLsn = respHdr->appliedLsn;
+    return respHdr->common.status == STATUS_OK;
+}
+
+ScanRpc::ScanRpc(Client *client, uint64_t start, uint64_t end, uint32_t maxCount, uint32_t maxBytes, bool reverse,
+                 Iterator *iterator, const ReadConstraint &constraint)
     : RpcWrapper(client->context, client->session, sizeof(WireFormat::Scan::Response), iterator->buffer.get())
       , iterator(iterator) {
     WireFormat::Scan::Request *reqHdr(allocHeader<WireFormat::Scan>());
     reqHdr->start = start;
     reqHdr->end = end;
+    reqHdr->maxCount = maxCount;
+    reqHdr->maxBytes = maxBytes;
+    reqHdr->reverse = reverse;
+    reqHdr->minLsn = constraint.minLsn;
+    reqHdr->maxStalenessMicros = constraint.maxStalenessMicros;
     send();
 }
 
@@ -112,7 +468,132 @@ void ScanRpc::wait() {
     if (respHdr->common.status != STATUS_OK)
         ClientException::throwException(HERE, respHdr->common.status);
     iterator->size = respHdr->size;
+    iterator->hasMore = respHdr->hasMore != 0;
+    iterator->nextKey = respHdr->nextKey;
+    iterator->lsn = respHdr->lsn;
     response->truncateFront(sizeof(*respHdr));
 }
 
+ScanAggregateRpc::ScanAggregateRpc(Client *client, uint64_t start, uint64_t end,
+                                   WireFormat::ScanAggregate::Function function, uint32_t fieldOffset,
+                                   uint8_t fieldWidth, const void *prefix, uint32_t prefixLength)
+    : RpcWrapper(client->context, client->session, sizeof(WireFormat::ScanAggregate::Response)) {
+    WireFormat::ScanAggregate::Request *reqHdr(allocHeader<WireFormat::ScanAggregate>());
+    reqHdr->start = start;
+    reqHdr->end = end;
+    reqHdr->function = function;
+    reqHdr->fieldOffset = fieldOffset;
+    reqHdr->fieldWidth = fieldWidth;
+    if (prefix != nullptr) {
+        reqHdr->prefixLength = prefixLength;
+        request.append(prefix, prefixLength);
+    }
+    send();
+}
+
+uint64_t ScanAggregateRpc::wait(uint64_t *count, uint64_t *fieldCount) {
+    waitInternal(context->dispatch);
+    const WireFormat::ScanAggregate::Response *respHdr(
+        getResponseHeader<WireFormat::ScanAggregate>());
+    if (respHdr->common.status != STATUS_OK)
+        ClientException::throwException(HERE, respHdr->common.status);
+    if (count != nullptr)
+        *count = respHdr->count;
+    if (fieldCount != nullptr)
+        *fieldCount = respHdr->fieldCount;
+    return respHdr->result;
+}
+
+ScanStreamRpc::ScanStreamRpc(Client *client, uint64_t start, uint64_t end, uint32_t chunkBytes, Buffer *response)
+    : RpcWrapper(client->context, client->session, sizeof(WireFormat::Scan::Response), response), available(0)
+      , started(false) {
+    WireFormat::Scan::Request *reqHdr(allocHeader<WireFormat::Scan>());
+    reqHdr->start = start;
+    reqHdr->end = end;
+    reqHdr->chunkBytes = chunkBytes;
+    send();
+}
+
+void ScanStreamRpc::frameReceived() {
+    available = response->size();
+}
+
+/**
+ * Wait until the object at offset has been received.
+ *
+ * \param[in,out] offset
+ *      Position of the next object in the response. It is moved past the
+ *      response header once the first frame arrives, and rewound when
+ *      consumed frames are released.
+ * \return
+ *      False means the stream has ended and there are no more objects.
+ */
+bool ScanStreamRpc::fetch(uint32_t *offset) {
+    bool isDispatchThread = context->dispatch->isDispatchThread();
+    // Value of available when the frames were last found not to be safe to
+    // release, so that the dispatch thread isn't locked out again until
+    // another frame has arrived.
+    uint32_t releaseChecked = 0;
+    while (true) {
+        if (!started && available >= sizeof(WireFormat::Scan::Response)) {
+            auto *respHdr = response->getStart<WireFormat::Scan::Response>();
+            if (respHdr->common.status != STATUS_OK)
+                ClientException::throwException(HERE, respHdr->common.status);
+            *offset = sizeof(*respHdr);
+            started = true;
+        }
+        if (started && *offset < available)
+            return true;
+
+        RpcState copyOfState = getState();
+        if (copyOfState == FINISHED) {
+            if (available == response->size()) {
+                if (!started)
+                    throw MessageErrorException(HERE);
+                return false;
+            }
+            // The final message isn't empty: it carries an error status,
+            // after the frames received.
+            auto *responseCommon = response->getOffset<WireFormat::ResponseCommon>(available);
+            if (responseCommon == nullptr)
+                throw MessageErrorException(HERE);
+            if (responseCommon->status != STATUS_RETRY || started)
+                ClientException::throwException(HERE, responseCommon->status);
+            // Turned away before it started, as by an overloaded server: send
+            // it again later, as RpcWrapper::isReady() does.
+            WireFormat::RetryResponse defaultResponse = {{STATUS_RETRY}, 100, 200, 0};
+            const WireFormat::RetryResponse *retryResponse =
+                response->getOffset<WireFormat::RetryResponse>(available);
+            if (retryResponse == nullptr)
+                retryResponse = &defaultResponse;
+            retry(retryResponse->minDelayMicros, retryResponse->maxDelayMicros);
+            continue;
+        }
+        if (copyOfState == RETRY) {
+            if (Cycles::rdtsc() >= retryTime)
+                send();
+            continue;
+        }
+        if (copyOfState == FAILED || copyOfState == CANCELED)
+            throw TransportException(HERE, "streamed scan failed");
+
+        if (started && available != 0 && available != releaseChecked) {
+            // Every complete frame has been consumed; unless the next one has
+            // started arriving, release their memory. The transport appends
+            // frames to the response in the dispatch thread, so keep it out
+            // meanwhile.
+            Dispatch::Lock lock(context->dispatch);
+            if (available == response->size()) {
+                response->release();
+                available = 0;
+                *offset = 0;
+            } else {
+                releaseChecked = available;
+            }
+        }
+        if (isDispatchThread)
+            context->dispatch->poll();
+    }
+}
+
 }
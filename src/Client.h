@@ -10,19 +10,97 @@
 
 namespace Gungnir {
 
+/**
+ * How fresh a read served by a backup must be; a primary always qualifies.
+ * A backup that doesn't replies STATUS_STALE_REPLICA.
+ */
+struct ReadConstraint {
+    /// Primary log offset (LSN) the backup must have applied; 0 means any.
+    /// Reads return the LSN they reflect, so passing the largest one seen
+    /// so far keeps reads monotonic.
+    uint64_t minLsn;
+
+    /// How long ago the backup may last have been level with its primary;
+    /// 0 means no bound.
+    uint32_t maxStalenessMicros;
+};
+
+/// One object of a Client::multiGet.
+struct MultiGetObject {
+    uint64_t key;
+
+    /// Receives the value; left empty if the object doesn't exist.
+    Buffer *value;
+
+    /// Set to whether the object exists.
+    bool exists;
+
+    /// Set to the version of the object, or 0 if it doesn't exist.
+    uint64_t version;
+};
+
+/// One object of a Client::multiPut.
+struct MultiPutObject {
+    uint64_t key;
+    const void *value;
+    uint32_t length;
+
+    /// Set to the version written.
+    uint64_t version;
+};
+
+/// One write of a Client::transact.
+struct TransactOperation {
+    WireFormat::Transact::Operation operation;
+    uint64_t key;
+
+    /// The value to put; unused for TX_ERASE.
+    const void *value;
+    uint32_t length;
+
+    /// Set to the version written, or 0 for erases.
+    uint64_t version;
+};
+
 class Client {
 
 public:
     explicit Client(Context *context, const std::string &connectLocator);
 
-    void get(uint64_t key, Buffer *value, bool *objectExists = nullptr);
+    Client(Context *context, Transport::SessionRef session);
+
+    virtual ~Client() = default;
+
+    void get(uint64_t key, Buffer *value, bool *objectExists = nullptr, uint64_t *version = nullptr);
+
+    void put(uint64_t key, const void *buf, uint32_t length, uint64_t *version = nullptr);
+
+    int64_t increment(uint64_t key, int64_t delta, uint64_t *version = nullptr);
+
+    bool compareAndSwap(uint64_t key, uint64_t expectedVersion, const void *buf, uint32_t length,
+                        uint64_t *version = nullptr);
 
-    void put(uint64_t key, const void *buf, uint32_t length);
+    void append(uint64_t key, const void *buf, uint32_t length, uint64_t *version = nullptr);
 
     void erase(uint64_t key);
 
+    void multiGet(MultiGetObject *objects, uint32_t count);
+
+    void multiPut(MultiPutObject *objects, uint32_t count);
+
+    void transact(TransactOperation *operations, uint32_t count);
+
     Iterator scan(uint64_t startKey, uint64_t lastKey);
 
+    Iterator scan(uint64_t startKey, uint64_t lastKey, uint32_t maxCount, uint32_t maxBytes = 0,
+                  bool reverse = false);
+
+    Iterator scanStream(uint64_t startKey, uint64_t lastKey, uint32_t chunkBytes = 64 * 1024);
+
+    uint64_t aggregate(uint64_t startKey, uint64_t lastKey, WireFormat::ScanAggregate::Function function,
+                       uint32_t fieldOffset = 0, uint8_t fieldWidth = 8, const void *prefix = nullptr,
+                       uint32_t prefixLength = 0, uint64_t *count = nullptr, uint64_t *fieldCount = nullptr);
+
     Context *context;
 
     Transport::SessionRef session;
@@ -31,16 +109,37 @@ public:
 
 class GetRpc : public RpcWrapper {
 public:
-    GetRpc(Client *client, uint64_t key, Buffer *value);
+    GetRpc(Client *client, uint64_t key, Buffer *value, const ReadConstraint &constraint = ReadConstraint());
 
-    void wait(bool *objectExists);
+    void wait(bool *objectExists, uint64_t *version = nullptr, uint64_t *lsn = nullptr);
 };
 
 class PutRpc : public RpcWrapper {
 public:
     PutRpc(Client *client, uint64_t key, const void *buf, uint32_t length);
 
-    void wait();
+    void wait(uint64_t *version = nullptr);
+};
+
+class IncrementRpc : public RpcWrapper {
+public:
+    IncrementRpc(Client *client, uint64_t key, int64_t delta);
+
+    int64_t wait(uint64_t *version);
+};
+
+class CompareAndSwapRpc : public RpcWrapper {
+public:
+    CompareAndSwapRpc(Client *client, uint64_t key, uint64_t expectedVersion, const void *buf, uint32_t length);
+
+    bool wait(uint64_t *version);
+};
+
+class AppendRpc : public RpcWrapper {
+public:
+    AppendRpc(Client *client, uint64_t key, const void *buf, uint32_t length);
+
+    void wait(uint64_t *version);
 };
 
 class EraseRpc : public RpcWrapper {
@@ -50,9 +149,54 @@ public:
     void wait();
 };
 
+class MultiGetRpc : public RpcWrapper {
+public:
+    MultiGetRpc(Client *client, MultiGetObject *objects, uint32_t count);
+
+    void wait();
+
+private:
+    MultiGetObject *objects;
+    uint32_t count;
+};
+
+class MultiPutRpc : public RpcWrapper {
+public:
+    MultiPutRpc(Client *client, MultiPutObject *objects, uint32_t count);
+
+    void wait();
+
+private:
+    MultiPutObject *objects;
+    uint32_t count;
+};
+
+class TransactRpc : public RpcWrapper {
+public:
+    TransactRpc(Client *client, TransactOperation *operations, uint32_t count);
+
+    void wait();
+
+private:
+    TransactOperation *operations;
+    uint32_t count;
+};
+
+/**
+ * Sends a batch of a primary's log entries to a backup, which applies and
+ * logs them before it replies; see Replicator.
+ */
+class ReplicateRpc : public RpcWrapper {
+public:
+    ReplicateRpc(Client *client, uint64_t offset, Buffer *entries, uint64_t primaryLsn);
+
+    bool wait(uint64_t *appliedLsn);
+};
+
 class ScanRpc : public RpcWrapper {
 public:
-    ScanRpc(Client *client, uint64_t start, uint64_t end, Iterator *iterator);
+    ScanRpc(Client *client, uint64_t start, uint64_t end, uint32_t maxCount, uint32_t maxBytes, bool reverse,
+            Iterator *iterator, const ReadConstraint &constraint = ReadConstraint());
 
     void wait();
 
@@ -60,6 +204,36 @@ private:
     Iterator *iterator;
 };
 
+class ScanAggregateRpc : public RpcWrapper {
+public:
+    ScanAggregateRpc(Client *client, uint64_t start, uint64_t end, WireFormat::ScanAggregate::Function function,
+                     uint32_t fieldOffset, uint8_t fieldWidth, const void *prefix, uint32_t prefixLength);
+
+    uint64_t wait(uint64_t *count, uint64_t *fieldCount);
+};
+
+/**
+ * A scan whose reply the server streams in frames. The RPC stays in
+ * progress while the Iterator that owns it consumes frames, so traversal on
+ * the server overlaps with transfer and processing on the client.
+ */
+class ScanStreamRpc : public RpcWrapper {
+public:
+    ScanStreamRpc(Client *client, uint64_t start, uint64_t end, uint32_t chunkBytes, Buffer *response);
+
+    void frameReceived() override;
+
+    bool fetch(uint32_t *offset);
+
+private:
+    /// Bytes at the start of the response that belong to completely
+    /// received frames. Set by the dispatch thread as frames arrive.
+    std::atomic<uint32_t> available;
+
+    /// True means the response header in the first frame has been checked.
+    bool started;
+};
+
 }
 
 #endif //GUNGNIR_CLIENT_H
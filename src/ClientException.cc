@@ -43,6 +43,16 @@ ClientException::throwException(const CodeLocation &where, Status status) {
             throw ObjectDoesntExistException(where);
         case STATUS_RETRY:
             throw RetryException(where);
+        case STATUS_WRONG_VERSION:
+            throw WrongVersionException(where);
+        case STATUS_INVALID_OBJECT:
+            throw InvalidObjectException(where);
+        case STATUS_STALE_REPLICA:
+            throw StaleReplicaException(where);
+        case STATUS_NOT_PRIMARY:
+            throw NotPrimaryException(where);
+        case STATUS_LOG_GAP:
+            throw LogGapException(where);
         default:
             throw InternalError(where, status);
     }
@@ -95,6 +95,26 @@ DEFINE_EXCEPTION(ObjectDoesntExistException,
 DEFINE_EXCEPTION(MessageErrorException,
                  STATUS_MESSAGE_ERROR ,
                  InternalError)
+
+DEFINE_EXCEPTION(WrongVersionException,
+                 STATUS_WRONG_VERSION,
+                 ClientException)
+
+DEFINE_EXCEPTION(InvalidObjectException,
+                 STATUS_INVALID_OBJECT,
+                 ClientException)
+
+DEFINE_EXCEPTION(StaleReplicaException,
+                 STATUS_STALE_REPLICA,
+                 ClientException)
+
+DEFINE_EXCEPTION(NotPrimaryException,
+                 STATUS_NOT_PRIMARY,
+                 ClientException)
+
+DEFINE_EXCEPTION(LogGapException,
+                 STATUS_LOG_GAP,
+                 ClientException)
 }
 
 #endif //GUNGNIR_CLIENTEXCEPTION_H
@@ -247,7 +247,9 @@ bool ConcurrentSkipList::tryLockNodesForChange(int nodeHeight, LayerLocker guard
             guards[layer] = predecessor->tryAcquireGuard();
             if (!guards[layer].owns_lock()) {
                 for (int i = 0; i < layer; i++) {
-                    guards[layer].unlock();
+                    // Layers that share a predecessor hold no lock of their own.
+                    if (guards[i].owns_lock())
+                        guards[i].unlock();
                 }
                 return false;
             }
@@ -451,6 +453,41 @@ ConcurrentSkipList::Node *ConcurrentSkipList::lowerBound(const Key &data) const
     return node;
 }
 
+// Returns the last valid node whose key is no greater than data, or nullptr
+// if there is none. Used as the starting point of descending scans.
+ConcurrentSkipList::Node *ConcurrentSkipList::floor(const Key &data) const {
+    auto ret = findNode(data);
+    if (ret.second && !ret.first->markedForRemoval()) {
+        return ret.first;
+    }
+    return predecessor(data);
+}
+
+// Returns the last valid node whose key is less than data, or nullptr if
+// there is none. Nodes only link forward, so each step of a descending scan
+// is a fresh search from the head; a predecessor that turns out to be marked
+// for removal is skipped by searching again below its key.
+ConcurrentSkipList::Node *ConcurrentSkipList::predecessor(const Key &data) const {
+    Key bound = data;
+    while (true) {
+        Node *pred = head.load(std::memory_order_consume);
+        for (int layer = pred->maxLayer(); layer >= 0; --layer) {
+            Node *node = pred->skip(layer);
+            while (greater(bound, node)) {
+                pred = node;
+                node = node->skip(layer);
+            }
+        }
+        if (pred->isHeadNode()) {
+            return nullptr;
+        }
+        if (!pred->markedForRemoval()) {
+            return pred;
+        }
+        bound = pred->getKey();
+    }
+}
+
 ConcurrentSkipList::ConcurrentSkipList(Context *context, int height)
     : context(context), allocator(), head(create(height, Key(), true)), size(0), epoch(0) {
 
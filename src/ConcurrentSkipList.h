@@ -180,6 +180,10 @@ public:
 
     Node *lowerBound(const Key &data) const;
 
+    Node *floor(const Key &data) const;
+
+    Node *predecessor(const Key &data) const;
+
 private:
     std::pair<Node *, int> findNode(const Key &key) const;
 
@@ -1,6 +1,8 @@
 #include "Context.h"
 #include "Dispatch.h"
 #include "TcpTransport.h"
+#include "UringTransport.h"
+#include "ShmTransport.h"
 #include "ConcurrentSkipList.h"
 #include "OptionConfig.h"
 
@@ -8,15 +10,24 @@ namespace Gungnir {
 
 Context::Context() :
     dispatch(nullptr), workerManager(nullptr), transport(nullptr), skipList(nullptr), logCleaner(nullptr)
-    , optionConfig(nullptr), log(nullptr) {
+    , optionConfig(nullptr), log(nullptr), replicaStatus(nullptr) {
 
 }
 
 Context::Context(OptionConfig &optionConfig, bool hasDedicatedDispatchThread) :
     dispatch(nullptr), workerManager(nullptr), transport(nullptr), skipList(nullptr), logCleaner(nullptr)
-    , optionConfig(&optionConfig), log(nullptr) {
-    dispatch = new Dispatch(hasDedicatedDispatchThread);
-    transport = new TcpTransport(this, optionConfig.serverLocator);
+    , optionConfig(&optionConfig), log(nullptr), replicaStatus(nullptr) {
+    dispatch = new Dispatch(hasDedicatedDispatchThread, optionConfig.edgeTriggered,
+                            optionConfig.inlineEpoll, optionConfig.idleMicros);
+    if (ShmTransport::isShmLocator(optionConfig.serverLocator) ||
+        (optionConfig.serverLocator.empty() && ShmTransport::isShmLocator(optionConfig.connectLocator))) {
+        transport = new ShmTransport(this, optionConfig.serverLocator);
+    } else if (optionConfig.uring && !optionConfig.serverLocator.empty() &&
+               !TcpTransport::isUnixLocator(optionConfig.serverLocator)) {
+        transport = new UringTransport(this, optionConfig.serverLocator);
+    } else {
+        transport = new TcpTransport(this, optionConfig.serverLocator);
+    }
 }
 
 Context::~Context() {
@@ -18,6 +18,8 @@ class OptionConfig;
 
 class Log;
 
+class ReplicaStatus;
+
 class Context {
 public:
     Dispatch *dispatch;
@@ -27,6 +29,7 @@ public:
     LogCleaner *logCleaner;
     OptionConfig *optionConfig;
     Log *log;
+    ReplicaStatus *replicaStatus;
 
     Context();
 
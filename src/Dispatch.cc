@@ -1,22 +1,46 @@
 #include <cassert>
 #include <cstring>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/syscall.h>
 #include <cstdio>
 #include <unistd.h>
 
 #include "Dispatch.h"
+#include "Cycles.h"
 #include "ThreadId.h"
 #include "Logger.h"
 #include "Exception.h"
 
 namespace Gungnir {
-Dispatch::Dispatch(bool hasDedicatedThread)
+Dispatch::Dispatch(bool hasDedicatedThread, bool edgeTriggered, bool inlinePolling, uint32_t idleMicros)
     : ownerId(ThreadId::get()), mutex(), lockNeeded(0), locked(0), hasDedicatedThread(hasDedicatedThread)
-      , pollers(), files(), epollFd(-1), epollThread(), exitPipeFds(), readyFd(-1), readyEvents(0u)
-      , fileInvocationSerial(0) {
-
+      , pollers(), files(), epollFd(-1), epollThread(), exitPipeFds(), readyEvents(), readyHead(0u), readyTail(0u)
+      , edgeTriggered(edgeTriggered), inlinePolling(inlinePolling), idleMicros(idleMicros), passesSinceEpoll(0)
+      , lastWorkTime(Cycles::rdtsc()), sleeping(false), wakeupFd(-1), fileInvocationSerial(0) {
+    if (inlinePolling) {
+        // No epoll thread will be started; the epoll set is created up
+        // front, together with the eventfd that ends blocking waits.
+        epollFd = epoll_create(10);
+        if (epollFd < 0) {
+            throw FatalError(HERE, "epoll_create failed in Dispatch", errno);
+        }
+        wakeupFd = eventfd(0, EFD_NONBLOCK);
+        if (wakeupFd < 0) {
+            throw FatalError(HERE, "Dispatch couldn't create wakeup eventfd", errno);
+        }
+        epoll_event epollEvent{};
+        epollEvent.data.u64 = 0;
+        epollEvent.events = EPOLLIN;
 
+        // -1 fd marks the wakeup eventfd.
+        epollEvent.data.fd = -1;
+        if (epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeupFd, &epollEvent) != 0) {
+            throw FatalError(HERE,
+                             "Dispatch couldn't set epoll event for wakeup eventfd",
+                             errno);
+        }
+    }
 }
 
 Dispatch::~Dispatch() {
@@ -34,6 +58,10 @@ Dispatch::~Dispatch() {
         close(epollFd);
         epollFd = -1;
     }
+    if (wakeupFd >= 0) {
+        close(wakeupFd);
+        wakeupFd = -1;
+    }
     for (auto &poller : pollers) {
         poller->owner = nullptr;
         poller->slot = -1;
@@ -47,7 +75,7 @@ Dispatch::~Dispatch() {
             file = nullptr;
         }
     }
-    readyFd.store(-1, std::memory_order_release);
+    readyTail.store(readyHead.load(std::memory_order_acquire), std::memory_order_release);
 }
 
 bool Dispatch::isDispatchThread() {
@@ -73,20 +101,38 @@ int Dispatch::poll() {
         while (lockNeeded.load(std::memory_order_acquire) != 0) {
             // Empty loop body.
         }
-        locked.store(std::memory_order_release);
+        locked.store(0, std::memory_order_release);
 
     }
     for (auto &poller : pollers) {
         result += poller->poll();
     }
-    if (readyFd >= 0) {
-        int fd = readyFd;
-
-        // Make sure that the read of readyEvents doesn't get reordered either
-        // before we see readyFd or after we change it (otherwise could
-        // read the wrong value).
-        uint32_t events = readyEvents.load(std::memory_order_acquire);
-        readyFd.store(-1, std::memory_order_release);
+    if (inlinePolling) {
+        int timeoutMs = 0;
+        if (result == 0 && lockNeeded.load() == 0 &&
+            Cycles::rdtsc() - lastWorkTime > Cycles::fromMicroseconds(idleMicros)) {
+            // Nothing to do for a while: block in epoll_wait. Announce it
+            // first, then look once more for work handed over by threads
+            // that couldn't have seen the announcement.
+            sleeping.store(true);
+            for (auto &poller : pollers) {
+                result += poller->poll();
+            }
+            if (result == 0 && lockNeeded.load() == 0) {
+                timeoutMs = BLOCKING_WAIT_MS;
+            }
+        }
+        if (timeoutMs != 0 || ++passesSinceEpoll >= EPOLL_INTERVAL) {
+            passesSinceEpoll = 0;
+            pollEpoll(timeoutMs);
+        }
+        sleeping.store(false, std::memory_order_relaxed);
+    }
+    uint32_t head = readyHead.load(std::memory_order_acquire);
+    uint32_t tail = readyTail.load(std::memory_order_relaxed);
+    for (; tail != head; tail++) {
+        int fd = readyEvents[tail & (READY_RING_SIZE - 1)].fd;
+        uint32_t events = readyEvents[tail & (READY_RING_SIZE - 1)].events;
         File *file = files[fd];
         if (file) {
             int id = fileInvocationSerial + 1;
@@ -112,14 +158,40 @@ int Dispatch::poll() {
             // handler was created for the same fd.
             if ((files[fd] == file) && (file->invocationId == id)) {
                 file->invocationId = 0;
-                file->setEvents(file->events);
+                if (!edgeTriggered) {
+                    file->setEvents(file->events);
+                }
             }
         }
     }
+    // Give the slots of this batch back to the epoll thread.
+    readyTail.store(tail, std::memory_order_release);
+    if (inlinePolling && result > 0) {
+        lastWorkTime = Cycles::rdtsc();
+    }
 
     return result;
 }
 
+/**
+ * Make an inline-polling dispatch thread return from a blocking
+ * epoll_wait. Must be invoked by any other thread after it hands the
+ * dispatch thread work that a Poller will find (e.g., a worker completing
+ * an RPC). Cheap when the dispatch thread isn't blocked.
+ */
+void Dispatch::wakeup() {
+    // Pairs with the store to sleeping in #poll: either the dispatch thread
+    // sees our work when it looks again, or we see that it is sleeping.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleeping.load(std::memory_order_relaxed)) {
+        uint64_t value = 1;
+        if (write(wakeupFd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+            Logger::log(HERE, "Dispatch couldn't write wakeup eventfd: %s",
+                        strerror(errno));
+        }
+    }
+}
+
 void Dispatch::run() {
     while (true) {
         poll();
@@ -154,8 +226,9 @@ Dispatch::Poller::~Poller() {
 Dispatch::File::File(Dispatch *dispatch, int fd, int events)
     : owner(dispatch), fd(fd), events(0), active(false), invocationId(0) {
     // Start the polling thread if it doesn't already exist (and also create
-    // the epoll file descriptor and the exit pipe).
-    if (!owner->epollThread) {
+    // the epoll file descriptor and the exit pipe). An inline-polling
+    // Dispatch created its epoll file descriptor already.
+    if (!owner->inlinePolling && !owner->epollThread) {
         owner->epollFd = epoll_create(10);
         if (owner->epollFd < 0) {
             throw FatalError(HERE, "epoll_create failed in Dispatch", errno);
@@ -205,7 +278,7 @@ Dispatch::File::File(Dispatch *dispatch, int fd, int events)
  *      The dispatch object on whose behalf this thread is working.
  */
 void Dispatch::epollThreadMain(Dispatch *owner) try {
-#define MAX_EVENTS 20
+#define MAX_EVENTS 256
     struct epoll_event events[MAX_EVENTS];
     while (true) {
         int count = epoll_wait(owner->epollFd, events, MAX_EVENTS, -1);
@@ -224,7 +297,9 @@ void Dispatch::epollThreadMain(Dispatch *owner) try {
         }
 
         // Signal all of the ready file descriptors back to the main
-        // polling loop using a shared memory location.
+        // polling loop through the ring; the batch becomes visible at once
+        // when readyHead is advanced.
+        uint32_t head = owner->readyHead.load(std::memory_order_relaxed);
         for (int i = 0; i < count; i++) {
             int fd = events[i].data.fd;
             uint32_t readyEvents = 0;
@@ -239,23 +314,25 @@ void Dispatch::epollThreadMain(Dispatch *owner) try {
                 // and indicates that this thread should exit.
                 return;
             }
-            while (owner->readyFd.load(std::memory_order_acquire) >= 0) {
-                // The main polling loop hasn't yet noticed the last file that
-                // became ready; wait for the shared memory location to clear
-                // again. It's also possible the main thread has signaled for
-                // this thread to exit and isn't interested in this readyFd
-                // value, so check on that while waiting.
+            while (head - owner->readyTail.load(std::memory_order_acquire)
+                   >= READY_RING_SIZE) {
+                // The ring is full: publish what we have and wait for the
+                // main polling loop to consume some of it. It's also possible
+                // the main thread has signaled for this thread to exit and
+                // isn't interested in these events, so check on that while
+                // waiting.
+                owner->readyHead.store(head, std::memory_order_release);
                 if (owner->exitPipeFds[0] >= 0 &&
                     fdIsReady(owner->exitPipeFds[0])) {
                     return;
                 }
             }
-            owner->readyEvents = readyEvents;
-            // The following line guarantees that the modification of
-            // owner->readyEvents will be visible in memory before the
-            // modification of readyFd.
-            owner->readyFd.store(events[i].data.fd, std::memory_order_release);
+            owner->readyEvents[head & (READY_RING_SIZE - 1)] = {fd, readyEvents};
+            head++;
         }
+        // The release store guarantees that the entries written above are
+        // visible in memory before the new head.
+        owner->readyHead.store(head, std::memory_order_release);
     }
 } catch (const std::exception &e) {
     Logger::log(HERE, "Fatal error in epollThreadMain: %s", e.what());
@@ -265,6 +342,48 @@ void Dispatch::epollThreadMain(Dispatch *owner) try {
     throw;
 }
 
+/**
+ * Used instead of the epoll thread by an inline-polling Dispatch: collect
+ * the events epoll reports into the ring, where #poll handles them.
+ *
+ * \param timeoutMs
+ *      Passed to epoll_wait; zero means don't block.
+ */
+void Dispatch::pollEpoll(int timeoutMs) {
+    struct epoll_event events[MAX_EVENTS];
+    int count = epoll_wait(epollFd, events, MAX_EVENTS, timeoutMs);
+    if (count < 0) {
+        if (errno == EINTR)
+            return;
+        throw FatalError(HERE, "epoll_wait failed in Dispatch", errno);
+    }
+
+    // The ring is always drained by the end of #poll, so this batch fits.
+    uint32_t head = readyHead.load(std::memory_order_relaxed);
+    for (int i = 0; i < count; i++) {
+        int fd = events[i].data.fd;
+        if (fd == -1) {
+            // Somebody woke us up; reset the eventfd.
+            uint64_t value;
+            if (read(wakeupFd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+                Logger::log(HERE, "Dispatch couldn't read wakeup eventfd: %s",
+                            strerror(errno));
+            }
+            continue;
+        }
+        uint32_t readyEvents = 0;
+        if (events[i].events & EPOLLIN) {
+            readyEvents |= READABLE;
+        }
+        if (events[i].events & EPOLLOUT) {
+            readyEvents |= WRITABLE;
+        }
+        this->readyEvents[head & (READY_RING_SIZE - 1)] = {fd, readyEvents};
+        head++;
+    }
+    readyHead.store(head, std::memory_order_release);
+}
+
 bool Dispatch::fdIsReady(int fd) {
     assert(fd >= 0);
     fd_set fds;
@@ -301,25 +420,35 @@ void Dispatch::File::setEvents(uint32_t events) {
         return;
     }
 
+    if (owner->edgeTriggered && active && this->events == static_cast<int>(events)) {
+        // An edge-triggered registration stays armed; nothing changes.
+        return;
+    }
+
     epoll_event epollEvent{};
     // The following statement is not needed, but without it valgrind
     // will generate false errors about uninitialized data.
     epollEvent.data.u64 = 0;
     this->events = events;
-    if (invocationId != 0) {
+    if (invocationId != 0 && !owner->edgeTriggered) {
         // Don't communicate anything to epoll while a call to
         // operator() is in progress (don't want another instance of
         // the handler to be invoked until the first completes): we
         // will get another chance to update epoll state when the handler
-        // completes.
+        // completes. Edge-triggered files are never re-armed afterwards,
+        // so they are updated right away; any event this raises is handled
+        // after the current invocation, by the same thread.
         return;
     }
     epollEvent.events = 0;
     if (events & READABLE) {
-        epollEvent.events |= EPOLLIN | EPOLLONESHOT;
+        epollEvent.events |= EPOLLIN;
     }
     if (events & WRITABLE) {
-        epollEvent.events |= EPOLLOUT | EPOLLONESHOT;
+        epollEvent.events |= EPOLLOUT;
+    }
+    if (epollEvent.events != 0) {
+        epollEvent.events |= owner->edgeTriggered ? EPOLLET : EPOLLONESHOT;
     }
     epollEvent.data.fd = fd;
     if (epoll_ctl(owner->epollFd,
@@ -364,6 +493,7 @@ Dispatch::Lock::Lock(Dispatch *dispatch)
     // The following statements ensure that the preceding load completes
     // before the following store (reordering could cause deadlock).
     dispatch->lockNeeded.store(1, std::memory_order_release);
+    dispatch->wakeup();
     while (dispatch->locked.load(std::memory_order_acquire) == 0) {
         // Empty loop: spin-wait for the dispatch thread to lock itself.
     }
@@ -13,7 +13,8 @@ namespace Gungnir {
 class Dispatch {
 
 public:
-    explicit Dispatch(bool hasDedicatedThread);
+    explicit Dispatch(bool hasDedicatedThread, bool edgeTriggered = false,
+                      bool inlinePolling = false, uint32_t idleMicros = 1000);
 
     ~Dispatch();
 
@@ -21,6 +22,14 @@ public:
 
     int poll();
 
+    void wakeup();
+
+    /// True means there is no epoll thread, and the dispatch thread may
+    /// block in epoll_wait when idle.
+    bool isInlinePolling() const {
+        return inlinePolling;
+    }
+
     void run() __attribute__ ((noreturn));
 
     /**
@@ -94,9 +103,11 @@ public:
          * whenever an event associated with the object has occurred. If
          * the event still exists when this method returns (e.g., the file
          * is readable but the method did not read the data), then the method
-         * will be invoked again. During the execution of this method events
-         * for this object are disabled (calling Dispatch::poll will not cause
-         * this method to be invoked).
+         * will be invoked again, unless the Dispatch is edge-triggered: then
+         * the method must consume the event completely (read or write until
+         * EAGAIN), since it is only invoked again on a new edge. During the
+         * execution of this method events for this object are disabled
+         * (calling Dispatch::poll will not cause this method to be invoked).
          *
          * \param events
          *      Indicates whether the file is readable or writable or both
@@ -168,6 +179,8 @@ private:
 
     static void epollThreadMain(Dispatch *owner);
 
+    void pollEpoll(int timeoutMs);
+
     static bool fdIsReady(int fd);
 
     int ownerId;
@@ -207,16 +220,63 @@ private:
     // valid if #epollThread is non-null.
     int exitPipeFds[2];
 
-    // Used for communication between the epoll thread and #poll: the
-    // epoll thread stores a fd here when it becomes ready, and #poll
-    // resets this back to -1 once it has retrieved the fd.
-    std::atomic<int> readyFd;
+    // Number of slots in #readyEvents; must be a power of two.
+    static const uint32_t READY_RING_SIZE = 1024;
+
+    // An fd reported ready by the epoll thread, with the events that fired
+    // for it (OR'ed combination of FileEvent values).
+    struct ReadyEvent {
+        int fd;
+        uint32_t events;
+    };
+
+    // Used for communication between the epoll thread and #poll: a
+    // single-producer single-consumer ring. The epoll thread appends each
+    // batch returned by epoll_wait and then publishes it by advancing
+    // #readyHead; #poll handles every published entry and then advances
+    // #readyTail to give the slots back.
+    ReadyEvent readyEvents[READY_RING_SIZE];
+
+    // Total number of entries published by the epoll thread.
+    std::atomic<uint32_t> readyHead;
+
+    // Total number of entries consumed by #poll.
+    std::atomic<uint32_t> readyTail;
+
+    // True means files are registered edge-triggered: they stay armed
+    // after an event instead of being re-armed with epoll_ctl after each
+    // invocation, and handlers must drain their fd.
+    bool edgeTriggered;
+
+    // True means there is no epoll thread: #poll calls epoll_wait itself,
+    // without blocking every #EPOLL_INTERVAL passes, and blocking once it
+    // has found no work for #idleMicros.
+    bool inlinePolling;
+
+    // Passes of #poll between two non-blocking epoll_wait calls when
+    // inline polling.
+    static const uint32_t EPOLL_INTERVAL = 8;
+
+    // Upper bound on a blocking epoll_wait when inline polling; threads
+    // that hand work to the dispatch thread wake it sooner with #wakeup.
+    static const int BLOCKING_WAIT_MS = 100;
+
+    // Idle time after which an inline-polling dispatch thread blocks.
+    uint32_t idleMicros;
+
+    // Passes of #poll since the last epoll_wait.
+    uint32_t passesSinceEpoll;
+
+    // Cycles::rdtsc() of the last pass of #poll that did useful work.
+    uint64_t lastWorkTime;
+
+    // True while the dispatch thread is blocked (or about to block) in
+    // epoll_wait; #wakeup only writes #wakeupFd then.
+    std::atomic<bool> sleeping;
 
-    // Also used for communication between epoll thread and #poll:
-    // before setting readyFd the epoll thread stores information here
-    // about which events fired for readyFd (OR'ed combination of
-    // FileEvent values).
-    std::atomic<uint32_t> readyEvents;
+    // An eventfd in the epoll set of an inline-polling Dispatch; writing
+    // it ends a blocking epoll_wait.
+    int wakeupFd;
 
     // Used to assign a (nearly) unique identifier to each invocation
     // of a File.
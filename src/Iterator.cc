@@ -1,4 +1,5 @@
 #include "Iterator.h"
+#include "Client.h"
 
 namespace Gungnir {
 
@@ -6,7 +7,7 @@ Iterator::Iterator() : Iterator(new Buffer()) {
 
 }
 
-Iterator::Iterator(Buffer *buffer) : buffer(buffer), size(0), offset(0) {
+Iterator::Iterator(Buffer *buffer) : buffer(buffer), size(0), offset(0), hasMore(false), nextKey(0), lsn(0), stream() {
 
 }
 
@@ -17,12 +18,20 @@ Iterator::Iterator(const Iterator &that) {
     this->buffer = that.buffer;
     this->size = that.size;
     this->offset = that.offset;
+    this->hasMore = that.hasMore;
+    this->nextKey = that.nextKey;
+    this->lsn = that.lsn;
+    this->stream = that.stream;
 }
 
 Iterator &Iterator::operator=(const Iterator &that) {
     this->buffer = that.buffer;
     this->size = that.size;
     this->offset = that.offset;
+    this->hasMore = that.hasMore;
+    this->nextKey = that.nextKey;
+    this->lsn = that.lsn;
+    this->stream = that.stream;
     return *this;
 }
 
@@ -43,6 +52,8 @@ void Iterator::next() {
 }
 
 bool Iterator::isDone() {
+    if (stream)
+        return !stream->fetch(&offset);
     return offset >= buffer->size();
 }
 }
@@ -6,11 +6,22 @@
 
 namespace Gungnir {
 
+class ScanStreamRpc;
+
 class Iterator {
 public:
     std::shared_ptr<Buffer> buffer;
     uint32_t size;
     uint32_t offset;
+    bool hasMore;
+    uint64_t nextKey;
+
+    /// LSN the objects reflect; see ReadConstraint.
+    uint64_t lsn;
+
+    /// Streamed scan that feeds buffer, or NULL if the whole reply is
+    /// already present.
+    std::shared_ptr<ScanStreamRpc> stream;
 
     Iterator();
 
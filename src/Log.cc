@@ -2,10 +2,13 @@
 #include "Object.h"
 #include "Exception.h"
 #include "Logger.h"
+#include "Common.h"
 
 #include <memory>
+#include <vector>
 #include <cstring>
 #include <cassert>
+#include <cerrno>
 #include <unistd.h>
 #include <fcntl.h>
 
@@ -17,9 +20,10 @@ LogEntry::LogEntry(LogEntryType type, Key key)
 }
 
 Log::Log(const char *filePath, bool recover, int segmentSize) :
-    head(nullptr), tail(nullptr), segmentSize(segmentSize), appendedLength(0), syncedLength(0), lock(), fd()
-    , writer(), stopWriter(false) {
-    head = tail = new Segment(segmentSize);
+    head(nullptr), tail(nullptr), segmentSize(segmentSize), appendedLength(0), syncedLength(0), lock()
+    , replicating(false), localSync(true), replicationOffset(0), replicatedLength(0), appendListener(), fd()
+    , recovered(), recoveredLength(sizeof(FileHeader)), writer()
+    , stopWriter(false) {
     if (!recover) {
         ::remove(filePath);
     }
@@ -27,10 +31,32 @@ Log::Log(const char *filePath, bool recover, int segmentSize) :
     if (fd == -1)
         throw FatalError(HERE, "log file create failed");
 
+    // A new file starts with a header; an existing one must start with a
+    // header of this format, since entries of another one would be
+    // misparsed.
+    FileHeader header{};
+    ssize_t ret = ::read(fd, &header, sizeof(header));
+    if (ret == 0) {
+        header = {FILE_MAGIC, FORMAT_VERSION};
+        if (::write(fd, &header, sizeof(header)) != static_cast<ssize_t>(sizeof(header)))
+            throw FatalError(HERE, "log file header write failed");
+    } else if (ret != static_cast<ssize_t>(sizeof(header)) || header.magic != FILE_MAGIC) {
+        ::close(fd);
+        throw FatalError(HERE, format("%s is not a log file of format version %u; "
+                                      "logs written before versions were recorded can't be recovered",
+                                      filePath, FORMAT_VERSION));
+    } else if (header.formatVersion != FORMAT_VERSION) {
+        ::close(fd);
+        throw FatalError(HERE, format("%s has log format version %u, expected %u",
+                                      filePath, header.formatVersion, FORMAT_VERSION));
+    }
+    head = tail = new Segment(segmentSize);
 }
 
 Log::~Log() {
     ::close(fd);
+    for (LogEntry *entry : recovered)
+        delete entry;
     if (writer) {
         stopWriter = true;
         writer->join();
@@ -42,7 +68,8 @@ void Log::startWriter() {
     writer.reset(new std::thread(writerThread, this));
 }
 
-Log::Segment::Segment(int segmentSize) : data(nullptr), length(0), writeOffset(0), next(nullptr) {
+Log::Segment::Segment(int segmentSize)
+    : data(nullptr), length(0), writeOffset(0), replicateOffset(0), next(nullptr) {
     data = (char *) std::malloc(segmentSize);
 }
 
@@ -51,42 +78,73 @@ Log::Segment::~Segment() {
 }
 
 uint64_t Log::append(LogEntry *entry) {
-    uint32_t syncLength;
-    char *dest;
+    return append(&entry, 1);
+}
+
+/**
+ * Append several entries as one contiguous range of the log, so they are
+ * written out together and a single sync covers all of them.
+ *
+ * \return
+ *      The log offset to pass to sync() to wait for every entry.
+ */
+uint64_t Log::append(LogEntry **entries, int count) {
+    uint64_t syncLength;
+    uint32_t totalLength = 0;
+    for (int i = 0; i < count; i++)
+        totalLength += entries[i]->length();
+
+    auto capacity = static_cast<uint32_t>(segmentSize);
     {
         SpinLock::Guard guard(lock);
-        uint32_t entryLength = entry->length();
-        if (tail->length + entryLength > segmentSize) {
-            tail->next = new Segment(segmentSize);
+        if (tail->length + totalLength > capacity) {
+            // A range longer than a segment gets an oversized segment of its
+            // own.
+            tail->next = new Segment(totalLength > capacity ? totalLength : capacity);
             tail = tail->next;
         }
-        appendedLength += entryLength;
-        syncLength = appendedLength;
-        dest = tail->data + tail->length;
-
-        tail->length += entryLength;
-        entry->copyTo(dest);
+        syncLength = appendedLength.load(std::memory_order_relaxed) + totalLength;
+        appendedLength.store(syncLength, std::memory_order_release);
+        char *dest = tail->data + tail->length;
+        tail->length += totalLength;
+        for (int i = 0; i < count; i++) {
+            entries[i]->copyTo(dest);
+            dest += entries[i]->length();
+        }
     }
+    if (appendListener)
+        appendListener();
 
     return syncLength;
 }
 
+/**
+ * Return whether the log is durable up to toOffset: written to the log
+ * file, and acknowledged by enough backups if it is replicated.
+ */
 bool Log::sync(uint64_t toOffset) {
-    SpinLock::Guard guard(lock);
-    return toOffset <= syncedLength.load();
+    if (localSync && toOffset > syncedLength.load())
+        return false;
+    return !replicating || toOffset <= replicatedLength.load(std::memory_order_acquire);
 }
 
 bool Log::write() {
     bool workDone = false;
     uint64_t length = 0;
     char *buffer = nullptr;
+    Segment *segment;
 
     assert(head != nullptr);
     {
         SpinLock::Guard guard(lock);
-        if (head->length > head->writeOffset) {
-            buffer = head->data + head->writeOffset;
-            length = head->length - head->writeOffset;
+        // Segments written out may still wait for replication, so the one
+        // to write isn't necessarily the head.
+        segment = head;
+        while (segment != tail && segment->writeOffset == segment->length)
+            segment = segment->next;
+        if (segment->length > segment->writeOffset) {
+            buffer = segment->data + segment->writeOffset;
+            length = segment->length - segment->writeOffset;
         }
     }
 
@@ -100,18 +158,88 @@ bool Log::write() {
 
     {
         SpinLock::Guard guard(lock);
-        head->writeOffset += length;
+        segment->writeOffset += length;
         syncedLength.fetch_add(length);
 
-        if (head != tail && head->writeOffset == head->length) {
+        while (head != tail && head->writeOffset == head->length &&
+               (!replicating || head->replicateOffset == head->length)) {
             Segment *oldHead = head;
             head = head->next;
             delete oldHead;
+            // The next segment may hold data even if this one held none
+            // (a batch too long for it moves on to a new segment).
+            workDone = true;
         }
     }
     return workDone;
 }
 
+/**
+ * Keep the log for replication from now on: segments are freed only once
+ * takeReplicationBatch() has handed them out, and sync() also waits for
+ * setReplicatedLength(). Must be called before anything is appended.
+ *
+ * \param replacesLocalSync
+ *      True means sync() no longer waits for the log file: a write is
+ *      durable once the backups have it.
+ */
+void Log::enableReplication(bool replacesLocalSync) {
+    SpinLock::Guard guard(lock);
+    replicating = true;
+    localSync = !replacesLocalSync;
+}
+
+/**
+ * Have listener invoked, in the appending thread, after each append, such
+ * as to wake a thread that waits for the log to grow. Must be called before
+ * anything is appended.
+ */
+void Log::setAppendListener(std::function<void()> listener) {
+    appendListener = std::move(listener);
+}
+
+/**
+ * Append to batch the log bytes not handed out yet, a whole number of
+ * entries. Segments are taken whole, so the batch may exceed maxBytes only
+ * if its first segment does. Must be called from one thread at a time.
+ *
+ * \return
+ *      The log offset of the first byte appended to batch.
+ */
+uint64_t Log::takeReplicationBatch(Buffer *batch, uint32_t maxBytes) {
+    uint64_t offset = replicationOffset;
+    std::vector<Segment *> taken;
+    std::vector<uint64_t> ends;
+    uint64_t total = 0;
+    {
+        SpinLock::Guard guard(lock);
+        for (Segment *segment = head; segment != nullptr; segment = segment->next) {
+            uint64_t length = segment->length - segment->replicateOffset;
+            if (length == 0)
+                continue;
+            if (total != 0 && total + length > maxBytes)
+                break;
+            taken.push_back(segment);
+            ends.push_back(segment->length);
+            total += length;
+        }
+    }
+
+    // The segments can't be freed before their replicateOffset moves past
+    // what is copied here, and appends only add bytes past it.
+    for (size_t i = 0; i < taken.size(); i++) {
+        Segment *segment = taken[i];
+        batch->append(segment->data + segment->replicateOffset,
+                      static_cast<uint32_t>(ends[i] - segment->replicateOffset));
+    }
+
+    SpinLock::Guard guard(lock);
+    for (size_t i = 0; i < taken.size(); i++)
+        taken[i]->replicateOffset = ends[i];
+    replicationOffset += total;
+    return offset;
+}
+
 void Log::writerThread(Log *log) {
     while (true) {
         if (log->stopWriter)
@@ -124,34 +252,210 @@ void Log::writerThread(Log *log) {
     }
 }
 
+/**
+ * Return the next entry recovered from the log file, or NULL at its end.
+ * The entries of a transaction are returned only once its commit marker
+ * has been read; a transaction cut short by a crash ends the log. At the
+ * end, the file is cut after the last complete record (see
+ * getRecoveredLength()), so that the writer appends there.
+ */
 LogEntry *Log::read() {
+    while (recovered.empty()) {
+        LogEntry *entry = readEntry();
+        if (entry == nullptr || entry->type == LOG_ENTRY_TYPE_TXCOMMIT) {
+            delete entry;
+            discardTail();
+            return nullptr;
+        }
+        if (entry->type != LOG_ENTRY_TYPE_TXBEGIN) {
+            recoveredLength = static_cast<uint64_t>(::lseek(fd, 0, SEEK_CUR));
+            return entry;
+        }
+
+        uint32_t count = static_cast<TransactionBegin *>(entry)->count;
+        delete entry;
+        bool complete = true;
+        for (uint32_t i = 0; i < count && complete; i++) {
+            entry = readEntry();
+            complete = entry != nullptr && (entry->type == LOG_ENTRY_TYPE_OBJ ||
+                                            entry->type == LOG_ENTRY_TYPE_OBJTOMB);
+            if (entry != nullptr)
+                recovered.push_back(entry);
+        }
+        if (complete) {
+            entry = readEntry();
+            complete = entry != nullptr && entry->type == LOG_ENTRY_TYPE_TXCOMMIT &&
+                       static_cast<TransactionCommit *>(entry)->count == count;
+            delete entry;
+        }
+        if (!complete) {
+            for (LogEntry *e : recovered)
+                delete e;
+            recovered.clear();
+            discardTail();
+            return nullptr;
+        }
+        recoveredLength = static_cast<uint64_t>(::lseek(fd, 0, SEEK_CUR));
+    }
+    LogEntry *entry = recovered.front();
+    recovered.pop_front();
+    return entry;
+}
+
+/**
+ * Cut the log file after its last complete record, and have the writer
+ * append there: bytes past it belong to a record a crash cut short, and
+ * entries written after them would never be recovered.
+ */
+void Log::discardTail() {
+    off_t end = ::lseek(fd, 0, SEEK_END);
+    if (end > static_cast<off_t>(recoveredLength)) {
+        Logger::log(HERE, "Discarding %lu bytes at the end of the log file, after its last complete record",
+                    static_cast<uint64_t>(end) - recoveredLength);
+        if (::ftruncate(fd, static_cast<off_t>(recoveredLength)) != 0)
+            throw FatalError(HERE, "log file truncate failed", errno);
+    }
+    if (::lseek(fd, static_cast<off_t>(recoveredLength), SEEK_SET) < 0)
+        throw FatalError(HERE, "log file seek failed", errno);
+}
+
+/**
+ * Read one entry from the log file.
+ *
+ * \return
+ *      The entry, or NULL if the file ends before a complete entry.
+ */
+LogEntry *Log::readEntry() {
     LogEntryType type;
     uint64_t key;
+    uint64_t version;
     uint32_t len;
-    char buffer[200];
     ssize_t ret;
 
     ret = ::read(fd, &type, sizeof(type));
     if (ret <= 0)
         return nullptr;
+    if (type == LOG_ENTRY_TYPE_TXBEGIN || type == LOG_ENTRY_TYPE_TXCOMMIT) {
+        uint32_t count;
+        ret = ::read(fd, &count, sizeof(count));
+        if (ret != static_cast<ssize_t>(sizeof(count)))
+            return nullptr;
+        if (type == LOG_ENTRY_TYPE_TXBEGIN)
+            return new TransactionBegin(count);
+        return new TransactionCommit(count);
+    }
     ret = ::read(fd, &key, sizeof(key));
     if (ret <= 0)
         return nullptr;
     switch (type) {
-        case LOG_ENTRY_TYPE_OBJ:
+        case LOG_ENTRY_TYPE_OBJ: {
+            ret = ::read(fd, &version, sizeof(version));
+            if (ret <= 0)
+                return nullptr;
             ret = ::read(fd, &len, sizeof(len));
             if (ret <= 0)
                 return nullptr;
 
-            ret = ::read(fd, buffer, len);
-            if (ret <= 0)
+            auto *object = new Object(key, len);
+            if (len != 0) {
+                ret = ::read(fd, object->value.getStart<char>(), len);
+                if (ret != static_cast<ssize_t>(len)) {
+                    delete object;
+                    return nullptr;
+                }
+            }
+            object->version = version;
+            return object;
+        }
+        case LOG_ENTRY_TYPE_OBJTOMB:
+            return new ObjectTombstone(key);
+        default:
+            return nullptr;
+    }
+}
+
+/**
+ * Parse one entry from buffer, in the format the entries are appended in,
+ * such as a batch from takeReplicationBatch().
+ *
+ * \param offset
+ *      Where the entry starts; advanced past it.
+ * \return
+ *      The entry, or NULL if buffer ends before a complete entry or holds
+ *      an unknown type.
+ */
+LogEntry *Log::parseEntry(Buffer *buffer, uint32_t *offset) {
+    LogEntryType type;
+    uint64_t key;
+    uint64_t version;
+    uint32_t len;
+    uint32_t at = *offset;
+
+    if (buffer->copy(at, sizeof(type), &type) != sizeof(type))
+        return nullptr;
+    at += sizeof(type);
+    if (type == LOG_ENTRY_TYPE_TXBEGIN || type == LOG_ENTRY_TYPE_TXCOMMIT) {
+        uint32_t count;
+        if (buffer->copy(at, sizeof(count), &count) != sizeof(count))
+            return nullptr;
+        *offset = at + sizeof(count);
+        if (type == LOG_ENTRY_TYPE_TXBEGIN)
+            return new TransactionBegin(count);
+        return new TransactionCommit(count);
+    }
+    if (buffer->copy(at, sizeof(key), &key) != sizeof(key))
+        return nullptr;
+    at += sizeof(key);
+    switch (type) {
+        case LOG_ENTRY_TYPE_OBJ: {
+            if (buffer->copy(at, sizeof(version), &version) != sizeof(version))
+                return nullptr;
+            at += sizeof(version);
+            if (buffer->copy(at, sizeof(len), &len) != sizeof(len))
+                return nullptr;
+            at += sizeof(len);
+            if (buffer->size() - at < len)
                 return nullptr;
-            return new Object(key, buffer, len);
+
+            auto *object = new Object(key, len);
+            if (len != 0)
+                buffer->copy(at, len, object->value.getStart<char>());
+            object->version = version;
+            *offset = at + len;
+            return object;
+        }
         case LOG_ENTRY_TYPE_OBJTOMB:
+            *offset = at;
             return new ObjectTombstone(key);
         default:
             return nullptr;
     }
 }
 
+TransactionBegin::TransactionBegin(uint32_t count)
+    : LogEntry(LOG_ENTRY_TYPE_TXBEGIN, 0), count(count) {
+}
+
+uint32_t TransactionBegin::length() {
+    return sizeof(type) + sizeof(count);
+}
+
+void TransactionBegin::copyTo(char *dest) {
+    memcpy(dest, &type, 1);
+    memcpy(dest + 1, &count, 4);
+}
+
+TransactionCommit::TransactionCommit(uint32_t count)
+    : LogEntry(LOG_ENTRY_TYPE_TXCOMMIT, 0), count(count) {
+}
+
+uint32_t TransactionCommit::length() {
+    return sizeof(type) + sizeof(count);
+}
+
+void TransactionCommit::copyTo(char *dest) {
+    memcpy(dest, &type, 1);
+    memcpy(dest + 1, &count, 4);
+}
+
 }
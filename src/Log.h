@@ -5,8 +5,11 @@
 #include <memory>
 #include <thread>
 #include <atomic>
+#include <deque>
+#include <functional>
 
 #include "Key.h"
+#include "Buffer.h"
 #include "SpinLock.h"
 
 namespace Gungnir {
@@ -15,6 +18,8 @@ namespace Gungnir {
 enum LogEntryType : uint8_t {
     LOG_ENTRY_TYPE_OBJ,
     LOG_ENTRY_TYPE_OBJTOMB,
+    LOG_ENTRY_TYPE_TXBEGIN,
+    LOG_ENTRY_TYPE_TXCOMMIT,
 };
 
 class LogEntry {
@@ -22,6 +27,8 @@ public:
     LogEntryType type;
     Key key;
 
+    virtual ~LogEntry() = default;
+
     virtual uint32_t length() = 0;
 
     virtual void copyTo(char *dest) = 0;
@@ -30,10 +37,53 @@ protected:
     LogEntry(LogEntryType type, Key key);
 };
 
+/**
+ * Opens a transaction: the next count entries in the log belong to it, and
+ * they are followed by a TransactionCommit.
+ */
+class TransactionBegin : public LogEntry {
+public:
+    explicit TransactionBegin(uint32_t count);
+
+    uint32_t length() override;
+
+    void copyTo(char *dest) override;
+
+    uint32_t count;
+};
+
+/**
+ * Closes a transaction; a transaction without one was cut short by a crash
+ * and is not recovered.
+ */
+class TransactionCommit : public LogEntry {
+public:
+    explicit TransactionCommit(uint32_t count);
+
+    uint32_t length() override;
+
+    void copyTo(char *dest) override;
+
+    uint32_t count;
+};
+
 class Log {
 public:
     explicit Log(const char *filePath, bool recover, int segmentSize = 1024 * 1024);
 
+    /// Identifies a log file, at its start.
+    static const uint32_t FILE_MAGIC = 0x474c4e47;
+
+    /// Format of the entries that follow the header. Version 2 added the
+    /// object version to OBJ entries; files of version 1 have no header,
+    /// and can't be recovered.
+    static const uint32_t FORMAT_VERSION = 2;
+
+    struct FileHeader {
+        uint32_t magic;
+        uint32_t formatVersion;
+    } __attribute__((packed));
+
     ~Log();
 
     void startWriter();
@@ -45,6 +95,7 @@ private:
         char *data;
         uint64_t length;
         uint64_t writeOffset;
+        uint64_t replicateOffset;
         Segment *next;
 
         Segment(int segmentSize);
@@ -56,26 +107,80 @@ private:
 public:
     uint64_t append(LogEntry *entry);
 
+    uint64_t append(LogEntry **entries, int count);
+
     bool sync(uint64_t offset);
 
     bool write();
 
+    void enableReplication(bool replacesLocalSync);
+
+    void setAppendListener(std::function<void()> listener);
+
+    uint64_t takeReplicationBatch(Buffer *batch, uint32_t maxBytes);
+
+    /// Bytes appended so far.
+    uint64_t getAppendedLength() const {
+        return appendedLength.load(std::memory_order_acquire);
+    }
+
+    /// Record that the first length bytes of the log are replicated.
+    void setReplicatedLength(uint64_t length) {
+        replicatedLength.store(length, std::memory_order_release);
+    }
+
     LogEntry *read();
 
+    /// End, in the log file, of the last complete record read() has
+    /// returned: an entry, or a whole committed transaction.
+    uint64_t getRecoveredLength() const {
+        return recoveredLength;
+    }
+
+    LogEntry *readEntry();
+
+    static LogEntry *parseEntry(Buffer *buffer, uint32_t *offset);
+
     Segment *head;
     Segment *tail;
     int segmentSize;
-    uint64_t appendedLength;
+    std::atomic<uint64_t> appendedLength;
     std::atomic<uint64_t> syncedLength;
     SpinLock lock;
 
+    /// True means segments are kept until takeReplicationBatch() has
+    /// handed them out as well, and sync() waits for replicatedLength.
+    bool replicating;
+
+    /// True means sync() waits for the log file; false once the backups
+    /// are the only durability point.
+    bool localSync;
+
+    /// Bytes handed out by takeReplicationBatch() so far.
+    uint64_t replicationOffset;
+
+    /// Bytes acknowledged by enough backups; see setReplicatedLength().
+    std::atomic<uint64_t> replicatedLength;
+
+    /// Invoked after each append, if set; see setAppendListener().
+    std::function<void()> appendListener;
+
     int fd;
+
+    /// Entries of a committed transaction that read() hasn't returned yet.
+    std::deque<LogEntry *> recovered;
+
+    /// See getRecoveredLength().
+    uint64_t recoveredLength;
+
     std::unique_ptr<std::thread> writer;
     bool stopWriter;
 
 
     const static int POLL_USEC = 10000;
 
+    void discardTail();
+
     static void writerThread(Log *log);
 };
 
@@ -3,10 +3,13 @@
 #include "WorkerManager.h"
 #include "Context.h"
 
+#include <algorithm>
+#include <cstdint>
+
 namespace Gungnir {
 
 LogCleaner::LogCleaner(Context *context) :
-    context(context), cleaner(), lock(), minEpoch(-1) {
+    context(context), cleaner(), lock(), workerManagers(), minEpoch(-1) {
 
 }
 
@@ -24,8 +27,32 @@ void LogCleaner::collect(int epoch, Object *object) {
     objects.emplace_back(epoch, object);
 }
 
+/**
+ * Have the epochs of workerManager's workers hold back what is freed. Every
+ * dispatch thread's WorkerManager must be added before it serves RPCs.
+ */
+void LogCleaner::addWorkerManager(WorkerManager *workerManager) {
+    SpinLock::Guard guard(lock);
+    workerManagers.push_back(workerManager);
+}
+
+void LogCleaner::removeWorkerManager(WorkerManager *workerManager) {
+    SpinLock::Guard guard(lock);
+    workerManagers.erase(std::find(workerManagers.begin(), workerManagers.end(), workerManager));
+}
+
+/**
+ * Take the oldest epoch any worker of any dispatch thread is in; what was
+ * removed before it can be freed.
+ */
 void LogCleaner::loadEpoch() {
-    context->workerManager->minEpoch.load();
+    SpinLock::Guard guard(lock);
+    if (workerManagers.empty())
+        return;
+    int epoch = INT32_MAX;
+    for (WorkerManager *workerManager : workerManagers)
+        epoch = std::min(epoch, workerManager->minEpoch.load());
+    minEpoch = epoch;
 }
 
 bool LogCleaner::clean() {
@@ -34,16 +61,20 @@ bool LogCleaner::clean() {
     Object *objectToDelete = nullptr;
     {
         SpinLock::Guard guard(lock);
-        auto removal = removals.front();
-        if (removal.first < minEpoch) {
-            nodeToDelete = removal.second;
+        if (!removals.empty() && removals.front().first < minEpoch) {
+            nodeToDelete = removals.front().second;
             removals.pop_front();
             workDone = true;
         }
-        auto object = objects.front();
-        if (object.first < minEpoch) {
-            objectToDelete = object.second;
-            objects.pop_front();
+        // An object still referenced by a reply in transit waits, set aside,
+        // until the reply is out (see freeUnpinned()).
+        if (!objects.empty() && objects.front().first < minEpoch) {
+            if (objects.front().second->pins.load(std::memory_order_acquire) == 0) {
+                objectToDelete = objects.front().second;
+                objects.pop_front();
+            } else {
+                pinnedObjects.splice(pinnedObjects.end(), objects, objects.begin());
+            }
             workDone = true;
         }
 
@@ -54,9 +85,28 @@ bool LogCleaner::clean() {
     return workDone;
 }
 
+/**
+ * Free the objects set aside by clean() whose replies are out by now. A
+ * slow reader may keep its reply, and so its objects, pinned for long.
+ */
+bool LogCleaner::freeUnpinned() {
+    bool workDone = false;
+    for (auto it = pinnedObjects.begin(); it != pinnedObjects.end();) {
+        if (it->second->pins.load(std::memory_order_acquire) == 0) {
+            delete it->second;
+            it = pinnedObjects.erase(it);
+            workDone = true;
+        } else {
+            ++it;
+        }
+    }
+    return workDone;
+}
+
 void LogCleaner::cleanerThread(LogCleaner *logCleaner) {
     while (true) {
         while (logCleaner->clean());
+        logCleaner->freeUnpinned();
         logCleaner->loadEpoch();
         if (!logCleaner->clean()) {
             useconds_t r = static_cast<useconds_t>(generateRandom() % POLL_USEC) / 10;
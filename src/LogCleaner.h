@@ -7,9 +7,12 @@
 #include <memory>
 #include <thread>
 #include <list>
+#include <vector>
 
 namespace Gungnir {
 
+class WorkerManager;
+
 class LogCleaner {
 
 public:
@@ -21,10 +24,16 @@ public:
 
     void collect(int epoch, Object *object);
 
+    void addWorkerManager(WorkerManager *workerManager);
+
+    void removeWorkerManager(WorkerManager *workerManager);
+
     void loadEpoch();
 
     bool clean();
 
+    bool freeUnpinned();
+
 private:
 
     const static int POLL_USEC = 10000;
@@ -36,8 +45,17 @@ private:
     std::list<std::pair<int, ConcurrentSkipList::Node *>> removals;
     std::list<std::pair<int, Object *>> objects;
 
+    /// Objects past their epoch that a reply in transit still pinned when
+    /// they reached the front of objects. Set aside so that they don't hold
+    /// back the objects behind them; only the cleaner thread uses it.
+    std::list<std::pair<int, Object *>> pinnedObjects;
+
     SpinLock lock;
 
+    /// The WorkerManagers of all dispatch threads, whose workers may still
+    /// reference what was removed. Protected by lock.
+    std::vector<WorkerManager *> workerManagers;
+
     int minEpoch;
 
     static void cleanerThread(LogCleaner *logCleaner);
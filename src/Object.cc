@@ -5,19 +5,33 @@
 namespace Gungnir {
 
 
+/**
+ * Construct an object holding the contents of value, which is left empty.
+ * A request body the transport received into its own allocation becomes
+ * the object's storage as it is, without a copy.
+ */
 Object::Object(Key key, Buffer *value)
-    : LogEntry(LOG_ENTRY_TYPE_OBJ, key) {
-    this->value.append(value);
+    : LogEntry(LOG_ENTRY_TYPE_OBJ, key), version(0), pins(0) {
+    this->value.adopt(value);
 
 }
 
 Object::Object(Key key, const void *data, uint32_t length)
-    : LogEntry(LOG_ENTRY_TYPE_OBJ, key) {
+    : LogEntry(LOG_ENTRY_TYPE_OBJ, key), version(0), pins(0) {
     this->value.append(data, length);
 }
 
+/**
+ * Construct an object whose value is length bytes of contiguous,
+ * uninitialized storage, for the caller to fill in through value.
+ */
+Object::Object(Key key, uint32_t length)
+    : LogEntry(LOG_ENTRY_TYPE_OBJ, key), version(0), pins(0) {
+    this->value.alloc(length);
+}
+
 uint32_t Object::length() {
-    return sizeof(type) + sizeof(key) + sizeof(uint32_t) + value.size();
+    return sizeof(type) + sizeof(key) + sizeof(version) + sizeof(uint32_t) + value.size();
 }
 
 void Object::copyTo(char *dest) {
@@ -26,8 +40,43 @@ void Object::copyTo(char *dest) {
 
     memcpy(dest, &type, 1);
     memcpy(dest + 1, &key, 8);
-    memcpy(dest + 9, &len, 4);
-    memcpy(dest + 13, value.getStart<char>(), value.size());
+    memcpy(dest + 9, &version, 8);
+    memcpy(dest + 17, &len, 4);
+    memcpy(dest + 21, value.getStart<char>(), value.size());
+}
+
+/**
+ * Append the value to a reply. Large values are not copied: buffer refers
+ * to them in place and keeps the object pinned until it drops the
+ * reference (once the reply has been transmitted), so the transport sends
+ * them straight from object memory.
+ */
+void Object::appendValueTo(Buffer *buffer) {
+    if (value.size() < MIN_PINNED_VALUE) {
+        buffer->append(&value);
+        return;
+    }
+    Buffer::Iterator it(&value);
+    while (!it.isDone()) {
+        buffer->appendChunk(new PinnedChunk(this, const_cast<void *>(it.getData()), it.getLength()));
+        it.next();
+    }
+}
+
+Object::PinnedChunk::PinnedChunk(Object *object, void *data, uint32_t length)
+    : Chunk(data, length), object(object) {
+    object->pins.fetch_add(1, std::memory_order_relaxed);
+}
+
+Object::PinnedChunk::~PinnedChunk() {
+    object->pins.fetch_sub(1, std::memory_order_release);
+}
+
+/**
+ * Refer to the same part of the value, pinning the object once more.
+ */
+Buffer::Chunk *Object::PinnedChunk::share() {
+    return new PinnedChunk(object, data, length);
 }
 
 ObjectTombstone::ObjectTombstone(Key key)
@@ -1,6 +1,8 @@
 #ifndef GUNGNIR_OBJECT_H
 #define GUNGNIR_OBJECT_H
 
+#include <atomic>
+
 #include "Key.h"
 #include "Buffer.h"
 #include "Log.h"
@@ -12,13 +14,46 @@ class Object : public LogEntry {
 public:
     Buffer value;
 
+    /// Number of writes that produced this object since the key was
+    /// (re)created: 1 for the first write, incremented by each overwrite.
+    /// Compare-and-swap is conditioned on it.
+    uint64_t version;
+
+    /// Number of reply buffers that refer to value in place; the object
+    /// must not be freed while this is nonzero.
+    std::atomic<int> pins;
+
+    /// Values shorter than this are copied into replies, since referring
+    /// to them costs more than the copy.
+    static const uint32_t MIN_PINNED_VALUE = 1024;
+
     Object(Key key, Buffer *value);
 
     Object(Key key, const void *data, uint32_t length);
 
+    Object(Key key, uint32_t length);
+
     uint32_t length() override;
 
     void copyTo(char *dest) override;
+
+    void appendValueTo(Buffer *buffer);
+
+private:
+    /**
+     * A Buffer chunk that refers to part of the value of a pinned object.
+     */
+    class PinnedChunk : public Buffer::Chunk {
+    public:
+        PinnedChunk(Object *object, void *data, uint32_t length);
+
+        ~PinnedChunk() override;
+
+        Chunk *share() override;
+
+    private:
+        Object *object;
+    };
 };
 
 class ObjectTombstone : public LogEntry {
@@ -1,4 +1,5 @@
 #include "OptionConfig.h"
+#include "PriorityLanes.h"
 
 #include <thread>
 
@@ -6,20 +7,62 @@ namespace Gungnir {
 
 OptionConfig::OptionConfig() :
     options("Gungnir", "High performance key value store")
-    , serverLocator(), connectLocator(), maxCores(1), readPercent(50), targetOps(1000000), objectCount(10000000)
-    , objectSize(128), time(2), logFilePath("/tmp/gungnir.log"), recover(false) {
+    , serverLocator(), connectLocator(), maxCores(1), dispatchThreads(1), edgeTriggered(false), inlineEpoll(false), idleMicros(1000), uring(false), readPercent(50), targetOps(1000000), window(1)
+    , clientThreads(1), ioThreads(1), objectCount(10000000)
+    , objectSize(128), time(2), logFilePath("/tmp/gungnir.log"), recover(false)
+    , enableLog(false), backupLocators(), backup(false), replicationAcks(0), skipLocalSync(false)
+    , maxStalenessMicros(0), maxWaitingRpcs(4096), queueDelayTargetMicros(20000), queueDelayIntervalMicros(100000)
+    , statsSeconds(0), laneWeights(LaneWeights::DEFAULT) {
     maxCores = std::max(maxCores, std::thread::hardware_concurrency() / 2);
     options.add_options()
         ("l,listen", "Server listening address", cxxopts::value<std::string>(serverLocator))
         ("c,connect", "Client connect address", cxxopts::value<std::string>(connectLocator))
         ("C,maxCores", "Max core number", cxxopts::value<uint32_t>(maxCores))
+        ("D,dispatchThreads", "Number of dispatch threads; worker cores are split among them",
+         cxxopts::value<uint32_t>(dispatchThreads))
+        ("E,edgeTriggered", "Register sockets with edge-triggered epoll",
+         cxxopts::value<bool>(edgeTriggered))
+        ("inlineEpoll", "Call epoll_wait from the dispatch loop instead of an epoll thread",
+         cxxopts::value<bool>(inlineEpoll))
+        ("idleMicros", "Idle time after which an inline polling dispatch loop blocks",
+         cxxopts::value<uint32_t>(idleMicros))
+        ("uring", "Serve requests with the io_uring transport", cxxopts::value<bool>(uring))
         ("readPercent", "Read percentage of YCSB workload", cxxopts::value<uint32_t>(readPercent))
         ("targetOps", "Target throughput(op/s) of YCSB workload", cxxopts::value<uint64_t>(targetOps))
+        ("window", "Outstanding requests of YCSB workload; above 1 they are issued asynchronously",
+         cxxopts::value<uint32_t>(window))
+        ("clientThreads", "Threads running the YCSB workload; above 1 they share one client",
+         cxxopts::value<uint32_t>(clientThreads))
+        ("ioThreads", "Connections, each with its own I/O thread, of a client shared by several threads",
+         cxxopts::value<uint32_t>(ioThreads))
         ("objectCount", "Maximum object number of YCSB workload", cxxopts::value<uint32_t>(objectCount))
         ("objectSize", "Maximum object size of YCSB workload", cxxopts::value<uint32_t>(objectSize))
         ("time", "Benchmark time of YCSB workload", cxxopts::value<uint64_t>(time))
         ("L,logPath", "Log path for gungnir", cxxopts::value<std::string>(logFilePath))
-        ("recover", "Enable gungnir recovery", cxxopts::value<bool>(recover));
+        ("recover", "Enable gungnir recovery", cxxopts::value<bool>(recover))
+        ("log", "Keep a write-ahead log; implied by --backups", cxxopts::value<bool>(enableLog))
+        ("backups", "Comma separated addresses of backup servers; a server streams its log to them, "
+                    "and the YCSB workload reads from them as well",
+         cxxopts::value<std::string>(backupLocators))
+        ("backup", "Serve as a backup: apply the log a primary streams here, and reject client writes",
+         cxxopts::value<bool>(backup))
+        ("replicationAcks", "Backups that must acknowledge a write before it is durable; 0 means all",
+         cxxopts::value<uint32_t>(replicationAcks))
+        ("skipLocalSync", "With backups, don't wait for the log file before a write is durable",
+         cxxopts::value<bool>(skipLocalSync))
+        ("maxStalenessMicros", "How far behind its primary a backup serving a YCSB read may be; 0 means no bound",
+         cxxopts::value<uint32_t>(maxStalenessMicros))
+        ("maxWaitingRpcs", "Requests that may wait for a busy worker; more are told to retry; 0 means no limit",
+         cxxopts::value<uint32_t>(maxWaitingRpcs))
+        ("queueDelayTargetMicros", "Queueing delay that waiting requests must get below once per interval, "
+                                   "or those waiting longer are told to retry; 0 means no target",
+         cxxopts::value<uint32_t>(queueDelayTargetMicros))
+        ("queueDelayIntervalMicros", "Interval of --queueDelayTargetMicros",
+         cxxopts::value<uint32_t>(queueDelayIntervalMicros))
+        ("statsSeconds", "Seconds between server statistics log lines; 0 means none",
+         cxxopts::value<uint32_t>(statsSeconds))
+        ("laneWeights", "Requests served in turn from the GET, PUT/ERASE and SCAN lanes of a server's queues",
+         cxxopts::value<std::string>(laneWeights));
 }
 
 void OptionConfig::parse(int argc, char **argv) {
@@ -18,13 +18,32 @@ public:
     std::string serverLocator;
     std::string connectLocator;
     uint32_t maxCores;
+    uint32_t dispatchThreads;
+    bool edgeTriggered;
+    bool inlineEpoll;
+    uint32_t idleMicros;
+    bool uring;
     uint32_t readPercent;
     uint64_t targetOps;
+    uint32_t window;
+    uint32_t clientThreads;
+    uint32_t ioThreads;
     uint32_t objectCount;
     uint32_t objectSize;
     uint64_t time;
     std::string logFilePath;
     bool recover;
+    bool enableLog;
+    std::string backupLocators;
+    bool backup;
+    uint32_t replicationAcks;
+    bool skipLocalSync;
+    uint32_t maxStalenessMicros;
+    uint32_t maxWaitingRpcs;
+    uint32_t queueDelayTargetMicros;
+    uint32_t queueDelayIntervalMicros;
+    uint32_t statsSeconds;
+    std::string laneWeights;
 };
 
 }
@@ -0,0 +1,44 @@
+#include <cstdlib>
+
+#include "PriorityLanes.h"
+#include "Exception.h"
+#include "WireFormat.h"
+
+namespace Gungnir {
+
+/**
+ * Return the lane of requests with opcode.
+ */
+uint32_t laneOf(uint16_t opcode) {
+    switch (opcode) {
+        case WireFormat::GET:
+        case WireFormat::MULTI_GET:
+            return READ_LANE;
+        case WireFormat::SCAN:
+        case WireFormat::SCAN_AGGREGATE:
+            return SCAN_LANE;
+        default:
+            return WRITE_LANE;
+    }
+}
+
+/**
+ * Parse weights given as a comma separated list, in lane order, such as
+ * "8,4,1". Lanes left out get a weight of 1.
+ */
+LaneWeights::LaneWeights(const std::string &spec) : weights() {
+    const char *next = spec.c_str();
+    for (uint32_t &weight: weights) {
+        weight = 1;
+        if (*next == '\0')
+            continue;
+        char *end;
+        unsigned long value = strtoul(next, &end, 10);
+        if (end == next || (*end != ',' && *end != '\0') || value == 0 || value > UINT32_MAX)
+            throw FatalError(HERE, "Lane weights must be positive integers separated by commas: " + spec);
+        weight = static_cast<uint32_t>(value);
+        next = *end == ',' ? end + 1 : end;
+    }
+}
+
+}
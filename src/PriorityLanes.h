@@ -0,0 +1,136 @@
+#ifndef GUNGNIR_PRIORITYLANES_H
+#define GUNGNIR_PRIORITYLANES_H
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <string>
+
+namespace Gungnir {
+
+/**
+ * Classes of requests, from the one served first: short reads, writes,
+ * which may wait for the log, and scans, which may run long.
+ */
+enum Lane : uint32_t {
+    READ_LANE = 0,
+    WRITE_LANE = 1,
+    SCAN_LANE = 2,
+    LANE_COUNT = 3
+};
+
+uint32_t laneOf(uint16_t opcode);
+
+/**
+ * How many items each lane of a PriorityLanes may hand out in one round.
+ */
+struct LaneWeights {
+    /// Weights unless configured otherwise.
+    static constexpr const char *DEFAULT = "8,4,1";
+
+    explicit LaneWeights(const std::string &spec = DEFAULT);
+
+    uint32_t weights[LANE_COUNT];
+};
+
+/**
+ * A queue with one FIFO lane per class of request. Items are handed out
+ * by weighted round robin: in each round a lane with items hands out up to
+ * its weight of them before the next lane's turn. Every weight is at least
+ * 1, so no lane starves, however busy the ones ahead of it are.
+ */
+template<typename T>
+class PriorityLanes {
+public:
+    explicit PriorityLanes(const LaneWeights &weights)
+        : weights(weights), lanes(), current(0), credit(weights.weights[0]), count(0) {}
+
+    void push(uint32_t lane, T item) {
+        lanes[lane].push_back(item);
+        count++;
+    }
+
+    /**
+     * Remove and return the next item; the queue must not be empty.
+     */
+    T pop() {
+        while (credit == 0 || lanes[current].empty()) {
+            current = (current + 1) % LANE_COUNT;
+            credit = weights.weights[current];
+        }
+        credit--;
+        count--;
+        T item = lanes[current].front();
+        lanes[current].pop_front();
+        return item;
+    }
+
+    /**
+     * Remove and return the next item of one lane, out of turn; the lane
+     * must not be empty.
+     */
+    T pop(uint32_t lane) {
+        count--;
+        T item = lanes[lane].front();
+        lanes[lane].pop_front();
+        return item;
+    }
+
+    /**
+     * Remove the first item for which predicate is true. Returns false if
+     * there is none.
+     */
+    template<typename Predicate>
+    bool eraseIf(Predicate predicate) {
+        for (std::deque<T> &lane: lanes) {
+            auto it = std::find_if(lane.begin(), lane.end(), predicate);
+            if (it != lane.end()) {
+                lane.erase(it);
+                count--;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * Return about how many items will be handed out before one pushed
+     * into lane now: those ahead of it in its lane, and as many of the
+     * other lanes' as their weights let through in the rounds those take.
+     */
+    size_t ahead(uint32_t lane) const {
+        size_t rounds = lanes[lane].size() / weights.weights[lane];
+        size_t items = lanes[lane].size();
+        for (uint32_t other = 0; other < LANE_COUNT; other++) {
+            if (other != lane)
+                items += std::min(lanes[other].size(), rounds * weights.weights[other]);
+        }
+        return items;
+    }
+
+    const std::deque<T> &getLane(uint32_t lane) const {
+        return lanes[lane];
+    }
+
+    bool empty() const {
+        return count == 0;
+    }
+
+    size_t size() const {
+        return count;
+    }
+
+private:
+    LaneWeights weights;
+    std::deque<T> lanes[LANE_COUNT];
+
+    /// Lane whose turn it is, and how many more items it may hand out.
+    uint32_t current;
+    uint32_t credit;
+
+    size_t count;
+};
+
+}
+
+#endif //GUNGNIR_PRIORITYLANES_H
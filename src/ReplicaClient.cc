@@ -0,0 +1,73 @@
+#include <algorithm>
+
+#include "ReplicaClient.h"
+#include "ClientException.h"
+
+namespace Gungnir {
+
+ReplicaClient::ReplicaClient(Context *context, const std::string &primaryLocator,
+                             const std::vector<std::string> &backupLocators)
+    : replicas(), next(0) {
+    replicas.emplace_back(new Client(context, primaryLocator));
+    for (const std::string &locator: backupLocators)
+        replicas.emplace_back(new Client(context, locator));
+}
+
+/**
+ * Read an object from the first replica, in turn, that meets constraint.
+ *
+ * \param[out] lsn
+ *      If not NULL, receives the LSN the value reflects; passing the
+ *      largest one seen as the minLsn of later reads keeps them monotonic.
+ */
+void ReplicaClient::get(uint64_t key, Buffer *value, const ReadConstraint &constraint, bool *objectExists,
+                        uint64_t *version, uint64_t *lsn) {
+    uint32_t start = next++;
+    for (uint32_t i = 0; i < replicas.size(); i++) {
+        Client *replica = replicas[(start + i) % replicas.size()].get();
+        try {
+            GetRpc rpc(replica, key, value, constraint);
+            rpc.wait(objectExists, version, lsn);
+            return;
+        } catch (StaleReplicaException &) {
+            // The primary comes up before the round ends.
+        }
+    }
+}
+
+/**
+ * Return every object in [start, end], read from the first replica, in
+ * turn, that meets constraint. A page refused by a backup that has fallen
+ * behind meanwhile is read from the next replica.
+ */
+Iterator ReplicaClient::scan(uint64_t start, uint64_t end, const ReadConstraint &constraint) {
+    Iterator iterator;
+    uint32_t replica = next++ % replicas.size();
+    while (true) {
+        Iterator page;
+        try {
+            ScanRpc rpc(replicas[replica].get(), start, end, 0, 0, false, &page, constraint);
+            rpc.wait();
+        } catch (StaleReplicaException &) {
+            replica = (replica + 1) % static_cast<uint32_t>(replicas.size());
+            continue;
+        }
+        iterator.buffer->append(page.buffer.get());
+        iterator.size += page.size;
+        iterator.lsn = std::max(iterator.lsn, page.lsn);
+        if (!page.hasMore)
+            break;
+        start = page.nextKey;
+    }
+    return iterator;
+}
+
+void ReplicaClient::put(uint64_t key, const void *buf, uint32_t length, uint64_t *version) {
+    getPrimary()->put(key, buf, length, version);
+}
+
+void ReplicaClient::erase(uint64_t key) {
+    getPrimary()->erase(key);
+}
+
+}
@@ -0,0 +1,52 @@
+#ifndef GUNGNIR_REPLICACLIENT_H
+#define GUNGNIR_REPLICACLIENT_H
+
+#include <memory>
+#include <vector>
+
+#include "Client.h"
+
+namespace Gungnir {
+
+/**
+ * A client of a primary and its backups that spreads reads over all of
+ * them; writes go to the primary. Each read goes to the next replica in
+ * turn, with a ReadConstraint. A backup that doesn't meet it passes the
+ * read on to the next replica, and the primary, which always meets it,
+ * ends the round.
+ */
+class ReplicaClient {
+
+public:
+    ReplicaClient(Context *context, const std::string &primaryLocator,
+                  const std::vector<std::string> &backupLocators);
+
+    Client *getPrimary() {
+        return replicas[0].get();
+    }
+
+    /// Returns the number of servers reads are spread over.
+    uint32_t getReplicaCount() const {
+        return static_cast<uint32_t>(replicas.size());
+    }
+
+    void get(uint64_t key, Buffer *value, const ReadConstraint &constraint, bool *objectExists = nullptr,
+             uint64_t *version = nullptr, uint64_t *lsn = nullptr);
+
+    Iterator scan(uint64_t start, uint64_t end, const ReadConstraint &constraint);
+
+    void put(uint64_t key, const void *buf, uint32_t length, uint64_t *version = nullptr);
+
+    void erase(uint64_t key);
+
+private:
+    /// The primary, then the backups.
+    std::vector<std::unique_ptr<Client>> replicas;
+
+    /// Index of the replica the next read starts at.
+    uint32_t next;
+};
+
+}
+
+#endif //GUNGNIR_REPLICACLIENT_H
@@ -0,0 +1,371 @@
+#include <algorithm>
+#include <functional>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "Replicator.h"
+#include "ClientException.h"
+#include "Common.h"
+#include "Cycles.h"
+#include "Logger.h"
+#include "TcpTransport.h"
+
+namespace Gungnir {
+
+ReplicaStatus::ReplicaStatus(bool backup) : backup(backup), appliedLsn(0), currentSince(0) {
+}
+
+/**
+ * Record that a batch from the primary has been applied.
+ *
+ * \param lsn
+ *      End of the batch.
+ * \param caughtUp
+ *      True means the batch held everything the primary had logged when
+ *      it sent it.
+ * \param receivedCycles
+ *      Cycles::rdtsc() when the batch arrived.
+ */
+void ReplicaStatus::applied(uint64_t lsn, bool caughtUp, uint64_t receivedCycles) {
+    appliedLsn.store(lsn, std::memory_order_release);
+    if (caughtUp)
+        currentSince.store(receivedCycles, std::memory_order_release);
+    backup.store(true, std::memory_order_release);
+}
+
+/**
+ * Return whether a read may be served here: this server has applied the
+ * primary's log up to minLsn, and was level with it no longer than
+ * maxStalenessMicros ago (0 means no bound).
+ */
+bool ReplicaStatus::satisfies(uint64_t minLsn, uint32_t maxStalenessMicros) {
+    if (!backup.load(std::memory_order_acquire))
+        return true;
+    if (appliedLsn.load(std::memory_order_acquire) < minLsn)
+        return false;
+    if (maxStalenessMicros == 0)
+        return true;
+    uint64_t since = currentSince.load(std::memory_order_acquire);
+    return since != 0 && Cycles::rdtsc() - since <= Cycles::fromMicroseconds(maxStalenessMicros);
+}
+
+/**
+ * Return the LSN that reads served here reflect: the end of the last
+ * batch applied on a backup, and the end of the log on a primary.
+ */
+uint64_t ReplicaStatus::getLsn(Log *log) {
+    if (backup.load(std::memory_order_acquire))
+        return appliedLsn.load(std::memory_order_acquire);
+    return log != nullptr ? log->getAppendedLength() : 0;
+}
+
+/**
+ * \param backupLocators
+ *      Service locators of the backups; they are reached over TCP or Unix
+ *      domain sockets.
+ * \param requiredAcks
+ *      Backups that must acknowledge a log offset before it is replicated;
+ *      0 means all of them.
+ * \param replacesLocalSync
+ *      True means a write is durable once replicated, without waiting for
+ *      the log file; see Log::enableReplication().
+ */
+Replicator::Replicator(Log *log, const std::vector<std::string> &backupLocators, uint32_t requiredAcks,
+                       bool replacesLocalSync)
+    : log(log), context(nullptr), backups(), requiredAcks(requiredAcks), batches(), takenLength(0), nextBatch(new Batch())
+      , ready(false), error(), stop(false), thread() {
+    if (backupLocators.empty())
+        throw FatalError(HERE, "Replicator needs at least one backup");
+    for (const std::string &locator: backupLocators)
+        backups.emplace_back(locator);
+    if (this->requiredAcks == 0)
+        this->requiredAcks = static_cast<uint32_t>(backups.size());
+    if (this->requiredAcks > backups.size())
+        throw FatalError(HERE, "More replication acks required than there are backups");
+    log->enableReplication(replacesLocalSync);
+}
+
+Replicator::~Replicator() {
+    if (thread) {
+        stop.store(true, std::memory_order_release);
+        thread->join();
+    }
+}
+
+/**
+ * Start the thread and connect it to the backups.
+ *
+ * \throw TransportException
+ *      A backup couldn't be reached.
+ */
+void Replicator::start() {
+    thread.reset(new std::thread(main, this));
+    while (!ready.load(std::memory_order_acquire)) {
+        std::this_thread::yield();
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+void Replicator::main(Replicator *replicator) {
+    // The Context is created here so that this thread owns its Dispatch.
+    // It only ever connects, so its transport doesn't listen. The Dispatch
+    // polls inline and blocks as soon as a pass finds nothing to do, since
+    // the thread shares the cores with the dispatch threads and workers:
+    // appends to the log wake it, and so do replies and the timer.
+    Context context;
+    std::unique_ptr<ReplicationPoller> poller;
+    std::unique_ptr<HeartbeatTimer> timer;
+    try {
+        context.dispatch = new Dispatch(true, false, true, 0);
+        context.transport = new TcpTransport(&context, "");
+        for (Backup &backup: replicator->backups)
+            backup.client.reset(new Client(&context, backup.locator));
+        poller.reset(new ReplicationPoller(context.dispatch, replicator));
+
+        int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (fd < 0)
+            throw FatalError(HERE, "Replicator couldn't create timerfd", errno);
+        itimerspec interval{};
+        interval.it_interval.tv_nsec = HEARTBEAT_MICROS * 1000;
+        interval.it_value = interval.it_interval;
+        if (timerfd_settime(fd, 0, &interval, nullptr) != 0) {
+            int error = errno;
+            close(fd);
+            throw FatalError(HERE, "Replicator couldn't arm timerfd", error);
+        }
+        timer.reset(new HeartbeatTimer(context.dispatch, fd, replicator));
+
+        Dispatch *dispatch = context.dispatch;
+        replicator->log->setAppendListener([dispatch] { dispatch->wakeup(); });
+        replicator->context = &context;
+    } catch (...) {
+        replicator->error = std::current_exception();
+    }
+    replicator->ready.store(true, std::memory_order_release);
+
+    if (!replicator->error) {
+        while (!replicator->stop.load(std::memory_order_acquire)) {
+            context.dispatch->poll();
+        }
+    }
+    timer.reset();
+    poller.reset();
+    for (Backup &backup: replicator->backups) {
+        backup.rpc.reset();
+        backup.client.reset();
+    }
+}
+
+/**
+ * Take what has been appended to the log, collect the replies of the
+ * backups, and send each idle backup everything it hasn't got yet.
+ */
+int Replicator::poll() {
+    int result = 0;
+    nextBatch->offset = log->takeReplicationBatch(&nextBatch->entries, MAX_BATCH_BYTES);
+    if (nextBatch->entries.size() != 0) {
+        takenLength = nextBatch->offset + nextBatch->entries.size();
+        batches.push_back(std::move(nextBatch));
+        nextBatch.reset(new Batch());
+        result = 1;
+    }
+
+    for (Backup &backup: backups) {
+        if (backup.failed || backup.abandoned)
+            continue;
+        if (backup.rpc) {
+            try {
+                if (!backup.rpc->isReady())
+                    continue;
+                uint64_t appliedLsn;
+                if (backup.rpc->wait(&appliedLsn)) {
+                    backup.ackedLength = backup.sentLength;
+                    backup.rpc.reset();
+                } else {
+                    resend(&backup, appliedLsn);
+                }
+            } catch (ClientException &e) {
+                abandon(&backup, e.what());
+            } catch (std::exception &e) {
+                fail(&backup, e.what());
+            }
+            result = 1;
+        }
+        if (!backup.failed && !backup.abandoned && backup.sentLength < takenLength) {
+            send(&backup);
+            result = 1;
+        }
+    }
+    if (result != 0)
+        updateReplicatedLength();
+    return result;
+}
+
+/**
+ * Invoked every HEARTBEAT_MICROS: send each idle backup a request, empty
+ * if there is nothing new, try again to reach the failed ones, and abandon
+ * those that have been failed for longer than MAX_FAILED_MICROS.
+ */
+void Replicator::tick() {
+    uint64_t now = Cycles::rdtsc();
+    for (Backup &backup: backups) {
+        if (backup.abandoned)
+            continue;
+        if (backup.failed) {
+            if (now - backup.failedSince > Cycles::fromMicroseconds(MAX_FAILED_MICROS))
+                abandon(&backup, "unreachable");
+            else if (now >= backup.retryAt)
+                reconnect(&backup);
+        } else if (!backup.rpc) {
+            send(&backup);
+        }
+    }
+    updateReplicatedLength();
+}
+
+/**
+ * Send the batches that follow what backup has got, as many as fit in one
+ * request; none makes a heartbeat. The first may start before sentLength,
+ * if the backup asked for what follows an offset inside it (see resend());
+ * the backup skips what it has.
+ */
+void Replicator::send(Backup *backup) {
+    Buffer entries;
+    uint64_t offset = backup->sentLength;
+    for (auto &batch: batches) {
+        if (batch->offset + batch->entries.size() <= backup->sentLength)
+            continue;
+        if (entries.size() == 0)
+            offset = batch->offset;
+        else if (entries.size() + batch->entries.size() > MAX_BATCH_BYTES)
+            break;
+        entries.append(&batch->entries);
+    }
+    backup->rpc.reset(new ReplicateRpc(backup->client.get(), offset, &entries, takenLength));
+    backup->sentLength = offset + entries.size();
+}
+
+/**
+ * Handle a backup that refused a batch because it has only applied what
+ * precedes appliedLsn, as after it restarted: send it everything from
+ * there, if that is still kept, and otherwise abandon it.
+ */
+void Replicator::resend(Backup *backup, uint64_t appliedLsn) {
+    backup->rpc.reset();
+    uint64_t retainedFrom = batches.empty() ? takenLength : batches.front()->offset;
+    if (appliedLsn < retainedFrom) {
+        abandon(backup, format("it has only %lu bytes of the log, and those after them are gone",
+                               appliedLsn).c_str());
+        return;
+    }
+    Logger::log(HERE, "Backup %s has only %lu bytes of the log; resending from there", backup->locator.c_str(),
+                appliedLsn);
+    backup->ackedLength = std::min(backup->ackedLength, appliedLsn);
+    backup->sentLength = appliedLsn;
+}
+
+/**
+ * Close the connection to backup, whose request failed, and have it
+ * reconnected after RECONNECT_MICROS; what it hasn't acknowledged is sent
+ * again then.
+ */
+void Replicator::fail(Backup *backup, const char *reason) {
+    Logger::log(HERE, "Backup %s failed: %s; reconnecting", backup->locator.c_str(), reason);
+    backup->rpc.reset();
+    backup->client.reset();
+    backup->sentLength = backup->ackedLength;
+    backup->failed = true;
+    backup->failedSince = Cycles::rdtsc();
+    backup->retryAt = backup->failedSince + Cycles::fromMicroseconds(RECONNECT_MICROS);
+}
+
+/**
+ * Give up on backup for good, such as when it can't be sent what it is
+ * missing. Writes then need acks from the backups that remain only.
+ */
+void Replicator::abandon(Backup *backup, const char *reason) {
+    Logger::log(HERE, "Abandoning backup %s: %s", backup->locator.c_str(), reason);
+    backup->rpc.reset();
+    backup->client.reset();
+    backup->abandoned = true;
+    auto remaining = static_cast<uint32_t>(std::count_if(backups.begin(), backups.end(),
+                                                         [](const Backup &b) { return !b.abandoned; }));
+    if (remaining == 0)
+        Logger::log(HERE, "No backups remain; writes no longer wait for replication");
+    else if (remaining < requiredAcks)
+        Logger::log(HERE, "Only %u backups remain, fewer than the %u acks writes wait for; they now wait for %u",
+                    remaining, requiredAcks, remaining);
+}
+
+/**
+ * Try to reach a failed backup again; if it can't be, try again after
+ * RECONNECT_MICROS.
+ */
+void Replicator::reconnect(Backup *backup) {
+    try {
+        backup->client.reset(new Client(context, backup->locator));
+    } catch (TransportException &e) {
+        backup->retryAt = Cycles::rdtsc() + Cycles::fromMicroseconds(RECONNECT_MICROS);
+        return;
+    }
+    Logger::log(HERE, "Reconnected to backup %s", backup->locator.c_str());
+    backup->failed = false;
+}
+
+/**
+ * Tell the log how much of it enough connected backups have acknowledged,
+ * abandon the failed backups that have fallen too far behind, and drop the
+ * batches that every backup not abandoned has. Acks are required from no
+ * more backups than remain: once every backup is abandoned, writes no
+ * longer wait for replication at all.
+ */
+void Replicator::updateReplicatedLength() {
+    std::vector<uint64_t> acked;
+    uint32_t remaining = 0;
+    uint64_t retainedFrom = takenLength;
+    for (Backup &backup: backups) {
+        if (backup.failed && !backup.abandoned && takenLength - backup.ackedLength > MAX_RETAINED_BYTES)
+            abandon(&backup, "too far behind");
+        if (backup.abandoned)
+            continue;
+        remaining++;
+        retainedFrom = std::min(retainedFrom, backup.ackedLength);
+        if (!backup.failed)
+            acked.push_back(backup.ackedLength);
+    }
+    uint32_t required = std::min(requiredAcks, remaining);
+    std::sort(acked.begin(), acked.end(), std::greater<uint64_t>());
+    if (required == 0)
+        log->setReplicatedLength(takenLength);
+    else if (acked.size() >= required)
+        log->setReplicatedLength(acked[required - 1]);
+    while (!batches.empty() && batches.front()->offset + batches.front()->entries.size() <= retainedFrom)
+        batches.pop_front();
+}
+
+Replicator::ReplicationPoller::ReplicationPoller(Dispatch *dispatch, Replicator *replicator)
+    : Dispatch::Poller(dispatch, "ReplicationPoller"), replicator(replicator) {
+}
+
+int Replicator::ReplicationPoller::poll() {
+    return replicator->poll();
+}
+
+Replicator::HeartbeatTimer::HeartbeatTimer(Dispatch *dispatch, int fd, Replicator *replicator)
+    : Dispatch::File(dispatch, fd, Dispatch::FileEvent::READABLE), replicator(replicator) {
+}
+
+Replicator::HeartbeatTimer::~HeartbeatTimer() {
+    close(fd);
+}
+
+void Replicator::HeartbeatTimer::handleFileEvent(uint32_t events) {
+    uint64_t expirations;
+    if (read(fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+        return;
+    replicator->tick();
+}
+
+}
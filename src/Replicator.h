@@ -0,0 +1,217 @@
+#ifndef GUNGNIR_REPLICATOR_H
+#define GUNGNIR_REPLICATOR_H
+
+#include <atomic>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "Client.h"
+#include "Dispatch.h"
+#include "Log.h"
+
+namespace Gungnir {
+
+/**
+ * How far the data of a server has caught up with the log of its primary,
+ * for reads that bound their staleness. Log sequence numbers (LSNs) are
+ * offsets in the primary's log. A server is a backup if it was started as
+ * one or has received a batch; otherwise it is a primary, or stands alone,
+ * and is always current. Backups reject client writes, which would make
+ * them diverge from their primary.
+ */
+class ReplicaStatus {
+public:
+    explicit ReplicaStatus(bool backup = false);
+
+    /// True means client writes are rejected here.
+    bool isBackup() {
+        return backup.load(std::memory_order_acquire);
+    }
+
+    /// End of the last batch applied, or 0.
+    uint64_t getAppliedLsn() {
+        return appliedLsn.load(std::memory_order_acquire);
+    }
+
+    void applied(uint64_t lsn, bool caughtUp, uint64_t receivedCycles);
+
+    bool satisfies(uint64_t minLsn, uint32_t maxStalenessMicros);
+
+    uint64_t getLsn(Log *log);
+
+private:
+    /// True once a batch from a primary has been applied.
+    std::atomic<bool> backup;
+
+    /// End of the last batch applied.
+    std::atomic<uint64_t> appliedLsn;
+
+    /// Cycles::rdtsc() when the last batch that left this server level
+    /// with its primary's log arrived.
+    std::atomic<uint64_t> currentSince;
+};
+
+/**
+ * Streams the log of a primary to its backups. A thread of its own, with a
+ * Context and Dispatch of its own, takes the bytes appended to the log
+ * since its last batch and sends them to every backup in REPLICATE
+ * requests. Each backup has at most one request in flight, so batches
+ * arrive in log order, and whatever is appended while it is busy goes out
+ * together in its next request. A log offset is replicated once
+ * requiredAcks backups have acknowledged it; Log::sync() counts on that.
+ * The thread sleeps until the log grows, a reply arrives, or its timer
+ * fires.
+ *
+ * A backup whose connection fails is reconnected every RECONNECT_MICROS
+ * and then sent everything it hasn't acknowledged; the batches are kept
+ * for it meanwhile, up to MAX_RETAINED_BYTES. A backup that restarted is
+ * sent everything it lost, if that is still kept. A backup that refuses a
+ * batch, can't be sent what it lacks, falls further behind than
+ * MAX_RETAINED_BYTES, or stays unreachable for MAX_FAILED_MICROS, is
+ * abandoned for good, and writes then wait for acks from the backups that
+ * remain only. While a backup that isn't abandoned is disconnected, writes
+ * that need its ack wait. An idle backup gets an empty request every
+ * HEARTBEAT_MICROS, so that it knows it is still current; see
+ * ReplicaStatus.
+ */
+class Replicator {
+public:
+    /// Most log bytes sent to a backup in one request, unless a single
+    /// segment is larger.
+    static const uint32_t MAX_BATCH_BYTES = 1u << 20;
+
+    /// Longest time a backup goes without a request.
+    static const uint32_t HEARTBEAT_MICROS = 1000;
+
+    /// Time between attempts to reconnect to a failed backup.
+    static const uint32_t RECONNECT_MICROS = 1000000;
+
+    /// Most log bytes kept for a failed backup before it is abandoned.
+    static const uint64_t MAX_RETAINED_BYTES = 1ull << 28;
+
+    /// Longest time a backup stays failed before it is abandoned.
+    static const uint32_t MAX_FAILED_MICROS = 10000000;
+
+    Replicator(Log *log, const std::vector<std::string> &backupLocators, uint32_t requiredAcks,
+               bool replacesLocalSync);
+
+    ~Replicator();
+
+    void start();
+
+private:
+    /// Log bytes taken in one call to Log::takeReplicationBatch().
+    struct Batch {
+        uint64_t offset;
+        Buffer entries;
+    };
+
+    struct Backup {
+        explicit Backup(std::string locator)
+            : locator(std::move(locator)), client(), rpc(), sentLength(0), ackedLength(0), failed(false)
+              , failedSince(0), retryAt(0), abandoned(false) {}
+
+        std::string locator;
+        std::unique_ptr<Client> client;
+
+        /// Request in flight, if any.
+        std::unique_ptr<ReplicateRpc> rpc;
+
+        /// Log bytes sent to the backup, including those in flight.
+        uint64_t sentLength;
+
+        /// Log bytes the backup has acknowledged.
+        uint64_t ackedLength;
+
+        /// True means the connection failed and hasn't been restored.
+        bool failed;
+
+        /// Cycles::rdtsc() when a failed backup failed, and after which it
+        /// is reconnected.
+        uint64_t failedSince;
+        uint64_t retryAt;
+
+        /// True means the backup is given up on for good.
+        bool abandoned;
+    };
+
+    class ReplicationPoller : public Dispatch::Poller {
+    public:
+        ReplicationPoller(Dispatch *dispatch, Replicator *replicator);
+
+        int poll() override;
+
+    private:
+        Replicator *replicator;
+    };
+
+    /**
+     * A timerfd that fires every HEARTBEAT_MICROS, so that idle backups
+     * get heartbeats and failed ones are reconnected while the log is
+     * quiet.
+     */
+    class HeartbeatTimer : public Dispatch::File {
+    public:
+        HeartbeatTimer(Dispatch *dispatch, int fd, Replicator *replicator);
+
+        ~HeartbeatTimer() override;
+
+        void handleFileEvent(uint32_t events) override;
+
+    private:
+        Replicator *replicator;
+    };
+
+    int poll();
+
+    void tick();
+
+    void send(Backup *backup);
+
+    void resend(Backup *backup, uint64_t appliedLsn);
+
+    void fail(Backup *backup, const char *reason);
+
+    void abandon(Backup *backup, const char *reason);
+
+    void reconnect(Backup *backup);
+
+    void updateReplicatedLength();
+
+    static void main(Replicator *replicator);
+
+    Log *log;
+
+    /// Context of the thread; NULL until it starts.
+    Context *context;
+
+    std::vector<Backup> backups;
+    uint32_t requiredAcks;
+
+    /// Batches some backup hasn't acknowledged yet, in log order.
+    std::deque<std::unique_ptr<Batch>> batches;
+
+    /// Log bytes taken into batches so far.
+    uint64_t takenLength;
+
+    /// Batch that the next bytes appended to the log are taken into.
+    std::unique_ptr<Batch> nextBatch;
+
+    /// Set once the thread has connected to the backups, or failed to.
+    std::atomic<bool> ready;
+
+    /// Exception thrown while connecting, if any.
+    std::exception_ptr error;
+
+    /// Set to make the thread exit.
+    std::atomic<bool> stop;
+
+    std::unique_ptr<std::thread> thread;
+};
+
+}
+
+#endif //GUNGNIR_REPLICATOR_H
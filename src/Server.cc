@@ -1,33 +1,135 @@
 #include "Server.h"
+
+#include <algorithm>
+
 #include "Dispatch.h"
 #include "WorkerManager.h"
 #include "ConcurrentSkipList.h"
 #include "OptionConfig.h"
 #include "LogCleaner.h"
 #include "Log.h"
+#include "Logger.h"
+#include "Object.h"
+#include "Replicator.h"
+#include "ShardedClient.h"
+#include "ShmTransport.h"
+#include "TcpTransport.h"
 
 namespace Gungnir {
 
 Server::Server(Context *context) :
-    context(context) {
+    context(context), dispatchCount(1), workersPerDispatch(1), dispatchThreads(), replicator() {
+    dispatchCount = std::max(1u, context->optionConfig->dispatchThreads);
+    const std::string &locator = context->optionConfig->serverLocator;
+    if (dispatchCount > 1 && ShmTransport::isShmLocator(locator)) {
+        // All clients attach to the one segment, which a single transport
+        // serves.
+        Logger::log(HERE, "Shared memory server runs a single dispatch thread");
+        dispatchCount = 1;
+    } else if (dispatchCount > 1 && TcpTransport::isUnixLocator(locator)) {
+        // A socket path can't be shared like a port: each bind would
+        // replace the previous one.
+        Logger::log(HERE, "Unix domain socket server runs a single dispatch thread");
+        dispatchCount = 1;
+    }
+    workersPerDispatch = std::max(1u, context->optionConfig->maxCores / dispatchCount);
     context->skipList = new ConcurrentSkipList(context);
-    context->workerManager = new WorkerManager(context, context->optionConfig->maxCores);
+    context->workerManager = new WorkerManager(context, workersPerDispatch);
     context->logCleaner = new LogCleaner(context);
-//    context->log = new Log(context->optionConfig->logFilePath.c_str(), context->optionConfig->recover);
+    context->logCleaner->addWorkerManager(context->workerManager);
+    context->replicaStatus = new ReplicaStatus(context->optionConfig->backup);
+    OptionConfig &optionConfig = *context->optionConfig;
+    std::vector<std::string> backups = ShardedClient::splitLocators(optionConfig.backupLocators);
+    if (optionConfig.enableLog || !backups.empty())
+        context->log = new Log(optionConfig.logFilePath.c_str(), optionConfig.recover);
+    if (context->log != nullptr && optionConfig.recover)
+        recover();
+    if (!backups.empty()) {
+        replicator.reset(new Replicator(context->log, backups, optionConfig.replicationAcks,
+                                        optionConfig.skipLocalSync));
+    }
 }
 
 Server::~Server() {
+    replicator.reset();
+    context->logCleaner->removeWorkerManager(context->workerManager);
     delete context->skipList;
     delete context->workerManager;
 }
 
+/**
+ * Install what the log file holds in the skip list, in log order, before
+ * any RPC is served: objects replace what their keys hold, and tombstones
+ * clear their keys. Log::read() leaves the file cut after its last
+ * complete record, for the writer to append there.
+ */
+void Server::recover() {
+    ConcurrentSkipList *skipList = context->skipList;
+    uint64_t entries = 0;
+    while (LogEntry *entry = context->log->read()) {
+        entries++;
+        if (entry->type == LOG_ENTRY_TYPE_OBJ) {
+            ConcurrentSkipList::Node *node;
+            while ((node = skipList->addOrGetNode(entry->key)) == nullptr) {
+                // Nothing else runs yet; the insertion just has to retry.
+            }
+            skipList->destroy(node->setObject(static_cast<Object *>(entry)));
+            continue;
+        }
+        if (entry->type == LOG_ENTRY_TYPE_OBJTOMB) {
+            ConcurrentSkipList::Node *node = skipList->find(entry->key);
+            if (node != nullptr)
+                skipList->destroy(node->setObject(nullptr));
+        }
+        delete entry;
+    }
+    Logger::log(HERE, "Recovered %lu log entries (%lu bytes) from %s", entries,
+                context->log->getRecoveredLength(), context->optionConfig->logFilePath.c_str());
+}
+
 void Server::run() {
 
     Dispatch &dispatch = *context->dispatch;
 
     context->logCleaner->start();
-//    context->log->startWriter();
+    if (context->log != nullptr)
+        context->log->startWriter();
+    if (replicator)
+        replicator->start();
 
+    for (uint32_t i = 1; i < dispatchCount; i++) {
+        dispatchThreads.emplace_back(new std::thread(dispatchThreadMain, this));
+    }
     dispatch.run();
 }
+
+/**
+ * Run one more event loop: it has its own Dispatch, its own transport
+ * (whose listen socket shares the server's address through SO_REUSEPORT,
+ * so it serves a share of the connections) and its own workers. The skip
+ * list and the log are shared by all of them.
+ */
+void Server::dispatchThreadMain(Server *server) {
+    // The Dispatch must be created here, since it belongs to the thread
+    // that creates it.
+    Context context(*server->context->optionConfig, true);
+    context.skipList = server->context->skipList;
+    context.logCleaner = server->context->logCleaner;
+    context.log = server->context->log;
+    context.replicaStatus = server->context->replicaStatus;
+    std::unique_ptr<WorkerManager> workerManager(new WorkerManager(&context, server->workersPerDispatch));
+    context.workerManager = workerManager.get();
+    context.logCleaner->addWorkerManager(workerManager.get());
+    context.dispatch->run();
+
+    context.logCleaner->removeWorkerManager(workerManager.get());
+    workerManager.reset();
+    // The rest belongs to the server; the Context must only free its own
+    // Dispatch and transport.
+    context.workerManager = nullptr;
+    context.skipList = nullptr;
+    context.logCleaner = nullptr;
+    context.log = nullptr;
+    context.replicaStatus = nullptr;
+}
 }
@@ -1,10 +1,16 @@
 #ifndef GUNGNIR_SERVER_H
 #define GUNGNIR_SERVER_H
 
+#include <memory>
+#include <thread>
+#include <vector>
+
 #include "Context.h"
 
 namespace Gungnir {
 
+class Replicator;
+
 class Server {
 
 public:
@@ -14,7 +20,24 @@ public:
 
     void run();
 private:
+    void recover();
+
+    static void dispatchThreadMain(Server *server);
+
     Context *context;
+
+    /// Number of dispatch threads, including the one that calls run().
+    uint32_t dispatchCount;
+
+    /// Worker threads created for each dispatch thread.
+    uint32_t workersPerDispatch;
+
+    /// Dispatch threads beyond the first; the first is the thread that
+    /// calls run().
+    std::vector<std::unique_ptr<std::thread>> dispatchThreads;
+
+    /// Streams the log to the backups, if there are any.
+    std::unique_ptr<Replicator> replicator;
 };
 
 }
@@ -3,6 +3,11 @@
 #include "Cycles.h"
 #include "Logger.h"
 #include "ConcurrentSkipList.h"
+#include "Dispatch.h"
+#include "Replicator.h"
+
+#include <algorithm>
+#include <numeric>
 
 namespace Gungnir {
 
@@ -31,6 +36,35 @@ void Service::prepareRetryResponse(Buffer *replyPayload, uint32_t minDelayMicros
     }
 }
 
+/**
+ * Make sure that this server may serve a read that bounds its staleness;
+ * see ReplicaStatus::satisfies().
+ *
+ * \throw StaleReplicaException
+ *      This server is a backup that lags too far behind; the client
+ *      should read elsewhere.
+ */
+void Service::checkFreshness(uint64_t minLsn, uint32_t maxStalenessMicros) {
+    if (context->replicaStatus != nullptr && !context->replicaStatus->satisfies(minLsn, maxStalenessMicros))
+        throw StaleReplicaException(HERE);
+}
+
+/**
+ * Make sure that this server may apply a client write.
+ *
+ * \throw NotPrimaryException
+ *      This server is a backup, which only applies its primary's log.
+ */
+void Service::checkPrimary() {
+    if (context->replicaStatus != nullptr && context->replicaStatus->isBackup())
+        throw NotPrimaryException(HERE);
+}
+
+/// Return the LSN to tag a read reply with.
+uint64_t Service::getLsn() {
+    return context->replicaStatus != nullptr ? context->replicaStatus->getLsn(context->log) : 0;
+}
+
 Service *Service::dispatch(Worker *worker, Context *context, Transport::ServerRpc *rpc) {
     const WireFormat::RequestCommon *header;
     header = rpc->requestPayload.getStart<WireFormat::RequestCommon>();
@@ -45,15 +79,31 @@ Service *Service::dispatch(Worker *worker, Context *context, Transport::ServerRp
             return new EraseService(worker, context, rpc);
         case WireFormat::SCAN:
             return new ScanService(worker, context, rpc);
+        case WireFormat::SCAN_AGGREGATE:
+            return new ScanAggregateService(worker, context, rpc);
+        case WireFormat::INCREMENT:
+            return new IncrementService(worker, context, rpc);
+        case WireFormat::COMPARE_AND_SWAP:
+            return new CompareAndSwapService(worker, context, rpc);
+        case WireFormat::APPEND:
+            return new AppendService(worker, context, rpc);
+        case WireFormat::MULTI_GET:
+            return new MultiGetService(worker, context, rpc);
+        case WireFormat::MULTI_PUT:
+            return new MultiPutService(worker, context, rpc);
+        case WireFormat::TRANSACT:
+            return new TransactService(worker, context, rpc);
+        case WireFormat::REPLICATE:
+            return new ReplicateService(worker, context, rpc);
         default:
             return nullptr;
     }
 }
 
 Service::Service(Worker *worker, Context *context, Transport::ServerRpc *rpc)
-    : worker(worker), context(context), requestPayload(&rpc->requestPayload), replyPayload(&rpc->replyPayload)
-      , skipList(context->skipList) {
-
+    : worker(worker), context(context), rpc(rpc), requestPayload(&rpc->requestPayload)
+      , replyPayload(&rpc->replyPayload), skipList(context->skipList), epoch(0) {
+    lane = laneOf(requestPayload->getStart<WireFormat::RequestCommon>()->opcode);
 }
 
 GetService::GetService(Worker *worker, Context *context, Transport::ServerRpc *rpc)
@@ -65,13 +115,16 @@ void GetService::performTask() {
     Key key(reqHdr->key);
 
     auto *respHdr = replyPayload->emplaceAppend<WireFormat::Get::Response>();
+    respHdr->lsn = getLsn();
+    checkFreshness(reqHdr->minLsn, reqHdr->maxStalenessMicros);
     ConcurrentSkipList::Node *node = skipList->find(key);
     if (node != nullptr && !node->markedForRemoval()) {
         respHdr->common.status = STATUS_OK;
         Object *object = node->getObject();
         if (object != nullptr) {
-            replyPayload->append(&object->value);
+            object->appendValueTo(replyPayload);
             respHdr->length = object->value.size();
+            respHdr->version = object->version;
             respHdr->common.status = STATUS_OK;
             return;
         }
@@ -79,17 +132,14 @@ void GetService::performTask() {
     respHdr->common.status = STATUS_OBJECT_DOESNT_EXIST;
 }
 
-PutService::PutService(Worker *worker, Context *context, Transport::ServerRpc *rpc)
-    : Service(worker, context, rpc), state(FIND), key(), node(nullptr), guard(), object(nullptr), toOffset(0) {
-    auto *respHdr = replyPayload->emplaceAppend<WireFormat::Put::Response>();
-    respHdr->common.status = STATUS_OK;
-    auto *reqHdr = requestPayload->getStart<WireFormat::Put::Request>();
-    key = reqHdr->key;
+WriteService::WriteService(Worker *worker, Context *context, Transport::ServerRpc *rpc, Key key)
+    : Service(worker, context, rpc), state(FIND), key(key), node(nullptr), guard(), object(nullptr), toOffset(0) {
 }
 
-void PutService::performTask() {
+void WriteService::performTask() {
 
     if (state == FIND) {
+        checkPrimary();
         node = skipList->addOrGetNode(key);
         if (node == nullptr) {
             schedule();
@@ -112,8 +162,15 @@ void PutService::performTask() {
                 return;
             }
 
-            requestPayload->truncateFront(sizeof(WireFormat::Put::Request));
-            object = new Object(key, requestPayload);
+            Object *old = node->getObject();
+            object = update(old);
+            if (object == nullptr) {
+                guard.unlock();
+                state = DONE;
+                return;
+            }
+            object->version = (old != nullptr ? old->version : 0) + 1 + rpc->skippedVersions;
+            updated(object);
             if (context->log) {
                 toOffset = context->log->append(object);
             }
@@ -143,6 +200,114 @@ void PutService::performTask() {
     }
 }
 
+PutService::PutService(Worker *worker, Context *context, Transport::ServerRpc *rpc)
+    : WriteService(worker, context, rpc, rpc->requestPayload.getStart<WireFormat::Put::Request>()->key) {
+    auto *respHdr = replyPayload->emplaceAppend<WireFormat::Put::Response>();
+    respHdr->common.status = STATUS_OK;
+    respHdr->version = 0;
+}
+
+/**
+ * The value is not copied: the object takes over the memory the transport
+ * received the request into, past the request header.
+ */
+Object *PutService::update(Object *old) {
+    requestPayload->truncateFront(sizeof(WireFormat::Put::Request));
+    return new Object(key, requestPayload);
+}
+
+void PutService::updated(Object *object) {
+    auto *respHdr = replyPayload->getStart<WireFormat::Put::Response>();
+    respHdr->version = object->version;
+}
+
+IncrementService::IncrementService(Worker *worker, Context *context, Transport::ServerRpc *rpc)
+    : WriteService(worker, context, rpc, rpc->requestPayload.getStart<WireFormat::Increment::Request>()->key)
+      , value(0) {
+    auto *respHdr = replyPayload->emplaceAppend<WireFormat::Increment::Response>();
+    respHdr->common.status = STATUS_OK;
+    respHdr->value = 0;
+    respHdr->version = 0;
+}
+
+/**
+ * The value is a 64-bit little-endian integer; any other length is
+ * STATUS_INVALID_OBJECT. Overflow wraps around.
+ */
+Object *IncrementService::update(Object *old) {
+    auto *reqHdr = requestPayload->getStart<WireFormat::Increment::Request>();
+    uint64_t current = 0;
+    if (old != nullptr) {
+        if (old->value.size() != sizeof(current)) {
+            prepareErrorResponse(replyPayload, STATUS_INVALID_OBJECT);
+            return nullptr;
+        }
+        old->value.copy(0, sizeof(current), &current);
+    }
+    value = static_cast<int64_t>(current + static_cast<uint64_t>(reqHdr->delta));
+    return new Object(key, &value, sizeof(value));
+}
+
+void IncrementService::updated(Object *object) {
+    auto *respHdr = replyPayload->getStart<WireFormat::Increment::Response>();
+    respHdr->value = value;
+    respHdr->version = object->version;
+}
+
+CompareAndSwapService::CompareAndSwapService(Worker *worker, Context *context, Transport::ServerRpc *rpc)
+    : WriteService(worker, context, rpc,
+                   rpc->requestPayload.getStart<WireFormat::CompareAndSwap::Request>()->key) {
+    auto *respHdr = replyPayload->emplaceAppend<WireFormat::CompareAndSwap::Response>();
+    respHdr->common.status = STATUS_OK;
+    respHdr->version = 0;
+}
+
+Object *CompareAndSwapService::update(Object *old) {
+    auto *reqHdr = requestPayload->getStart<WireFormat::CompareAndSwap::Request>();
+    uint64_t current = old != nullptr ? old->version : 0;
+    if (current != reqHdr->version) {
+        auto *respHdr = replyPayload->getStart<WireFormat::CompareAndSwap::Response>();
+        respHdr->common.status = STATUS_WRONG_VERSION;
+        respHdr->version = current;
+        return nullptr;
+    }
+    requestPayload->truncateFront(sizeof(WireFormat::CompareAndSwap::Request));
+    return new Object(key, requestPayload);
+}
+
+void CompareAndSwapService::updated(Object *object) {
+    auto *respHdr = replyPayload->getStart<WireFormat::CompareAndSwap::Response>();
+    respHdr->version = object->version;
+}
+
+AppendService::AppendService(Worker *worker, Context *context, Transport::ServerRpc *rpc)
+    : WriteService(worker, context, rpc, rpc->requestPayload.getStart<WireFormat::Append::Request>()->key) {
+    auto *respHdr = replyPayload->emplaceAppend<WireFormat::Append::Response>();
+    respHdr->common.status = STATUS_OK;
+    respHdr->version = 0;
+}
+
+/**
+ * The new value is copied into one contiguous allocation, since scans and
+ * the log expect values to be contiguous.
+ */
+Object *AppendService::update(Object *old) {
+    requestPayload->truncateFront(sizeof(WireFormat::Append::Request));
+    uint32_t oldLength = old != nullptr ? old->value.size() : 0;
+    uint32_t length = requestPayload->size();
+    auto *object = new Object(key, oldLength + length);
+    char *dest = static_cast<char *>(object->value.getRange(0, oldLength + length));
+    if (old != nullptr)
+        old->value.copy(0, oldLength, dest);
+    requestPayload->copy(0, length, dest + oldLength);
+    return object;
+}
+
+void AppendService::updated(Object *object) {
+    auto *respHdr = replyPayload->getStart<WireFormat::Append::Response>();
+    respHdr->version = object->version;
+}
+
 EraseService::EraseService(Worker *worker, Context *context, Transport::ServerRpc *rpc)
     : Service(worker, context, rpc), state(FIND), nodeToDelete(nullptr), nodeGuard(), isMarked(false), nodeHeight(0)
       , predecessors(), successors(), maxLayer(0), layer(), toOffset(0) {
@@ -156,6 +321,7 @@ void EraseService::performTask() {
     Key key(reqHdr->key);
 
     if (state == FIND) {
+        checkPrimary();
         maxLayer = 0;
         layer = skipList->findInsertionPointGetMaxLayer(key, predecessors, successors, &maxLayer);
         if (!isMarked && (layer < 0 || !ConcurrentSkipList::okToDelete(successors[layer], layer))) {
@@ -237,61 +403,644 @@ void EraseService::performTask() {
 
 }
 
+MultiGetService::MultiGetService(Worker *worker, Context *context, Transport::ServerRpc *rpc)
+    : Service(worker, context, rpc) {
+}
+
+/**
+ * Keys are looked up in sorted order, so consecutive searches follow
+ * mostly the same path and find it in cache; the reply keeps request order.
+ */
+void MultiGetService::performTask() {
+    auto *reqHdr = requestPayload->getStart<WireFormat::MultiGet::Request>();
+    uint32_t count = reqHdr->count;
+    if (count > WireFormat::MultiGet::MAX_COUNT ||
+        requestPayload->size() < sizeof(*reqHdr) + count * sizeof(uint64_t))
+        throw MessageErrorException(HERE);
+
+    std::vector<uint64_t> keys(count);
+    requestPayload->copy(sizeof(*reqHdr), count * sizeof(uint64_t), keys.data());
+    std::vector<uint32_t> order(count);
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&keys](uint32_t a, uint32_t b) {
+        return keys[a] < keys[b];
+    });
+
+    std::vector<Object *> objects(count, nullptr);
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t index = order[i];
+        if (i > 0 && keys[order[i - 1]] == keys[index]) {
+            objects[index] = objects[order[i - 1]];
+            continue;
+        }
+        ConcurrentSkipList::Node *node = skipList->find(keys[index]);
+        if (node != nullptr && !node->markedForRemoval())
+            objects[index] = node->getObject();
+    }
+
+    auto *respHdr = replyPayload->emplaceAppend<WireFormat::MultiGet::Response>();
+    respHdr->common.status = STATUS_OK;
+    respHdr->count = count;
+    for (Object *object : objects) {
+        auto *part = replyPayload->emplaceAppend<WireFormat::MultiGet::Part>();
+        if (object != nullptr) {
+            part->status = STATUS_OK;
+            part->length = object->value.size();
+            part->version = object->version;
+            object->appendValueTo(replyPayload);
+        } else {
+            part->status = STATUS_OBJECT_DOESNT_EXIST;
+            part->length = 0;
+            part->version = 0;
+        }
+    }
+}
+
+BatchWriteService::BatchWriteService(Worker *worker, Context *context, Transport::ServerRpc *rpc,
+                                     bool transactional)
+    : Service(worker, context, rpc), writes(), replyIndex(), state(PARSE), transactional(transactional), found(0)
+      , toOffset(0) {
+}
+
+/**
+ * Lock every node in key order. Locks are never waited for while others
+ * are held: on contention everything is released and the caller yields and
+ * retries, so batches can't deadlock with each other or with other writers.
+ */
+bool BatchWriteService::lockAll() {
+    for (Write &write : writes) {
+        for (int i = 0; i < 10; i++) {
+            write.guard = write.node->tryAcquireGuard();
+            if (write.guard.owns_lock())
+                break;
+        }
+        if (!write.guard.owns_lock()) {
+            unlockAll();
+            return false;
+        }
+    }
+    return true;
+}
+
+void BatchWriteService::unlockAll() {
+    for (Write &write : writes) {
+        if (write.guard.owns_lock())
+            write.guard.unlock();
+    }
+}
+
+void BatchWriteService::performTask() {
+    if (state == PARSE) {
+        checkPrimary();
+        std::vector<Write> parsed;
+        parse(&parsed);
+        auto count = static_cast<uint32_t>(parsed.size());
+        std::vector<uint32_t> order(count);
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&parsed](uint32_t a, uint32_t b) {
+            return parsed[a].key.value() < parsed[b].key.value();
+        });
+        replyIndex.resize(count);
+        for (uint32_t i = 0; i < count; i++) {
+            uint32_t index = order[i];
+            if (writes.empty() || writes.back().key.value() != parsed[index].key.value())
+                writes.push_back(std::move(parsed[index]));
+            else
+                writes.back() = std::move(parsed[index]);
+            replyIndex[index] = static_cast<uint32_t>(writes.size() - 1);
+        }
+        state = FIND;
+    }
+    if (state == FIND) {
+        for (; found < writes.size(); found++) {
+            writes[found].node = skipList->addOrGetNode(writes[found].key);
+            if (writes[found].node == nullptr) {
+                schedule();
+                return;
+            }
+        }
+        state = LOCK;
+    }
+    if (state == LOCK) {
+        if (!lockAll()) {
+            schedule();
+            return;
+        }
+        for (Write &write : writes) {
+            if (write.node->markedForRemoval()) {
+                unlockAll();
+                found = 0;
+                state = FIND;
+                schedule();
+                return;
+            }
+        }
+
+        std::vector<LogEntry *> entries;
+        entries.reserve(writes.size() + 2);
+        if (transactional)
+            entries.push_back(new TransactionBegin(static_cast<uint32_t>(writes.size())));
+        for (Write &write : writes) {
+            if (write.erase) {
+                entries.push_back(new ObjectTombstone(write.key));
+                continue;
+            }
+            write.object = new Object(write.key, write.length);
+            if (write.length != 0)
+                requestPayload->copy(write.offset, write.length, write.object->value.getStart<char>());
+            Object *old = write.node->getObject();
+            write.object->version = old != nullptr ? old->version + 1 : 1;
+            entries.push_back(write.object);
+        }
+        if (transactional)
+            entries.push_back(new TransactionCommit(static_cast<uint32_t>(writes.size())));
+        if (context->log) {
+            toOffset = context->log->append(entries.data(), static_cast<int>(entries.size()));
+        }
+        // The log has copied the entries; only the objects live on.
+        for (LogEntry *entry : entries) {
+            if (entry->type != LOG_ENTRY_TYPE_OBJ)
+                delete entry;
+        }
+        state = WRITE;
+    }
+    if (state == WRITE) {
+        if (context->log != nullptr) {
+            bool synced = false;
+            for (int i = 0; i < 10; i++) {
+                synced = context->log->sync(toOffset);
+                if (synced)
+                    break;
+            }
+            if (!synced) {
+                schedule();
+                return;
+            }
+        }
+        for (Write &write : writes) {
+            Object *old = write.node->setObject(write.object);
+            skipList->destroy(old);
+        }
+        unlockAll();
+        prepareReply();
+        state = DONE;
+    }
+}
+
+MultiPutService::MultiPutService(Worker *worker, Context *context, Transport::ServerRpc *rpc)
+    : BatchWriteService(worker, context, rpc, false) {
+    auto *respHdr = replyPayload->emplaceAppend<WireFormat::MultiPut::Response>();
+    respHdr->common.status = STATUS_OK;
+    respHdr->count = 0;
+}
+
+void MultiPutService::parse(std::vector<Write> *parsed) {
+    auto *reqHdr = requestPayload->getStart<WireFormat::MultiPut::Request>();
+    uint32_t count = reqHdr->count;
+    if (count > WireFormat::MultiPut::MAX_COUNT)
+        throw MessageErrorException(HERE);
+
+    parsed->resize(count);
+    uint32_t offset = sizeof(*reqHdr);
+    for (Write &write : *parsed) {
+        WireFormat::MultiPut::Part part{};
+        if (requestPayload->copy(offset, sizeof(part), &part) != sizeof(part))
+            throw MessageErrorException(HERE);
+        offset += sizeof(part);
+        if (requestPayload->size() - offset < part.length)
+            throw MessageErrorException(HERE);
+        write.key = part.key;
+        write.erase = false;
+        write.offset = offset;
+        write.length = part.length;
+        write.node = nullptr;
+        write.object = nullptr;
+        offset += part.length;
+    }
+}
+
+void MultiPutService::prepareReply() {
+    auto *respHdr = replyPayload->getStart<WireFormat::MultiPut::Response>();
+    respHdr->count = static_cast<uint32_t>(replyIndex.size());
+    for (uint32_t index : replyIndex) {
+        uint64_t version = writes[index].object->version;
+        replyPayload->append(&version, sizeof(version));
+    }
+}
+
+TransactService::TransactService(Worker *worker, Context *context, Transport::ServerRpc *rpc)
+    : BatchWriteService(worker, context, rpc, true) {
+    auto *respHdr = replyPayload->emplaceAppend<WireFormat::Transact::Response>();
+    respHdr->common.status = STATUS_OK;
+    respHdr->count = 0;
+}
+
+void TransactService::parse(std::vector<Write> *parsed) {
+    auto *reqHdr = requestPayload->getStart<WireFormat::Transact::Request>();
+    uint32_t count = reqHdr->count;
+    if (count > WireFormat::Transact::MAX_COUNT)
+        throw MessageErrorException(HERE);
+
+    parsed->resize(count);
+    uint32_t offset = sizeof(*reqHdr);
+    for (Write &write : *parsed) {
+        WireFormat::Transact::Part part{};
+        if (requestPayload->copy(offset, sizeof(part), &part) != sizeof(part))
+            throw MessageErrorException(HERE);
+        offset += sizeof(part);
+        if (part.operation != WireFormat::Transact::TX_PUT && part.operation != WireFormat::Transact::TX_ERASE)
+            throw MessageErrorException(HERE);
+        if (requestPayload->size() - offset < part.length)
+            throw MessageErrorException(HERE);
+        write.key = part.key;
+        write.erase = part.operation == WireFormat::Transact::TX_ERASE;
+        write.offset = offset;
+        write.length = part.length;
+        write.node = nullptr;
+        write.object = nullptr;
+        offset += part.length;
+    }
+}
+
+void TransactService::prepareReply() {
+    auto *respHdr = replyPayload->getStart<WireFormat::Transact::Response>();
+    respHdr->count = static_cast<uint32_t>(replyIndex.size());
+    for (uint32_t index : replyIndex) {
+        Object *object = writes[index].object;
+        uint64_t version = object != nullptr ? object->version : 0;
+        replyPayload->append(&version, sizeof(version));
+    }
+}
+
+ReplicateService::ReplicateService(Worker *worker, Context *context, Transport::ServerRpc *rpc)
+    : Service(worker, context, rpc), state(PARSE), updates(), applied(0), toOffset(0), receivedCycles(0), lsn(0)
+      , caughtUp(false) {
+    auto *respHdr = replyPayload->emplaceAppend<WireFormat::Replicate::Response>();
+    respHdr->common.status = STATUS_OK;
+    respHdr->appliedLsn = 0;
+}
+
+void ReplicateService::performTask() {
+    if (state == PARSE) {
+        auto *reqHdr = requestPayload->getStart<WireFormat::Replicate::Request>();
+        if (reqHdr == nullptr || requestPayload->size() - sizeof(*reqHdr) != reqHdr->length)
+            throw MessageErrorException(HERE);
+        // A batch resent after the primary lost its connection may repeat
+        // entries applied already; those are skipped. One that starts past
+        // them would leave a gap, as when this server restarted and lost
+        // what it had: the primary is told where to resend from instead.
+        uint64_t appliedLsn = context->replicaStatus != nullptr ? context->replicaStatus->getAppliedLsn()
+                                                                : reqHdr->offset;
+        if (reqHdr->offset > appliedLsn) {
+            auto *respHdr = replyPayload->getStart<WireFormat::Replicate::Response>();
+            respHdr->common.status = STATUS_LOG_GAP;
+            respHdr->appliedLsn = appliedLsn;
+            state = DONE;
+            return;
+        }
+        receivedCycles = Cycles::rdtsc();
+        lsn = std::max(reqHdr->offset + reqHdr->length, appliedLsn);
+        caughtUp = lsn == reqHdr->primaryLsn;
+
+        std::vector<LogEntry *> entries;
+        uint32_t offset = sizeof(*reqHdr);
+        while (offset < requestPayload->size()) {
+            uint64_t entryLsn = reqHdr->offset + offset - sizeof(*reqHdr);
+            LogEntry *entry = Log::parseEntry(requestPayload, &offset);
+            if (entry == nullptr) {
+                for (LogEntry *parsed : entries)
+                    delete parsed;
+                throw MessageErrorException(HERE);
+            }
+            if (entryLsn < appliedLsn) {
+                delete entry;
+                continue;
+            }
+            entries.push_back(entry);
+        }
+        if (context->log && !entries.empty()) {
+            toOffset = context->log->append(entries.data(), static_cast<int>(entries.size()));
+        }
+        for (LogEntry *entry : entries) {
+            if (entry->type == LOG_ENTRY_TYPE_OBJ) {
+                updates.push_back({entry->key, static_cast<Object *>(entry)});
+                continue;
+            }
+            if (entry->type == LOG_ENTRY_TYPE_OBJTOMB)
+                updates.push_back({entry->key, nullptr});
+            delete entry;
+        }
+        state = APPLY;
+    }
+    if (state == APPLY) {
+        for (; applied < updates.size(); applied++) {
+            Update &update = updates[applied];
+            ConcurrentSkipList::Node *node;
+            if (update.object != nullptr) {
+                node = skipList->addOrGetNode(update.key);
+                if (node == nullptr) {
+                    schedule();
+                    return;
+                }
+            } else {
+                node = skipList->find(update.key);
+                if (node == nullptr)
+                    continue;
+            }
+            ConcurrentSkipList::ScopedLocker guard = node->tryAcquireGuard();
+            if (!guard.owns_lock()) {
+                schedule();
+                return;
+            }
+            if (node->markedForRemoval()) {
+                // An erase is unlinking the node: a put must find or create
+                // its successor, while an erase has nothing left to do.
+                if (update.object != nullptr) {
+                    schedule();
+                    return;
+                }
+                continue;
+            }
+            Object *old = node->setObject(update.object);
+            skipList->destroy(old);
+        }
+        if (context->replicaStatus != nullptr)
+            context->replicaStatus->applied(lsn, caughtUp, receivedCycles);
+        replyPayload->getStart<WireFormat::Replicate::Response>()->appliedLsn = lsn;
+        state = WRITE;
+    }
+    if (state == WRITE) {
+        if (context->log != nullptr) {
+            bool synced = false;
+            for (int i = 0; i < 10; i++) {
+                synced = context->log->sync(toOffset);
+                if (synced)
+                    break;
+            }
+            if (!synced) {
+                schedule();
+                return;
+            }
+        }
+        state = DONE;
+    }
+}
+
 ScanService::ScanService(Worker *worker, Context *context, Transport::ServerRpc *rpc)
-    : Service(worker, context, rpc), state(INIT), current(nullptr), size(0) {
+    : Service(worker, context, rpc), state(INIT), current(nullptr), size(0), bytes(0), start(), end(), maxCount(0)
+      , maxBytes(0), reverse(false), minLsn(0), maxStalenessMicros(0), chunkBytes(0), output(replyPayload) {
 
-    auto *respHdr = replyPayload->emplaceAppend<WireFormat::Scan::Response>();
+    auto *reqHdr = requestPayload->getStart<WireFormat::Scan::Request>();
+    start = reqHdr->start;
+    end = reqHdr->end;
+    maxCount = reqHdr->maxCount;
+    maxBytes = reqHdr->maxBytes;
+    if (maxBytes == 0 || maxBytes > DEFAULT_MAX_BYTES) {
+        maxBytes = DEFAULT_MAX_BYTES;
+    }
+    reverse = reqHdr->reverse != 0;
+    chunkBytes = reqHdr->chunkBytes;
+    if (chunkBytes != 0) {
+        // Streamed replies carry the response header in their first frame
+        // and end with an empty final message.
+        if (chunkBytes < MIN_CHUNK_BYTES) {
+            chunkBytes = MIN_CHUNK_BYTES;
+        } else if (chunkBytes > DEFAULT_MAX_BYTES) {
+            chunkBytes = DEFAULT_MAX_BYTES;
+        }
+        output = new Buffer();
+    }
+
+    minLsn = reqHdr->minLsn;
+    maxStalenessMicros = reqHdr->maxStalenessMicros;
+
+    auto *respHdr = output->emplaceAppend<WireFormat::Scan::Response>();
     respHdr->common.status = STATUS_OK;
+    respHdr->size = 0;
+    respHdr->hasMore = 0;
+    respHdr->nextKey = 0;
+    respHdr->lsn = 0;
+}
+
+ScanService::~ScanService() {
+    if (output != replyPayload) {
+        delete output;
+    }
 }
 
 void ScanService::performTask() {
-    auto *reqHdr = requestPayload->getStart<WireFormat::Scan::Request>();
-    Key start(reqHdr->start), end(reqHdr->end);
     if (state == INIT) {
-        current = skipList->lowerBound(start);
+        checkFreshness(minLsn, maxStalenessMicros);
+        output->getStart<WireFormat::Scan::Response>()->lsn = getLsn();
+        current = reverse ? skipList->floor(end) : skipList->lowerBound(start);
         state = COLLECT;
     }
 
     if (state == COLLECT) {
         int count = 0;
-        while (count < 100 && current != nullptr && current->getKey().value() <= end.value()) {
-            append(current->getObject());
-            current = current->next();
+        while (count < 100 && inRange(current)) {
+            if (maxCount != 0 && size >= maxCount) {
+                break;
+            }
+            Object *object = current->getObject();
+            if (object != nullptr) {
+                uint32_t entryBytes = 12 + object->value.size();
+                if (chunkBytes != 0) {
+                    if (output->size() + entryBytes > chunkBytes && output->size() != 0 && !flushChunk()) {
+                        // The client hasn't drained earlier frames yet.
+                        schedule();
+                        return;
+                    }
+                } else if (size != 0 && bytes + entryBytes > maxBytes) {
+                    // Always return at least one object so that a page
+                    // makes progress even if a single value exceeds maxBytes.
+                    break;
+                }
+                append(object);
+                bytes += entryBytes;
+                size++;
+            }
+            current = advance(current);
             count++;
-            size++;
         }
-        if (current == nullptr) {
-            state = DONE;
-        } else if (current->getKey().value() > end.value()) {
-            state = DONE;
-        } else {
+        if (count == 100 && inRange(current)) {
             schedule();
             return;
         }
+        state = DONE;
     }
 
     if (state == DONE) {
+        if (chunkBytes != 0) {
+            // The last frame carries the tail of the range; the final reply
+            // itself is empty.
+            if (output->size() != 0 && !flushChunk()) {
+                schedule();
+            }
+            return;
+        }
         auto *respHdr = replyPayload->getStart<WireFormat::Scan::Response>();
         respHdr->size = size;
+        if (inRange(current)) {
+            respHdr->hasMore = 1;
+            respHdr->nextKey = current->getKey().value();
+        }
     }
 
 }
 
+/**
+ * Hand the frame being filled to the transport and start a new one.
+ *
+ * \return
+ *      False means too many earlier frames are still in flight; the
+ *      caller should yield and try again later.
+ */
+bool ScanService::flushChunk() {
+    if (rpc->framesInFlight.load(std::memory_order_acquire) >= Transport::ServerRpc::MAX_FRAMES_IN_FLIGHT) {
+        return false;
+    }
+    rpc->appendFrame(output);
+    if (context->dispatch != nullptr)
+        context->dispatch->wakeup();
+    output = new Buffer();
+    return true;
+}
+
+bool ScanService::inRange(ConcurrentSkipList::Node *node) {
+    if (node == nullptr) {
+        return false;
+    }
+    uint64_t key = node->getKey().value();
+    return reverse ? key >= start.value() : key <= end.value();
+}
+
+ConcurrentSkipList::Node *ScanService::advance(ConcurrentSkipList::Node *node) {
+    return reverse ? skipList->predecessor(node->getKey()) : node->next();
+}
+
 void ScanService::append(Object *object) {
     uint64_t key = object->key.value();
     uint32_t size = object->value.size();
-    uint32_t offset = replyPayload->size();
-    uint32_t bytesNeeded = 12 + size;
-    replyPayload->alloc(bytesNeeded);
-
-    void *ptr;
-    uint32_t contiguous = replyPayload->peek(offset, &ptr);
-    assert(contiguous == bytesNeeded);
-    char *dest = static_cast<char *>(ptr);
+    bool pinned = size >= Object::MIN_PINNED_VALUE;
+    auto *dest = static_cast<char *>(output->alloc(pinned ? 12 : 12 + size));
     memcpy(dest, &key, 8);
     memcpy(dest + 8, &size, 4);
-    char *src = object->value.getStart<char>();
-    memcpy(dest + 12, src, size);
+    if (pinned) {
+        object->appendValueTo(output);
+    } else {
+        object->value.copy(0, size, dest + 12);
+    }
+}
+
+ScanAggregateService::ScanAggregateService(Worker *worker, Context *context, Transport::ServerRpc *rpc)
+    : Service(worker, context, rpc), state(INIT), current(nullptr), end(), function(0), fieldWidth(0)
+      , fieldOffset(0), prefix(), count(0), fieldCount(0), result(0) {
+    auto *respHdr = replyPayload->emplaceAppend<WireFormat::ScanAggregate::Response>();
+    respHdr->common.status = STATUS_OK;
+
+    auto *reqHdr = requestPayload->getStart<WireFormat::ScanAggregate::Request>();
+    end = reqHdr->end;
+    function = reqHdr->function;
+    fieldWidth = reqHdr->fieldWidth;
+    fieldOffset = reqHdr->fieldOffset;
+    if (reqHdr->prefixLength != 0) {
+        auto *data = static_cast<const char *>(
+            requestPayload->getRange(sizeof(*reqHdr), reqHdr->prefixLength));
+        if (data != nullptr) {
+            prefix.assign(data, reqHdr->prefixLength);
+        }
+    }
+    if (function == WireFormat::ScanAggregate::MIN) {
+        result = UINT64_MAX;
+    }
+}
+
+void ScanAggregateService::performTask() {
+    if (state == INIT) {
+        auto *reqHdr = requestPayload->getStart<WireFormat::ScanAggregate::Request>();
+        if (function > WireFormat::ScanAggregate::MAX ||
+            (fieldWidth != 1 && fieldWidth != 2 && fieldWidth != 4 && fieldWidth != 8) ||
+            fieldOffset > UINT32_MAX - fieldWidth || prefix.size() != reqHdr->prefixLength) {
+            throw MessageErrorException(HERE);
+        }
+        current = skipList->lowerBound(reqHdr->start);
+        state = COLLECT;
+    }
 
+    if (state == COLLECT) {
+        // Values live in separate objects, so first gather the fields of a
+        // batch into a dense array; reduce() then runs straight-line loops
+        // over it that the compiler can vectorise.
+        uint64_t fields[BATCH_SIZE];
+        int n = 0;
+        int visited = 0;
+        while (visited < BATCH_SIZE && current != nullptr && current->getKey().value() <= end.value()) {
+            Object *object = current->getObject();
+            current = current->next();
+            visited++;
+            if (object == nullptr) {
+                continue;
+            }
+            uint32_t length = object->value.size();
+            const char *value = object->value.getStart<char>();
+            if (!prefix.empty() &&
+                (length < prefix.size() || memcmp(value, prefix.data(), prefix.size()) != 0)) {
+                continue;
+            }
+            count++;
+            if (function == WireFormat::ScanAggregate::COUNT || fieldWidth > length ||
+                fieldOffset > length - fieldWidth) {
+                continue;
+            }
+            uint64_t field = 0;
+            memcpy(&field, value + fieldOffset, fieldWidth);
+            fields[n++] = field;
+        }
+        reduce(fields, n);
+        if (current != nullptr && current->getKey().value() <= end.value()) {
+            schedule();
+            return;
+        }
+        state = DONE;
+    }
+
+    if (state == DONE) {
+        auto *respHdr = replyPayload->getStart<WireFormat::ScanAggregate::Response>();
+        respHdr->count = count;
+        respHdr->fieldCount = fieldCount;
+        respHdr->result = function == WireFormat::ScanAggregate::COUNT ? count : result;
+    }
 }
+
+void ScanAggregateService::reduce(const uint64_t *fields, int n) {
+    fieldCount += n;
+    uint64_t acc;
+    switch (function) {
+        case WireFormat::ScanAggregate::SUM:
+            acc = 0;
+            for (int i = 0; i < n; i++) {
+                acc += fields[i];
+            }
+            result += acc;
+            break;
+        case WireFormat::ScanAggregate::MIN:
+            acc = result;
+            for (int i = 0; i < n; i++) {
+                acc = fields[i] < acc ? fields[i] : acc;
+            }
+            result = acc;
+            break;
+        case WireFormat::ScanAggregate::MAX:
+            acc = result;
+            for (int i = 0; i < n; i++) {
+                acc = fields[i] > acc ? fields[i] : acc;
+            }
+            result = acc;
+            break;
+        default:
+            break;
+    }
+}
+
 }
@@ -7,6 +7,8 @@
 #include "TaskQueue.h"
 #include "Key.h"
 
+#include <vector>
+
 namespace Gungnir {
 
 class Service : public Task {
@@ -21,12 +23,23 @@ public:
 
     static Service *dispatch(Worker *worker, Context *context, Transport::ServerRpc *rpc);
 
+    void checkFreshness(uint64_t minLsn, uint32_t maxStalenessMicros);
+
+    void checkPrimary();
+
+    uint64_t getLsn();
+
 public:
     Worker *worker;
     Context *context;
+    Transport::ServerRpc *rpc;
     Buffer *requestPayload;
     Buffer *replyPayload;
     ConcurrentSkipList *skipList;
+
+    /// Skip list epoch when the service started; objects retired since
+    /// then must outlive it.
+    int epoch;
 };
 
 class GetService : public Service {
@@ -36,7 +49,13 @@ public:
     void performTask() override;
 };
 
-class PutService : public Service {
+/**
+ * Base for services that replace the object of a single key under its node
+ * lock: the node is found or created, locked, the new object is derived
+ * from the current one and logged, and it is installed once the log entry
+ * is durable. Subclasses decide what the new object is.
+ */
+class WriteService : public Service {
 public:
     enum State {
         FIND,
@@ -45,11 +64,24 @@ public:
         DONE
     };
 
-    PutService(Worker *worker, Context *context, Transport::ServerRpc *rpc);
+    WriteService(Worker *worker, Context *context, Transport::ServerRpc *rpc, Key key);
 
     void performTask() override;
 
-private:
+protected:
+    /**
+     * Build the object that replaces old (NULL if the key has no object)
+     * while the node lock is held. Returning NULL leaves the object
+     * unchanged; the reply must then already say why.
+     */
+    virtual Object *update(Object *old) = 0;
+
+    /**
+     * Called with the lock still held after update() returned object and
+     * its version was assigned; fills in the reply.
+     */
+    virtual void updated(Object *object) = 0;
+
     State state;
     Key key;
     ConcurrentSkipList::Node *node;
@@ -58,6 +90,49 @@ private:
     uint64_t toOffset;
 };
 
+class PutService : public WriteService {
+public:
+    PutService(Worker *worker, Context *context, Transport::ServerRpc *rpc);
+
+protected:
+    Object *update(Object *old) override;
+
+    void updated(Object *object) override;
+};
+
+class IncrementService : public WriteService {
+public:
+    IncrementService(Worker *worker, Context *context, Transport::ServerRpc *rpc);
+
+protected:
+    Object *update(Object *old) override;
+
+    void updated(Object *object) override;
+
+private:
+    int64_t value;
+};
+
+class CompareAndSwapService : public WriteService {
+public:
+    CompareAndSwapService(Worker *worker, Context *context, Transport::ServerRpc *rpc);
+
+protected:
+    Object *update(Object *old) override;
+
+    void updated(Object *object) override;
+};
+
+class AppendService : public WriteService {
+public:
+    AppendService(Worker *worker, Context *context, Transport::ServerRpc *rpc);
+
+protected:
+    Object *update(Object *old) override;
+
+    void updated(Object *object) override;
+};
+
 class EraseService : public Service {
 public:
     enum State {
@@ -85,6 +160,161 @@ private:
     uint64_t toOffset;
 };
 
+class MultiGetService : public Service {
+public:
+    MultiGetService(Worker *worker, Context *context, Transport::ServerRpc *rpc);
+
+    void performTask() override;
+};
+
+/**
+ * Base for services that write a batch of keys. The nodes are locked in
+ * key order, the new objects are logged with one contiguous append, and
+ * they are installed once the log entries are durable. Subclasses parse
+ * the request and build the reply.
+ */
+class BatchWriteService : public Service {
+public:
+    enum State {
+        PARSE,
+        FIND,
+        LOCK,
+        WRITE,
+        DONE
+    };
+
+    BatchWriteService(Worker *worker, Context *context, Transport::ServerRpc *rpc, bool transactional);
+
+    void performTask() override;
+
+protected:
+    struct Write {
+        Key key;
+        bool erase;                   // True means remove the object.
+        uint32_t offset;              // Offset of the value in the request.
+        uint32_t length;
+        ConcurrentSkipList::Node *node;
+        ConcurrentSkipList::ScopedLocker guard;
+        Object *object;               // NULL for erases.
+    };
+
+    /**
+     * Append the writes in the request to parsed, in request order.
+     *
+     * \throw MessageErrorException
+     *      The request is malformed.
+     */
+    virtual void parse(std::vector<Write> *parsed) = 0;
+
+    /**
+     * Fill in the reply once every write has been installed; the version
+     * written for request part i is writes[replyIndex[i]].object->version.
+     */
+    virtual void prepareReply() = 0;
+
+    /// One entry per distinct key, sorted by key; when a key repeats, the
+    /// last write in the request wins.
+    std::vector<Write> writes;
+
+    /// Index in writes of the entry that serves each request part.
+    std::vector<uint32_t> replyIndex;
+
+private:
+    bool lockAll();
+
+    void unlockAll();
+
+    State state;
+
+    /// True means the batch is logged between transaction markers, so
+    /// recovery replays all of it or none of it.
+    bool transactional;
+
+    /// Number of leading writes whose node has been found.
+    uint32_t found;
+    uint64_t toOffset;
+};
+
+/**
+ * Writes a batch of objects. The batch is not atomic: a crash may leave a
+ * prefix of it in the log.
+ */
+class MultiPutService : public BatchWriteService {
+public:
+    MultiPutService(Worker *worker, Context *context, Transport::ServerRpc *rpc);
+
+protected:
+    void parse(std::vector<Write> *parsed) override;
+
+    void prepareReply() override;
+};
+
+/**
+ * Applies a set of puts and erases as one transaction: no other writer can
+ * interleave with it, and it is logged as a single record that recovery
+ * replays completely or not at all. Readers don't take locks, so a
+ * concurrent read may still observe it half-installed.
+ *
+ * Erased objects are cleared from their node; the empty node stays linked
+ * until a later ERASE of its key.
+ */
+class TransactService : public BatchWriteService {
+public:
+    TransactService(Worker *worker, Context *context, Transport::ServerRpc *rpc);
+
+protected:
+    void parse(std::vector<Write> *parsed) override;
+
+    void prepareReply() override;
+};
+
+/**
+ * Applies a batch of a primary's log entries on a backup. The entries are
+ * appended to the backup's own log, if it keeps one, and installed in log
+ * order with the versions the primary gave them; the reply waits until
+ * they are durable here. Erases clear the node, as with TransactService.
+ * Transaction markers are only logged, so a reader of the backup may see a
+ * transaction half-applied. Entries applied already, as in a batch resent
+ * after the primary reconnected, are skipped; a batch that would leave a
+ * gap, as after this server restarted, is answered with STATUS_LOG_GAP and
+ * the end of what has been applied, for the primary to resend from.
+ */
+class ReplicateService : public Service {
+public:
+    enum State {
+        PARSE,
+        APPLY,
+        WRITE,
+        DONE
+    };
+
+    ReplicateService(Worker *worker, Context *context, Transport::ServerRpc *rpc);
+
+    void performTask() override;
+
+private:
+    struct Update {
+        Key key;
+        Object *object;               // NULL for erases.
+    };
+
+    State state;
+    std::vector<Update> updates;
+
+    /// Number of leading updates installed.
+    uint32_t applied;
+    uint64_t toOffset;
+
+    /// Cycles::rdtsc() when the batch arrived.
+    uint64_t receivedCycles;
+
+    /// Primary log offset at the end of the batch.
+    uint64_t lsn;
+
+    /// True means the batch left this server level with the primary.
+    bool caughtUp;
+};
+
 class ScanService : public Service {
 public:
     enum State {
@@ -93,16 +323,77 @@ public:
         DONE
     };
 
+    /// Reply size limit used when the request doesn't ask for a smaller one;
+    /// keeps the memory held by a single scan reply bounded.
+    static const uint32_t DEFAULT_MAX_BYTES = 1u << 20;
+
+    /// Smallest frame a streamed scan will emit.
+    static const uint32_t MIN_CHUNK_BYTES = 4096;
+
     ScanService(Worker *worker, Context *context, Transport::ServerRpc *rpc);
 
+    ~ScanService() override;
+
     void performTask() override;
 
     void append(Object *object);
 
 private:
+    bool flushChunk();
+
+    bool inRange(ConcurrentSkipList::Node *node);
+
+    ConcurrentSkipList::Node *advance(ConcurrentSkipList::Node *node);
+
     State state;
     ConcurrentSkipList::Node *current;
     uint32_t size;
+    uint32_t bytes;
+    Key start;
+    Key end;
+    uint32_t maxCount;
+    uint32_t maxBytes;
+    bool reverse;
+    uint64_t minLsn;
+    uint32_t maxStalenessMicros;
+
+    /// Nonzero means the reply is streamed in frames of about this size.
+    uint32_t chunkBytes;
+
+    /// Where objects are appended: replyPayload, or the frame being filled
+    /// when streaming.
+    Buffer *output;
+};
+
+class ScanAggregateService : public Service {
+public:
+    enum State {
+        INIT,
+        COLLECT,
+        DONE
+    };
+
+    /// Number of objects visited per slice of the traversal; also the
+    /// size of the batch of fields reduced in one pass.
+    static const int BATCH_SIZE = 128;
+
+    ScanAggregateService(Worker *worker, Context *context, Transport::ServerRpc *rpc);
+
+    void performTask() override;
+
+private:
+    void reduce(const uint64_t *fields, int n);
+
+    State state;
+    ConcurrentSkipList::Node *current;
+    Key end;
+    uint8_t function;
+    uint8_t fieldWidth;
+    uint32_t fieldOffset;
+    std::string prefix;
+    uint64_t count;
+    uint64_t fieldCount;
+    uint64_t result;
 };
 
 }
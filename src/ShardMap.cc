@@ -0,0 +1,93 @@
+#include <algorithm>
+
+#include "ShardMap.h"
+#include "Exception.h"
+
+namespace Gungnir {
+
+/**
+ * Construct a consistent hashing map over shards 0 to shardCount - 1.
+ *
+ * \param virtualNodes
+ *      Points each shard has on the ring; more of them spread the keys
+ *      more evenly.
+ */
+ShardMap::ShardMap(uint32_t shardCount, uint32_t virtualNodes)
+    : shardCount(shardCount), ring(), rangeStarts() {
+    if (shardCount == 0)
+        throw FatalError(HERE, "ShardMap needs at least one shard");
+    virtualNodes = std::max(1u, virtualNodes);
+    ring.reserve(static_cast<size_t>(shardCount) * virtualNodes);
+    for (uint32_t shard = 0; shard < shardCount; shard++) {
+        for (uint32_t node = 0; node < virtualNodes; node++) {
+            // A node's position depends only on its shard and index, so
+            // the nodes of the other shards stay put when one is added.
+            uint64_t position = hash((static_cast<uint64_t>(shard) << 32 | node) ^ 0x5bd1e9955bd1e995ul);
+            ring.emplace_back(position, shard);
+        }
+    }
+    std::sort(ring.begin(), ring.end());
+}
+
+/**
+ * Construct a range map: shard i holds the keys from rangeStarts[i] up to
+ * rangeStarts[i + 1], and the last shard the rest. Keys below
+ * rangeStarts[0] go to shard 0.
+ */
+ShardMap::ShardMap(std::vector<uint64_t> rangeStarts)
+    : shardCount(static_cast<uint32_t>(rangeStarts.size())), ring(), rangeStarts(std::move(rangeStarts)) {
+    if (shardCount == 0)
+        throw FatalError(HERE, "ShardMap needs at least one shard");
+    if (!std::is_sorted(this->rangeStarts.begin(), this->rangeStarts.end()))
+        throw FatalError(HERE, "ShardMap ranges must be in ascending order");
+}
+
+uint32_t ShardMap::shardOf(uint64_t key) const {
+    if (isRangeMap()) {
+        auto it = std::upper_bound(rangeStarts.begin(), rangeStarts.end(), key);
+        if (it == rangeStarts.begin())
+            return 0;
+        return static_cast<uint32_t>(it - rangeStarts.begin() - 1);
+    }
+
+    // The key belongs to the first node at or after its hash, wrapping
+    // around at the end of the ring.
+    std::pair<uint64_t, uint32_t> point(hash(key), 0);
+    auto it = std::lower_bound(ring.begin(), ring.end(), point);
+    if (it == ring.end())
+        it = ring.begin();
+    return it->second;
+}
+
+/**
+ * Return the shards that may hold keys in [start, end], in ascending order.
+ * With hashing that is all of them.
+ */
+std::vector<uint32_t> ShardMap::shardsFor(uint64_t start, uint64_t end) const {
+    std::vector<uint32_t> shards;
+    if (!isRangeMap()) {
+        for (uint32_t shard = 0; shard < shardCount; shard++)
+            shards.push_back(shard);
+        return shards;
+    }
+    if (start > end)
+        return shards;
+    for (uint32_t shard = shardOf(start); shard <= shardOf(end); shard++)
+        shards.push_back(shard);
+    return shards;
+}
+
+/**
+ * Mix the bits of value (the finalizer of MurmurHash3), so that
+ * neighbouring keys land far apart on the ring.
+ */
+uint64_t ShardMap::hash(uint64_t value) {
+    value ^= value >> 33;
+    value *= 0xff51afd7ed558ccdul;
+    value ^= value >> 33;
+    value *= 0xc4ceb9fe1a85ec53ul;
+    value ^= value >> 33;
+    return value;
+}
+
+}
@@ -0,0 +1,55 @@
+#ifndef GUNGNIR_SHARDMAP_H
+#define GUNGNIR_SHARDMAP_H
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace Gungnir {
+
+/**
+ * Decides which of several servers (shards) holds a key. Keys are placed
+ * either by consistent hashing, where each shard owns the arcs that end at
+ * its virtual nodes on a 64-bit hash ring, so that adding a shard only
+ * moves the keys the new one takes over; or by a static range map, where
+ * each shard holds one contiguous range of keys.
+ */
+class ShardMap {
+public:
+    /// Virtual nodes per shard unless the constructor is told otherwise.
+    static const uint32_t DEFAULT_VIRTUAL_NODES = 128;
+
+    explicit ShardMap(uint32_t shardCount, uint32_t virtualNodes = DEFAULT_VIRTUAL_NODES);
+
+    explicit ShardMap(std::vector<uint64_t> rangeStarts);
+
+    uint32_t shardOf(uint64_t key) const;
+
+    std::vector<uint32_t> shardsFor(uint64_t start, uint64_t end) const;
+
+    /// True means the shards hold contiguous ranges of keys.
+    bool isRangeMap() const {
+        return !rangeStarts.empty();
+    }
+
+    uint32_t getShardCount() const {
+        return shardCount;
+    }
+
+    static uint64_t hash(uint64_t value);
+
+private:
+    uint32_t shardCount;
+
+    /// Virtual nodes of all shards as (hash, shard), sorted by hash; empty
+    /// for a range map.
+    std::vector<std::pair<uint64_t, uint32_t>> ring;
+
+    /// First key of the range of each shard, ascending; empty when
+    /// hashing.
+    std::vector<uint64_t> rangeStarts;
+};
+
+}
+
+#endif //GUNGNIR_SHARDMAP_H
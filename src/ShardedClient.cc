@@ -0,0 +1,201 @@
+#include <algorithm>
+
+#include "ShardedClient.h"
+
+namespace Gungnir {
+
+/**
+ * Construct a client that places keys on the servers by consistent
+ * hashing. The order of connectLocators matters: it numbers the shards.
+ */
+ShardedClient::ShardedClient(Context *context, const std::vector<std::string> &connectLocators,
+                             uint32_t virtualNodes)
+    : map(static_cast<uint32_t>(connectLocators.size()), virtualNodes), shards() {
+    for (const std::string &locator: connectLocators)
+        shards.emplace_back(new Client(context, locator));
+}
+
+/**
+ * Construct a client whose servers hold contiguous ranges of keys: the one
+ * of connectLocators[i] holds the keys from rangeStarts[i] on; see
+ * ShardMap.
+ */
+ShardedClient::ShardedClient(Context *context, const std::vector<std::string> &connectLocators,
+                             const std::vector<uint64_t> &rangeStarts)
+    : map(rangeStarts), shards() {
+    if (connectLocators.size() != rangeStarts.size())
+        throw FatalError(HERE, "ShardedClient needs one range per server");
+    for (const std::string &locator: connectLocators)
+        shards.emplace_back(new Client(context, locator));
+}
+
+/**
+ * Split a comma separated list of service locators.
+ */
+std::vector<std::string> ShardedClient::splitLocators(const std::string &connectLocators) {
+    std::vector<std::string> locators;
+    size_t begin = 0;
+    while (begin <= connectLocators.size()) {
+        size_t end = connectLocators.find(',', begin);
+        if (end == std::string::npos)
+            end = connectLocators.size();
+        if (end > begin)
+            locators.push_back(connectLocators.substr(begin, end - begin));
+        begin = end + 1;
+    }
+    return locators;
+}
+
+void ShardedClient::get(uint64_t key, Buffer *value, bool *objectExists, uint64_t *version) {
+    clientFor(key)->get(key, value, objectExists, version);
+}
+
+void ShardedClient::put(uint64_t key, const void *buf, uint32_t length, uint64_t *version) {
+    clientFor(key)->put(key, buf, length, version);
+}
+
+int64_t ShardedClient::increment(uint64_t key, int64_t delta, uint64_t *version) {
+    return clientFor(key)->increment(key, delta, version);
+}
+
+bool ShardedClient::compareAndSwap(uint64_t key, uint64_t expectedVersion, const void *buf, uint32_t length,
+                                   uint64_t *version) {
+    return clientFor(key)->compareAndSwap(key, expectedVersion, buf, length, version);
+}
+
+void ShardedClient::append(uint64_t key, const void *buf, uint32_t length, uint64_t *version) {
+    clientFor(key)->append(key, buf, length, version);
+}
+
+void ShardedClient::erase(uint64_t key) {
+    clientFor(key)->erase(key);
+}
+
+/**
+ * Read several objects, sending the batches of all shards before waiting
+ * for any of them.
+ */
+void ShardedClient::multiGet(MultiGetObject *objects, uint32_t count) {
+    std::vector<std::vector<uint32_t>> indexes(shards.size());
+    for (uint32_t i = 0; i < count; i++)
+        indexes[map.shardOf(objects[i].key)].push_back(i);
+
+    // Each shard's objects are copied together, since a batch must be
+    // contiguous; the value buffers are shared with the caller's objects.
+    std::vector<std::vector<MultiGetObject>> batches(shards.size());
+    std::vector<std::unique_ptr<MultiGetRpc>> rpcs;
+    for (size_t shard = 0; shard < shards.size(); shard++) {
+        std::vector<MultiGetObject> &batch = batches[shard];
+        for (uint32_t index: indexes[shard])
+            batch.push_back(objects[index]);
+        for (uint32_t i = 0; i < batch.size(); i += WireFormat::MultiGet::MAX_COUNT) {
+            uint32_t n = std::min(static_cast<uint32_t>(batch.size()) - i, WireFormat::MultiGet::MAX_COUNT);
+            rpcs.emplace_back(new MultiGetRpc(shards[shard].get(), batch.data() + i, n));
+        }
+    }
+    for (auto &rpc: rpcs)
+        rpc->wait();
+
+    for (size_t shard = 0; shard < shards.size(); shard++) {
+        for (size_t i = 0; i < indexes[shard].size(); i++) {
+            MultiGetObject &object = objects[indexes[shard][i]];
+            object.exists = batches[shard][i].exists;
+            object.version = batches[shard][i].version;
+        }
+    }
+}
+
+/**
+ * Write several objects, sending the batches of all shards before waiting
+ * for any of them. As with Client::multiPut, the writes are not atomic.
+ */
+void ShardedClient::multiPut(MultiPutObject *objects, uint32_t count) {
+    std::vector<std::vector<uint32_t>> indexes(shards.size());
+    for (uint32_t i = 0; i < count; i++)
+        indexes[map.shardOf(objects[i].key)].push_back(i);
+
+    std::vector<std::vector<MultiPutObject>> batches(shards.size());
+    std::vector<std::unique_ptr<MultiPutRpc>> rpcs;
+    for (size_t shard = 0; shard < shards.size(); shard++) {
+        std::vector<MultiPutObject> &batch = batches[shard];
+        for (uint32_t index: indexes[shard])
+            batch.push_back(objects[index]);
+        for (uint32_t i = 0; i < batch.size(); i += WireFormat::MultiPut::MAX_COUNT) {
+            uint32_t n = std::min(static_cast<uint32_t>(batch.size()) - i, WireFormat::MultiPut::MAX_COUNT);
+            rpcs.emplace_back(new MultiPutRpc(shards[shard].get(), batch.data() + i, n));
+        }
+    }
+    for (auto &rpc: rpcs)
+        rpc->wait();
+
+    for (size_t shard = 0; shard < shards.size(); shard++) {
+        for (size_t i = 0; i < indexes[shard].size(); i++)
+            objects[indexes[shard][i]].version = batches[shard][i].version;
+    }
+}
+
+/**
+ * Return every object in [start, end], in key order. Each round sends the
+ * next page request to every shard whose part of the range isn't
+ * exhausted, all at once; the shards' results are then merged.
+ */
+Iterator ShardedClient::scan(uint64_t start, uint64_t end) {
+    std::vector<uint32_t> targets = map.shardsFor(start, end);
+    size_t count = targets.size();
+    std::vector<Iterator> results(count);
+    std::vector<uint64_t> nextStart(count, start);
+    std::vector<bool> exhausted(count, false);
+
+    while (true) {
+        std::vector<Iterator> pages(count);
+        std::vector<std::unique_ptr<ScanRpc>> rpcs(count);
+        bool sent = false;
+        for (size_t i = 0; i < count; i++) {
+            if (exhausted[i])
+                continue;
+            rpcs[i].reset(new ScanRpc(shards[targets[i]].get(), nextStart[i], end, 0, 0, false, &pages[i]));
+            sent = true;
+        }
+        if (!sent)
+            break;
+        for (size_t i = 0; i < count; i++) {
+            if (!rpcs[i])
+                continue;
+            rpcs[i]->wait();
+            results[i].buffer->append(pages[i].buffer.get());
+            results[i].size += pages[i].size;
+            if (pages[i].hasMore)
+                nextStart[i] = pages[i].nextKey;
+            else
+                exhausted[i] = true;
+        }
+    }
+
+    if (count == 1)
+        return results[0];
+
+    Iterator merged;
+    while (true) {
+        Iterator *smallest = nullptr;
+        uint64_t smallestKey = 0;
+        for (Iterator &result: results) {
+            if (result.isDone())
+                continue;
+            uint64_t key = result.getKey();
+            if (smallest == nullptr || key < smallestKey) {
+                smallest = &result;
+                smallestKey = key;
+            }
+        }
+        if (smallest == nullptr)
+            break;
+        uint32_t length;
+        smallest->getValue(length);
+        merged.buffer->append(smallest->buffer.get(), smallest->offset, 12 + length);
+        merged.size++;
+        smallest->next();
+    }
+    return merged;
+}
+
+}
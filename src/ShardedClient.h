@@ -0,0 +1,75 @@
+#ifndef GUNGNIR_SHARDEDCLIENT_H
+#define GUNGNIR_SHARDEDCLIENT_H
+
+#include <memory>
+#include <vector>
+
+#include "Client.h"
+#include "ShardMap.h"
+
+namespace Gungnir {
+
+/**
+ * A client of several servers that each hold a share of the keys, as
+ * placed by a ShardMap. Single-key operations go to the shard of their
+ * key; multi-key operations send one batch to each shard involved at once
+ * and wait for all of them, and scans read every shard that may hold part
+ * of the range in parallel and merge the results in key order.
+ */
+class ShardedClient {
+
+public:
+    ShardedClient(Context *context, const std::vector<std::string> &connectLocators,
+                  uint32_t virtualNodes = ShardMap::DEFAULT_VIRTUAL_NODES);
+
+    ShardedClient(Context *context, const std::vector<std::string> &connectLocators,
+                  const std::vector<uint64_t> &rangeStarts);
+
+    static std::vector<std::string> splitLocators(const std::string &connectLocators);
+
+    /// Returns the client of the shard that holds key.
+    Client *clientFor(uint64_t key) {
+        return shards[map.shardOf(key)].get();
+    }
+
+    Client *getShard(uint32_t shard) {
+        return shards[shard].get();
+    }
+
+    uint32_t shardOf(uint64_t key) const {
+        return map.shardOf(key);
+    }
+
+    uint32_t getShardCount() const {
+        return map.getShardCount();
+    }
+
+    void get(uint64_t key, Buffer *value, bool *objectExists = nullptr, uint64_t *version = nullptr);
+
+    void put(uint64_t key, const void *buf, uint32_t length, uint64_t *version = nullptr);
+
+    int64_t increment(uint64_t key, int64_t delta, uint64_t *version = nullptr);
+
+    bool compareAndSwap(uint64_t key, uint64_t expectedVersion, const void *buf, uint32_t length,
+                        uint64_t *version = nullptr);
+
+    void append(uint64_t key, const void *buf, uint32_t length, uint64_t *version = nullptr);
+
+    void erase(uint64_t key);
+
+    void multiGet(MultiGetObject *objects, uint32_t count);
+
+    void multiPut(MultiPutObject *objects, uint32_t count);
+
+    Iterator scan(uint64_t startKey, uint64_t lastKey);
+
+private:
+    ShardMap map;
+
+    /// Client of each shard, by index in the map.
+    std::vector<std::unique_ptr<Client>> shards;
+};
+
+}
+
+#endif //GUNGNIR_SHARDEDCLIENT_H
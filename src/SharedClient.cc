@@ -0,0 +1,177 @@
+#include "SharedClient.h"
+#include "ThreadId.h"
+
+namespace Gungnir {
+
+std::atomic<uint64_t> SharedClient::nextId(1);
+__thread uint64_t SharedClient::cachedClientId = 0;
+__thread SharedClient::ThreadSession *SharedClient::cachedThreadSession = nullptr;
+
+/**
+ * Start the I/O threads and connect each of them to the server.
+ *
+ * \param optionConfig
+ *      Configuration of the Contexts of the I/O threads; must outlive the
+ *      SharedClient.
+ * \param ioThreads
+ *      Number of I/O threads, and so of connections to the server.
+ * \throw TransportException
+ *      An I/O thread couldn't connect to the server.
+ */
+SharedClient::SharedClient(OptionConfig &optionConfig, const std::string &connectLocator, uint32_t ioThreads)
+    : Client(nullptr, Transport::SessionRef()), id(nextId++), ioThreads(), threadSessions(), lock() {
+    for (uint32_t i = 0; i < std::max(1u, ioThreads); i++) {
+        this->ioThreads.emplace_back(new IoThread(optionConfig, connectLocator));
+    }
+    for (auto &ioThread: this->ioThreads) {
+        while (!ioThread->ready.load(std::memory_order_acquire)) {
+            std::this_thread::yield();
+        }
+        if (ioThread->error) {
+            std::rethrow_exception(ioThread->error);
+        }
+    }
+    context = this->ioThreads[0]->context;
+    session = std::make_shared<SharedSession>(this, connectLocator);
+}
+
+/**
+ * Stops the I/O threads. No RPC may be outstanding.
+ */
+SharedClient::~SharedClient() {
+    session.reset();
+    ioThreads.clear();
+}
+
+/**
+ * Return the ThreadSession of the calling thread, binding the thread to an
+ * I/O thread the first time.
+ */
+SharedClient::ThreadSession *SharedClient::getThreadSession() {
+    if (cachedClientId == id) {
+        return cachedThreadSession;
+    }
+
+    std::lock_guard<SpinLock> guard(lock);
+    std::unique_ptr<ThreadSession> &threadSession = threadSessions[ThreadId::get()];
+    if (!threadSession) {
+        // Spread the calling threads over the I/O threads in the order
+        // they show up.
+        IoThread *ioThread = ioThreads[(threadSessions.size() - 1) % ioThreads.size()].get();
+        threadSession.reset(new ThreadSession(ioThread));
+        Dispatch::Lock dispatchLock(ioThread->context->dispatch);
+        ioThread->threadSessions.push_back(threadSession.get());
+    }
+    cachedClientId = id;
+    cachedThreadSession = threadSession.get();
+    return cachedThreadSession;
+}
+
+SharedClient::IoThread::IoThread(OptionConfig &optionConfig, const std::string &connectLocator)
+    : ready(false), error(), stop(false), context(nullptr), session(), threadSessions()
+      , thread(main, this, &optionConfig, connectLocator) {
+}
+
+SharedClient::IoThread::~IoThread() {
+    stop.store(true, std::memory_order_release);
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+/**
+ * Send every request waiting in the rings of the calling threads. Must be
+ * invoked in the I/O thread, or with its Dispatch locked.
+ *
+ * \return
+ *      The number of requests sent.
+ */
+int SharedClient::IoThread::drain() {
+    int count = 0;
+    for (ThreadSession *threadSession: threadSessions) {
+        uint32_t head = threadSession->head.load(std::memory_order_relaxed);
+        uint32_t tail = threadSession->tail.load(std::memory_order_acquire);
+        for (; head != tail; head++) {
+            Submission &submission = threadSession->ring[head & (ThreadSession::RING_SIZE - 1)];
+            session->sendRequest(submission.request, submission.response, submission.notifier);
+            count++;
+        }
+        threadSession->head.store(head, std::memory_order_release);
+    }
+    return count;
+}
+
+void SharedClient::IoThread::main(IoThread *ioThread, OptionConfig *optionConfig, std::string connectLocator) {
+    // The Context is created here so that this thread owns its Dispatch.
+    std::unique_ptr<Context> context;
+    std::unique_ptr<SubmissionPoller> poller;
+    try {
+        context.reset(new Context(*optionConfig, true));
+        ioThread->session = context->transport->getSession(connectLocator);
+        poller.reset(new SubmissionPoller(context->dispatch, ioThread));
+    } catch (...) {
+        ioThread->error = std::current_exception();
+        ioThread->session.reset();
+        ioThread->ready.store(true, std::memory_order_release);
+        return;
+    }
+    ioThread->context = context.get();
+    ioThread->ready.store(true, std::memory_order_release);
+
+    while (!ioThread->stop.load(std::memory_order_acquire)) {
+        context->dispatch->poll();
+    }
+    poller.reset();
+    ioThread->session.reset();
+}
+
+SharedClient::SubmissionPoller::SubmissionPoller(Dispatch *dispatch, IoThread *ioThread)
+    : Dispatch::Poller(dispatch, "SubmissionPoller"), ioThread(ioThread) {
+}
+
+int SharedClient::SubmissionPoller::poll() {
+    return ioThread->drain() > 0 ? 1 : 0;
+}
+
+SharedClient::SharedSession::SharedSession(SharedClient *client, const std::string &serviceLocator)
+    : Session(serviceLocator), client(client) {
+}
+
+void SharedClient::SharedSession::abort() {
+    for (auto &ioThread: client->ioThreads) {
+        Dispatch::Lock dispatchLock(ioThread->context->dispatch);
+        ioThread->drain();
+        ioThread->session->abort();
+    }
+}
+
+/**
+ * The request may still be in a ring, or sent by any of the I/O threads
+ * if it was retried from another thread, so each of them sends what is
+ * waiting and then cancels it on its session.
+ */
+void SharedClient::SharedSession::cancelRequest(Transport::RpcNotifier *notifier) {
+    for (auto &ioThread: client->ioThreads) {
+        Dispatch::Lock dispatchLock(ioThread->context->dispatch);
+        ioThread->drain();
+        ioThread->session->cancelRequest(notifier);
+    }
+}
+
+std::string SharedClient::SharedSession::getRpcInfo() {
+    return "SharedSession";
+}
+
+void SharedClient::SharedSession::sendRequest(Buffer *request, Buffer *response,
+                                              Transport::RpcNotifier *notifier) {
+    ThreadSession *threadSession = client->getThreadSession();
+    uint32_t tail = threadSession->tail.load(std::memory_order_relaxed);
+    while (tail - threadSession->head.load(std::memory_order_acquire) >= ThreadSession::RING_SIZE) {
+        // The ring is full: wait for the I/O thread to catch up.
+    }
+    threadSession->ring[tail & (ThreadSession::RING_SIZE - 1)] = {request, response, notifier};
+    threadSession->tail.store(tail + 1, std::memory_order_release);
+    threadSession->ioThread->context->dispatch->wakeup();
+}
+
+}
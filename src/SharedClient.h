@@ -0,0 +1,162 @@
+#ifndef GUNGNIR_SHAREDCLIENT_H
+#define GUNGNIR_SHAREDCLIENT_H
+
+#include <atomic>
+#include <exception>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "Client.h"
+#include "Dispatch.h"
+#include "SpinLock.h"
+
+namespace Gungnir {
+
+/**
+ * A Client that any number of threads may use at once. It runs its own
+ * client I/O threads, each with a Context of its own and a connection to
+ * the server. A calling thread is bound to one of them the first time it
+ * sends an RPC, and from then on hands its requests over through a
+ * single-producer ring of its own, which that I/O thread drains on each
+ * pass of its dispatch loop. Callers never poll a Dispatch: they spin on
+ * their RPCs until the I/O thread completes them.
+ */
+class SharedClient : public Client {
+
+public:
+    SharedClient(OptionConfig &optionConfig, const std::string &connectLocator, uint32_t ioThreads = 1);
+
+    ~SharedClient() override;
+
+private:
+    class IoThread;
+
+    /**
+     * Request handed from a calling thread to its I/O thread.
+     */
+    struct Submission {
+        Buffer *request;
+        Buffer *response;
+        Transport::RpcNotifier *notifier;
+    };
+
+    /**
+     * The lightweight session of one calling thread: the ring its requests
+     * go through.
+     */
+    struct ThreadSession {
+        explicit ThreadSession(IoThread *ioThread) : ioThread(ioThread), head(0), tail(0), ring() {}
+
+        /// I/O thread that drains the ring.
+        IoThread *ioThread;
+
+        /// Number of submissions taken by the I/O thread.
+        std::atomic<uint32_t> head;
+        char headPadding[60];
+
+        /// Number of submissions made by the calling thread.
+        std::atomic<uint32_t> tail;
+        char tailPadding[60];
+
+        /// Capacity of ring; must be a power of two.
+        static const uint32_t RING_SIZE = 256;
+
+        Submission ring[RING_SIZE];
+    };
+
+    /**
+     * A thread that owns a Context and a session to the server, and sends
+     * the requests of its calling threads on that session.
+     */
+    class IoThread {
+    public:
+        IoThread(OptionConfig &optionConfig, const std::string &connectLocator);
+
+        ~IoThread();
+
+        int drain();
+
+        /// Set once the thread's Context and session exist, or its setup
+        /// failed.
+        std::atomic<bool> ready;
+
+        /// Exception thrown by the setup of the thread, if any.
+        std::exception_ptr error;
+
+        /// Set to make the thread exit.
+        std::atomic<bool> stop;
+
+        /// The thread's Context; valid once ready is set.
+        Context *context;
+
+        /// Session the requests are sent on; valid once ready is set.
+        Transport::SessionRef session;
+
+        /// Sessions of the calling threads bound to this thread. Only
+        /// changed with the thread's Dispatch locked.
+        std::vector<ThreadSession *> threadSessions;
+
+        std::thread thread;
+
+    private:
+        static void main(IoThread *ioThread, OptionConfig *optionConfig, std::string connectLocator);
+    };
+
+    /**
+     * Drains the rings of the calling threads on each pass of an I/O
+     * thread's dispatch loop.
+     */
+    class SubmissionPoller : public Dispatch::Poller {
+    public:
+        SubmissionPoller(Dispatch *dispatch, IoThread *ioThread);
+
+        int poll() override;
+
+    private:
+        IoThread *ioThread;
+    };
+
+    /**
+     * The session of a SharedClient: passes each RPC to the ThreadSession
+     * of the calling thread.
+     */
+    class SharedSession : public Transport::Session {
+    public:
+        SharedSession(SharedClient *client, const std::string &serviceLocator);
+
+        void abort() override;
+
+        void cancelRequest(Transport::RpcNotifier *notifier) override;
+
+        std::string getRpcInfo() override;
+
+        void sendRequest(Buffer *request, Buffer *response, Transport::RpcNotifier *notifier) override;
+
+    private:
+        SharedClient *client;
+    };
+
+    ThreadSession *getThreadSession();
+
+    /// Distinguishes this SharedClient from others in the per-thread cache.
+    uint64_t id;
+
+    std::vector<std::unique_ptr<IoThread>> ioThreads;
+
+    /// Sessions of the calling threads, by ThreadId; protected by lock.
+    std::unordered_map<int, std::unique_ptr<ThreadSession>> threadSessions;
+    SpinLock lock;
+
+    /// Used to hand out the id of each SharedClient.
+    static std::atomic<uint64_t> nextId;
+
+    /// The ThreadSession the calling thread last used, and the id of the
+    /// SharedClient it belongs to.
+    static __thread uint64_t cachedClientId;
+    static __thread ThreadSession *cachedThreadSession;
+};
+
+}
+
+#endif //GUNGNIR_SHAREDCLIENT_H
@@ -0,0 +1,575 @@
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "ShmTransport.h"
+#include "Logger.h"
+#include "WorkerManager.h"
+
+namespace Gungnir {
+
+ShmTransport::ShmTransport(Context *context, const std::string &serviceLocator)
+    : context(context), locatorString(serviceLocator), name(), segment(nullptr), attachSerial(0), connections()
+      , sessions(), sessionLock(), poller(), serverRpcPool() {
+    if (!serviceLocator.empty()) {
+        name = segmentName(serviceLocator);
+        segment = mapSegment(name, true);
+        connections.resize(MAX_CLIENTS);
+    }
+    poller.reset(new ShmPoller(this));
+}
+
+ShmTransport::~ShmTransport() {
+    poller.reset();
+    for (Connection *connection : connections) {
+        if (connection != nullptr) {
+            delete connection;
+        }
+    }
+    if (segment != nullptr) {
+        munmap(segment, sizeof(Segment));
+        shm_unlink(name.c_str());
+    }
+}
+
+Transport::SessionRef ShmTransport::getSession(const std::string &serviceLocator) {
+    return std::make_shared<ShmSession>(this, serviceLocator);
+}
+
+std::string ShmTransport::getServiceLocator() {
+    return locatorString;
+}
+
+/**
+ * Returns whether a service locator names a shared memory server.
+ */
+bool ShmTransport::isShmLocator(const std::string &serviceLocator) {
+    return serviceLocator.compare(0, 4, "shm:") == 0;
+}
+
+/**
+ * Returns the name of the shared memory segment of the server at
+ * serviceLocator ("shm:name=...").
+ *
+ * \throw TransportException
+ *      The locator is malformed.
+ */
+std::string ShmTransport::segmentName(const std::string &serviceLocator) {
+    const std::string prefix = "shm:name=";
+    if (serviceLocator.compare(0, prefix.size(), prefix) != 0 ||
+        serviceLocator.size() == prefix.size() ||
+        serviceLocator.find('/', prefix.size()) != std::string::npos) {
+        throw TransportException(HERE, format("ShmTransport can't parse service locator '%s'",
+                                              serviceLocator.c_str()));
+    }
+    std::string name = serviceLocator.substr(prefix.size());
+    return "/gungnir." + name.substr(0, name.find(','));
+}
+
+/**
+ * Map a server's segment.
+ *
+ * \param create
+ *      True means create the segment afresh (for the server); false means
+ *      open an existing one (for a client).
+ *
+ * \throw TransportException
+ *      The segment couldn't be created or opened.
+ */
+ShmTransport::Segment *ShmTransport::mapSegment(const std::string &name, bool create) {
+    if (create) {
+        // A server that went away without cleaning up may have left the
+        // segment behind; its clients keep their mappings of it.
+        shm_unlink(name.c_str());
+    }
+    int fd = shm_open(name.c_str(), create ? O_RDWR | O_CREAT | O_EXCL : O_RDWR, 0600);
+    if (fd < 0) {
+        Logger::log(HERE, "ShmTransport couldn't open segment %s: %s", name.c_str(), strerror(errno));
+        throw TransportException(HERE, format("ShmTransport couldn't open segment %s", name.c_str()), errno);
+    }
+    if (create && ftruncate(fd, sizeof(Segment)) != 0) {
+        ::close(fd);
+        shm_unlink(name.c_str());
+        Logger::log(HERE, "ShmTransport couldn't size segment %s: %s", name.c_str(), strerror(errno));
+        throw TransportException(HERE, format("ShmTransport couldn't size segment %s", name.c_str()), errno);
+    }
+    void *memory = mmap(nullptr, sizeof(Segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (memory == MAP_FAILED) {
+        Logger::log(HERE, "ShmTransport couldn't map segment %s: %s", name.c_str(), strerror(errno));
+        throw TransportException(HERE, format("ShmTransport couldn't map segment %s", name.c_str()), errno);
+    }
+    auto *segment = static_cast<Segment *>(memory);
+    if (create) {
+        // The new segment is zero-filled: every slot is FREE with empty
+        // rings. Publish it last.
+        segment->magic.store(MAGIC, std::memory_order_release);
+    } else if (segment->magic.load(std::memory_order_acquire) != MAGIC) {
+        munmap(memory, sizeof(Segment));
+        throw TransportException(HERE, format("ShmTransport segment %s isn't initialized", name.c_str()));
+    }
+    return segment;
+}
+
+/**
+ * Copy up to length bytes into the ring.
+ *
+ * \return
+ *      The number of bytes written; less than length means the ring is
+ *      full.
+ */
+uint32_t ShmTransport::Ring::write(const void *src, uint32_t length) {
+    uint64_t position = tail.load(std::memory_order_relaxed);
+    auto space = static_cast<uint32_t>(RING_BYTES - (position - head.load(std::memory_order_acquire)));
+    length = std::min(length, space);
+    uint32_t offset = static_cast<uint32_t>(position) & (RING_BYTES - 1);
+    uint32_t first = std::min(length, RING_BYTES - offset);
+    memcpy(data + offset, src, first);
+    memcpy(data, static_cast<const char *>(src) + first, length - first);
+    tail.store(position + length, std::memory_order_release);
+    return length;
+}
+
+/**
+ * Consume up to length bytes from the ring.
+ *
+ * \param dest
+ *      Where the bytes are copied; NULL means discard them.
+ *
+ * \return
+ *      The number of bytes consumed; less than length means the ring is
+ *      empty.
+ */
+uint32_t ShmTransport::Ring::read(void *dest, uint32_t length) {
+    uint64_t position = head.load(std::memory_order_relaxed);
+    auto available = static_cast<uint32_t>(tail.load(std::memory_order_acquire) - position);
+    length = std::min(length, available);
+    if (dest != nullptr) {
+        uint32_t offset = static_cast<uint32_t>(position) & (RING_BYTES - 1);
+        uint32_t first = std::min(length, RING_BYTES - offset);
+        memcpy(dest, data + offset, first);
+        memcpy(static_cast<char *>(dest) + first, data, length - first);
+    }
+    head.store(position + length, std::memory_order_release);
+    return length;
+}
+
+/**
+ * Empty the ring; neither side may be using it.
+ */
+void ShmTransport::Ring::reset() {
+    head.store(0, std::memory_order_relaxed);
+    tail.store(0, std::memory_order_relaxed);
+}
+
+/**
+ * Write as much of the queued messages into ring as fits, retiring those
+ * that are completely written.
+ *
+ * \return
+ *      True means some bytes were written.
+ */
+bool ShmTransport::transmit(Ring *ring, OutgoingQueue *queue) {
+    bool progress = false;
+    while (!queue->messages.empty()) {
+        OutgoingMessage &message = queue->messages.front();
+        uint32_t total = static_cast<uint32_t>(sizeof(Header)) + message.header.len;
+        while (queue->sentBytes < total) {
+            uint32_t written;
+            if (queue->sentBytes < sizeof(Header)) {
+                written = ring->write(reinterpret_cast<char *>(&message.header) + queue->sentBytes,
+                                      static_cast<uint32_t>(sizeof(Header)) - queue->sentBytes);
+            } else {
+                void *data;
+                uint32_t length = message.payload->peek(
+                    queue->sentBytes - static_cast<uint32_t>(sizeof(Header)), &data);
+                written = ring->write(data, length);
+            }
+            if (written == 0) {
+                return progress;
+            }
+            queue->sentBytes += written;
+            progress = true;
+        }
+        OutgoingMessage done = message;
+        queue->messages.pop_front();
+        queue->sentBytes = 0;
+        completeMessage(done);
+    }
+    return progress;
+}
+
+/**
+ * Release what a message held once it has been written (or never will be).
+ */
+void ShmTransport::completeMessage(const OutgoingMessage &message) {
+    if (message.rpc == nullptr) {
+        // A request; the caller owns it.
+        return;
+    }
+    if (message.payload != &message.rpc->replyPayload) {
+        message.rpc->releaseFrame(message.payload);
+    } else {
+        destroyRpc(message.rpc);
+    }
+}
+
+/**
+ * Serve the attached clients: take the requests that have arrived and
+ * write the replies that are waiting.
+ *
+ * \return
+ *      The number of connections that made progress.
+ */
+int ShmTransport::pollConnections() {
+    if (segment->attachSerial.load(std::memory_order_acquire) != attachSerial) {
+        attachConnections();
+    }
+    int result = 0;
+    for (Connection *connection : connections) {
+        if (connection == nullptr || connection->closed) {
+            continue;
+        }
+        if (connection->slot->state.load(std::memory_order_acquire) == DETACHED) {
+            closeConnection(connection);
+            continue;
+        }
+        uint64_t head = connection->slot->requests.head.load(std::memory_order_relaxed);
+        receive(connection);
+        if (connection->closed) {
+            continue;
+        }
+        bool sent = transmit(&connection->slot->responses, &connection->outgoing);
+        if (sent || connection->slot->requests.head.load(std::memory_order_relaxed) != head) {
+            result++;
+        }
+    }
+    return result;
+}
+
+/**
+ * Pick up the clients that attached since the last scan.
+ */
+void ShmTransport::attachConnections() {
+    attachSerial = segment->attachSerial.load(std::memory_order_acquire);
+    for (uint32_t i = 0; i < MAX_CLIENTS; i++) {
+        Slot *slot = &segment->slots[i];
+        if (connections[i] == nullptr && slot->state.load(std::memory_order_acquire) == ATTACHED) {
+            connections[i] = new Connection(i, slot);
+        }
+    }
+}
+
+/**
+ * Read the requests that have arrived on a connection and hand the
+ * complete ones to the workers.
+ */
+void ShmTransport::receive(Connection *connection) {
+    Ring *ring = &connection->slot->requests;
+    IncomingMessage &incoming = connection->incoming;
+    while (true) {
+        if (incoming.headerBytes < sizeof(Header)) {
+            incoming.headerBytes += ring->read(reinterpret_cast<char *>(&incoming.header) + incoming.headerBytes,
+                                               static_cast<uint32_t>(sizeof(Header)) - incoming.headerBytes);
+            if (incoming.headerBytes < sizeof(Header)) {
+                return;
+            }
+            if (incoming.header.len > MAX_RPC_LEN) {
+                Logger::log(HERE, "ShmTransport received oversize message (%u bytes); "
+                                  "dropping client in slot %u", incoming.header.len, connection->index);
+                closeConnection(connection);
+                return;
+            }
+            connection->rpc = serverRpcPool.construct(connection, this);
+            connection->rpc->nonce = incoming.header.nonce;
+            connection->refs++;
+            incoming.bodyBytes = 0;
+            incoming.body = incoming.header.len > 0
+                            ? static_cast<char *>(connection->rpc->requestPayload.alloc(incoming.header.len))
+                            : nullptr;
+        }
+        if (incoming.bodyBytes < incoming.header.len) {
+            incoming.bodyBytes += ring->read(incoming.body + incoming.bodyBytes,
+                                             incoming.header.len - incoming.bodyBytes);
+            if (incoming.bodyBytes < incoming.header.len) {
+                return;
+            }
+        }
+        incoming.headerBytes = 0;
+        ShmServerRpc *rpc = connection->rpc;
+        connection->rpc = nullptr;
+        context->workerManager->handleRpc(rpc);
+    }
+}
+
+/**
+ * Stop serving a client that detached: its waiting replies are dropped,
+ * and its slot is freed once the workers are done with its RPCs.
+ */
+void ShmTransport::closeConnection(Connection *connection) {
+    connection->closed = true;
+    connection->refs++;
+    if (connection->rpc != nullptr) {
+        destroyRpc(connection->rpc);
+        connection->rpc = nullptr;
+    }
+    while (!connection->outgoing.messages.empty()) {
+        OutgoingMessage message = connection->outgoing.messages.front();
+        connection->outgoing.messages.pop_front();
+        completeMessage(message);
+    }
+    connection->refs--;
+    release(connection);
+}
+
+void ShmTransport::destroyRpc(ShmServerRpc *rpc) {
+    Connection *connection = rpc->connection;
+    serverRpcPool.destroy(rpc);
+    connection->refs--;
+    release(connection);
+}
+
+/**
+ * Free a closed connection and hand its slot back to clients once nothing
+ * references it any more.
+ */
+void ShmTransport::release(Connection *connection) {
+    if (!connection->closed || connection->refs > 0) {
+        return;
+    }
+    Slot *slot = connection->slot;
+    slot->requests.reset();
+    slot->responses.reset();
+    slot->pid.store(0, std::memory_order_relaxed);
+    slot->state.store(FREE, std::memory_order_release);
+    connections[connection->index] = nullptr;
+    delete connection;
+}
+
+/**
+ * Queue the reply behind any frames still waiting; the RPC is recycled
+ * once the reply has been written.
+ */
+void ShmTransport::ShmServerRpc::sendReply() {
+    sendFrames();
+    if (connection->closed) {
+        transport->destroyRpc(this);
+        return;
+    }
+    connection->outgoing.messages.push_back({this, &replyPayload, {nonce, replyPayload.size(), 0}});
+}
+
+/**
+ * Queue the frames a worker has produced so far.
+ */
+void ShmTransport::ShmServerRpc::sendFrames() {
+    while (Buffer *frame = popFrame()) {
+        if (connection->closed) {
+            // Nobody is listening anymore; let the worker run to completion.
+            releaseFrame(frame);
+            continue;
+        }
+        connection->outgoing.messages.push_back({this, frame, {nonce, frame->size(), MORE_FRAMES}});
+    }
+}
+
+std::string ShmTransport::ShmServerRpc::getClientServiceLocator() {
+    return format("shm:pid=%d,slot=%u", connection->slot->pid.load(std::memory_order_relaxed),
+                  connection->index);
+}
+
+ShmTransport::Connection::Connection(uint32_t index, Slot *slot)
+    : index(index), slot(slot), closed(false), refs(0), incoming(), rpc(nullptr), outgoing() {
+}
+
+/**
+ * Attach to the server at serviceLocator by claiming a free slot of its
+ * segment.
+ *
+ * \throw TransportException
+ *      The server can't be reached or has no free slot.
+ */
+ShmTransport::ShmSession::ShmSession(ShmTransport *transport, const std::string &serviceLocator)
+    : Session(serviceLocator), transport(transport), segment(nullptr), slot(nullptr), serial(1), rpcs(), outgoing()
+      , incoming(), canceledRequest(), lock() {
+    segment = mapSegment(segmentName(serviceLocator), false);
+    for (Slot &candidate : segment->slots) {
+        uint32_t expected = FREE;
+        if (candidate.state.compare_exchange_strong(expected, ATTACHED, std::memory_order_acq_rel)) {
+            slot = &candidate;
+            break;
+        }
+    }
+    if (slot == nullptr) {
+        munmap(segment, sizeof(Segment));
+        throw TransportException(HERE, format("ShmTransport server %s has no free slot",
+                                              serviceLocator.c_str()));
+    }
+    slot->pid.store(getpid(), std::memory_order_relaxed);
+    segment->attachSerial.fetch_add(1, std::memory_order_release);
+
+    SpinLock::Guard guard(transport->sessionLock);
+    transport->sessions.push_back(this);
+}
+
+ShmTransport::ShmSession::~ShmSession() {
+    {
+        SpinLock::Guard guard(transport->sessionLock);
+        transport->sessions.erase(std::find(transport->sessions.begin(), transport->sessions.end(), this));
+    }
+    close();
+    munmap(segment, sizeof(Segment));
+}
+
+void ShmTransport::ShmSession::abort() {
+    close();
+}
+
+/**
+ * Fail every outstanding RPC and give the slot back to the server.
+ */
+void ShmTransport::ShmSession::close() {
+    SpinLock::Guard guard(lock);
+    if (slot == nullptr) {
+        return;
+    }
+    slot->state.store(DETACHED, std::memory_order_release);
+    slot = nullptr;
+    outgoing.messages.clear();
+    for (auto &entry : rpcs) {
+        entry.second.notifier->failed();
+    }
+    rpcs.clear();
+}
+
+void ShmTransport::ShmSession::cancelRequest(RpcNotifier *notifier) {
+    SpinLock::Guard guard(lock);
+    for (auto it = rpcs.begin(); it != rpcs.end(); it++) {
+        if (it->second.notifier != notifier) {
+            continue;
+        }
+        uint64_t nonce = it->first;
+        Buffer *request = it->second.request;
+        rpcs.erase(it);
+
+        // The caller may free the buffers as soon as we return. A request
+        // that was partially written has to be completed, from a copy.
+        for (auto message = outgoing.messages.begin(); message != outgoing.messages.end(); message++) {
+            if (message->payload != request) {
+                continue;
+            }
+            if (message == outgoing.messages.begin() && outgoing.sentBytes > 0) {
+                canceledRequest.reset();
+                canceledRequest.append(request);
+                message->payload = &canceledRequest;
+            } else {
+                outgoing.messages.erase(message);
+            }
+            break;
+        }
+        if (incoming.headerBytes == sizeof(Header) && incoming.header.nonce == nonce) {
+            // The response is being read; discard the rest of it.
+            incoming.body = nullptr;
+        }
+        return;
+    }
+}
+
+std::string ShmTransport::ShmSession::getRpcInfo() {
+    return "ShmSession";
+}
+
+void ShmTransport::ShmSession::sendRequest(Buffer *request, Buffer *response, RpcNotifier *notifier) {
+    response->reset();
+    SpinLock::Guard guard(lock);
+    if (slot == nullptr) {
+        notifier->failed();
+        return;
+    }
+    uint64_t nonce = serial++;
+    rpcs[nonce] = {request, response, notifier};
+    outgoing.messages.push_back({nullptr, request, {nonce, request->size(), 0}});
+    transport->transmit(&slot->requests, &outgoing);
+}
+
+/**
+ * Write the requests that didn't fit into the ring earlier, and read the
+ * responses that have arrived.
+ */
+void ShmTransport::ShmSession::poll() {
+    SpinLock::Guard guard(lock);
+    if (slot == nullptr) {
+        return;
+    }
+    if (!outgoing.messages.empty()) {
+        transport->transmit(&slot->requests, &outgoing);
+    }
+    Ring *ring = &slot->responses;
+    while (true) {
+        if (incoming.headerBytes < sizeof(Header)) {
+            incoming.headerBytes += ring->read(reinterpret_cast<char *>(&incoming.header) + incoming.headerBytes,
+                                               static_cast<uint32_t>(sizeof(Header)) - incoming.headerBytes);
+            if (incoming.headerBytes < sizeof(Header)) {
+                return;
+            }
+            // Frames of a streamed response are appended to the ones
+            // already received.
+            auto it = rpcs.find(incoming.header.nonce);
+            incoming.bodyBytes = 0;
+            incoming.body = (it != rpcs.end() && incoming.header.len > 0)
+                            ? static_cast<char *>(it->second.response->alloc(incoming.header.len))
+                            : nullptr;
+        }
+        if (incoming.bodyBytes < incoming.header.len) {
+            incoming.bodyBytes += ring->read(incoming.body != nullptr ? incoming.body + incoming.bodyBytes : nullptr,
+                                             incoming.header.len - incoming.bodyBytes);
+            if (incoming.bodyBytes < incoming.header.len) {
+                return;
+            }
+        }
+        incoming.headerBytes = 0;
+        auto it = rpcs.find(incoming.header.nonce);
+        if (it == rpcs.end()) {
+            // Canceled.
+            continue;
+        }
+        if (incoming.header.flags & MORE_FRAMES) {
+            it->second.notifier->frameReceived();
+        } else {
+            RpcNotifier *notifier = it->second.notifier;
+            rpcs.erase(it);
+            notifier->completed();
+        }
+    }
+}
+
+ShmTransport::ShmPoller::ShmPoller(ShmTransport *transport)
+    : Dispatch::Poller(transport->context->dispatch, "ShmPoller"), transport(transport) {
+}
+
+/**
+ * Nobody can wake the dispatch thread of a server from another process, so
+ * while clients are attached this counts as work and keeps an inline-polling
+ * Dispatch from blocking in epoll_wait.
+ */
+int ShmTransport::ShmPoller::poll() {
+    int result = 0;
+    if (transport->segment != nullptr) {
+        result += transport->pollConnections();
+        for (Connection *connection : transport->connections) {
+            if (connection != nullptr) {
+                result++;
+                break;
+            }
+        }
+    }
+    SpinLock::Guard guard(transport->sessionLock);
+    for (ShmSession *session : transport->sessions) {
+        session->poll();
+    }
+    return result;
+}
+
+}
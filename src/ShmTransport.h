@@ -0,0 +1,360 @@
+#ifndef GUNGNIR_SHMTRANSPORT_H
+#define GUNGNIR_SHMTRANSPORT_H
+
+#include <atomic>
+#include <deque>
+#include <unordered_map>
+#include <vector>
+
+#include "Transport.h"
+#include "Dispatch.h"
+#include "Context.h"
+#include "ObjectPool.h"
+#include "SpinLock.h"
+
+namespace Gungnir {
+
+/**
+ * A transport for clients on the same host as the server. The server
+ * creates a POSIX shared memory segment named by its locator
+ * ("shm:name=..."); a client attaches by claiming one of its slots, each of
+ * which holds a pair of single-producer, single-consumer byte rings: one
+ * for requests, one for responses. Messages are framed as in TcpTransport.
+ *
+ * There are no system calls on the request path: the ring positions serve
+ * as doorbells, and each side's dispatch loop polls the rings it consumes
+ * on every pass.
+ */
+class ShmTransport : public Transport {
+
+public:
+    explicit ShmTransport(Context *context, const std::string &serviceLocator);
+
+    ~ShmTransport() override;
+
+    SessionRef getSession(const std::string &serviceLocator) override;
+
+    std::string getServiceLocator() override;
+
+    static bool isShmLocator(const std::string &serviceLocator);
+
+    class ShmServerRpc;
+
+private:
+
+    class Connection;
+
+    class ShmSession;
+
+    /**
+     * Header for request and response messages; identical to the one of
+     * TcpTransport.
+     */
+    struct Header {
+        /// Unique identifier for this RPC, generated on the client.
+        uint64_t nonce;
+
+        /// The size in bytes of the payload (which follows immediately).
+        uint32_t len;
+
+        /// OR'ed combination of HeaderFlags values.
+        uint8_t flags;
+    } __attribute__((packed));
+
+    enum HeaderFlags : uint8_t {
+        /// This message is one frame of a streamed response.
+        MORE_FRAMES = 1
+    };
+
+    /// Number of clients that can be attached at once.
+    static const uint32_t MAX_CLIENTS = 64;
+
+    /// Capacity of each ring; must be a power of two.
+    static const uint32_t RING_BYTES = 1u << 18;
+
+    /// Stored in a segment once it is initialized.
+    static const uint32_t MAGIC = 0x474e5331;
+
+    /**
+     * A byte stream from one process to another. Only the producer
+     * advances tail and only the consumer advances head; both count bytes
+     * since the ring was reset.
+     */
+    struct Ring {
+        std::atomic<uint64_t> head;
+        char headPadding[56];
+        std::atomic<uint64_t> tail;
+        char tailPadding[56];
+        char data[RING_BYTES];
+
+        uint32_t write(const void *src, uint32_t length);
+
+        uint32_t read(void *dest, uint32_t length);
+
+        void reset();
+    };
+
+    enum SlotState : uint32_t {
+        /// No client; the server owns the slot.
+        FREE = 0,
+
+        /// Claimed by a client.
+        ATTACHED = 1,
+
+        /// Given up by its client; the server frees it once the requests
+        /// it is serving are done.
+        DETACHED = 2
+    };
+
+    /**
+     * The part of the segment used by one client.
+     */
+    struct Slot {
+        /// SlotState value.
+        std::atomic<uint32_t> state;
+
+        /// Process id of the client.
+        std::atomic<int32_t> pid;
+        char padding[56];
+
+        Ring requests;
+        Ring responses;
+    };
+
+    /**
+     * Layout of the shared memory segment.
+     */
+    struct Segment {
+        /// MAGIC once the server has initialized the segment.
+        std::atomic<uint32_t> magic;
+
+        /// Incremented by each client that attaches, so the server only
+        /// scans the slots when one did.
+        std::atomic<uint32_t> attachSerial;
+        char padding[56];
+
+        Slot slots[MAX_CLIENTS];
+    };
+
+public:
+    /**
+     * The shared memory implementation of Transport::ServerRpc.
+     */
+    class ShmServerRpc : public Transport::ServerRpc {
+        friend class ShmTransport;
+
+        friend class ObjectPool<ShmServerRpc>;
+
+    public:
+        ShmServerRpc(Connection *connection, ShmTransport *transport)
+            : connection(connection), transport(transport), nonce(0) {}
+
+        ~ShmServerRpc() override = default;
+
+        void sendReply() override;
+
+        void sendFrames() override;
+
+        std::string getClientServiceLocator() override;
+
+    private:
+        /// Connection the request arrived on; kept alive by this RPC.
+        Connection *connection;
+
+        ShmTransport *transport;
+
+        /// Nonce of the request, echoed in every message of the reply.
+        uint64_t nonce;
+    };
+
+private:
+    /**
+     * One message waiting to be written into a ring.
+     */
+    struct OutgoingMessage {
+        /// Server RPC the message answers, or NULL for a client request.
+        ShmServerRpc *rpc;
+
+        /// Contents of the message: a request, a frame of a streamed
+        /// reply or rpc->replyPayload.
+        Buffer *payload;
+
+        Header header;
+    };
+
+    /**
+     * Messages waiting to be written into a ring, oldest first.
+     */
+    struct OutgoingQueue {
+        OutgoingQueue() : messages(), sentBytes(0) {}
+
+        std::deque<OutgoingMessage> messages;
+
+        /// Bytes of the front message already written.
+        uint32_t sentBytes;
+    };
+
+    /**
+     * State of a message being read from a ring.
+     */
+    struct IncomingMessage {
+        IncomingMessage() : header(), headerBytes(0), bodyBytes(0), body(nullptr) {}
+
+        Header header;
+
+        /// Bytes of header and body read so far.
+        uint32_t headerBytes;
+        uint32_t bodyBytes;
+
+        /// Where the body goes; NULL means it is discarded.
+        char *body;
+    };
+
+    /**
+     * A client attached to a slot of the server's segment.
+     */
+    class Connection {
+    public:
+        Connection(uint32_t index, Slot *slot);
+
+        /// Index of slot in the segment.
+        uint32_t index;
+
+        Slot *slot;
+
+        /// True once the client has detached; the connection is freed
+        /// when refs drops to zero.
+        bool closed;
+
+        /// Number of RPCs alive that reference this connection.
+        int refs;
+
+        IncomingMessage incoming;
+
+        /// RPC the request being read is assembled in, or NULL.
+        ShmServerRpc *rpc;
+
+        OutgoingQueue outgoing;
+    };
+
+    /**
+     * A client's attachment to a server; see ShmTransport.
+     */
+    class ShmSession : public Session {
+    public:
+        ShmSession(ShmTransport *transport, const std::string &serviceLocator);
+
+        ~ShmSession() override;
+
+        void abort() override;
+
+        void cancelRequest(RpcNotifier *notifier) override;
+
+        std::string getRpcInfo() override;
+
+        void sendRequest(Buffer *request, Buffer *response,
+                         RpcNotifier *notifier) override;
+
+        void poll();
+
+    private:
+        void close();
+
+        /**
+         * An RPC waiting for its response.
+         */
+        struct ClientRpc {
+            Buffer *request;
+            Buffer *response;
+            RpcNotifier *notifier;
+        };
+
+        ShmTransport *transport;
+
+        /// The server's segment, mapped into this process.
+        Segment *segment;
+
+        /// Slot this session claimed, or NULL once closed.
+        Slot *slot;
+
+        /// Nonce of the next request.
+        uint64_t serial;
+
+        /// Outstanding RPCs, by nonce.
+        std::unordered_map<uint64_t, ClientRpc> rpcs;
+
+        OutgoingQueue outgoing;
+
+        IncomingMessage incoming;
+
+        /// Holds the unwritten rest of a request that was canceled while
+        /// partially written, so the stream stays framed.
+        Buffer canceledRequest;
+
+        /// Serializes the caller's thread and the dispatch thread.
+        SpinLock lock;
+    };
+
+    /**
+     * Moves messages between the rings and the RPCs on each pass of the
+     * dispatch loop.
+     */
+    class ShmPoller : public Dispatch::Poller {
+    public:
+        explicit ShmPoller(ShmTransport *transport);
+
+        int poll() override;
+
+    private:
+        ShmTransport *transport;
+    };
+
+    static std::string segmentName(const std::string &serviceLocator);
+
+    static Segment *mapSegment(const std::string &name, bool create);
+
+    int pollConnections();
+
+    void attachConnections();
+
+    void receive(Connection *connection);
+
+    bool transmit(Ring *ring, OutgoingQueue *queue);
+
+    void completeMessage(const OutgoingMessage &message);
+
+    void closeConnection(Connection *connection);
+
+    void destroyRpc(ShmServerRpc *rpc);
+
+    void release(Connection *connection);
+
+    Context *context;
+
+    std::string locatorString;
+
+    /// Name of the segment this server created, or empty for a client.
+    std::string name;
+
+    /// The segment this server serves, or NULL.
+    Segment *segment;
+
+    /// Value of segment->attachSerial when the slots were last scanned.
+    uint32_t attachSerial;
+
+    /// Attached clients, indexed by slot.
+    std::vector<Connection *> connections;
+
+    /// Sessions opened through this transport; protected by sessionLock.
+    std::vector<ShmSession *> sessions;
+    SpinLock sessionLock;
+
+    std::unique_ptr<ShmPoller> poller;
+
+    /// Pool allocator for our ServerRpc objects.
+    ObjectPool<ShmServerRpc> serverRpcPool;
+};
+
+}
+
+#endif //GUNGNIR_SHMTRANSPORT_H
@@ -1,8 +1,9 @@
 #include "TaskQueue.h"
+#include "OptionConfig.h"
 
 namespace Gungnir {
 
-Task::Task() {
+Task::Task() : taskQueue(nullptr), lane(READ_LANE), scheduled(false) {
 
 }
 
@@ -18,14 +19,16 @@ bool Task::isScheduled() {
     return scheduled;
 }
 
-TaskQueue::TaskQueue(Context *context) : context(context), tasks() {
+TaskQueue::TaskQueue(Context *context)
+    : context(context)
+      , tasks(context->optionConfig != nullptr ? LaneWeights(context->optionConfig->laneWeights) : LaneWeights()) {
 
 }
 
 void TaskQueue::schedule(Task *task) {
     task->taskQueue = this;
     task->scheduled = true;
-    tasks.push(task);
+    tasks.push(task->lane, task);
 }
 
 bool TaskQueue::isIdle() {
@@ -35,8 +38,7 @@ bool TaskQueue::isIdle() {
 Task *TaskQueue::getNextTask() {
     if (tasks.empty())
         return nullptr;
-    Task *task = tasks.front();
-    tasks.pop();
+    Task *task = tasks.pop();
     task->scheduled = false;
     return task;
 }
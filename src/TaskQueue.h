@@ -1,8 +1,8 @@
 #ifndef GUNGNIR_TASKQUEUE_H
 #define GUNGNIR_TASKQUEUE_H
 
-#include <queue>
 #include "Context.h"
+#include "PriorityLanes.h"
 
 namespace Gungnir {
 
@@ -24,6 +24,9 @@ protected:
 
     TaskQueue *taskQueue;
 
+    /// Lane the task waits in when it is scheduled; see PriorityLanes.
+    uint32_t lane;
+
 private:
     bool scheduled;
 
@@ -46,7 +49,7 @@ public:
 protected:
     Context *context;
 
-    std::queue<Task *> tasks;
+    PriorityLanes<Task *> tasks;
 
     Task *getNextTask();
 };
@@ -19,13 +19,16 @@
 namespace Gungnir {
 
 TcpTransport::TcpTransport(Context *context, const std::string &serviceLocator)
-    : context(context), locatorString(serviceLocator), listenSocket(-1), acceptHandler(), sockets(), nextSocketId(100)
-      , serverRpcPool(), clientRpcPool() {
+    : context(context), locatorString(serviceLocator), listenSocket(-1), unixPath(), acceptHandler(), sockets()
+      , nextSocketId(100)
+      , socketsToFlush(), flushPoller(), serverRpcPool(), clientRpcPool() {
     if (serviceLocator.empty())
         return;
 
-    IpAddress address(serviceLocator);
-    listenSocket = socket(PF_INET, SOCK_STREAM, 0);
+    flushPoller.reset(new FlushPoller(this));
+
+    bool local = isUnixLocator(serviceLocator);
+    listenSocket = socket(local ? PF_UNIX : PF_INET, SOCK_STREAM, 0);
 
     if (listenSocket == -1) {
         Logger::log(HERE, "TcpTransport couldn't create listen socket: %s", strerror(errno));
@@ -43,6 +46,42 @@ TcpTransport::TcpTransport(Context *context, const std::string &serviceLocator)
             HERE, "TcpTransport couldn't set nonblocking on listen socket", errno);
     }
 
+    if (local) {
+        sockaddr_un address = unixAddress(serviceLocator);
+        // A server that went away leaves its socket file behind.
+        unlink(address.sun_path);
+        if (bind(listenSocket, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == -1) {
+            close(listenSocket);
+            std::string message = format("TcpTransport couldn't bind to '%s'",
+                                         serviceLocator.c_str());
+            Logger::log(HERE, "%s: %s", message.c_str(), strerror(errno));
+            throw TransportException(HERE, message, errno);
+        }
+        unixPath = address.sun_path;
+    } else {
+        bindTcp(serviceLocator);
+    }
+
+    if (listen(listenSocket, INT_MAX) == -1) {
+        close(listenSocket);
+        Logger::log(HERE, "TcpTransport couldn't listen on socket: %s",
+                    strerror(errno));
+        throw TransportException(HERE,
+                                 "TcpTransport couldn't listen on socket", errno);
+    }
+
+    // Arrange to be notified whenever anyone connects to listenSocket.
+    acceptHandler.reset(new AcceptHandler(listenSocket, this));
+}
+
+/**
+ * Bind the listen socket to the TCP address of serviceLocator.
+ *
+ * \throw TransportException
+ *      The socket couldn't be bound.
+ */
+void TcpTransport::bindTcp(const std::string &serviceLocator) {
+    IpAddress address(serviceLocator);
     int optval = 1;
     if (setsockopt(listenSocket, SOL_SOCKET, SO_REUSEADDR, &optval,
                    sizeof(optval)) != 0) {
@@ -53,6 +92,17 @@ TcpTransport::TcpTransport(Context *context, const std::string &serviceLocator)
             HERE, "TcpTransport couldn't set SO_REUSEADDR on listen socket", errno);
     }
 
+    // Each dispatch thread of a server has its own transport listening on
+    // the same address; the kernel spreads incoming connections over them.
+    if (setsockopt(listenSocket, SOL_SOCKET, SO_REUSEPORT, &optval,
+                   sizeof(optval)) != 0) {
+        close(listenSocket);
+        Logger::log(HERE, "TcpTransport couldn't set SO_REUSEPORT on "
+                          "listen socket: %s", strerror(errno));
+        throw TransportException(
+            HERE, "TcpTransport couldn't set SO_REUSEPORT on listen socket", errno);
+    }
+
     if (bind(listenSocket, &address.address,
              sizeof(address.address)) == -1) {
         close(listenSocket);
@@ -61,17 +111,6 @@ TcpTransport::TcpTransport(Context *context, const std::string &serviceLocator)
         Logger::log(HERE, "%s: %s", message.c_str(), strerror(errno));
         throw TransportException(HERE, message, errno);
     }
-
-    if (listen(listenSocket, INT_MAX) == -1) {
-        close(listenSocket);
-        Logger::log(HERE, "TcpTransport couldn't listen on socket: %s",
-                    strerror(errno));
-        throw TransportException(HERE,
-                                 "TcpTransport couldn't listen on socket", errno);
-    }
-
-    // Arrange to be notified whenever anyone connects to listenSocket.
-    acceptHandler.reset(new AcceptHandler(listenSocket, this));
 }
 
 TcpTransport::~TcpTransport() {
@@ -79,6 +118,9 @@ TcpTransport::~TcpTransport() {
         close(listenSocket);
         listenSocket = -1;
     }
+    if (!unixPath.empty()) {
+        unlink(unixPath.c_str());
+    }
     for (unsigned int i = 0; i < sockets.size(); i++) {
         if (sockets[i] != nullptr) {
             closeSocket(i);
@@ -94,8 +136,47 @@ std::string TcpTransport::getServiceLocator() {
     return locatorString;
 }
 
+/**
+ * Returns whether a service locator names a Unix domain socket.
+ */
+bool TcpTransport::isUnixLocator(const std::string &serviceLocator) {
+    return serviceLocator.compare(0, 5, "unix:") == 0;
+}
+
+/**
+ * Returns the address of the Unix domain socket named by serviceLocator
+ * ("unix:path=...").
+ *
+ * \throw TransportException
+ *      The locator is malformed, or the path is too long.
+ */
+sockaddr_un TcpTransport::unixAddress(const std::string &serviceLocator) {
+    const std::string prefix = "unix:path=";
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    std::string path = serviceLocator.substr(std::min(prefix.size(), serviceLocator.size()));
+    if (serviceLocator.compare(0, prefix.size(), prefix) != 0 || path.empty() ||
+        path.size() >= sizeof(address.sun_path)) {
+        throw TransportException(HERE, format("TcpTransport can't parse service locator '%s'",
+                                              serviceLocator.c_str()));
+    }
+    memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    return address;
+}
+
+/**
+ * Ask for large kernel buffers on a Unix domain socket. The kernel caps
+ * the sizes at net.core.[rw]mem_max; that is not an error.
+ */
+void TcpTransport::setBufferSizes(int fd) {
+    int size = UNIX_BUFFER_BYTES;
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+}
+
 TcpTransport::IncomingMessage::IncomingMessage(Buffer *buffer, TcpTransport::TcpSession *session)
-    : header(), headerBytesReceived(0), messageBytesReceived(0), messageLength(0), buffer(buffer), session(session) {
+    : header(), headerBytesReceived(0), messageBytesReceived(0), messageLength(0), bufferOffset(0), buffer(buffer)
+      , session(session) {
 
 }
 
@@ -109,6 +190,9 @@ void TcpTransport::IncomingMessage::cancel() {
  *
  * \param fd
  *      File descriptor to use for reading message info.
+ * \param ring
+ *      Receive ring of that socket; the message is parsed from it, and
+ *      it is refilled when it runs empty.
  * \return
  *      True means the message is complete (it's present in the
  *      buffer provided to the constructor); false means we still need
@@ -117,16 +201,16 @@ void TcpTransport::IncomingMessage::cancel() {
  * \throw TransportException
  *      An I/O error occurred.
  */
-bool TcpTransport::IncomingMessage::readMessage(int fd) {
+bool TcpTransport::IncomingMessage::readMessage(int fd, ReceiveRing *ring) {
     // First make sure we have received the header (it may arrive in
     // multiple chunks).
-    if (headerBytesReceived < sizeof(Header)) {
-        ssize_t len = TcpTransport::recvCarefully(fd,
-                                                  reinterpret_cast<char *>(&header) + headerBytesReceived,
-                                                  sizeof(header) - headerBytesReceived);
-        headerBytesReceived += static_cast<uint32_t>(len);
-        if (headerBytesReceived < sizeof(Header))
+    while (headerBytesReceived < sizeof(Header)) {
+        if (ring->size() == 0 && !ring->fill(fd))
             return false;
+        headerBytesReceived += ring->take(reinterpret_cast<char *>(&header) + headerBytesReceived,
+                                          sizeof(header) - headerBytesReceived);
+        if (headerBytesReceived < sizeof(Header))
+            continue;
 
         // Header is complete; check for various errors and set up for
         // reading the body.
@@ -140,76 +224,214 @@ bool TcpTransport::IncomingMessage::readMessage(int fd) {
         if ((buffer == nullptr) && (session != nullptr)) {
             buffer = session->findRpc(&header);
         }
-        if (buffer == nullptr)
+        if (buffer == nullptr) {
             messageLength = 0;
+        } else if (messageLength > 0) {
+            // Later frames of a streamed response are appended after the
+            // ones already received.
+            bufferOffset = buffer->size();
+            if (messageLength <= ReceiveRing::MAX_VIEW && ring->size() >= messageLength) {
+                // A small body that has fully arrived: refer to it in place.
+                ring->appendView(buffer, messageLength);
+                messageBytesReceived = messageLength;
+                return true;
+            }
+            buffer->alloc(messageLength);
+        }
     }
 
     // We have the header; now receive the message body (it may take several
-    // calls to this method before we get all of it).
-    if (messageBytesReceived < messageLength) {
-        void *dest;
-        if (buffer->size() == 0) {
-            dest = buffer->alloc(messageLength);
+    // calls to this method before we get all of it), and discard any
+    // extraneous bytes.
+    while (messageBytesReceived < header.len) {
+        uint32_t wanted = messageLength > messageBytesReceived ? messageLength - messageBytesReceived : 0;
+        if (ring->size() == 0) {
+            if (wanted >= ReceiveRing::MIN_DIRECT) {
+                // Bulk data: skip the extra copy through the ring.
+                void *dest;
+                buffer->peek(bufferOffset + messageBytesReceived, &dest);
+                uint32_t len = ring->receive(fd, dest, wanted);
+                messageBytesReceived += len;
+                if (len < wanted)
+                    return false;
+                continue;
+            }
+            if (!ring->fill(fd))
+                return false;
+        }
+        uint32_t len;
+        if (wanted > 0) {
+            void *dest;
+            buffer->peek(bufferOffset + messageBytesReceived, &dest);
+            len = ring->take(dest, wanted);
         } else {
-            buffer->peek(messageBytesReceived, &dest);
+            len = ring->skip(header.len - messageBytesReceived);
         }
-        ssize_t len = TcpTransport::recvCarefully(fd, dest,
-                                                  messageLength - messageBytesReceived);
-        messageBytesReceived += static_cast<uint32_t>(len);
-        if (messageBytesReceived < messageLength)
-            return false;
+        messageBytesReceived += len;
     }
+    return true;
+}
 
-    // We have the header and the message body, but we may have to discard
-    // extraneous bytes.
-    if (messageBytesReceived < header.len) {
-        char buffer[4096];
-        uint32_t maxLength = header.len - messageBytesReceived;
-        if (maxLength > sizeof(buffer))
-            maxLength = sizeof(buffer);
-        ssize_t len = TcpTransport::recvCarefully(fd, buffer, maxLength);
-        messageBytesReceived += static_cast<uint32_t>(len);
-        if (messageBytesReceived < header.len)
-            return false;
+TcpTransport::ReceiveRing::ReceiveRing()
+    : block(new Block()), start(0), end(0), drained(false) {
+}
+
+TcpTransport::ReceiveRing::~ReceiveRing() {
+    block->release();
+}
+
+/**
+ * Receive as many bytes as the socket holds and there is room for, with a
+ * single recv.
+ *
+ * \return
+ *      False means nothing was received: the socket is empty.
+ *
+ * \throw TransportException
+ *      An I/O error occurred.
+ */
+bool TcpTransport::ReceiveRing::fill(int fd) {
+    if (drained) {
+        // The last recv emptied the socket; don't spend a system call to
+        // learn that again.
+        drained = false;
+        return false;
     }
-    return true;
+    if (start == end && block->refs.load(std::memory_order_acquire) == 1) {
+        start = end = 0;
+    }
+    if (BLOCK_SIZE - end < MAX_VIEW) {
+        makeRoom();
+    }
+    uint32_t space = BLOCK_SIZE - end;
+    auto len = static_cast<uint32_t>(TcpTransport::recvCarefully(fd, block->data + end, space));
+    end += len;
+    drained = len < space;
+    return len > 0;
+}
+
+/**
+ * Receive part of a large message body straight into its destination,
+ * bypassing the ring (which must be empty).
+ *
+ * \return
+ *      The number of bytes received; less than \a length means the socket
+ *      is empty.
+ *
+ * \throw TransportException
+ *      An I/O error occurred.
+ */
+uint32_t TcpTransport::ReceiveRing::receive(int fd, void *dest, uint32_t length) {
+    assert(size() == 0);
+    if (drained) {
+        drained = false;
+        return 0;
+    }
+    return static_cast<uint32_t>(TcpTransport::recvCarefully(fd, dest, length));
+}
+
+/**
+ * Copy up to \a length unparsed bytes to \a dest and consume them.
+ *
+ * \return
+ *      The number of bytes copied.
+ */
+uint32_t TcpTransport::ReceiveRing::take(void *dest, uint32_t length) {
+    length = std::min(length, size());
+    memcpy(dest, block->data + start, length);
+    start += length;
+    return length;
+}
+
+/**
+ * Consume up to \a length unparsed bytes without looking at them.
+ *
+ * \return
+ *      The number of bytes consumed.
+ */
+uint32_t TcpTransport::ReceiveRing::skip(uint32_t length) {
+    length = std::min(length, size());
+    start += length;
+    return length;
+}
+
+/**
+ * Consume \a length unparsed bytes (which must have arrived) by appending
+ * a view of them to \a buffer.
+ */
+void TcpTransport::ReceiveRing::appendView(Buffer *buffer, uint32_t length) {
+    assert(length <= size());
+    buffer->appendChunk(new View(block, block->data + start, length));
+    start += length;
+}
+
+/**
+ * Make room at the end of the storage by moving the unparsed bytes to the
+ * front: in place if no view refers to the block, else into a new block.
+ */
+void TcpTransport::ReceiveRing::makeRoom() {
+    uint32_t pending = size();
+    if (block->refs.load(std::memory_order_acquire) == 1) {
+        memmove(block->data, block->data + start, pending);
+    } else {
+        Block *fresh = new Block();
+        memcpy(fresh->data, block->data + start, pending);
+        block->release();
+        block = fresh;
+    }
+    start = 0;
+    end = pending;
+}
+
+TcpTransport::ReceiveRing::View::View(Block *block, char *data, uint32_t length)
+    : Chunk(data, length), block(block) {
+    block->refs.fetch_add(1, std::memory_order_relaxed);
 }
 
+TcpTransport::ReceiveRing::View::~View() {
+    block->release();
+}
+
+/**
+ * Queue the reply for transmission behind any frames still waiting; it goes
+ * out at the end of the current dispatch pass, together with the other
+ * replies on the same socket, and the RPC is recycled once it is out.
+ */
 void TcpTransport::TcpServerRpc::sendReply() {
-    try {
-        Socket *socket = transport->sockets[fd];
+    Socket *socket = transport->sockets[fd];
 
-        // It's possible that our fd has been closed (or even reused for a
-        // new connection); if so, just discard the RPC without sending
-        // a response.
-        if ((socket != nullptr) && (socket->id == socketId)) {
-            if (!socket->rpcsWaitingToReply.empty()) {
-                // Can't transmit the response yet; the socket is backed up.
-                socket->rpcsWaitingToReply.push_back(this);
-                return;
-            }
+    // It's possible that our fd has been closed (or even reused for a
+    // new connection); if so, just discard the RPC without sending
+    // a response.
+    if ((socket == nullptr) || (socket->id != socketId)) {
+        transport->serverRpcPool.destroy(this);
+        return;
+    }
+    sendFrames();
+    transport->queueMessage(socket, this, nullptr);
+}
 
-            // Try to transmit the response.
-            socket->bytesLeftToSend = TcpTransport::sendMessage(
-                fd, message.header.nonce, &replyPayload, -1);
-            if (socket->bytesLeftToSend > 0) {
-                socket->rpcsWaitingToReply.push_back(this);
-                socket->ioHandler.setEvents(Dispatch::FileEvent::READABLE |
-                                            Dispatch::FileEvent::WRITABLE);
-                return;
-            }
+/**
+ * Queue the frames a worker has produced so far.
+ */
+void TcpTransport::TcpServerRpc::sendFrames() {
+    Socket *socket = transport->sockets[fd];
+    bool closed = (socket == nullptr) || (socket->id != socketId);
+    while (Buffer *frame = popFrame()) {
+        if (closed) {
+            // Nobody is listening anymore; let the worker run to completion.
+            releaseFrame(frame);
+            continue;
         }
-    } catch (TransportException &e) {
-        transport->closeSocket(fd);
+        transport->queueMessage(socket, this, frame);
     }
-
-    // The whole response was sent immediately (this should be the
-    // common case).  Recycle the RPC object.
-    transport->serverRpcPool.destroy(this);
 }
 
 std::string TcpTransport::TcpServerRpc::getClientServiceLocator() {
     Socket *socket = transport->sockets[fd];
+    if (!transport->unixPath.empty()) {
+        return "unix:path=" + transport->unixPath;
+    }
     return format("tcp:host=%s,port=%hu", inet_ntoa(socket->sin.sin_addr),
                   NTOHS(socket->sin.sin_port));
 }
@@ -241,12 +463,124 @@ ssize_t TcpTransport::recvCarefully(int fd, void *buffer, size_t length) {
 }
 
 
-int TcpTransport::sendMessage(int fd, uint64_t nonce, Buffer *payload, int bytesToSend) {
+/**
+ * Append a message to the ones waiting on \a socket, and make sure the
+ * socket gets flushed.
+ *
+ * \param frame
+ *      Frame of a streamed reply to \a rpc; NULL means its final reply.
+ */
+void TcpTransport::queueMessage(Socket *socket, TcpServerRpc *rpc, Buffer *frame) {
+    Buffer *payload = frame != nullptr ? frame : &rpc->replyPayload;
+    socket->outgoing.push_back({rpc, frame, {rpc->message.header.nonce, payload->size(),
+                                             static_cast<uint8_t>(frame != nullptr ? MORE_FRAMES : 0)}});
+    if (!socket->flushQueued && !socket->backedUp) {
+        socket->flushQueued = true;
+        socketsToFlush.push_back(rpc->fd);
+    }
+}
+
+/**
+ * Transmit as many waiting messages of \a socket (open on \a fd) as it
+ * accepts. Messages are gathered into as few sendmsg calls as possible, so
+ * replies to pipelined requests share system calls and packets; a message
+ * may be split between calls.
+ *
+ * \return
+ *      True means every message went out; false means the socket is
+ *      backed up.
+ *
+ * \throw TransportException
+ *      An I/O error occurred.
+ */
+bool TcpTransport::flush(int fd, Socket *socket) {
+    struct iovec iov[MAX_SEND_IOVECS];
+    while (!socket->outgoing.empty()) {
+        uint32_t iovecs = 0;
+        size_t bytes = 0;
+        uint32_t skip = socket->sentBytes;
+        for (OutgoingMessage &message : socket->outgoing) {
+            if (iovecs + 2 > MAX_SEND_IOVECS) {
+                break;
+            }
+            uint32_t offset = 0;
+            if (skip < sizeof(Header)) {
+                iov[iovecs].iov_base = reinterpret_cast<char *>(&message.header) + skip;
+                iov[iovecs].iov_len = sizeof(Header) - skip;
+                bytes += iov[iovecs].iov_len;
+                iovecs++;
+            } else {
+                offset = skip - static_cast<uint32_t>(sizeof(Header));
+            }
+            skip = 0;
+            Buffer *payload = message.frame != nullptr ? message.frame : &message.rpc->replyPayload;
+            Buffer::Iterator iter(payload, offset, message.header.len - offset);
+            while (!iter.isDone() && iovecs < MAX_SEND_IOVECS) {
+                iov[iovecs].iov_base = const_cast<void *>(iter.getData());
+                iov[iovecs].iov_len = iter.getLength();
+                bytes += iov[iovecs].iov_len;
+                iovecs++;
+                iter.next();
+            }
+            if (!iter.isDone()) {
+                // The rest of this message goes out with the next sendmsg.
+                break;
+            }
+        }
+
+        msghdr msg{};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iovecs;
+        ssize_t r = sendmsg(fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (r == -1) {
+            if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+                Logger::log(HERE, "TcpTransport sendmsg error: %s", strerror(errno));
+                throw TransportException(HERE, "TcpTransport sendmsg error", errno);
+            }
+            r = 0;
+        }
+
+        // Retire the messages that are completely out.
+        size_t sent = static_cast<size_t>(r);
+        while (sent > 0) {
+            uint32_t left = static_cast<uint32_t>(sizeof(Header)) + socket->outgoing.front().header.len
+                            - socket->sentBytes;
+            if (sent < left) {
+                socket->sentBytes += static_cast<uint32_t>(sent);
+                break;
+            }
+            sent -= left;
+            completeMessage(socket);
+        }
+        if (static_cast<size_t>(r) < bytes) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Retire the front message waiting on \a socket, which has been fully
+ * transmitted (or will never be).
+ */
+void TcpTransport::completeMessage(Socket *socket) {
+    OutgoingMessage message = socket->outgoing.front();
+    socket->outgoing.pop_front();
+    socket->sentBytes = 0;
+    if (message.frame != nullptr) {
+        message.rpc->releaseFrame(message.frame);
+    } else {
+        serverRpcPool.destroy(message.rpc);
+    }
+}
+
+int TcpTransport::sendMessage(int fd, uint64_t nonce, Buffer *payload, int bytesToSend, uint8_t flags) {
     assert(fd >= 0);
 
     Header header{};
     header.nonce = nonce;
     header.len = payload->size();
+    header.flags = flags;
     int totalLength = static_cast<int>(sizeof(header) + header.len);
     if (bytesToSend < 0) {
         bytesToSend = totalLength;
@@ -314,60 +648,68 @@ TcpTransport::AcceptHandler::AcceptHandler(int fd, TcpTransport *transport)
 }
 
 void TcpTransport::AcceptHandler::handleFileEvent(uint32_t events) {
-    struct sockaddr_in sin{};
-    socklen_t socklen = sizeof(sin);
-
-    int acceptedFd = accept(transport->listenSocket,
-                            reinterpret_cast<sockaddr *>(&sin),
-                            &socklen);
-    if (acceptedFd < 0) {
-        switch (errno) {
-            // According to the man page for accept, you're supposed to
-            // treat these as retry on Linux.
-            case EHOSTDOWN:
-            case EHOSTUNREACH:
-            case ENETDOWN:
-            case ENETUNREACH:
-            case ENONET:
-            case ENOPROTOOPT:
-            case EOPNOTSUPP:
-            case EPROTO:
-                return;
-
-                // No incoming connections are currently available.
-            case EAGAIN:
+    // Take every pending connection: with an edge-triggered Dispatch this
+    // handler is not invoked again for connections that are already queued.
+    while (true) {
+        struct sockaddr_in sin{};
+        socklen_t socklen = sizeof(sin);
+
+        int acceptedFd = accept(transport->listenSocket,
+                                reinterpret_cast<sockaddr *>(&sin),
+                                &socklen);
+        if (acceptedFd < 0) {
+            switch (errno) {
+                // According to the man page for accept, you're supposed to
+                // treat these as retry on Linux.
+                case EHOSTDOWN:
+                case EHOSTUNREACH:
+                case ENETDOWN:
+                case ENETUNREACH:
+                case ENONET:
+                case ENOPROTOOPT:
+                case EOPNOTSUPP:
+                case EPROTO:
+                    continue;
+
+                    // No incoming connections are currently available.
+                case EAGAIN:
 #if EAGAIN != EWOULDBLOCK
-                case EWOULDBLOCK:
+                    case EWOULDBLOCK:
 #endif
-                return;
-        }
+                    return;
+            }
 
-        // Unexpected error: log a message and then close the socket
-        // (so we don't get repeated errors).
-        Logger::log(HERE, "error in TcpTransport::AcceptHandler accepting "
-                          "connection for '%s': %s",
-                    transport->locatorString.c_str(), strerror(errno));
-        setEvents(0);
-        close(transport->listenSocket);
-        transport->listenSocket = -1;
-        return;
-    }
+            // Unexpected error: log a message and then close the socket
+            // (so we don't get repeated errors).
+            Logger::log(HERE, "error in TcpTransport::AcceptHandler accepting "
+                              "connection for '%s': %s",
+                        transport->locatorString.c_str(), strerror(errno));
+            setEvents(0);
+            close(transport->listenSocket);
+            transport->listenSocket = -1;
+            return;
+        }
 
-    // Disable the hideous Nagle algorithm, which will delay sending small
-    // messages in some situations (before adding this code in 5/2015, we
-    // observed occasional 40ms delays when a server responded to a batch
-    // of requests from the same client).
-    int flag = 1;
-    setsockopt(acceptedFd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+        // Disable the hideous Nagle algorithm, which will delay sending small
+        // messages in some situations (before adding this code in 5/2015, we
+        // observed occasional 40ms delays when a server responded to a batch
+        // of requests from the same client).
+        if (transport->unixPath.empty()) {
+            int flag = 1;
+            setsockopt(acceptedFd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+        } else {
+            setBufferSizes(acceptedFd);
+        }
 
-    // At this point we have successfully opened a client connection.
-    // Save information about it and create a handler for incoming
-    // requests.
-    if (transport->sockets.size() <=
-        static_cast<unsigned int>(acceptedFd)) {
-        transport->sockets.resize(acceptedFd + 1);
+        // At this point we have successfully opened a client connection.
+        // Save information about it and create a handler for incoming
+        // requests.
+        if (transport->sockets.size() <=
+            static_cast<unsigned int>(acceptedFd)) {
+            transport->sockets.resize(acceptedFd + 1);
+        }
+        transport->sockets[acceptedFd] = new Socket(acceptedFd, transport, sin);
     }
-    transport->sockets[acceptedFd] = new Socket(acceptedFd, transport, sin);
 }
 
 TcpTransport::ServerSocketHandler::ServerSocketHandler(int fd, TcpTransport *transport, TcpTransport::Socket *socket)
@@ -384,15 +726,24 @@ void TcpTransport::ServerSocketHandler::handleFileEvent(uint32_t events) {
     assert(socket != nullptr);
     try {
         if (events & Dispatch::FileEvent::READABLE) {
-            if (socket->rpc == nullptr) {
-                socket->rpc = transport->serverRpcPool.construct(socket,
-                                                                 fd, transport);
-            }
-            if (socket->rpc->message.readMessage(fd)) {
+            // Keep reading requests until the socket runs dry: a client may
+            // pipeline several without waiting for replies, and they are
+            // served concurrently.
+            while (true) {
+                if (socket->rpc == nullptr) {
+                    socket->rpc = transport->serverRpcPool.construct(socket,
+                                                                     fd, transport);
+                }
+                if (!socket->rpc->message.readMessage(fd, &socket->ring)) {
+                    break;
+                }
                 // The incoming request is complete; pass it off for servicing.
                 TcpServerRpc *rpc = socket->rpc;
                 socket->rpc = nullptr;
                 transport->context->workerManager->handleRpc(rpc);
+                if (socket != transport->sockets[socketFd]) {
+                    return;
+                }
             }
         }
         // Check to see if this socket got closed due to an error in the
@@ -403,24 +754,10 @@ void TcpTransport::ServerSocketHandler::handleFileEvent(uint32_t events) {
         if (socket != transport->sockets[socketFd]) {
             return;
         }
-        if (events & Dispatch::FileEvent::WRITABLE) {
-            while (true) {
-                if (socket->rpcsWaitingToReply.empty()) {
-                    setEvents(Dispatch::FileEvent::READABLE);
-                    break;
-                }
-                TcpServerRpc *rpc = socket->rpcsWaitingToReply.front();
-                socket->bytesLeftToSend = TcpTransport::sendMessage(
-                    fd, rpc->message.header.nonce, &rpc->replyPayload,
-                    socket->bytesLeftToSend);
-                if (socket->bytesLeftToSend != 0) {
-                    break;
-                }
-                // The current reply is finished; start the next one, if
-                // there is one.
-                socket->rpcsWaitingToReply.pop_front();
-                transport->serverRpcPool.destroy(rpc);
-                socket->bytesLeftToSend = -1;
+        if ((events & Dispatch::FileEvent::WRITABLE) && socket->backedUp) {
+            if (transport->flush(socketFd, socket)) {
+                socket->backedUp = false;
+                setEvents(Dispatch::FileEvent::READABLE);
             }
         }
     } catch (TransportException &e) {
@@ -428,6 +765,34 @@ void TcpTransport::ServerSocketHandler::handleFileEvent(uint32_t events) {
     }
 }
 
+TcpTransport::FlushPoller::FlushPoller(TcpTransport *transport)
+    : Dispatch::Poller(transport->context->dispatch, "TcpFlushPoller"), transport(transport) {
+}
+
+int TcpTransport::FlushPoller::poll() {
+    int result = 0;
+    for (int fd : transport->socketsToFlush) {
+        Socket *socket = transport->sockets[fd];
+        if ((socket == nullptr) || !socket->flushQueued) {
+            // Closed since it was queued.
+            continue;
+        }
+        socket->flushQueued = false;
+        result++;
+        try {
+            if (!transport->flush(fd, socket)) {
+                socket->backedUp = true;
+                socket->ioHandler.setEvents(Dispatch::FileEvent::READABLE |
+                                            Dispatch::FileEvent::WRITABLE);
+            }
+        } catch (TransportException &e) {
+            transport->closeSocket(fd);
+        }
+    }
+    transport->socketsToFlush.clear();
+    return result;
+}
+
 TcpTransport::ClientSocketHandler::ClientSocketHandler(int fd, TcpTransport::TcpSession *session)
     : Dispatch::File(session->transport->context->dispatch, fd,
                      Dispatch::FileEvent::READABLE)
@@ -438,12 +803,20 @@ TcpTransport::ClientSocketHandler::ClientSocketHandler(int fd, TcpTransport::Tcp
 void TcpTransport::ClientSocketHandler::handleFileEvent(uint32_t events) {
     try {
         if (events & Dispatch::FileEvent::READABLE) {
-            if (session->message->readMessage(fd)) {
-                // This RPC is finished.
+            // Replies to pipelined requests may arrive back to back, in any
+            // order; take all that are available.
+            while (session->message->readMessage(fd, &session->ring)) {
                 if (session->current != nullptr) {
-                    session->rpcsWaitingForResponse.remove(session->current);
-                    session->current->notifier->completed();
-                    session->transport->clientRpcPool.destroy(session->current);
+                    if (session->message->header.flags & MORE_FRAMES) {
+                        // One frame of a streamed response; the RPC stays
+                        // outstanding until the final message arrives.
+                        session->current->notifier->frameReceived();
+                    } else {
+                        // This RPC is finished.
+                        session->rpcsWaitingForResponse.erase(session->current->nonce);
+                        session->current->notifier->completed();
+                        session->transport->clientRpcPool.destroy(session->current);
+                    }
                     session->current = nullptr;
                 }
                 session->message.reset(new IncomingMessage(static_cast<Buffer *>(nullptr), session));
@@ -461,7 +834,7 @@ void TcpTransport::ClientSocketHandler::handleFileEvent(uint32_t events) {
                 // The current RPC is finished; start the next one, if
                 // there is one.
                 session->rpcsWaitingToSend.pop_front();
-                session->rpcsWaitingForResponse.push_back(rpc);
+                session->rpcsWaitingForResponse[rpc->nonce] = rpc;
                 rpc->sent = true;
                 session->bytesLeftToSend = -1;
             }
@@ -474,9 +847,17 @@ void TcpTransport::ClientSocketHandler::handleFileEvent(uint32_t events) {
 
 TcpTransport::TcpSession::TcpSession(TcpTransport *transport, const std::string &serviceLocator)
     : Session(serviceLocator)
-      , transport(transport), address(serviceLocator), fd(-1), serial(1), rpcsWaitingToSend(), bytesLeftToSend(0)
-      , rpcsWaitingForResponse(), current(nullptr), message(), clientIoHandler() {
-    fd = socket(PF_INET, SOCK_STREAM, 0);
+      , transport(transport), fd(-1), serial(1), rpcsWaitingToSend(), bytesLeftToSend(0)
+      , rpcsWaitingForResponse(), current(nullptr), ring(), message(), clientIoHandler() {
+    bool local = isUnixLocator(serviceLocator);
+    sockaddr_un unixPeer{};
+    sockaddr inetPeer{};
+    if (local) {
+        unixPeer = unixAddress(serviceLocator);
+    } else {
+        inetPeer = IpAddress(serviceLocator).address;
+    }
+    fd = socket(local ? PF_UNIX : PF_INET, SOCK_STREAM, 0);
     if (fd == -1) {
         Logger::log(HERE, "TcpTransport couldn't open socket for session: %s",
                     strerror(errno));
@@ -484,7 +865,8 @@ TcpTransport::TcpSession::TcpSession(TcpTransport *transport, const std::string
                                  "TcpTransport couldn't open socket for session", errno);
     }
 
-    int r = connect(fd, &address.address, sizeof(address.address));
+    int r = local ? connect(fd, reinterpret_cast<sockaddr *>(&unixPeer), sizeof(unixPeer))
+                  : connect(fd, &inetPeer, sizeof(inetPeer));
     if (r == -1) {
         ::close(fd);
         fd = -1;
@@ -495,39 +877,43 @@ TcpTransport::TcpSession::TcpSession(TcpTransport *transport, const std::string
             this->serviceLocator.c_str()), errno);
     }
 
-    // Check to see if we accidentally connected to ourself. This can
-    // happen if the target server is on the same machine and has
-    // crashed, so that it is no longer using its port. If this
-    // happens our local socket (fd) might end up reusing that same port,
-    // in which case we will connect to ourselves. If this happens,
-    // abort this connection (it will get retried, at which point a
-    // different port will get selected).
-    sockaddr cAddr;
-    socklen_t cAddrLen = sizeof(cAddr);
-    // Read address information associated with our local socket.
-    if (getsockname(fd, &cAddr, &cAddrLen)) {
-        ::close(fd);
-        fd = -1;
-        Logger::log(HERE, "TcpTransport failed to get client socket info");
-        throw TransportException(HERE,
-                                 "TcpTransport failed to get client socket info", errno);
-    }
-    IpAddress sourceIp(&cAddr);
-    IpAddress destinationIp(serviceLocator);
-    if (sourceIp.toString() == destinationIp.toString()) {
-        ::close(fd);
-        fd = -1;
-        Logger::log(HERE, "TcpTransport connected to itself %s",
-                    sourceIp.toString().c_str());
-        throw TransportException(HERE, format(
-            "TcpTransport connected to itself %s",
-            sourceIp.toString().c_str()));
-    }
+    if (local) {
+        setBufferSizes(fd);
+    } else {
+        // Check to see if we accidentally connected to ourself. This can
+        // happen if the target server is on the same machine and has
+        // crashed, so that it is no longer using its port. If this
+        // happens our local socket (fd) might end up reusing that same port,
+        // in which case we will connect to ourselves. If this happens,
+        // abort this connection (it will get retried, at which point a
+        // different port will get selected).
+        sockaddr cAddr;
+        socklen_t cAddrLen = sizeof(cAddr);
+        // Read address information associated with our local socket.
+        if (getsockname(fd, &cAddr, &cAddrLen)) {
+            ::close(fd);
+            fd = -1;
+            Logger::log(HERE, "TcpTransport failed to get client socket info");
+            throw TransportException(HERE,
+                                     "TcpTransport failed to get client socket info", errno);
+        }
+        IpAddress sourceIp(&cAddr);
+        IpAddress destinationIp(serviceLocator);
+        if (sourceIp.toString() == destinationIp.toString()) {
+            ::close(fd);
+            fd = -1;
+            Logger::log(HERE, "TcpTransport connected to itself %s",
+                        sourceIp.toString().c_str());
+            throw TransportException(HERE, format(
+                "TcpTransport connected to itself %s",
+                sourceIp.toString().c_str()));
+        }
 
-    // Disable the hideous Nagle algorithm, which will delay sending small
-    // messages in some situations.
-    int flag = 1;
-    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+        // Disable the hideous Nagle algorithm, which will delay sending small
+        // messages in some situations.
+        int flag = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+    }
 
     /// Arrange for notification whenever the server sends us data.
     Dispatch::Lock lock(transport->context->dispatch);
@@ -546,39 +932,37 @@ void TcpTransport::TcpSession::abort() {
 void TcpTransport::TcpSession::cancelRequest(Transport::RpcNotifier *notifier) {
     // Search for an RPC that refers to this notifier; if one is
     // found then remove all state relating to it.
-    for (auto rpc = rpcsWaitingForResponse.begin(); rpc != rpcsWaitingForResponse.end(); rpc++) {
-
-        if ((*rpc)->notifier == notifier) {
-            rpcsWaitingForResponse.erase(rpc);
-            transport->clientRpcPool.destroy(*rpc);
+    for (auto it = rpcsWaitingForResponse.begin(); it != rpcsWaitingForResponse.end(); it++) {
+        TcpClientRpc *rpc = it->second;
+        if (rpc->notifier == notifier) {
+            rpcsWaitingForResponse.erase(it);
 
             // If we have started reading the response message,
             // cancel that also.
-            if (*rpc == current) {
+            if (rpc == current) {
                 message->cancel();
                 current = nullptr;
             }
+            transport->clientRpcPool.destroy(rpc);
             return;
         }
     }
 
     for (auto rpc = rpcsWaitingToSend.begin(); rpc != rpcsWaitingToSend.end(); rpc++) {
         if ((*rpc)->notifier == notifier) {
-            rpcsWaitingToSend.erase(rpc);
             transport->clientRpcPool.destroy(*rpc);
+            rpcsWaitingToSend.erase(rpc);
             return;
         }
     }
 }
 
 Buffer *TcpTransport::TcpSession::findRpc(TcpTransport::Header *header) {
-    for (TcpClientRpc *rpc: rpcsWaitingForResponse) {
-        if (rpc->nonce == header->nonce) {
-            current = rpc;
-            return rpc->response;
-        }
-    }
-    return nullptr;
+    auto it = rpcsWaitingForResponse.find(header->nonce);
+    if (it == rpcsWaitingForResponse.end())
+        return nullptr;
+    current = it->second;
+    return current->response;
 }
 
 std::string TcpTransport::TcpSession::getRpcInfo() {
@@ -613,7 +997,7 @@ void TcpTransport::TcpSession::sendRequest(Buffer *request, Buffer *response, Tr
     if (bytesLeftToSend == 0) {
         // The whole request was sent immediately (this should be the
         // common case).
-        rpcsWaitingForResponse.push_back(rpc);
+        rpcsWaitingForResponse[rpc->nonce] = rpc;
         rpc->sent = true;
     } else {
         rpcsWaitingToSend.push_back(rpc);
@@ -627,13 +1011,11 @@ void TcpTransport::TcpSession::close() {
         ::close(fd);
         fd = -1;
     }
-    while (!rpcsWaitingForResponse.empty()) {
-        TcpClientRpc *rpc = rpcsWaitingForResponse.front();
-        rpc->notifier->failed();
-        rpcsWaitingForResponse.pop_front();
-        transport->clientRpcPool.destroy(rpc);
-
+    for (auto &entry: rpcsWaitingForResponse) {
+        entry.second->notifier->failed();
+        transport->clientRpcPool.destroy(entry.second);
     }
+    rpcsWaitingForResponse.clear();
     while (!rpcsWaitingToSend.empty()) {
         TcpClientRpc *rpc = rpcsWaitingToSend.front();
         rpc->notifier->failed();
@@ -647,8 +1029,8 @@ void TcpTransport::TcpSession::close() {
 }
 
 TcpTransport::Socket::Socket(int fd, TcpTransport *transport, sockaddr_in &sin)
-    : transport(transport), id(transport->nextSocketId), rpc(NULL), ioHandler(fd, transport, this), rpcsWaitingToReply()
-      , bytesLeftToSend(0), sin(sin) {
+    : transport(transport), id(transport->nextSocketId), rpc(NULL), ring(), ioHandler(fd, transport, this), outgoing()
+      , sentBytes(0), flushQueued(false), backedUp(false), sin(sin) {
     transport->nextSocketId++;
 }
 
@@ -656,10 +1038,10 @@ TcpTransport::Socket::~Socket() {
     if (rpc != nullptr) {
         transport->serverRpcPool.destroy(rpc);
     }
-    while (!rpcsWaitingToReply.empty()) {
-        TcpServerRpc *rpc = rpcsWaitingToReply.front();
-        rpcsWaitingToReply.pop_front();
-        transport->serverRpcPool.destroy(rpc);
+    // An RPC whose final reply isn't queued yet still belongs to a worker;
+    // it is recycled when that reply finds the socket gone.
+    while (!outgoing.empty()) {
+        transport->completeMessage(this);
     }
 }
 }
@@ -1,8 +1,12 @@
 #ifndef GUNGNIR_TCPTRANSPORT_H
 #define GUNGNIR_TCPTRANSPORT_H
 
+#include <atomic>
+#include <deque>
 #include <list>
+#include <unordered_map>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netinet/in.h>
 
 #include "Transport.h"
@@ -13,6 +17,11 @@
 
 namespace Gungnir {
 
+/**
+ * A transport over stream sockets: TCP for locators of the form
+ * "host:port", or Unix domain sockets for "unix:path=...", which spare
+ * co-located clients the TCP stack.
+ */
 class TcpTransport : public Transport {
 
 public:
@@ -24,6 +33,8 @@ public:
 
     std::string getServiceLocator() override;
 
+    static bool isUnixLocator(const std::string &serviceLocator);
+
     class TcpServerRpc;
 
 private:
@@ -32,8 +43,12 @@ private:
 
     class IncomingMessage;
 
+    class ReceiveRing;
+
     class ClientSocketHandler;
 
+    class FlushPoller;
+
     class Socket;
 
     class TcpSession;
@@ -56,23 +71,124 @@ private:
         /// The size in bytes of the payload (which follows immediately).
         /// Must be less than or equal to #MAX_RPC_LEN.
         uint32_t len;
+
+        /// OR'ed combination of HeaderFlags values.
+        uint8_t flags;
     } __attribute__((packed));
 
+    enum HeaderFlags : uint8_t {
+        /// This message is one frame of a streamed response: its payload
+        /// is appended to the response and more messages with the same
+        /// nonce follow. The last message of a response clears this flag.
+        MORE_FRAMES = 1
+    };
+
+    /**
+     * Bytes received on a socket that haven't been parsed yet. One recv
+     * takes as much as the socket holds, and every complete message in it
+     * is then parsed from memory; small message bodies are handed out as
+     * views of the ring's storage instead of being copied. The storage is
+     * reused in place once no view refers to it any more, and replaced by
+     * a fresh block otherwise.
+     */
+    class ReceiveRing {
+    public:
+        ReceiveRing();
+
+        ~ReceiveRing();
+
+        bool fill(int fd);
+
+        uint32_t receive(int fd, void *dest, uint32_t length);
+
+        uint32_t take(void *dest, uint32_t length);
+
+        uint32_t skip(uint32_t length);
+
+        void appendView(Buffer *buffer, uint32_t length);
+
+        /// Number of received bytes not parsed yet.
+        uint32_t size() const {
+            return end - start;
+        }
+
+        /// Size of a block of storage.
+        static const uint32_t BLOCK_SIZE = 32768;
+
+        /// Message bodies up to this size are handed out as views.
+        static const uint32_t MAX_VIEW = 2048;
+
+        /// Parts of a message body at least this large are received
+        /// straight into their buffer rather than through the ring.
+        static const uint32_t MIN_DIRECT = 16384;
+
+    private:
+        /**
+         * Storage shared by the ring and the views handed out from it.
+         */
+        struct Block {
+            Block() : refs(1), data() {}
+
+            void release() {
+                if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                    delete this;
+                }
+            }
+
+            /// The ring (while the block is current) plus one per view.
+            std::atomic<int> refs;
+
+            char data[BLOCK_SIZE];
+        };
+
+        /**
+         * A Buffer chunk referring to part of a Block; it may outlive the
+         * ring, and be deleted by another thread.
+         */
+        class View : public Buffer::Chunk {
+        public:
+            View(Block *block, char *data, uint32_t length);
+
+            ~View() override;
+
+        private:
+            Block *block;
+        };
+
+        void makeRoom();
+
+        /// Current storage.
+        Block *block;
+
+        /// Offsets in block of the first unparsed byte and of the end of
+        /// the received bytes.
+        uint32_t start;
+        uint32_t end;
+
+        /// True means the last recv returned less than it asked for, so
+        /// the socket is empty until the next readiness event.
+        bool drained;
+    };
+
     /**
      * Used to manage the receipt of a message (on either client or server)
      * using an event-based approach.
      */
     class IncomingMessage {
+        friend class TcpTransport;
+
         friend class ServerSocketHandler;
 
         friend class TcpServerRpc;
 
+        friend class ClientSocketHandler;
+
     public:
         IncomingMessage(Buffer *buffer, TcpSession *session);
 
         void cancel();
 
-        bool readMessage(int fd);
+        bool readMessage(int fd, ReceiveRing *ring);
 
     private:
         Header header;
@@ -92,6 +208,10 @@ private:
         /// discarded).
         uint32_t messageLength;
 
+        /// Offset in buffer at which the body of this message starts; nonzero
+        /// when the message is a later frame of a streamed response.
+        uint32_t bufferOffset;
+
         /// Buffer in which incoming message will be stored (not including
         /// transport-specific header); NULL means we haven't yet started
         /// reading the response, or else the RPC was canceled after we
@@ -120,6 +240,8 @@ public:
 
         void sendReply() override;
 
+        void sendFrames() override;
+
         std::string getClientServiceLocator() override;
 
         TcpServerRpc(Socket *socket, int fd, TcpTransport *transport)
@@ -155,12 +277,32 @@ public:
     };
 
 private:
+    void bindTcp(const std::string &serviceLocator);
+
     void closeSocket(int fd);
 
     static ssize_t recvCarefully(int fd, void *buffer, size_t length);
 
+    static sockaddr_un unixAddress(const std::string &serviceLocator);
+
+    static void setBufferSizes(int fd);
+
+    /// Send and receive buffer size requested for Unix domain sockets;
+    /// large enough for a pipelined batch or a streamed frame to go in a
+    /// single call.
+    static const int UNIX_BUFFER_BYTES = 4 << 20;
+
     static int sendMessage(int fd, uint64_t nonce, Buffer *payload,
-                           int bytesToSend);
+                           int bytesToSend, uint8_t flags = 0);
+
+    void queueMessage(Socket *socket, TcpServerRpc *rpc, Buffer *frame);
+
+    bool flush(int fd, Socket *socket);
+
+    void completeMessage(Socket *socket);
+
+    /// Most iovecs gathered into a single sendmsg.
+    static const uint32_t MAX_SEND_IOVECS = 128;
 
     class AcceptHandler : public Dispatch::File {
     public:
@@ -198,6 +340,20 @@ private:
         TcpSession *session;
     };
 
+    /**
+     * Transmits the replies queued on sockets during a pass of the
+     * dispatch loop, with one sendmsg per socket.
+     */
+    class FlushPoller : public Dispatch::Poller {
+    public:
+        explicit FlushPoller(TcpTransport *transport);
+
+        int poll() override;
+
+    private:
+        TcpTransport *transport;
+    };
+
     class TcpSession : public Session {
         friend class ClientIncomingMessage;
 
@@ -226,14 +382,15 @@ private:
         void close();
 
         TcpTransport *transport;
-        IpAddress address;
         int fd;
         uint64_t serial;
 
         std::list<TcpClientRpc *> rpcsWaitingToSend;
         int bytesLeftToSend;      /// The number of (trailing) bytes in the
-        std::list<TcpClientRpc *> rpcsWaitingForResponse;
+        /// RPCs whose requests have been sent, by nonce.
+        std::unordered_map<uint64_t, TcpClientRpc *> rpcsWaitingForResponse;
         TcpClientRpc *current;
+        ReceiveRing ring;
         std::unique_ptr<IncomingMessage> message;
         std::unique_ptr<ClientSocketHandler> clientIoHandler;
     };
@@ -246,9 +403,27 @@ private:
     /// clients.  -1 means this instance is not a server.
     int listenSocket;
 
+    /// Path of the Unix domain socket the server listens on, or empty for
+    /// TCP.
+    std::string unixPath;
+
     /// Used to wait for listenSocket to become readable.
     std::unique_ptr<AcceptHandler> acceptHandler;
 
+    /**
+     * One message waiting on a socket to be transmitted.
+     */
+    struct OutgoingMessage {
+        /// RPC the message answers.
+        TcpServerRpc *rpc;
+
+        /// Frame of a streamed reply; NULL means the final reply in
+        /// rpc->replyPayload.
+        Buffer *frame;
+
+        Header header;
+    };
+
     /// Used to hold information about a file descriptor associated with
     /// a socket, on which RPC requests may arrive.
     class Socket {
@@ -263,18 +438,21 @@ private:
         /// the same value.
         TcpServerRpc *rpc;        /// Incoming RPC that is in progress for
         /// this fd, or NULL if none.
+        ReceiveRing ring;         /// Bytes received on fd but not parsed
+        /// yet.
         ServerSocketHandler ioHandler;
         /// Used to get notified whenever data
         /// arrives on this fd.
-        std::list<TcpServerRpc *> rpcsWaitingToReply;
-        /// RPCs whose response messages have not yet
-        /// been transmitted.  The front RPC on this
-        /// list is currently being transmitted.
-        int bytesLeftToSend;      /// The number of (trailing) bytes in the
-        /// front RPC on rpcsWaitingToReply that still
-        /// need to be transmitted, once fd becomes
-        /// writable again.  -1 or 0 means there are
-        /// no RPCs waiting.
+        std::deque<OutgoingMessage> outgoing;
+        /// Replies and streamed frames not yet
+        /// transmitted, oldest first.
+        uint32_t sentBytes;       /// Bytes of the front message of
+        /// outgoing already transmitted.
+        bool flushQueued;         /// True means fd is on the transport's
+        /// socketsToFlush list.
+        bool backedUp;            /// True means the socket didn't take
+        /// everything; the rest goes out once fd
+        /// becomes writable again.
         struct sockaddr_in sin;   /// sockaddr_in of the client host on the
         /// other end of the socket. Used to
         /// implement #getClientServiceLocator().
@@ -288,6 +466,12 @@ private:
     /// Used to assign increasing id values to Sockets.
     uint64_t nextSocketId;
 
+    /// File descriptors of the sockets that got messages to transmit
+    /// during the current pass of the dispatch loop.
+    std::vector<int> socketsToFlush;
+
+    std::unique_ptr<FlushPoller> flushPoller;
+
     /// Counts the number of nonzero-size partial messages sent by
     /// sendMessage (for testing only).
     static int messageChunks;
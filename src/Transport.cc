@@ -10,6 +10,49 @@ void Transport::RpcNotifier::failed() {
 
 }
 
+/**
+ * Invoked when one frame of a streamed response has been appended to the
+ * response buffer; further frames will follow before #completed is invoked.
+ */
+void Transport::RpcNotifier::frameReceived() {
+
+}
+
+/**
+ * Queue one frame of a streamed reply for transmission. Invoked by the
+ * worker producing the reply; the transport takes ownership of the frame.
+ */
+void Transport::ServerRpc::appendFrame(Buffer *frame) {
+    SpinLock::Guard guard(frameLock);
+    frames.push_back(frame);
+    framesInFlight.fetch_add(1, std::memory_order_release);
+    framesQueued.fetch_add(1, std::memory_order_release);
+}
+
+/**
+ * Remove the oldest queued frame, or return NULL if there is none. The
+ * caller must eventually pass the frame to #releaseFrame.
+ */
+Buffer *Transport::ServerRpc::popFrame() {
+    SpinLock::Guard guard(frameLock);
+    if (frames.empty()) {
+        return nullptr;
+    }
+    Buffer *frame = frames.front();
+    frames.pop_front();
+    framesQueued.fetch_sub(1, std::memory_order_relaxed);
+    return frame;
+}
+
+/**
+ * Free a frame once it has been transmitted (or dropped), allowing the
+ * producer to fill another one.
+ */
+void Transport::ServerRpc::releaseFrame(Buffer *frame) {
+    delete frame;
+    framesInFlight.fetch_sub(1, std::memory_order_release);
+}
+
 void intrusive_ptr_add_ref(Transport::Session *session) {
     session->refCount.fetch_add(1, std::memory_order_relaxed);
 }
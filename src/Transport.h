@@ -3,6 +3,7 @@
 #include <utility>
 #include <atomic>
 #include <cassert>
+#include <deque>
 
 #ifndef GUNGNIR_TRANSPORT_H
 #define GUNGNIR_TRANSPORT_H
@@ -11,6 +12,7 @@
 #include "CodeLocation.h"
 #include "Exception.h"
 #include "Buffer.h"
+#include "SpinLock.h"
 
 namespace Gungnir {
 /**
@@ -52,6 +54,8 @@ public:
 
         virtual void failed();
 
+        virtual void frameReceived();
+
     };
 
     static const uint32_t MAX_RPC_LEN = ((1 << 23) + 200);
@@ -69,13 +73,22 @@ public:
             : requestPayload()
               , replyPayload()
               , epoch(0)
-              , activities(~0) {}
+              , activities(~0)
+              , skippedVersions(0)
+              , framesInFlight(0)
+              , framesQueued(0)
+              , frames()
+              , frameLock() {}
 
     public:
         /**
          * Destructor for ServerRpc.
          */
-        virtual ~ServerRpc() {}
+        virtual ~ServerRpc() {
+            while (Buffer *frame = popFrame()) {
+                releaseFrame(frame);
+            }
+        }
 
         /**
          * Respond to the RPC with the contents of #replyPayload.
@@ -99,6 +112,29 @@ public:
          */
         virtual std::string getClientServiceLocator() = 0;
 
+        /**
+         * Transmit the frames queued with #appendFrame, each as a separate
+         * message carrying this RPC's identity, ahead of the final reply.
+         * Invoked in the dispatch thread while a worker is still producing
+         * the reply. Transports that can't stream leave the frames queued.
+         */
+        virtual void sendFrames() {}
+
+        void appendFrame(Buffer *frame);
+
+        Buffer *popFrame();
+
+        void releaseFrame(Buffer *frame);
+
+        /**
+         * Return whether frames are queued for transmission. Cheap enough
+         * for the dispatch thread to ask of every RPC in progress on each
+         * pass: it takes no lock.
+         */
+        bool hasFrames() {
+            return framesQueued.load(std::memory_order_acquire) != 0;
+        }
+
         /**
          * Returns false if the epoch was not set, else true. Used to assert
          * that no RPCs are pushed through the WorkerManager without an epoch.
@@ -145,6 +181,38 @@ public:
         static const int READ_ACTIVITY = 1;
         static const int APPEND_ACTIVITY = 2;
 
+        /**
+         * Versions that the write this RPC performs passes over, on top of
+         * the one it takes: those of earlier writes it replaced before they
+         * were applied (see WorkerManager::coalesce()). Set by the dispatch
+         * thread before the RPC is handed to a worker.
+         */
+        uint32_t skippedVersions;
+
+        /**
+         * Producers of streamed replies stop filling new frames while this
+         * many are queued or still being transmitted, so a slow client
+         * bounds the memory held on the server.
+         */
+        static const int MAX_FRAMES_IN_FLIGHT = 2;
+
+        /**
+         * Number of frames handed to #appendFrame that haven't been
+         * released yet.
+         */
+        std::atomic<int> framesInFlight;
+
+    private:
+        /// Number of frames in #frames.
+        std::atomic<int> framesQueued;
+
+        /// Frames of a streamed reply waiting to be transmitted, oldest
+        /// first. Protected by frameLock, since they are produced by a
+        /// worker and consumed by the dispatch thread.
+        std::deque<Buffer *> frames;
+
+        SpinLock frameLock;
+
     };
 
     /**
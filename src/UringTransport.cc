@@ -0,0 +1,644 @@
+#include <algorithm>
+#include <cstring>
+#include <climits>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "UringTransport.h"
+#include "Logger.h"
+#include "IpAddress.h"
+#include "WorkerManager.h"
+
+namespace Gungnir {
+
+UringTransport::UringTransport(Context *context, const std::string &serviceLocator)
+    : context(context), locatorString(serviceLocator), listenSocket(-1), ringFd(-1), sqRing(nullptr), sqRingSize(0)
+      , cqRing(nullptr), cqRingSize(0), sqes(nullptr), sqesSize(0), sqHead(nullptr), sqTail(nullptr), sqMask(nullptr)
+      , sqFlags(nullptr), sqArray(nullptr), sqEntries(0), sqeTail(0), sqeSubmitted(0), cqHead(nullptr), cqTail(nullptr)
+      , cqMask(nullptr), cqes(nullptr), bufferRing(nullptr), bufferMemory(nullptr), bufferTail(0), freeFileIndexes()
+      , connections(), poller(), ringHandler(), serverRpcPool() {
+    IpAddress address(serviceLocator);
+    listenSocket = socket(PF_INET, SOCK_STREAM, 0);
+    if (listenSocket == -1) {
+        Logger::log(HERE, "UringTransport couldn't create listen socket: %s", strerror(errno));
+        throw TransportException(HERE, "UringTransport couldn't create listen socket", errno);
+    }
+
+    // See TcpTransport: every dispatch thread listens on the same address.
+    int optval = 1;
+    if (setsockopt(listenSocket, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval)) != 0 ||
+        setsockopt(listenSocket, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval)) != 0) {
+        close(listenSocket);
+        Logger::log(HERE, "UringTransport couldn't set socket options on "
+                          "listen socket: %s", strerror(errno));
+        throw TransportException(
+            HERE, "UringTransport couldn't set socket options on listen socket", errno);
+    }
+
+    if (bind(listenSocket, &address.address, sizeof(address.address)) == -1) {
+        close(listenSocket);
+        std::string message = format("UringTransport couldn't bind to '%s'",
+                                     serviceLocator.c_str());
+        Logger::log(HERE, "%s: %s", message.c_str(), strerror(errno));
+        throw TransportException(HERE, message, errno);
+    }
+
+    if (listen(listenSocket, INT_MAX) == -1) {
+        close(listenSocket);
+        Logger::log(HERE, "UringTransport couldn't listen on socket: %s",
+                    strerror(errno));
+        throw TransportException(HERE,
+                                 "UringTransport couldn't listen on socket", errno);
+    }
+
+    setupRing();
+    setupBuffers();
+    armAccept();
+    submit();
+
+    poller.reset(new UringPoller(this));
+    if (context->dispatch->isInlinePolling()) {
+        // Such a Dispatch may block in epoll_wait when idle; the ring fd
+        // turns readable as soon as a completion is posted.
+        ringHandler.reset(new RingHandler(ringFd, this));
+    }
+}
+
+UringTransport::~UringTransport() {
+    ringHandler.reset();
+    poller.reset();
+
+    // Closing the ring cancels every request in flight.
+    if (ringFd >= 0) {
+        close(ringFd);
+        ringFd = -1;
+    }
+    for (Connection *connection : connections) {
+        if (connection != nullptr) {
+            close(connection->fd);
+            delete connection;
+        }
+    }
+    if (listenSocket >= 0) {
+        close(listenSocket);
+        listenSocket = -1;
+    }
+    if (bufferRing != nullptr) {
+        munmap(bufferRing, BUFFER_COUNT * sizeof(io_uring_buf));
+    }
+    delete[] bufferMemory;
+    if (sqes != nullptr) {
+        munmap(sqes, sqesSize);
+    }
+    if (cqRing != nullptr && cqRing != sqRing) {
+        munmap(cqRing, cqRingSize);
+    }
+    if (sqRing != nullptr) {
+        munmap(sqRing, sqRingSize);
+    }
+}
+
+Transport::SessionRef UringTransport::getSession(const std::string &serviceLocator) {
+    throw TransportException(HERE, "UringTransport only serves requests; "
+                                   "use TcpTransport to open sessions");
+}
+
+std::string UringTransport::getServiceLocator() {
+    return locatorString;
+}
+
+/**
+ * Create the io_uring instance, map its rings and register an empty
+ * table of fixed files.
+ */
+void UringTransport::setupRing() {
+    io_uring_params params{};
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = 4 * RING_ENTRIES;
+    ringFd = static_cast<int>(syscall(__NR_io_uring_setup, RING_ENTRIES, &params));
+    if (ringFd < 0) {
+        Logger::log(HERE, "UringTransport couldn't set up io_uring: %s", strerror(errno));
+        throw TransportException(HERE, "UringTransport couldn't set up io_uring", errno);
+    }
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) ||
+        !(params.features & IORING_FEAT_NODROP)) {
+        throw TransportException(HERE, "UringTransport needs a newer kernel");
+    }
+
+    sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+    sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+    if (sqRing == MAP_FAILED) {
+        sqRing = nullptr;
+        throw TransportException(HERE, "UringTransport couldn't map io_uring", errno);
+    }
+    cqRing = sqRing;
+    sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    void *mapped = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+    if (mapped == MAP_FAILED) {
+        throw TransportException(HERE, "UringTransport couldn't map io_uring", errno);
+    }
+    sqes = static_cast<io_uring_sqe *>(mapped);
+
+    char *sq = static_cast<char *>(sqRing);
+    sqHead = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+    sqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    sqMask = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    sqFlags = reinterpret_cast<unsigned *>(sq + params.sq_off.flags);
+    sqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+    sqEntries = params.sq_entries;
+    sqeTail = sqeSubmitted = *sqTail;
+
+    char *cq = static_cast<char *>(cqRing);
+    cqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    cqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    cqMask = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+
+    // A sparse table: slots are filled in as connections are accepted.
+    std::vector<int> files(MAX_FIXED_FILES, -1);
+    if (syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_FILES,
+                files.data(), MAX_FIXED_FILES) < 0) {
+        throw TransportException(HERE, "UringTransport couldn't register files", errno);
+    }
+    for (int i = MAX_FIXED_FILES - 1; i >= 0; i--) {
+        freeFileIndexes.push_back(i);
+    }
+}
+
+/**
+ * Register the provided buffer ring that multishot receives pick their
+ * buffers from, and fill it.
+ */
+void UringTransport::setupBuffers() {
+    void *mapped = mmap(nullptr, BUFFER_COUNT * sizeof(io_uring_buf), PROT_READ | PROT_WRITE,
+                        MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (mapped == MAP_FAILED) {
+        throw TransportException(HERE, "UringTransport couldn't allocate buffer ring", errno);
+    }
+    bufferRing = static_cast<io_uring_buf_ring *>(mapped);
+    bufferMemory = new char[BUFFER_COUNT * BUFFER_SIZE];
+
+    io_uring_buf_reg reg{};
+    reg.ring_addr = reinterpret_cast<uint64_t>(bufferRing);
+    reg.ring_entries = BUFFER_COUNT;
+    reg.bgid = BUFFER_GROUP;
+    if (syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        throw TransportException(HERE, "UringTransport couldn't register buffer ring", errno);
+    }
+    for (uint16_t i = 0; i < BUFFER_COUNT; i++) {
+        recycleBuffer(i);
+    }
+}
+
+/**
+ * Return a cleared SQE to fill in; it is handed to the kernel by the next
+ * #submit.
+ */
+io_uring_sqe *UringTransport::getSqe() {
+    if (sqeTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries) {
+        submit();
+        if (sqeTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries) {
+            throw TransportException(HERE, "UringTransport submission queue is full");
+        }
+    }
+    unsigned index = sqeTail & *sqMask;
+    io_uring_sqe *sqe = &sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqArray[index] = index;
+    sqeTail++;
+    return sqe;
+}
+
+/**
+ * Hand every SQE prepared since the last call to the kernel, in one
+ * system call.
+ */
+void UringTransport::submit() {
+    unsigned pending = sqeTail - sqeSubmitted;
+    bool overflow = (__atomic_load_n(sqFlags, __ATOMIC_RELAXED) & IORING_SQ_CQ_OVERFLOW) != 0;
+    if (pending == 0 && !overflow) {
+        return;
+    }
+    __atomic_store_n(sqTail, sqeTail, __ATOMIC_RELEASE);
+
+    // GETEVENTS with no minimum flushes completions the kernel had to
+    // hold back while the completion queue was full.
+    int r = static_cast<int>(syscall(__NR_io_uring_enter, ringFd, pending, 0,
+                                     overflow ? IORING_ENTER_GETEVENTS : 0, nullptr, 0));
+    if (r < 0) {
+        if (errno == EAGAIN || errno == EBUSY || errno == EINTR) {
+            // Try again on the next pass.
+            return;
+        }
+        Logger::log(HERE, "UringTransport io_uring_enter failed: %s", strerror(errno));
+        throw TransportException(HERE, "UringTransport io_uring_enter failed", errno);
+    }
+    sqeSubmitted += r;
+}
+
+/**
+ * Handle every completion posted so far.
+ *
+ * \return
+ *      Number of completions handled.
+ */
+int UringTransport::reap() {
+    unsigned head = *cqHead;
+    unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+    int count = 0;
+    for (; head != tail; head++) {
+        io_uring_cqe *cqe = &cqes[head & *cqMask];
+        uint64_t operation = cqe->user_data & OP_MASK;
+        auto *connection = reinterpret_cast<Connection *>(cqe->user_data & ~OP_MASK);
+        switch (operation) {
+            case OP_ACCEPT:
+                handleAccept(cqe);
+                break;
+            case OP_RECV:
+                handleRecv(connection, cqe);
+                break;
+            case OP_SEND:
+                handleSend(connection, cqe);
+                break;
+            default:
+                break;
+        }
+        count++;
+        // Give the slot back right away; handlers may queue more SQEs
+        // whose completions need room.
+        __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+    }
+    return count;
+}
+
+void UringTransport::armAccept() {
+    io_uring_sqe *sqe = getSqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listenSocket;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = OP_ACCEPT;
+}
+
+void UringTransport::armRecv(Connection *connection) {
+    io_uring_sqe *sqe = getSqe();
+    sqe->opcode = IORING_OP_RECV;
+    if (connection->fileIndex >= 0) {
+        sqe->fd = connection->fileIndex;
+        sqe->flags = IOSQE_FIXED_FILE;
+    } else {
+        sqe->fd = connection->fd;
+    }
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUFFER_GROUP;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->user_data = reinterpret_cast<uint64_t>(connection) | OP_RECV;
+    connection->refs++;
+}
+
+/**
+ * Queue one sendmsg covering as many waiting messages as fit, unless one
+ * is already in flight (it would race with this one on the stream).
+ */
+void UringTransport::startSend(Connection *connection) {
+    if (connection->sending || connection->outgoing.empty()) {
+        return;
+    }
+    connection->iov.clear();
+    uint32_t skip = connection->sentBytes;
+    for (OutgoingMessage &message : connection->outgoing) {
+        if (connection->iov.size() + 2 > MAX_SEND_IOVECS) {
+            break;
+        }
+        uint32_t offset = 0;
+        if (skip < sizeof(Header)) {
+            connection->iov.push_back({reinterpret_cast<char *>(&message.header) + skip,
+                                       sizeof(Header) - skip});
+        } else {
+            offset = skip - static_cast<uint32_t>(sizeof(Header));
+        }
+        skip = 0;
+        Buffer *payload = message.frame != nullptr ? message.frame : &message.rpc->replyPayload;
+        Buffer::Iterator iter(payload, offset, message.header.len - offset);
+        while (!iter.isDone() && connection->iov.size() < MAX_SEND_IOVECS) {
+            connection->iov.push_back({const_cast<void *>(iter.getData()), iter.getLength()});
+            iter.next();
+        }
+        if (!iter.isDone()) {
+            // The rest of this message goes out with the next sendmsg.
+            break;
+        }
+    }
+
+    memset(&connection->msg, 0, sizeof(connection->msg));
+    connection->msg.msg_iov = connection->iov.data();
+    connection->msg.msg_iovlen = connection->iov.size();
+
+    io_uring_sqe *sqe = getSqe();
+    sqe->opcode = IORING_OP_SENDMSG;
+    if (connection->fileIndex >= 0) {
+        sqe->fd = connection->fileIndex;
+        sqe->flags = IOSQE_FIXED_FILE;
+    } else {
+        sqe->fd = connection->fd;
+    }
+    sqe->addr = reinterpret_cast<uint64_t>(&connection->msg);
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+    sqe->user_data = reinterpret_cast<uint64_t>(connection) | OP_SEND;
+    connection->sending = true;
+    connection->refs++;
+}
+
+void UringTransport::handleAccept(io_uring_cqe *cqe) {
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        armAccept();
+    }
+    if (cqe->res < 0) {
+        if (cqe->res != -EINTR && cqe->res != -EAGAIN) {
+            Logger::log(HERE, "error in UringTransport accepting connection "
+                              "for '%s': %s", locatorString.c_str(), strerror(-cqe->res));
+        }
+        return;
+    }
+    int fd = cqe->res;
+
+    // Disable the hideous Nagle algorithm; see TcpTransport.
+    int flag = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+
+    int fileIndex = -1;
+    if (!freeFileIndexes.empty()) {
+        io_uring_files_update update{};
+        update.offset = static_cast<uint32_t>(freeFileIndexes.back());
+        update.fds = reinterpret_cast<uint64_t>(&fd);
+        if (syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_FILES_UPDATE, &update, 1) == 1) {
+            fileIndex = freeFileIndexes.back();
+            freeFileIndexes.pop_back();
+        }
+    }
+    if (connections.size() <= static_cast<uint32_t>(fd)) {
+        connections.resize(fd + 1);
+    }
+    connections[fd] = new Connection(fd, fileIndex);
+    armRecv(connections[fd]);
+}
+
+void UringTransport::handleRecv(Connection *connection, io_uring_cqe *cqe) {
+    if (cqe->flags & IORING_CQE_F_BUFFER) {
+        auto bufferId = static_cast<uint16_t>(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+        if (cqe->res > 0 && !connection->closed) {
+            processInput(connection, bufferMemory + bufferId * BUFFER_SIZE,
+                         static_cast<uint32_t>(cqe->res));
+        }
+        recycleBuffer(bufferId);
+    }
+    if (cqe->flags & IORING_CQE_F_MORE) {
+        return;
+    }
+
+    // The multishot receive has ended: rearm it if it merely ran out of
+    // buffers (they have been recycled since), else the peer is gone.
+    connection->refs--;
+    if (cqe->res == -ENOBUFS && !connection->closed) {
+        armRecv(connection);
+    } else {
+        closeConnection(connection);
+    }
+    release(connection);
+}
+
+void UringTransport::handleSend(Connection *connection, io_uring_cqe *cqe) {
+    connection->sending = false;
+    connection->refs--;
+    if (cqe->res < 0 || connection->closed) {
+        closeConnection(connection);
+        dropOutgoing(connection);
+        release(connection);
+        return;
+    }
+
+    // Retire every message the send covered; the last one may have gone
+    // out only in part.
+    auto sent = static_cast<uint32_t>(cqe->res);
+    while (sent > 0 && !connection->outgoing.empty()) {
+        OutgoingMessage &message = connection->outgoing.front();
+        uint32_t left = static_cast<uint32_t>(sizeof(Header)) + message.header.len - connection->sentBytes;
+        if (sent < left) {
+            connection->sentBytes += sent;
+            break;
+        }
+        sent -= left;
+        connection->sentBytes = 0;
+        UringServerRpc *rpc = message.rpc;
+        Buffer *frame = message.frame;
+        connection->outgoing.pop_front();
+        if (frame != nullptr) {
+            rpc->releaseFrame(frame);
+        } else {
+            destroyRpc(rpc);
+        }
+    }
+    startSend(connection);
+    release(connection);
+}
+
+/**
+ * Split received bytes into requests, handing each complete one to the
+ * WorkerManager.
+ */
+void UringTransport::processInput(Connection *connection, const char *data, uint32_t length) {
+    while (length > 0) {
+        if (connection->headerBytes < sizeof(Header)) {
+            uint32_t count = std::min(length, static_cast<uint32_t>(sizeof(Header)) - connection->headerBytes);
+            memcpy(reinterpret_cast<char *>(&connection->header) + connection->headerBytes, data, count);
+            connection->headerBytes += count;
+            data += count;
+            length -= count;
+            if (connection->headerBytes < sizeof(Header)) {
+                return;
+            }
+
+            uint32_t messageLength = connection->header.len;
+            if (messageLength > MAX_RPC_LEN) {
+                Logger::log(HERE, "UringTransport received oversize message (%d bytes); "
+                                  "discarding extra bytes", connection->header.len);
+                messageLength = MAX_RPC_LEN;
+            }
+            connection->rpc = serverRpcPool.construct(connection, this);
+            connection->rpc->nonce = connection->header.nonce;
+            connection->refs++;
+            connection->body = messageLength > 0
+                               ? static_cast<char *>(connection->rpc->requestPayload.alloc(messageLength))
+                               : nullptr;
+        }
+
+        uint32_t count = std::min(length, connection->header.len - connection->bodyBytes);
+        uint32_t retained = std::min(connection->header.len, MAX_RPC_LEN);
+        if (connection->bodyBytes < retained) {
+            memcpy(connection->body + connection->bodyBytes, data,
+                   std::min(count, retained - connection->bodyBytes));
+        }
+        connection->bodyBytes += count;
+        data += count;
+        length -= count;
+        if (connection->bodyBytes < connection->header.len) {
+            return;
+        }
+
+        // The request is complete; pass it off for servicing.
+        UringServerRpc *rpc = connection->rpc;
+        connection->rpc = nullptr;
+        connection->headerBytes = 0;
+        connection->bodyBytes = 0;
+        context->workerManager->handleRpc(rpc);
+    }
+}
+
+void UringTransport::recycleBuffer(uint16_t bufferId) {
+    io_uring_buf *buffer = &bufferRing->bufs[bufferTail & (BUFFER_COUNT - 1)];
+    buffer->addr = reinterpret_cast<uint64_t>(bufferMemory + bufferId * BUFFER_SIZE);
+    buffer->len = BUFFER_SIZE;
+    buffer->bid = bufferId;
+    bufferTail++;
+    __atomic_store_n(&bufferRing->tail, bufferTail, __ATOMIC_RELEASE);
+}
+
+/**
+ * Shut a connection down. Requests in flight on it complete with errors;
+ * the connection is freed once they and its RPCs are gone. The caller
+ * must invoke #release afterwards.
+ */
+void UringTransport::closeConnection(Connection *connection) {
+    if (connection->closed) {
+        return;
+    }
+    connection->closed = true;
+    shutdown(connection->fd, SHUT_RDWR);
+
+    // Keep the connection until we are done with it here.
+    connection->refs++;
+    if (connection->rpc != nullptr) {
+        destroyRpc(connection->rpc);
+        connection->rpc = nullptr;
+    }
+    if (!connection->sending) {
+        dropOutgoing(connection);
+    }
+    connection->refs--;
+}
+
+/**
+ * Discard the messages waiting on a closed connection. The caller must
+ * invoke #release afterwards.
+ */
+void UringTransport::dropOutgoing(Connection *connection) {
+    connection->refs++;
+    while (!connection->outgoing.empty()) {
+        OutgoingMessage message = connection->outgoing.front();
+        connection->outgoing.pop_front();
+        if (message.frame != nullptr) {
+            message.rpc->releaseFrame(message.frame);
+        } else {
+            destroyRpc(message.rpc);
+        }
+    }
+    connection->refs--;
+}
+
+void UringTransport::destroyRpc(UringServerRpc *rpc) {
+    Connection *connection = rpc->connection;
+    serverRpcPool.destroy(rpc);
+    connection->refs--;
+    release(connection);
+}
+
+/**
+ * Free a connection that has been shut down and is no longer referenced.
+ */
+void UringTransport::release(Connection *connection) {
+    if (!connection->closed || connection->refs > 0) {
+        return;
+    }
+    if (connection->fileIndex >= 0) {
+        int fd = -1;
+        io_uring_files_update update{};
+        update.offset = static_cast<uint32_t>(connection->fileIndex);
+        update.fds = reinterpret_cast<uint64_t>(&fd);
+        syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_FILES_UPDATE, &update, 1);
+        freeFileIndexes.push_back(connection->fileIndex);
+    }
+    connections[connection->fd] = nullptr;
+    close(connection->fd);
+    delete connection;
+}
+
+/**
+ * Queue the reply for transmission behind any frames still waiting; the
+ * RPC is recycled once the reply is out.
+ */
+void UringTransport::UringServerRpc::sendReply() {
+    sendFrames();
+    if (connection->closed) {
+        transport->destroyRpc(this);
+        return;
+    }
+    connection->outgoing.push_back({this, nullptr, {nonce, replyPayload.size(), 0}});
+    transport->startSend(connection);
+}
+
+/**
+ * Queue the frames a worker has produced so far.
+ */
+void UringTransport::UringServerRpc::sendFrames() {
+    while (Buffer *frame = popFrame()) {
+        if (connection->closed) {
+            // Nobody is listening anymore; let the worker run to completion.
+            releaseFrame(frame);
+            continue;
+        }
+        connection->outgoing.push_back({this, frame, {nonce, frame->size(), MORE_FRAMES}});
+    }
+    transport->startSend(connection);
+}
+
+std::string UringTransport::UringServerRpc::getClientServiceLocator() {
+    sockaddr_in sin{};
+    socklen_t length = sizeof(sin);
+    getpeername(connection->fd, reinterpret_cast<sockaddr *>(&sin), &length);
+    return format("tcp:host=%s,port=%hu", inet_ntoa(sin.sin_addr), NTOHS(sin.sin_port));
+}
+
+UringTransport::Connection::Connection(int fd, int fileIndex)
+    : fd(fd), fileIndex(fileIndex), closed(false), refs(0), header(), headerBytes(0), bodyBytes(0), rpc(nullptr)
+      , body(nullptr), outgoing(), sentBytes(0), sending(false), iov(), msg() {
+}
+
+UringTransport::UringPoller::UringPoller(UringTransport *transport)
+    : Dispatch::Poller(transport->context->dispatch, "UringPoller"), transport(transport) {
+}
+
+int UringTransport::UringPoller::poll() {
+    int result = transport->reap();
+    transport->submit();
+    return result > 0 ? 1 : 0;
+}
+
+UringTransport::RingHandler::RingHandler(int fd, UringTransport *transport)
+    : Dispatch::File(transport->context->dispatch, fd, Dispatch::FileEvent::READABLE), transport(transport) {
+}
+
+void UringTransport::RingHandler::handleFileEvent(uint32_t events) {
+    transport->reap();
+    transport->submit();
+}
+
+}
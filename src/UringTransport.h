@@ -0,0 +1,305 @@
+#ifndef GUNGNIR_URINGTRANSPORT_H
+#define GUNGNIR_URINGTRANSPORT_H
+
+#include <deque>
+#include <vector>
+#include <linux/io_uring.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "Transport.h"
+#include "Dispatch.h"
+#include "Context.h"
+#include "ObjectPool.h"
+
+namespace Gungnir {
+
+/**
+ * A server transport that drives its sockets through io_uring rather than
+ * epoll readiness plus one recv/sendmsg call per message. Connections are
+ * taken with a multishot accept, registered as fixed files and read with a
+ * multishot receive into a ring of provided buffers, so a request costs no
+ * system call of its own; sends are queued as SQEs and submitted together
+ * once per pass of the dispatch loop.
+ *
+ * It speaks the same framing as TcpTransport, so clients connect to it
+ * with TcpTransport sessions; it has no client side of its own.
+ */
+class UringTransport : public Transport {
+
+public:
+    explicit UringTransport(Context *context, const std::string &serviceLocator);
+
+    ~UringTransport() override;
+
+    SessionRef getSession(const std::string &serviceLocator) override;
+
+    std::string getServiceLocator() override;
+
+    class UringServerRpc;
+
+private:
+
+    class Connection;
+
+    /**
+     * Header for request and response messages; identical to the one of
+     * TcpTransport.
+     */
+    struct Header {
+        /// Unique identifier for this RPC, generated on the client.
+        uint64_t nonce;
+
+        /// The size in bytes of the payload (which follows immediately).
+        uint32_t len;
+
+        /// OR'ed combination of HeaderFlags values.
+        uint8_t flags;
+    } __attribute__((packed));
+
+    enum HeaderFlags : uint8_t {
+        /// This message is one frame of a streamed response.
+        MORE_FRAMES = 1
+    };
+
+    /// Kind of request an SQE carries; stored in the low bits of its
+    /// user_data, above which sits the Connection it belongs to.
+    enum Operation : uint64_t {
+        OP_ACCEPT = 1,
+        OP_RECV = 2,
+        OP_SEND = 3,
+        OP_MASK = 7
+    };
+
+    /// Number of entries in the submission queue; the completion queue
+    /// is four times larger, since multishot receives post many CQEs.
+    static const uint32_t RING_ENTRIES = 1024;
+
+    /// Number and size of the provided buffers receives land in. The
+    /// count must be a power of two.
+    static const uint32_t BUFFER_COUNT = 256;
+    static const uint32_t BUFFER_SIZE = 16384;
+
+    /// Buffer group id of the provided buffer ring.
+    static const uint16_t BUFFER_GROUP = 0;
+
+    /// Size of the registered file table; connections beyond it are
+    /// served through plain file descriptors.
+    static const uint32_t MAX_FIXED_FILES = 4096;
+
+    /// Most iovecs gathered into a single sendmsg.
+    static const uint32_t MAX_SEND_IOVECS = 128;
+
+public:
+    /**
+     * The io_uring implementation of Transport::ServerRpc.
+     */
+    class UringServerRpc : public Transport::ServerRpc {
+        friend class UringTransport;
+
+        friend class ObjectPool<UringServerRpc>;
+
+    public:
+        UringServerRpc(Connection *connection, UringTransport *transport)
+            : connection(connection), transport(transport), nonce(0) {}
+
+        ~UringServerRpc() override = default;
+
+        void sendReply() override;
+
+        void sendFrames() override;
+
+        std::string getClientServiceLocator() override;
+
+    private:
+        /// Connection the request arrived on; kept alive by this RPC.
+        Connection *connection;
+
+        UringTransport *transport;
+
+        /// Nonce of the request, echoed in every message of the reply.
+        uint64_t nonce;
+    };
+
+private:
+    /**
+     * One message waiting on a connection to be transmitted.
+     */
+    struct OutgoingMessage {
+        /// RPC the message answers.
+        UringServerRpc *rpc;
+
+        /// Frame of a streamed reply; NULL means the final reply in
+        /// rpc->replyPayload.
+        Buffer *frame;
+
+        Header header;
+    };
+
+    /**
+     * An accepted client socket.
+     */
+    class Connection {
+    public:
+        Connection(int fd, int fileIndex);
+
+        /// Socket of the connection.
+        int fd;
+
+        /// Slot of fd in the registered file table, or -1.
+        int fileIndex;
+
+        /// True once the connection has been shut down; it is freed when
+        /// refs drops to zero.
+        bool closed;
+
+        /// Number of SQEs in flight and RPCs alive that reference this
+        /// connection.
+        int refs;
+
+        /// Header of the request being received.
+        Header header;
+
+        /// Bytes of header and body of that request received so far.
+        uint32_t headerBytes;
+        uint32_t bodyBytes;
+
+        /// RPC the request being received is assembled in, or NULL.
+        UringServerRpc *rpc;
+
+        /// Where the retained part of the request body goes.
+        char *body;
+
+        /// Messages to transmit, oldest first; a sendmsg in flight covers
+        /// a prefix of them.
+        std::deque<OutgoingMessage> outgoing;
+
+        /// Bytes of the front message already transmitted.
+        uint32_t sentBytes;
+
+        /// True while a sendmsg is in flight; iov and msg belong to it.
+        bool sending;
+        std::vector<iovec> iov;
+        msghdr msg;
+    };
+
+    /**
+     * Reaps completions and submits queued SQEs on each pass of the
+     * dispatch loop.
+     */
+    class UringPoller : public Dispatch::Poller {
+    public:
+        explicit UringPoller(UringTransport *transport);
+
+        int poll() override;
+
+    private:
+        UringTransport *transport;
+    };
+
+    /**
+     * Wakes a Dispatch that blocks in epoll_wait when completions arrive.
+     */
+    class RingHandler : public Dispatch::File {
+    public:
+        RingHandler(int fd, UringTransport *transport);
+
+        void handleFileEvent(uint32_t events) override;
+
+    private:
+        UringTransport *transport;
+    };
+
+    void setupRing();
+
+    void setupBuffers();
+
+    io_uring_sqe *getSqe();
+
+    void submit();
+
+    int reap();
+
+    void armAccept();
+
+    void armRecv(Connection *connection);
+
+    void startSend(Connection *connection);
+
+    void handleAccept(io_uring_cqe *cqe);
+
+    void handleRecv(Connection *connection, io_uring_cqe *cqe);
+
+    void handleSend(Connection *connection, io_uring_cqe *cqe);
+
+    void processInput(Connection *connection, const char *data, uint32_t length);
+
+    void recycleBuffer(uint16_t bufferId);
+
+    void closeConnection(Connection *connection);
+
+    void dropOutgoing(Connection *connection);
+
+    void destroyRpc(UringServerRpc *rpc);
+
+    void release(Connection *connection);
+
+    Context *context;
+
+    std::string locatorString;
+
+    /// File descriptor the server listens on.
+    int listenSocket;
+
+    /// The io_uring instance.
+    int ringFd;
+
+    /// Shared rings mapped from ringFd, with their sizes.
+    void *sqRing;
+    size_t sqRingSize;
+    void *cqRing;
+    size_t cqRingSize;
+    io_uring_sqe *sqes;
+    size_t sqesSize;
+
+    /// Fields of the submission ring.
+    unsigned *sqHead;
+    unsigned *sqTail;
+    unsigned *sqMask;
+    unsigned *sqFlags;
+    unsigned *sqArray;
+    unsigned sqEntries;
+
+    /// Tail of the SQEs prepared so far, and how many of them the kernel
+    /// has taken.
+    unsigned sqeTail;
+    unsigned sqeSubmitted;
+
+    /// Fields of the completion ring.
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned *cqMask;
+    io_uring_cqe *cqes;
+
+    /// Provided buffer ring and the memory of its buffers.
+    io_uring_buf_ring *bufferRing;
+    char *bufferMemory;
+    uint16_t bufferTail;
+
+    /// Unused slots of the registered file table.
+    std::vector<int> freeFileIndexes;
+
+    /// Open connections, indexed by file descriptor.
+    std::vector<Connection *> connections;
+
+    std::unique_ptr<UringPoller> poller;
+
+    std::unique_ptr<RingHandler> ringHandler;
+
+    /// Pool allocator for our ServerRpc objects.
+    ObjectPool<UringServerRpc> serverRpcPool;
+};
+
+}
+
+#endif //GUNGNIR_URINGTRANSPORT_H
@@ -10,7 +10,12 @@ typedef enum Status {
     STATUS_RETRY = 3,
     STATUS_MESSAGE_ERROR = 4,
     STATUS_INTERNAL_ERROR = 5,
-    STATUS_UNIMPLEMENTED_REQUEST = 6
+    STATUS_UNIMPLEMENTED_REQUEST = 6,
+    STATUS_WRONG_VERSION = 7,
+    STATUS_INVALID_OBJECT = 8,
+    STATUS_STALE_REPLICA = 9,
+    STATUS_NOT_PRIMARY = 10,
+    STATUS_LOG_GAP = 11
 } Status;
 
 
@@ -21,6 +26,14 @@ public:
         PUT = 2,
         ERASE = 3,
         SCAN = 4,
+        SCAN_AGGREGATE = 5,
+        INCREMENT = 6,
+        COMPARE_AND_SWAP = 7,
+        APPEND = 8,
+        MULTI_GET = 9,
+        MULTI_PUT = 10,
+        TRANSACT = 11,
+        REPLICATE = 12,
         ILLEGAL_RPC_TYPE = 100
     };
 
@@ -46,10 +59,16 @@ public:
         struct Request {
             RequestCommon common;
             uint64_t key;
+            uint64_t minLsn;          // Primary log offset a backup must have
+                                      // applied; 0 means any.
+            uint32_t maxStalenessMicros; // How far a backup may lag behind
+                                      // its primary; 0 means no bound.
         } __attribute__((packed));
         struct Response {
             ResponseCommon common;
             uint32_t length;
+            uint64_t version;         // Version of the object returned.
+            uint64_t lsn;             // Primary log offset the reply reflects.
         } __attribute__((packed));
     };
 
@@ -62,6 +81,7 @@ public:
         } __attribute__((packed));
         struct Response {
             ResponseCommon common;
+            uint64_t version;         // Version of the object written.
         } __attribute__((packed));
     };
     struct Erase {
@@ -80,10 +100,183 @@ public:
             RequestCommon common;
             uint64_t start;
             uint64_t end;
+            uint32_t maxCount;        // Maximum number of objects to return;
+                                      // 0 means no limit.
+            uint32_t maxBytes;        // Maximum bytes of key/value data to
+                                      // return; 0 means the server default.
+            uint8_t reverse;          // Nonzero means objects are returned in
+                                      // descending key order, starting at end.
+            uint32_t chunkBytes;      // Nonzero means stream the whole range
+                                      // in frames of about this many bytes
+                                      // (maxBytes is then ignored).
+            uint64_t minLsn;          // As for Get.
+            uint32_t maxStalenessMicros;
         } __attribute__((packed));
         struct Response {
             ResponseCommon common;
-            uint16_t size;
+            uint32_t size;            // Number of objects in this response.
+            uint8_t hasMore;          // Nonzero means the range was not
+                                      // exhausted; continue from nextKey.
+            uint64_t nextKey;         // First key not returned: the new start
+                                      // (or end, when reverse) of the range.
+            uint64_t lsn;             // Primary log offset the reply reflects.
+        } __attribute__((packed));
+    };
+    struct ScanAggregate {
+        static const Opcode opcode = SCAN_AGGREGATE;
+        enum Function : uint8_t {
+            COUNT = 0,
+            SUM = 1,
+            MIN = 2,
+            MAX = 3
+        };
+        struct Request {
+            RequestCommon common;
+            uint64_t start;
+            uint64_t end;
+            uint8_t function;         // Aggregate to compute; a Function.
+            uint8_t fieldWidth;       // Width of the unsigned little-endian
+                                      // field in bytes: 1, 2, 4 or 8.
+            uint32_t fieldOffset;     // Offset of the field within values.
+            uint32_t prefixLength;    // Length of the value prefix that
+                                      // follows this header; only objects
+                                      // whose value starts with it are
+                                      // aggregated. 0 means no filter.
+        } __attribute__((packed));
+        struct Response {
+            ResponseCommon common;
+            uint64_t count;           // Objects in range that passed the
+                                      // filter.
+            uint64_t fieldCount;      // Of those, objects whose value was
+                                      // long enough to contain the field.
+            uint64_t result;          // The aggregate over those fields; the
+                                      // same as count for COUNT.
+        } __attribute__((packed));
+    };
+    struct Increment {
+        static const Opcode opcode = INCREMENT;
+        struct Request {
+            RequestCommon common;
+            uint64_t key;
+            int64_t delta;            // Added to the 8-byte little-endian
+                                      // value; a missing object counts as 0.
+        } __attribute__((packed));
+        struct Response {
+            ResponseCommon common;
+            int64_t value;            // Value after the increment.
+            uint64_t version;         // Version of the object written.
+        } __attribute__((packed));
+    };
+    struct CompareAndSwap {
+        static const Opcode opcode = COMPARE_AND_SWAP;
+        struct Request {
+            RequestCommon common;
+            uint64_t key;
+            uint64_t version;         // The write happens only if the current
+                                      // version equals this; 0 means the
+                                      // object must not exist.
+            uint32_t length;          // Length of the new value, which
+                                      // follows this header.
+        } __attribute__((packed));
+        struct Response {
+            ResponseCommon common;
+            uint64_t version;         // Version written, or the current
+                                      // version if STATUS_WRONG_VERSION.
+        } __attribute__((packed));
+    };
+    struct Append {
+        static const Opcode opcode = APPEND;
+        struct Request {
+            RequestCommon common;
+            uint64_t key;
+            uint32_t length;          // Length of the data to append, which
+                                      // follows this header.
+        } __attribute__((packed));
+        struct Response {
+            ResponseCommon common;
+            uint64_t version;         // Version of the object written.
+        } __attribute__((packed));
+    };
+    struct MultiGet {
+        static const Opcode opcode = MULTI_GET;
+        static const uint32_t MAX_COUNT = 1024;
+        struct Request {
+            RequestCommon common;
+            uint32_t count;           // Number of uint64_t keys that follow
+                                      // this header; at most MAX_COUNT.
+        } __attribute__((packed));
+        struct Response {
+            ResponseCommon common;
+            uint32_t count;           // Number of Parts that follow this
+                                      // header, in request order.
+        } __attribute__((packed));
+        struct Part {
+            Status status;            // STATUS_OK or
+                                      // STATUS_OBJECT_DOESNT_EXIST.
+            uint32_t length;          // Length of the value that follows.
+            uint64_t version;
+        } __attribute__((packed));
+    };
+    struct MultiPut {
+        static const Opcode opcode = MULTI_PUT;
+        static const uint32_t MAX_COUNT = 1024;
+        struct Request {
+            RequestCommon common;
+            uint32_t count;           // Number of Parts that follow this
+                                      // header; at most MAX_COUNT.
+        } __attribute__((packed));
+        struct Part {
+            uint64_t key;
+            uint32_t length;          // Length of the value that follows.
+        } __attribute__((packed));
+        struct Response {
+            ResponseCommon common;
+            uint32_t count;           // Number of uint64_t versions that
+                                      // follow, in request order.
+        } __attribute__((packed));
+    };
+    struct Transact {
+        static const Opcode opcode = TRANSACT;
+        static const uint32_t MAX_COUNT = 1024;
+        enum Operation : uint8_t {
+            TX_PUT = 0,
+            TX_ERASE = 1
+        };
+        struct Request {
+            RequestCommon common;
+            uint32_t count;           // Number of Parts that follow this
+                                      // header; at most MAX_COUNT.
+        } __attribute__((packed));
+        struct Part {
+            uint8_t operation;        // An Operation.
+            uint64_t key;
+            uint32_t length;          // Length of the value that follows;
+                                      // 0 for TX_ERASE.
+        } __attribute__((packed));
+        struct Response {
+            ResponseCommon common;
+            uint32_t count;           // Number of uint64_t versions that
+                                      // follow, in request order; 0 for
+                                      // erases.
+        } __attribute__((packed));
+    };
+    struct Replicate {
+        static const Opcode opcode = REPLICATE;
+        struct Request {
+            RequestCommon common;
+            uint64_t offset;          // Offset in the primary's log of the
+                                      // first byte that follows.
+            uint32_t length;          // Bytes of log entries that follow.
+            uint64_t primaryLsn;      // Bytes in the primary's log when the
+                                      // request was sent; offset + length
+                                      // equal to it means the backup is
+                                      // caught up.
+        } __attribute__((packed));
+        struct Response {
+            ResponseCommon common;
+            uint64_t appliedLsn;      // End of what the backup has applied;
+                                      // if STATUS_LOG_GAP, the request must
+                                      // start there or before.
         } __attribute__((packed));
     };
 };
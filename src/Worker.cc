@@ -7,6 +7,8 @@
 #include "Service.h"
 #include "ConcurrentSkipList.h"
 
+#include <algorithm>
+
 #include <linux/futex.h>
 #include <syscall.h>
 #include <unistd.h>
@@ -37,13 +39,18 @@ void Worker::exit() {
     // it could go away).
     handoff(WORKER_EXIT);
     thread->join();
-    rpc = nullptr;
     exited = true;
 }
 
+/**
+ * Give the worker another RPC to serve; it may still be serving earlier
+ * ones. Called by the dispatch thread.
+ */
 void Worker::handoff(Transport::ServerRpc *newRpc) {
-    assert(rpc == nullptr);
-    rpc = newRpc;
+    {
+        SpinLock::Guard guard(queueLock);
+        incoming.push_back(newRpc);
+    }
 
     int prevState = state.exchange(WORKING);
     if (prevState == SLEEPING) {
@@ -54,6 +61,69 @@ void Worker::handoff(Transport::ServerRpc *newRpc) {
     }
 }
 
+/**
+ * Return an RPC whose reply is ready, or NULL if there is none. Called by
+ * the dispatch thread.
+ */
+Transport::ServerRpc *Worker::popCompleted() {
+    SpinLock::Guard guard(queueLock);
+    if (completed.empty())
+        return nullptr;
+    Transport::ServerRpc *rpc = completed.front();
+    completed.pop_front();
+    return rpc;
+}
+
+Transport::ServerRpc *Worker::popIncoming() {
+    SpinLock::Guard guard(queueLock);
+    if (incoming.empty())
+        return nullptr;
+    Transport::ServerRpc *rpc = incoming.front();
+    incoming.pop_front();
+    return rpc;
+}
+
+void Worker::startRpc(Transport::ServerRpc *newRpc) {
+    Service *service = Service::dispatch(this, context, newRpc);
+    if (service == nullptr) {
+        Service::prepareErrorResponse(&newRpc->replyPayload, STATUS_UNIMPLEMENTED_REQUEST);
+        {
+            SpinLock::Guard guard(queueLock);
+            completed.push_back(newRpc);
+        }
+        if (context->dispatch != nullptr)
+            context->dispatch->wakeup();
+        return;
+    }
+    if (active.empty())
+        updateEpoch();
+    service->epoch = context->skipList->epoch.load();
+    active.push_back(service);
+    schedule(service);
+}
+
+/**
+ * Hand the RPC of a service that has run to completion back to the
+ * dispatch thread, and free the service.
+ */
+void Worker::finish(Service *service) {
+    auto it = std::find(active.begin(), active.end(), service);
+    if (it != active.end()) {
+        active.erase(it);
+        // Objects may only be reclaimed once the oldest service still
+        // running can no longer reference them.
+        if (!active.empty())
+            localEpoch.store(active.front()->epoch);
+    }
+    {
+        SpinLock::Guard guard(queueLock);
+        completed.push_back(service->rpc);
+    }
+    if (context->dispatch != nullptr)
+        context->dispatch->wakeup();
+    delete service;
+}
+
 bool Worker::performTask() {
     auto *service = dynamic_cast<Service *> (getNextTask());
 
@@ -63,30 +133,16 @@ bool Worker::performTask() {
     try {
         service->performTask();
     } catch (RetryException &e) {
-        if (this->replySent()) {
-            throw FatalError(HERE, "Retry exception thrown after reply sent for %s RPC");
-        } else {
-            Service::prepareRetryResponse(service->replyPayload, e.minDelayMicros, e.maxDelayMicros, e.message);
-        }
+        Service::prepareRetryResponse(service->replyPayload, e.minDelayMicros, e.maxDelayMicros, e.message);
     } catch (ClientException &e) {
-        if (this->replySent()) {
-            throw FatalError(HERE, "exception thrown after reply sent for RPC");
-        } else {
-            Service::prepareErrorResponse(service->replyPayload, e.status);
-        }
+        Service::prepareErrorResponse(service->replyPayload, e.status);
     }
+    if (!service->isScheduled())
+        finish(service);
     return false;
 
 }
 
-bool Worker::replySent() {
-    return (state.load(std::memory_order_acquire) == POSTPROCESSING);
-}
-
-void Worker::sendReply() {
-    state.store(POSTPROCESSING, std::memory_order_release);
-}
-
 void Worker::updateEpoch() {
     localEpoch.store(context->skipList->epoch.load());
 }
@@ -134,20 +190,32 @@ void Worker::workerMain(Worker *worker) {
                 }
                 lastIdle = Cycles::rdtsc();
             }
-            if (worker->rpc == WORKER_EXIT)
-                break;
-
-            worker->updateEpoch();
+            // Serve RPCs until none is left, taking on new ones as the
+            // dispatch thread hands them off.
+            while (true) {
+                Transport::ServerRpc *rpc;
+                while ((rpc = worker->popIncoming()) != nullptr) {
+                    if (rpc == WORKER_EXIT)
+                        return;
+                    worker->startRpc(rpc);
+                }
+                if (!worker->isIdle()) {
+                    worker->performTask();
+                    continue;
+                }
 
-            Service *service = Service::dispatch(worker, worker->context, worker->rpc);
-            worker->schedule(service);
-            while (!worker->isIdle()) {
-                worker->performTask();
+                // Out of work. Tricky race condition: the dispatch thread
+                // could hand off an RPC just before we change the state to
+                // POLLING, so look for one again afterwards.
+                worker->state.store(Worker::POLLING);
+                {
+                    SpinLock::Guard guard(worker->queueLock);
+                    if (worker->incoming.empty())
+                        break;
+                }
+                worker->state.store(Worker::WORKING);
             }
 
-            // Pass the RPC back to the dispatch thread for completion.
-            worker->state.store(Worker::POLLING, std::memory_order_release);
-
             // Update performance statistics.
             uint64_t current = Cycles::rdtsc();
             lastIdle = current;
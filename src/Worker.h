@@ -5,17 +5,17 @@
 #include "Transport.h"
 #include "TaskQueue.h"
 #include "Context.h"
+#include "SpinLock.h"
 
+#include <deque>
 #include <thread>
+#include <vector>
 
 namespace Gungnir {
 
-class Worker : public TaskQueue {
-
-public:
-    bool replySent();
+class Service;
 
-    void sendReply();
+class Worker : public TaskQueue {
 
 private:
 
@@ -23,14 +23,28 @@ private:
 
 public:
     int threadId;
-    WireFormat::Opcode opcode;
-    Transport::ServerRpc *rpc;
     std::atomic<int> localEpoch;
 
     void updateEpoch();
 
     static int pollMicros;
 
+    /// Most RPCs the WorkerManager hands to one worker at a time. The
+    /// worker interleaves their services, so an RPC that yields (waiting
+    /// for a lock or the log) doesn't hold up the ones behind it.
+    static const uint32_t MAX_RPCS = 8;
+
+    /// RPCs of the read lane a worker takes on top of MAX_RPCS others.
+    /// A read runs in one step, and ahead of the others in the worker's
+    /// TaskQueue, so it shouldn't wait for a slot that scans or writes
+    /// hold for much longer.
+    static const uint32_t EXTRA_READ_RPCS = 8;
+
+    /// Most RPCs a worker may hold when it takes one of lane.
+    static uint32_t maxRpcs(uint32_t lane) {
+        return lane == READ_LANE ? MAX_RPCS + EXTRA_READ_RPCS : MAX_RPCS;
+    }
+
     static int futexWake(int *addr, int count);
 
     static int futexWait(int *addr, int value);
@@ -42,23 +56,45 @@ public:
     enum {
         POLLING,
         WORKING,
-        POSTPROCESSING,
         SLEEPING
     };
     bool exited;
 
+    /// RPCs handed to this worker that it hasn't completed yet. Only
+    /// accessed by the dispatch thread.
+    std::vector<Transport::ServerRpc *> rpcs;
+
     explicit Worker(Context *context)
-        : TaskQueue(context), thread(), threadId(0), opcode(WireFormat::Opcode::ILLEGAL_RPC_TYPE)
-          , rpc(nullptr), busyIndex(-1), state(POLLING), exited(false) {}
+        : TaskQueue(context), thread(), threadId(0), busyIndex(-1), state(POLLING), exited(false), rpcs()
+          , active(), queueLock(), incoming(), completed() {}
 
     void exit();
 
     void handoff(Transport::ServerRpc *newRpc);
 
+    Transport::ServerRpc *popCompleted();
+
     bool performTask() override;
 
+private:
+    Transport::ServerRpc *popIncoming();
+
+    void startRpc(Transport::ServerRpc *rpc);
+
+    void finish(Service *service);
+
+    /// Services of the RPCs in progress, oldest first. Only accessed by
+    /// the worker thread.
+    std::deque<Service *> active;
+
+    /// Protects incoming and completed, which pass RPCs between the
+    /// dispatch thread and the worker thread.
+    SpinLock queueLock;
+    std::deque<Transport::ServerRpc *> incoming;
+    std::deque<Transport::ServerRpc *> completed;
 
     friend class WorkerManager;
+    friend class WorkerManagerTest;
 };
 
 }
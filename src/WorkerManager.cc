@@ -4,6 +4,11 @@
 #include "Cycles.h"
 #include "TaskQueue.h"
 #include "Service.h"
+#include "OptionConfig.h"
+#include "ConcurrentSkipList.h"
+
+#include <algorithm>
+#include <cstring>
 
 
 namespace Gungnir {
@@ -11,7 +16,15 @@ namespace Gungnir {
 
 WorkerManager::WorkerManager(Context *context, uint32_t maxCores)
     : Dispatch::Poller(context->dispatch, "WorkerManager")
-      , context(context), waitingRpcs(), busyThreads(), idleThreads(), maxCores(maxCores), rpcsWaiting(0) {
+      , context(context), waitingRpcs(LaneWeights(context->optionConfig->laneWeights)), maxWaitingRpcs(context->optionConfig->maxWaitingRpcs)
+      , targetDelay(Cycles::fromMicroseconds(context->optionConfig->queueDelayTargetMicros))
+      , delayInterval(Cycles::fromMicroseconds(context->optionConfig->queueDelayIntervalMicros))
+      , intervalEnd(0), minDelay(~0ul), overloaded(false), serviceTime(0), completedBefore(0)
+      , retryMicros(MIN_RETRY_MICROS), turnedAwayBefore(0)
+      , statsInterval(Cycles::fromSeconds(context->optionConfig->statsSeconds)), nextStats(0)
+      , pendingGets(), pendingPuts(), trackedKeys(), followers(), busyThreads(), idleThreads()
+      , maxCores(maxCores), rpcsWaiting(0), minEpoch(0), coalescedGets(0), coalescedPuts(0)
+      , admittedRpcs(0), rejectedRpcs(0), shedRpcs(0), completedRpcs(0) {
     Logger::log("Max cores number:%d", maxCores);
     for (uint32_t i = 0; i < maxCores; i++) {
         auto *worker = new Worker(context);
@@ -49,20 +62,308 @@ void WorkerManager::handleRpc(Transport::ServerRpc *rpc) {
         rpc->sendReply();
         return;
     }
+    if (coalesce(rpc, header->opcode))
+        return;
+
+    uint32_t lane = laneOf(header->opcode);
+    Worker *worker = nullptr;
+    if (!idleThreads.empty()) {
+        worker = idleThreads.back();
+        idleThreads.pop_back();
+        worker->busyIndex = static_cast<int>(busyThreads.size());
+        busyThreads.push_back(worker);
+    } else {
+        // Every worker is busy; share the load with the least loaded one,
+        // which interleaves this RPC with the ones it is serving already.
+        for (Worker *busy : busyThreads) {
+            if (busy->rpcs.size() < Worker::maxRpcs(lane) &&
+                (worker == nullptr || busy->rpcs.size() < worker->rpcs.size()))
+                worker = busy;
+        }
+        if (worker == nullptr) {
+            uint64_t now = Cycles::rdtsc();
+            if (!admit(lane)) {
+                rejectedRpcs++;
+                reject(rpc, lane);
+                return;
+            }
+            waitingRpcs.push(lane, WaitingRpc{rpc, now, lane});
+            rpcsWaiting++;
+            track(rpc, header->opcode, nullptr);
+            return;
+        }
+    }
+    if (targetDelay != 0)
+        sampleDelay(0, Cycles::rdtsc());
+    admittedRpcs++;
+    worker->rpcs.push_back(rpc);
+    track(rpc, header->opcode, worker);
+    worker->handoff(rpc);
+}
+
+/**
+ * Decide whether an RPC that finds every worker full may wait for one.
+ * Waiting RPCs are bounded in two ways. There are at most maxWaitingRpcs
+ * of them. And, as in CoDel, the queueing delay must drop below
+ * targetDelay at least once every delayInterval: a queue that stays above
+ * it is not absorbing a burst but holding a backlog, which only adds
+ * delay. Until it does, RPCs that would wait longer than targetDelay are
+ * turned away on arrival, before they take up any memory or time; at
+ * other times, bursts may queue up to delayInterval. Rejected clients
+ * retry later (see RpcWrapper::retry()).
+ */
+bool WorkerManager::admit(uint32_t lane) {
+    if (maxWaitingRpcs != 0 && waitingRpcs.size() >= maxWaitingRpcs)
+        return false;
+    if (targetDelay == 0)
+        return true;
+    return expectedDelay(lane) <= (overloaded ? targetDelay : delayInterval);
+}
 
-    if (idleThreads.empty()) {
-        waitingRpcs.push(rpc);
-        rpcsWaiting++;
+/**
+ * Return how long, in cycles, an RPC arriving now in lane would wait for a
+ * worker, judging from the rate the workers served RPCs while overloaded
+ * (see sampleDelay()).
+ */
+uint64_t WorkerManager::expectedDelay(uint32_t lane) {
+    return waitingRpcs.ahead(lane) * serviceTime;
+}
+
+/**
+ * Record the time an RPC waited before a worker took it, and at the end
+ * of each interval, whether the queue stayed above the target throughout.
+ */
+void WorkerManager::sampleDelay(uint64_t delay, uint64_t now) {
+    minDelay = std::min(minDelay, delay);
+    if (now < intervalEnd)
         return;
+    overloaded = minDelay != ~0ul && minDelay > targetDelay;
+    minDelay = ~0ul;
+    // Workers that are overloaded are busy all the time, so their rate of
+    // completions is the rate at which they can serve. Until they have
+    // been, the first interval with completions gives an estimate, high if
+    // they were idle part of it, so that the first overload isn't met with
+    // a serviceTime of 0, which would admit every RPC.
+    if ((overloaded || serviceTime == 0) && completedRpcs != completedBefore && intervalEnd != 0)
+        serviceTime = (now - (intervalEnd - delayInterval)) / (completedRpcs - completedBefore);
+    completedBefore = completedRpcs;
+    intervalEnd = now + delayInterval;
+
+    // While clients keep being turned away, they are told to stay away
+    // longer, so that those waiting to retry don't keep coming back
+    // just to be turned away again.
+    uint64_t turnedAway = rejectedRpcs + shedRpcs;
+    if (turnedAway != turnedAwayBefore)
+        retryMicros = std::min<uint64_t>(2 * retryMicros, MAX_RETRY_MICROS);
+    else
+        retryMicros = std::max<uint64_t>(retryMicros / 2, MIN_RETRY_MICROS);
+    turnedAwayBefore = turnedAway;
+}
+
+/**
+ * Turn an RPC away with STATUS_RETRY. The client is told to come back
+ * once the RPCs waiting now have been served, and later the longer the
+ * server has been turning clients away, give or take half of that, so
+ * that the retries of many clients spread out.
+ */
+void WorkerManager::reject(Transport::ServerRpc *rpc, uint32_t lane) {
+    uint64_t delayMicros = std::max(retryMicros, Cycles::toMicroseconds(expectedDelay(lane)));
+    Service::prepareRetryResponse(&rpc->replyPayload, static_cast<uint32_t>(delayMicros / 2),
+                                  static_cast<uint32_t>(delayMicros * 3 / 2), "server overloaded");
+    sendReply(rpc);
+}
+
+/**
+ * Log the admission and coalescing statistics.
+ */
+void WorkerManager::logStats(uint64_t now) {
+    uint64_t oldest = now;
+    for (uint32_t lane = 0; lane < LANE_COUNT; lane++) {
+        if (!waitingRpcs.getLane(lane).empty())
+            oldest = std::min(oldest, waitingRpcs.getLane(lane).front().arrival);
     }
+    Logger::log("WorkerManager: %lu admitted, %lu rejected, %lu shed, %zu waiting for %lu us, %s; "
+                "%lu GETs and %lu PUTs coalesced",
+                admittedRpcs, rejectedRpcs, shedRpcs, waitingRpcs.size(),
+                Cycles::toMicroseconds(now - oldest),
+                overloaded ? "overloaded" : "not overloaded", coalescedGets, coalescedPuts);
+}
 
-    assert(!idleThreads.empty());
-    Worker *worker = idleThreads.back();
-    idleThreads.pop_back();
-    worker->opcode = WireFormat::Opcode(header->opcode);
-    worker->handoff(rpc);
-    worker->busyIndex = static_cast<int>(busyThreads.size());
-    busyThreads.push_back(worker);
+/**
+ * Coalesce requests for hot keys with others that haven't started yet: a
+ * GET identical to a pending one is answered with its reply, so one lookup
+ * serves both, and a PUT takes the place of a pending PUT to the same key
+ * (last writer wins), so only the later one is applied and logged. The
+ * later PUT skips a version for each one it replaced, and those are
+ * answered with the skipped versions, as if they had been applied just
+ * before it: a version a client got back is never one of another value,
+ * so compare-and-swap against a replaced PUT's version fails. Since the
+ * request coalesced with hasn't started, it runs entirely while both are
+ * outstanding, and both clients see a result they could have seen without
+ * coalescing.
+ *
+ * \return
+ *      True if rpc was joined to a pending GET and needs no worker.
+ */
+bool WorkerManager::coalesce(Transport::ServerRpc *rpc, uint16_t opcode) {
+    uint64_t key;
+    std::unordered_map<uint64_t, Pending> *pending = pendingFor(rpc, opcode, &key);
+    if (pending == nullptr)
+        return false;
+    auto it = pending->find(key);
+    if (it == pending->end())
+        return false;
+    Pending earlier = it->second;
+
+    if (opcode == WireFormat::GET) {
+        if (!unstarted(earlier)) {
+            untrack(earlier.rpc);
+            return false;
+        }
+        // Requests with different read constraints might not be answered
+        // alike.
+        if (memcmp(earlier.rpc->requestPayload.getStart<WireFormat::Get::Request>(),
+                   rpc->requestPayload.getStart<WireFormat::Get::Request>(),
+                   sizeof(WireFormat::Get::Request)) != 0)
+            return false;
+        followers[earlier.rpc].push_back(rpc);
+        coalescedGets++;
+        return true;
+    }
+
+    untrack(earlier.rpc);
+    if (!withdraw(earlier))
+        return false;
+    std::vector<Transport::ServerRpc *> &served = followers[rpc];
+    auto previous = followers.find(earlier.rpc);
+    if (previous != followers.end()) {
+        served = std::move(previous->second);
+        followers.erase(previous);
+    }
+    served.push_back(earlier.rpc);
+    rpc->skippedVersions = static_cast<uint32_t>(served.size());
+    coalescedPuts++;
+    return false;
+}
+
+/**
+ * Return the map of pending requests that rpc may be coalesced through, and
+ * its key, or NULL if it can't be coalesced.
+ */
+std::unordered_map<uint64_t, WorkerManager::Pending> *
+WorkerManager::pendingFor(Transport::ServerRpc *rpc, uint16_t opcode, uint64_t *key) {
+    if (opcode == WireFormat::GET) {
+        if (rpc->requestPayload.size() < sizeof(WireFormat::Get::Request))
+            return nullptr;
+        *key = rpc->requestPayload.getStart<WireFormat::Get::Request>()->key;
+        return &pendingGets;
+    }
+    if (opcode == WireFormat::PUT) {
+        if (rpc->requestPayload.size() < sizeof(WireFormat::Put::Request))
+            return nullptr;
+        *key = rpc->requestPayload.getStart<WireFormat::Put::Request>()->key;
+        return &pendingPuts;
+    }
+    return nullptr;
+}
+
+/**
+ * Record that rpc has been placed with worker (NULL for waitingRpcs), so
+ * that later requests for its key may be coalesced with it.
+ */
+void WorkerManager::track(Transport::ServerRpc *rpc, uint16_t opcode, Worker *worker) {
+    uint64_t key;
+    std::unordered_map<uint64_t, Pending> *pending = pendingFor(rpc, opcode, &key);
+    if (pending == nullptr)
+        return;
+    auto it = pending->find(key);
+    if (it != pending->end())
+        untrack(it->second.rpc);
+    (*pending)[key] = Pending{rpc, worker};
+    trackedKeys[rpc] = TrackedKey{pending, key};
+}
+
+/**
+ * Record that rpc has been handed from waitingRpcs to worker.
+ */
+void WorkerManager::moved(Transport::ServerRpc *rpc, Worker *worker) {
+    auto tracked = trackedKeys.find(rpc);
+    if (tracked != trackedKeys.end())
+        tracked->second.pending->at(tracked->second.key).worker = worker;
+}
+
+/**
+ * Forget a request recorded by track(), which later ones may no longer be
+ * coalesced with.
+ */
+void WorkerManager::untrack(Transport::ServerRpc *rpc) {
+    auto tracked = trackedKeys.find(rpc);
+    if (tracked == trackedKeys.end())
+        return;
+    tracked->second.pending->erase(tracked->second.key);
+    trackedKeys.erase(tracked);
+}
+
+/**
+ * Return whether a pending request hasn't been started by its worker.
+ */
+bool WorkerManager::unstarted(const Pending &pending) {
+    if (pending.worker == nullptr)
+        return true;
+    SpinLock::Guard guard(pending.worker->queueLock);
+    std::deque<Transport::ServerRpc *> &incoming = pending.worker->incoming;
+    return std::find(incoming.begin(), incoming.end(), pending.rpc) != incoming.end();
+}
+
+/**
+ * Take a pending request back from its worker or waitingRpcs before it
+ * starts. Returns false if it has started already.
+ */
+bool WorkerManager::withdraw(const Pending &pending) {
+    if (pending.worker == nullptr) {
+        waitingRpcs.eraseIf([&pending](const WaitingRpc &waiting) { return waiting.rpc == pending.rpc; });
+        rpcsWaiting--;
+        return true;
+    }
+    Worker *worker = pending.worker;
+    {
+        SpinLock::Guard guard(worker->queueLock);
+        auto it = std::find(worker->incoming.begin(), worker->incoming.end(), pending.rpc);
+        if (it == worker->incoming.end())
+            return false;
+        worker->incoming.erase(it);
+    }
+    worker->rpcs.erase(std::find(worker->rpcs.begin(), worker->rpcs.end(), pending.rpc));
+    return true;
+}
+
+/**
+ * Send the reply of a completed RPC, and a copy of it to every RPC
+ * coalesced with it. The copies share the values the reply pins rather
+ * than copy them. PUTs that rpc replaced get, in the order they arrived,
+ * the versions it skipped instead of its own.
+ */
+void WorkerManager::sendReply(Transport::ServerRpc *rpc) {
+    untrack(rpc);
+    auto served = followers.find(rpc);
+    if (served != followers.end()) {
+        std::vector<Transport::ServerRpc *> &replaced = served->second;
+        auto *putResp = rpc->replyPayload.getStart<WireFormat::Put::Response>();
+        for (size_t i = 0; i < replaced.size(); i++) {
+            Transport::ServerRpc *follower = replaced[i];
+            if (follower->requestPayload.getStart<WireFormat::RequestCommon>()->opcode == WireFormat::PUT &&
+                putResp != nullptr && putResp->common.status == STATUS_OK) {
+                auto *respHdr = follower->replyPayload.emplaceAppend<WireFormat::Put::Response>();
+                respHdr->common.status = STATUS_OK;
+                respHdr->version = putResp->version - (replaced.size() - i);
+            } else {
+                follower->replyPayload.appendShared(&rpc->replyPayload);
+            }
+            follower->sendReply();
+        }
+        followers.erase(served);
+    }
+    rpc->sendReply();
 }
 
 bool WorkerManager::idle() {
@@ -76,7 +377,11 @@ int WorkerManager::poll() {
     // worker. The order of iteration is crucial, since it allows us to
     // remove a worker from busyThreads in the middle of the loop without
     // interfering with the remaining iterations.
-    int minEpoch = INT32_MAX;
+    //
+    // Workers given RPCs from now on start in the current epoch or later,
+    // so what was removed before it is safe to free unless a busy worker
+    // started earlier.
+    int minEpoch = context->skipList->epoch.load();
 
     for (int i = static_cast<int>(busyThreads.size()) - 1; i >= 0; i--) {
         Worker *worker = busyThreads[i];
@@ -85,39 +390,64 @@ int WorkerManager::poll() {
             minEpoch = localEpoch;
 
         assert(worker->busyIndex == i);
-        int state = worker->state.load(std::memory_order_acquire);
-        if (state == Worker::WORKING) {
-            continue;
+
+        // Send the replies the worker has finished, in whatever order it
+        // finished them; clients match them up by nonce.
+        while (Transport::ServerRpc *rpc = worker->popCompleted()) {
+            foundWork = 1;
+            completedRpcs++;
+            auto it = std::find(worker->rpcs.begin(), worker->rpcs.end(), rpc);
+            if (it != worker->rpcs.end())
+                worker->rpcs.erase(it);
+            sendReply(rpc);
         }
-        foundWork = 1;
-        std::atomic_thread_fence(std::memory_order_acquire);
-
-        // The worker is either post-processing or idle; in either case,
-        // there may be an RPC that we have to respond to. Save the RPC
-        // information for now.
-        Transport::ServerRpc *rpc = worker->rpc;
-        worker->rpc = nullptr;
-
-        // Highest priority: if there are pending requests that are waiting
-        // for workers, hand off a new request to this worker ASAP.
-        bool startedNewRpc = false;
-        if (state != Worker::POSTPROCESSING) {
-            if (rpcsWaiting) {
-                rpcsWaiting--;
-                worker->handoff(waitingRpcs.front());
-                waitingRpcs.pop();
-                startedNewRpc = true;
+
+        // The others may be streaming their replies in frames; pass on the
+        // ones produced so far.
+        for (Transport::ServerRpc *rpc : worker->rpcs) {
+            if (rpc->hasFrames()) {
+                rpc->sendFrames();
+                foundWork = 1;
             }
         }
 
-        // Now send the response, if any.
-        if (rpc != nullptr) {
-            rpc->sendReply();
+        // Pending requests waiting for a worker take the freed slots, in
+        // the turns of their lanes; reads may take the slots only they
+        // can use out of turn. Those that have waited too long are turned
+        // away instead.
+        while (rpcsWaiting) {
+            WaitingRpc waiting;
+            if (worker->rpcs.size() < Worker::MAX_RPCS)
+                waiting = waitingRpcs.pop();
+            else if (worker->rpcs.size() < Worker::maxRpcs(READ_LANE) && !waitingRpcs.getLane(READ_LANE).empty())
+                waiting = waitingRpcs.pop(READ_LANE);
+            else
+                break;
+            rpcsWaiting--;
+            Transport::ServerRpc *rpc = waiting.rpc;
+            if (targetDelay != 0) {
+                uint64_t now = Cycles::rdtsc();
+                sampleDelay(now - waiting.arrival, now);
+                // Some RPCs got in before the queue was seen to be
+                // overloaded; those that waited too long already are
+                // turned away too.
+                if (now - waiting.arrival > (overloaded ? targetDelay : delayInterval)) {
+                    shedRpcs++;
+                    reject(rpc, waiting.lane);
+                    foundWork = 1;
+                    continue;
+                }
+            }
+            admittedRpcs++;
+            worker->rpcs.push_back(rpc);
+            moved(rpc, worker);
+            worker->handoff(rpc);
+            foundWork = 1;
         }
 
         // If the worker is idle, remove it from busyThreads (fill its
         // slot with the worker in the last slot).
-        if (!startedNewRpc && (state != Worker::POSTPROCESSING)) {
+        if (worker->rpcs.empty()) {
             if (worker != busyThreads.back()) {
                 busyThreads[worker->busyIndex] = busyThreads.back();
                 busyThreads[worker->busyIndex]->busyIndex = worker->busyIndex;
@@ -128,6 +458,15 @@ int WorkerManager::poll() {
         }
     }
     this->minEpoch.store(minEpoch);
+
+    if (statsInterval != 0) {
+        uint64_t now = Cycles::rdtsc();
+        if (now >= nextStats) {
+            if (nextStats != 0)
+                logStats(now);
+            nextStats = now + statsInterval;
+        }
+    }
     return foundWork;
 }
 
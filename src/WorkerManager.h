@@ -1,7 +1,8 @@
 #ifndef GUNGNIR_WORKERMANAGER_H
 #define GUNGNIR_WORKERMANAGER_H
 
-#include <queue>
+#include <unordered_map>
+#include <vector>
 
 #include "WireFormat.h"
 #include "Transport.h"
@@ -9,6 +10,7 @@
 #include "Context.h"
 #include "TaskQueue.h"
 #include "Worker.h"
+#include "PriorityLanes.h"
 
 namespace Gungnir {
 
@@ -28,10 +30,115 @@ public:
 
     Transport::ServerRpc *waitForRpc(double timeoutSeconds);
 
+    /// Shortest delay a rejected client is told to wait before it
+    /// retries.
+    static const uint32_t MIN_RETRY_MICROS = 100;
+
+    /// Longest delay a rejected client is told to wait.
+    static const uint32_t MAX_RETRY_MICROS = 1000000;
+
 private:
 
+    /// An RPC waiting for a worker to take it.
+    struct WaitingRpc {
+        Transport::ServerRpc *rpc;
+
+        /// Cycles::rdtsc() when it arrived.
+        uint64_t arrival;
+
+        uint32_t lane;
+    };
+
+    /// A GET or PUT that hasn't been seen to start yet, which later
+    /// requests for the same key may be coalesced with.
+    struct Pending {
+        Transport::ServerRpc *rpc;
+
+        /// Worker it was handed to, or NULL while it is in waitingRpcs.
+        Worker *worker;
+    };
+
+    bool coalesce(Transport::ServerRpc *rpc, uint16_t opcode);
+
+    std::unordered_map<uint64_t, Pending> *pendingFor(Transport::ServerRpc *rpc, uint16_t opcode, uint64_t *key);
+
+    void track(Transport::ServerRpc *rpc, uint16_t opcode, Worker *worker);
+
+    void moved(Transport::ServerRpc *rpc, Worker *worker);
+
+    void untrack(Transport::ServerRpc *rpc);
+
+    bool unstarted(const Pending &pending);
+
+    bool withdraw(const Pending &pending);
+
+    void sendReply(Transport::ServerRpc *rpc);
+
+    bool admit(uint32_t lane);
+
+    void sampleDelay(uint64_t delay, uint64_t now);
+
+    uint64_t expectedDelay(uint32_t lane);
+
+    void reject(Transport::ServerRpc *rpc, uint32_t lane);
+
+    void logStats(uint64_t now);
+
     Context *context;
-    std::queue<Transport::ServerRpc *> waitingRpcs;
+    /// RPCs waiting for a worker, in a lane by opcode (see laneOf()), so
+    /// that short reads don't wait behind long writes and scans.
+    PriorityLanes<WaitingRpc> waitingRpcs;
+
+    /// Most RPCs waitingRpcs holds; 0 means no limit.
+    uint32_t maxWaitingRpcs;
+
+    /// Queueing delay target and the interval it must be met in at least
+    /// once, in cycles; see admit(). A target of 0 turns the check off.
+    uint64_t targetDelay;
+    uint64_t delayInterval;
+
+    /// End of the current interval, and the shortest queueing delay seen
+    /// in it so far (~0 if none).
+    uint64_t intervalEnd;
+    uint64_t minDelay;
+
+    /// Set when the queueing delay stayed above targetDelay for a whole
+    /// interval; then RPCs that would wait longer than targetDelay are
+    /// rejected.
+    bool overloaded;
+
+    /// Cycles per RPC completed by the workers during the last interval
+    /// in which the queue was overloaded, or the first interval with
+    /// completions until then (0 before it ends); and RPCs completed
+    /// before the current interval.
+    uint64_t serviceTime;
+    uint64_t completedBefore;
+
+    /// Delay that rejected clients are told to wait, in microseconds, at
+    /// least; see reject(). And rejectedRpcs + shedRpcs when the current
+    /// interval started.
+    uint64_t retryMicros;
+    uint64_t turnedAwayBefore;
+
+    /// Cycles between statistics log lines, 0 for none, and the time of
+    /// the next one.
+    uint64_t statsInterval;
+    uint64_t nextStats;
+
+    /// Pending GETs and PUTs, by key.
+    std::unordered_map<uint64_t, Pending> pendingGets;
+    std::unordered_map<uint64_t, Pending> pendingPuts;
+
+    /// Where each pending request is recorded: a PUT may have consumed
+    /// its request by the time it completes.
+    struct TrackedKey {
+        std::unordered_map<uint64_t, Pending> *pending;
+        uint64_t key;
+    };
+    std::unordered_map<Transport::ServerRpc *, TrackedKey> trackedKeys;
+
+    /// RPCs that get the reply of another one, by the RPC that serves them.
+    std::unordered_map<Transport::ServerRpc *, std::vector<Transport::ServerRpc *>> followers;
 
     std::vector<Worker *> busyThreads;
     std::vector<Worker *> idleThreads;
@@ -40,6 +147,21 @@ private:
 public:
     std::atomic<int> minEpoch;
 
+    /// GETs served by the lookup of another, and PUTs overwritten by a
+    /// later one before they were applied.
+    uint64_t coalescedGets;
+    uint64_t coalescedPuts;
+
+    /// RPCs handed to a worker, RPCs turned away on arrival, and RPCs
+    /// turned away after they had waited too long, all with STATUS_RETRY.
+    uint64_t admittedRpcs;
+    uint64_t rejectedRpcs;
+    uint64_t shedRpcs;
+
+    /// RPCs whose replies the workers have produced.
+    uint64_t completedRpcs;
+
+    friend class WorkerManagerTest;
 };
 
 
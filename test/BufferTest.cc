@@ -8,6 +8,18 @@ class BufferTest : public ::testing::Test {
 
 };
 
+/// A chunk referring to memory the buffer doesn't own.
+struct BorrowedChunk : public Buffer::Chunk {
+    BorrowedChunk(void *data, uint32_t length, int *released)
+        : Chunk(data, length), released(released) {}
+
+    ~BorrowedChunk() override {
+        (*released)++;
+    }
+
+    int *released;
+};
+
 TEST_F(BufferTest, getRangeBasics) {
     Buffer buffer;
     const char *chunk = "0123456789";
@@ -34,6 +46,79 @@ TEST_F(BufferTest, peekOutOfRange) {
     EXPECT_EQ(0u, length);
 }
 
+TEST_F(BufferTest, appendChunk) {
+    char memory[] = "0123456789";
+    int released = 0;
+    Buffer buffer;
+    buffer.append("abc", 3);
+    buffer.appendChunk(new BorrowedChunk(memory, 10, &released));
+    buffer.append("ABC", 3);
+    EXPECT_EQ(16u, buffer.size());
+    EXPECT_EQ('2', *static_cast<char *>(buffer.getRange(5, 1)));
+    EXPECT_EQ(0, memcmp("9AB", buffer.getRange(12, 3), 3));
+    EXPECT_EQ(0, released);
+    buffer.reset();
+    EXPECT_EQ(1, released);
+    EXPECT_EQ('0', memory[0]);
+}
+
+TEST_F(BufferTest, adopt) {
+    Buffer source;
+    auto *data = static_cast<char *>(source.alloc(10));
+    memcpy(data, "0123456789", 10);
+    source.truncateFront(4);
+    Buffer buffer;
+    buffer.append("ab", 2);
+    buffer.adopt(&source);
+    EXPECT_EQ(0u, source.size());
+    EXPECT_EQ(8u, buffer.size());
+    EXPECT_EQ(data + 4, buffer.getRange(2, 6));
+    EXPECT_EQ(0, memcmp("b456", buffer.getRange(1, 4), 4));
+}
+
+TEST_F(BufferTest, adopt_borrowedMemoryIsCopied) {
+    char memory[] = "0123456789";
+    int released = 0;
+    Buffer source;
+    source.appendChunk(new BorrowedChunk(memory, 10, &released));
+    Buffer buffer;
+    buffer.adopt(&source);
+    EXPECT_EQ(0u, source.size());
+    EXPECT_EQ(10u, buffer.size());
+    EXPECT_NE(memory, buffer.getRange(0, 10));
+    EXPECT_EQ(0, memcmp(memory, buffer.getRange(0, 10), 10));
+    EXPECT_EQ(1, released);
+}
+
+/// A borrowed chunk whose memory outlives every chunk referring to it.
+struct ShareableChunk : public BorrowedChunk {
+    using BorrowedChunk::BorrowedChunk;
+
+    Chunk *share() override {
+        return new ShareableChunk(data, length, released);
+    }
+};
+
+TEST_F(BufferTest, appendShared) {
+    char memory[] = "0123456789";
+    int released = 0;
+    Buffer source;
+    source.append("ab", 2);
+    source.appendChunk(new ShareableChunk(memory, 10, &released));
+    {
+        Buffer buffer;
+        buffer.appendShared(&source);
+        EXPECT_EQ(12u, source.size());
+        EXPECT_EQ(12u, buffer.size());
+        EXPECT_NE(source.getRange(0, 2), buffer.getRange(0, 2));
+        EXPECT_EQ(0, memcmp("ab", buffer.getRange(0, 2), 2));
+        EXPECT_EQ(memory, buffer.getRange(2, 10));
+    }
+    EXPECT_EQ(1, released);
+    source.reset();
+    EXPECT_EQ(2, released);
+}
+
 TEST_F(BufferTest, peek_searchFromStart) {
     Buffer buffer;
     buffer.append("abcde", 5);
@@ -56,12 +56,17 @@ struct ConcurrentSkipListTest : public ::testing::Test {
         return rpc;
     }
 
-    TestRpc *scanRpc(uint64_t start, uint64_t end) {
+    TestRpc *scanRpc(uint64_t start, uint64_t end, uint32_t maxCount, uint32_t maxBytes, bool reverse,
+                     uint32_t chunkBytes = 0) {
         auto rpc = new TestRpc();
         auto reqHdr = rpc->requestPayload.emplaceAppend<WireFormat::Scan::Request>();
         reqHdr->common.opcode = WireFormat::SCAN;
         reqHdr->start = start;
         reqHdr->end = end;
+        reqHdr->maxCount = maxCount;
+        reqHdr->maxBytes = maxBytes;
+        reqHdr->reverse = reverse;
+        reqHdr->chunkBytes = chunkBytes;
         return rpc;
     }
 
@@ -92,8 +97,9 @@ struct ConcurrentSkipListTest : public ::testing::Test {
         return rpc;
     }
 
-    TestRpc *scan(uint64_t start, uint64_t end) {
-        TestRpc *rpc = scanRpc(start, end);
+    TestRpc *scan(uint64_t start, uint64_t end, uint32_t maxCount = 0, uint32_t maxBytes = 0,
+                  bool reverse = false) {
+        TestRpc *rpc = scanRpc(start, end, maxCount, maxBytes, reverse);
         Service *service = Service::dispatch(worker, context, rpc);
         worker->schedule(service);
         return rpc;
@@ -101,9 +107,11 @@ struct ConcurrentSkipListTest : public ::testing::Test {
 
     Iterator *toIterator(TestRpc *rpc) {
         auto *respHdr = rpc->replyPayload.getStart<WireFormat::Scan::Response>();
-        rpc->replyPayload.truncateFront(sizeof(*respHdr));
         auto iter = new Iterator(&rpc->replyPayload);
         iter->size = respHdr->size;
+        iter->hasMore = respHdr->hasMore != 0;
+        iter->nextKey = respHdr->nextKey;
+        rpc->replyPayload.truncateFront(sizeof(*respHdr));
         return iter;
     }
 };
@@ -178,4 +186,366 @@ TEST_F(ConcurrentSkipListTest, iterate) {
 
 }
 
+TEST_F(ConcurrentSkipListTest, predecessor) {
+    for (int key: {3, 7, 11, 15}) {
+        put(key, "abc");
+    }
+    erase(11);
+    while (!worker->isIdle())
+        worker->performTask();
+
+    ConcurrentSkipList *skipList = context->skipList;
+    EXPECT_EQ(nullptr, skipList->predecessor(3));
+    EXPECT_EQ(3u, skipList->predecessor(4)->getKey().value());
+    EXPECT_EQ(7u, skipList->predecessor(15)->getKey().value());
+    EXPECT_EQ(15u, skipList->floor(15)->getKey().value());
+    EXPECT_EQ(7u, skipList->floor(11)->getKey().value());
+    EXPECT_EQ(nullptr, skipList->floor(2));
+}
+
+TEST_F(ConcurrentSkipListTest, scanReverse) {
+    for (int key = 1; key <= 20; key++) {
+        put(key, std::to_string(key));
+    }
+    while (!worker->isIdle())
+        worker->performTask();
+
+    TestRpc *r = scan(5, 15, 0, 0, true);
+    while (!worker->isIdle())
+        worker->performTask();
+
+    auto iterator = toIterator(r);
+    EXPECT_EQ(11u, iterator->size);
+    EXPECT_FALSE(iterator->hasMore);
+    for (uint64_t expected = 15; expected >= 5; expected--) {
+        EXPECT_EQ(expected, iterator->getKey());
+        iterator->next();
+    }
+    EXPECT_TRUE(iterator->isDone());
+}
+
+TEST_F(ConcurrentSkipListTest, scanPaginated) {
+    for (int key = 1; key <= 250; key++) {
+        put(key, "abc");
+    }
+    while (!worker->isIdle())
+        worker->performTask();
+
+    // Count limit: the continuation key is the first key not returned.
+    TestRpc *r = scan(1, 1000, 120);
+    while (!worker->isIdle())
+        worker->performTask();
+    auto iterator = toIterator(r);
+    EXPECT_EQ(120u, iterator->size);
+    EXPECT_TRUE(iterator->hasMore);
+    EXPECT_EQ(121u, iterator->nextKey);
+
+    // Byte limit: each entry is 12 bytes of header plus a 3 byte value.
+    r = scan(121, 1000, 0, 10 * 15);
+    while (!worker->isIdle())
+        worker->performTask();
+    iterator = toIterator(r);
+    EXPECT_EQ(10u, iterator->size);
+    EXPECT_TRUE(iterator->hasMore);
+    EXPECT_EQ(131u, iterator->nextKey);
+
+    // Reverse pages continue downwards from the continuation key.
+    r = scan(1, 250, 100, 0, true);
+    while (!worker->isIdle())
+        worker->performTask();
+    iterator = toIterator(r);
+    EXPECT_EQ(100u, iterator->size);
+    EXPECT_EQ(250u, iterator->getKey());
+    EXPECT_TRUE(iterator->hasMore);
+    EXPECT_EQ(150u, iterator->nextKey);
+
+    r = scan(200, 1000);
+    while (!worker->isIdle())
+        worker->performTask();
+    iterator = toIterator(r);
+    EXPECT_EQ(51u, iterator->size);
+    EXPECT_FALSE(iterator->hasMore);
+}
+
+TEST_F(ConcurrentSkipListTest, scanStreamed) {
+    std::string value(1000, 'x');
+    for (int key = 1; key <= 40; key++) {
+        put(key, value);
+    }
+    while (!worker->isIdle())
+        worker->performTask();
+
+    TestRpc *rpc = scanRpc(1, 40, 0, 0, false, 4096);
+    worker->schedule(Service::dispatch(worker, context, rpc));
+
+    // Drain frames the way the transport would; the service must never get
+    // more than MAX_FRAMES_IN_FLIGHT ahead.
+    auto *received = new Buffer();
+    int maxFrames = Transport::ServerRpc::MAX_FRAMES_IN_FLIGHT;
+    int frames = 0;
+    while (!worker->isIdle()) {
+        worker->performTask();
+        EXPECT_LE(rpc->framesInFlight.load(), maxFrames);
+        while (Buffer *frame = rpc->popFrame()) {
+            EXPECT_LE(frame->size(), 4096u);
+            received->append(frame);
+            rpc->releaseFrame(frame);
+            frames++;
+        }
+    }
+    EXPECT_EQ(0u, rpc->replyPayload.size());
+    EXPECT_EQ(10, frames);
+
+    auto *respHdr = received->getStart<WireFormat::Scan::Response>();
+    EXPECT_EQ(STATUS_OK, respHdr->common.status);
+    received->truncateFront(sizeof(*respHdr));
+    Iterator iterator(received);
+    for (uint64_t expected = 1; expected <= 40; expected++) {
+        EXPECT_FALSE(iterator.isDone());
+        EXPECT_EQ(expected, iterator.getKey());
+        iterator.next();
+    }
+    EXPECT_TRUE(iterator.isDone());
+}
+
+TEST_F(ConcurrentSkipListTest, scanAggregate) {
+    // Values are a one byte tag followed by a little-endian 32-bit field.
+    for (uint32_t key = 1; key <= 300; key++) {
+        std::string value(5, '\0');
+        value[0] = key % 2 == 0 ? 'e' : 'o';
+        memcpy(&value[1], &key, sizeof(key));
+        put(key, value);
+    }
+    put(301, "e");
+    while (!worker->isIdle())
+        worker->performTask();
+
+    auto aggregate = [this](uint8_t function, const std::string &prefix,
+                            uint32_t fieldOffset = 1, uint8_t fieldWidth = 4) {
+        auto rpc = new TestRpc();
+        auto reqHdr = rpc->requestPayload.emplaceAppend<WireFormat::ScanAggregate::Request>();
+        reqHdr->common.opcode = WireFormat::SCAN_AGGREGATE;
+        reqHdr->start = 1;
+        reqHdr->end = 1000;
+        reqHdr->function = function;
+        reqHdr->fieldOffset = fieldOffset;
+        reqHdr->fieldWidth = fieldWidth;
+        reqHdr->prefixLength = static_cast<uint32_t>(prefix.size());
+        rpc->requestPayload.append(prefix.data(), reqHdr->prefixLength);
+        worker->schedule(Service::dispatch(worker, context, rpc));
+        while (!worker->isIdle())
+            worker->performTask();
+        return rpc->replyPayload.getStart<WireFormat::ScanAggregate::Response>();
+    };
+
+    auto *respHdr = aggregate(WireFormat::ScanAggregate::COUNT, "");
+    EXPECT_EQ(STATUS_OK, respHdr->common.status);
+    EXPECT_EQ(301u, respHdr->result);
+
+    respHdr = aggregate(WireFormat::ScanAggregate::SUM, "");
+    EXPECT_EQ(300u * 301 / 2, respHdr->result);
+    EXPECT_EQ(301u, respHdr->count);
+    EXPECT_EQ(300u, respHdr->fieldCount);
+
+    respHdr = aggregate(WireFormat::ScanAggregate::SUM, "e");
+    EXPECT_EQ(150u * 151, respHdr->result);
+    EXPECT_EQ(151u, respHdr->count);
+
+    respHdr = aggregate(WireFormat::ScanAggregate::MIN, "e");
+    EXPECT_EQ(2u, respHdr->result);
+
+    respHdr = aggregate(WireFormat::ScanAggregate::MAX, "o");
+    EXPECT_EQ(299u, respHdr->result);
+
+    // Fields past the end of every value are skipped, however close the
+    // offset is to wrapping around.
+    respHdr = aggregate(WireFormat::ScanAggregate::SUM, "", UINT32_MAX - 8, 8);
+    EXPECT_EQ(STATUS_OK, respHdr->common.status);
+    EXPECT_EQ(301u, respHdr->count);
+    EXPECT_EQ(0u, respHdr->fieldCount);
+
+    respHdr = aggregate(WireFormat::ScanAggregate::SUM, "", UINT32_MAX, 8);
+    EXPECT_EQ(STATUS_MESSAGE_ERROR, respHdr->common.status);
+
+    respHdr = aggregate(WireFormat::ScanAggregate::SUM, "", 1, 3);
+    EXPECT_EQ(STATUS_MESSAGE_ERROR, respHdr->common.status);
+}
+
+TEST_F(ConcurrentSkipListTest, readModifyWrite) {
+    auto execute = [&](TestRpc *rpc) {
+        worker->schedule(Service::dispatch(worker, context, rpc));
+        while (!worker->isIdle())
+            worker->performTask();
+        return rpc;
+    };
+    auto increment = [&](uint64_t key, int64_t delta) {
+        auto rpc = new TestRpc();
+        auto reqHdr = rpc->requestPayload.emplaceAppend<WireFormat::Increment::Request>();
+        reqHdr->common.opcode = WireFormat::INCREMENT;
+        reqHdr->key = key;
+        reqHdr->delta = delta;
+        return execute(rpc)->replyPayload.getStart<WireFormat::Increment::Response>();
+    };
+    auto compareAndSwap = [&](uint64_t key, uint64_t version, std::string value) {
+        auto rpc = new TestRpc();
+        auto reqHdr = rpc->requestPayload.emplaceAppend<WireFormat::CompareAndSwap::Request>();
+        reqHdr->common.opcode = WireFormat::COMPARE_AND_SWAP;
+        reqHdr->key = key;
+        reqHdr->version = version;
+        reqHdr->length = static_cast<uint32_t>(value.length());
+        rpc->requestPayload.append(value.c_str(), reqHdr->length);
+        return execute(rpc)->replyPayload.getStart<WireFormat::CompareAndSwap::Response>();
+    };
+    auto append = [&](uint64_t key, std::string value) {
+        auto rpc = new TestRpc();
+        auto reqHdr = rpc->requestPayload.emplaceAppend<WireFormat::Append::Request>();
+        reqHdr->common.opcode = WireFormat::APPEND;
+        reqHdr->key = key;
+        reqHdr->length = static_cast<uint32_t>(value.length());
+        rpc->requestPayload.append(value.c_str(), reqHdr->length);
+        return execute(rpc)->replyPayload.getStart<WireFormat::Append::Response>();
+    };
+
+    auto *incrHdr = increment(1, 5);
+    EXPECT_EQ(STATUS_OK, incrHdr->common.status);
+    EXPECT_EQ(5, incrHdr->value);
+    EXPECT_EQ(1u, incrHdr->version);
+    incrHdr = increment(1, -7);
+    EXPECT_EQ(-2, incrHdr->value);
+    EXPECT_EQ(2u, incrHdr->version);
+
+    put(2, "abc");
+    incrHdr = increment(2, 1);
+    EXPECT_EQ(STATUS_INVALID_OBJECT, incrHdr->common.status);
+
+    auto *casHdr = compareAndSwap(3, 0, "x");
+    EXPECT_EQ(STATUS_OK, casHdr->common.status);
+    EXPECT_EQ(1u, casHdr->version);
+    casHdr = compareAndSwap(3, 0, "y");
+    EXPECT_EQ(STATUS_WRONG_VERSION, casHdr->common.status);
+    EXPECT_EQ(1u, casHdr->version);
+    casHdr = compareAndSwap(3, 1, "z");
+    EXPECT_EQ(STATUS_OK, casHdr->common.status);
+    EXPECT_EQ(2u, casHdr->version);
+    EXPECT_EQ("z", getResult(execute(getRpc(3))));
+
+    auto *appendHdr = append(4, "ab");
+    EXPECT_EQ(1u, appendHdr->version);
+    appendHdr = append(4, "cd");
+    EXPECT_EQ(2u, appendHdr->version);
+    auto *r = execute(getRpc(4));
+    EXPECT_EQ("abcd", getResult(r));
+    EXPECT_EQ(2u, r->replyPayload.getStart<WireFormat::Get::Response>()->version);
+}
+
+TEST_F(ConcurrentSkipListTest, multiGetPut) {
+    auto execute = [&](TestRpc *rpc) {
+        worker->schedule(Service::dispatch(worker, context, rpc));
+        while (!worker->isIdle())
+            worker->performTask();
+        return rpc;
+    };
+
+    std::vector<std::pair<uint64_t, std::string>> puts{{9, "a"}, {3, "bb"}, {9, "ccc"}, {5, ""}};
+    auto *putRpc = new TestRpc();
+    auto *putHdr = putRpc->requestPayload.emplaceAppend<WireFormat::MultiPut::Request>();
+    putHdr->common.opcode = WireFormat::MULTI_PUT;
+    putHdr->count = static_cast<uint32_t>(puts.size());
+    for (auto &put : puts) {
+        auto *part = putRpc->requestPayload.emplaceAppend<WireFormat::MultiPut::Part>();
+        part->key = put.first;
+        part->length = static_cast<uint32_t>(put.second.length());
+        putRpc->requestPayload.append(put.second.c_str(), part->length);
+    }
+    execute(putRpc);
+    auto *putResp = putRpc->replyPayload.getStart<WireFormat::MultiPut::Response>();
+    EXPECT_EQ(STATUS_OK, putResp->common.status);
+    ASSERT_EQ(4u, putResp->count);
+    for (uint32_t i = 0; i < 4; i++) {
+        EXPECT_EQ(1u, *putRpc->replyPayload.getOffset<uint64_t>(
+            static_cast<uint32_t>(sizeof(*putResp) + i * sizeof(uint64_t))));
+    }
+
+    std::vector<uint64_t> keys{9, 4, 3, 5, 9};
+    auto *getRpc = new TestRpc();
+    auto *getHdr = getRpc->requestPayload.emplaceAppend<WireFormat::MultiGet::Request>();
+    getHdr->common.opcode = WireFormat::MULTI_GET;
+    getHdr->count = static_cast<uint32_t>(keys.size());
+    getRpc->requestPayload.append(keys.data(), static_cast<uint32_t>(keys.size() * sizeof(uint64_t)));
+    execute(getRpc);
+
+    std::vector<std::string> expected{"ccc", DOESNT_EXISTS, "bb", "", "ccc"};
+    auto *getResp = getRpc->replyPayload.getStart<WireFormat::MultiGet::Response>();
+    EXPECT_EQ(STATUS_OK, getResp->common.status);
+    ASSERT_EQ(5u, getResp->count);
+    uint32_t offset = sizeof(*getResp);
+    for (const std::string &value : expected) {
+        auto *part = getRpc->replyPayload.getOffset<WireFormat::MultiGet::Part>(offset);
+        offset += sizeof(*part);
+        if (value == DOESNT_EXISTS) {
+            EXPECT_EQ(STATUS_OBJECT_DOESNT_EXIST, part->status);
+            continue;
+        }
+        EXPECT_EQ(STATUS_OK, part->status);
+        std::string actual(part->length, '\0');
+        getRpc->replyPayload.copy(offset, part->length, &actual[0]);
+        EXPECT_EQ(value, actual);
+        offset += part->length;
+    }
+}
+
+TEST_F(ConcurrentSkipListTest, transact) {
+    put(2, "old");
+    put(4, "old");
+    while (!worker->isIdle())
+        worker->performTask();
+
+    struct Op {
+        uint8_t operation;
+        uint64_t key;
+        std::string value;
+    };
+    std::vector<Op> ops{{WireFormat::Transact::TX_PUT, 3, "x"},
+                        {WireFormat::Transact::TX_ERASE, 2, ""},
+                        {WireFormat::Transact::TX_PUT, 4, "y"},
+                        {WireFormat::Transact::TX_PUT, 1, "z"}};
+    auto *rpc = new TestRpc();
+    auto *reqHdr = rpc->requestPayload.emplaceAppend<WireFormat::Transact::Request>();
+    reqHdr->common.opcode = WireFormat::TRANSACT;
+    reqHdr->count = static_cast<uint32_t>(ops.size());
+    for (auto &op : ops) {
+        auto *part = rpc->requestPayload.emplaceAppend<WireFormat::Transact::Part>();
+        part->operation = op.operation;
+        part->key = op.key;
+        part->length = static_cast<uint32_t>(op.value.length());
+        rpc->requestPayload.append(op.value.c_str(), part->length);
+    }
+    worker->schedule(Service::dispatch(worker, context, rpc));
+    while (!worker->isIdle())
+        worker->performTask();
+
+    auto *respHdr = rpc->replyPayload.getStart<WireFormat::Transact::Response>();
+    EXPECT_EQ(STATUS_OK, respHdr->common.status);
+    ASSERT_EQ(4u, respHdr->count);
+    std::vector<uint64_t> expectedVersions{1, 0, 2, 1};
+    for (uint32_t i = 0; i < 4; i++) {
+        EXPECT_EQ(expectedVersions[i], *rpc->replyPayload.getOffset<uint64_t>(
+            static_cast<uint32_t>(sizeof(*respHdr) + i * sizeof(uint64_t))));
+    }
+
+    std::vector<std::string> expected{"z", DOESNT_EXISTS, "x", "y"};
+    std::vector<TestRpc *> gets;
+    for (uint64_t key = 1; key <= 4; key++)
+        gets.push_back(get(key));
+    while (!worker->isIdle())
+        worker->performTask();
+    for (int i = 0; i < 4; i++)
+        EXPECT_EQ(expected[i], getResult(gets[i]));
+
+    TestRpc *r = scan(1, 4);
+    while (!worker->isIdle())
+        worker->performTask();
+    EXPECT_EQ(3u, toIterator(r)->size);
+}
+
 }
@@ -2,6 +2,10 @@
 #include "Logger.h"
 #include "Object.h"
 #include "Log.h"
+#include "Exception.h"
+
+#include <fcntl.h>
+#include <unistd.h>
 
 namespace Gungnir {
 
@@ -31,7 +35,9 @@ TEST_F(LogTest, writeAndRead) {
         LogEntry *entry;
 
         if (i % 2 == 0) {
-            entry = new Object(i, data.c_str(), data.length());
+            auto *object = new Object(i, data.c_str(), data.length());
+            object->version = i + 1;
+            entry = object;
         } else {
             entry = new ObjectTombstone(i);
         }
@@ -50,6 +56,7 @@ TEST_F(LogTest, writeAndRead) {
             expectType = LOG_ENTRY_TYPE_OBJ;
             std::string actualValue = toString(&object->value);
             EXPECT_EQ(actualValue, std::to_string(i * 2));
+            EXPECT_EQ(object->version, i + 1);
         } else
             expectType = LOG_ENTRY_TYPE_OBJTOMB;
         EXPECT_EQ(entry->type, expectType);
@@ -105,4 +112,152 @@ TEST_F(LogTest, writerThread) {
     delete log;
 }
 
+TEST_F(LogTest, appendBatch) {
+    log = new Log(filePath, false, segmentSize);
+
+    // Larger than a segment, so the batch gets an oversized one.
+    std::vector<LogEntry *> entries;
+    for (int i = 0; i < 40; i++) {
+        std::string data = std::to_string(i * 5);
+        entries.push_back(new Object(i, data.c_str(), data.length()));
+    }
+    uint64_t toOffset = log->append(entries.data(), static_cast<int>(entries.size()));
+    EXPECT_GT(toOffset, static_cast<uint64_t>(segmentSize));
+    EXPECT_EQ(toOffset + 9, log->append(new ObjectTombstone(40)));
+    while (log->write());
+    EXPECT_TRUE(log->sync(toOffset));
+    delete log;
+
+    log = new Log(filePath, true, segmentSize);
+    for (int i = 0; i < 40; i++) {
+        auto *object = dynamic_cast<Object *>(log->read());
+        ASSERT_NE(object, nullptr);
+        EXPECT_EQ(object->key.value(), i);
+        EXPECT_EQ(toString(&object->value), std::to_string(i * 5));
+    }
+    LogEntry *entry = log->read();
+    EXPECT_EQ(entry->type, LOG_ENTRY_TYPE_OBJTOMB);
+    EXPECT_EQ(log->read(), nullptr);
+    delete log;
+}
+
+TEST_F(LogTest, transactionRecovery) {
+    log = new Log(filePath, false, segmentSize);
+
+    std::vector<LogEntry *> committed{new TransactionBegin(2), new Object(1, "a", 1), new ObjectTombstone(2),
+                                      new TransactionCommit(2)};
+    log->append(committed.data(), static_cast<int>(committed.size()));
+    log->append(new Object(3, "b", 1));
+    // A crash before the commit marker was written.
+    std::vector<LogEntry *> torn{new TransactionBegin(2), new Object(4, "c", 1), new Object(5, "d", 1)};
+    log->append(torn.data(), static_cast<int>(torn.size()));
+    while (log->write());
+    delete log;
+
+    log = new Log(filePath, true, segmentSize);
+    LogEntry *entry = log->read();
+    ASSERT_NE(entry, nullptr);
+    EXPECT_EQ(entry->type, LOG_ENTRY_TYPE_OBJ);
+    EXPECT_EQ(entry->key.value(), 1);
+    entry = log->read();
+    ASSERT_NE(entry, nullptr);
+    EXPECT_EQ(entry->type, LOG_ENTRY_TYPE_OBJTOMB);
+    EXPECT_EQ(entry->key.value(), 2);
+    entry = log->read();
+    ASSERT_NE(entry, nullptr);
+    EXPECT_EQ(entry->key.value(), 3);
+    EXPECT_EQ(log->read(), nullptr);
+
+    // The torn transaction is cut off, so what is written next follows the
+    // last complete record and is recovered with the rest.
+    int fd = ::open(filePath, O_RDONLY);
+    EXPECT_EQ(static_cast<off_t>(log->getRecoveredLength()), ::lseek(fd, 0, SEEK_END));
+    ::close(fd);
+    log->append(new Object(6, "e", 1));
+    while (log->write());
+    delete log;
+
+    log = new Log(filePath, true, segmentSize);
+    for (uint64_t key : {1, 2, 3, 6}) {
+        entry = log->read();
+        ASSERT_NE(entry, nullptr);
+        EXPECT_EQ(entry->key.value(), key);
+        delete entry;
+    }
+    EXPECT_EQ(log->read(), nullptr);
+    delete log;
+}
+
+TEST_F(LogTest, replication) {
+    log = new Log(filePath, false, segmentSize);
+    log->enableReplication(false);
+
+    uint64_t toOffset = 0;
+    for (int i = 0; i < 60; i++) {
+        std::string data = std::to_string(i * 7);
+        if (i % 3 == 2)
+            toOffset = log->append(new ObjectTombstone(i));
+        else
+            toOffset = log->append(new Object(i, data.c_str(), data.length()));
+    }
+    // Written out, but not yet replicated; the segments must stay.
+    while (log->write());
+    EXPECT_FALSE(log->sync(toOffset));
+
+    Buffer batch;
+    EXPECT_EQ(0u, log->takeReplicationBatch(&batch, static_cast<uint32_t>(segmentSize)));
+    uint64_t taken = batch.size();
+    EXPECT_LT(taken, toOffset);
+    EXPECT_EQ(taken, log->takeReplicationBatch(&batch, ~0u));
+    EXPECT_EQ(toOffset, batch.size());
+
+    uint32_t offset = 0;
+    for (int i = 0; i < 60; i++) {
+        LogEntry *entry = Log::parseEntry(&batch, &offset);
+        ASSERT_NE(entry, nullptr);
+        EXPECT_EQ(entry->key.value(), i);
+        if (i % 3 == 2) {
+            EXPECT_EQ(entry->type, LOG_ENTRY_TYPE_OBJTOMB);
+        } else {
+            EXPECT_EQ(entry->type, LOG_ENTRY_TYPE_OBJ);
+            EXPECT_EQ(toString(&static_cast<Object *>(entry)->value), std::to_string(i * 7));
+        }
+        delete entry;
+    }
+    EXPECT_EQ(Log::parseEntry(&batch, &offset), nullptr);
+
+    log->setReplicatedLength(taken);
+    EXPECT_TRUE(log->sync(taken));
+    EXPECT_FALSE(log->sync(toOffset));
+    log->setReplicatedLength(toOffset);
+    EXPECT_TRUE(log->sync(toOffset));
+    while (log->write());
+    delete log;
+}
+
+TEST_F(LogTest, formatVersion) {
+    // A file written before entries carried versions has no header: it
+    // starts with an OBJ entry.
+    int fd = ::open(filePath, O_CREAT | O_TRUNC | O_WRONLY, 0666);
+    char oldEntry[] = {LOG_ENTRY_TYPE_OBJ, 1, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 'a'};
+    ASSERT_EQ(static_cast<ssize_t>(sizeof(oldEntry)), ::write(fd, oldEntry, sizeof(oldEntry)));
+    ::close(fd);
+    EXPECT_THROW(new Log(filePath, true, segmentSize), FatalError);
+
+    Log::FileHeader header{Log::FILE_MAGIC, Log::FORMAT_VERSION + 1};
+    fd = ::open(filePath, O_CREAT | O_TRUNC | O_WRONLY, 0666);
+    ASSERT_EQ(static_cast<ssize_t>(sizeof(header)), ::write(fd, &header, sizeof(header)));
+    ::close(fd);
+    EXPECT_THROW(new Log(filePath, true, segmentSize), FatalError);
+
+    // Recovering a file that doesn't exist yet starts a new one.
+    ::remove(filePath);
+    log = new Log(filePath, true, segmentSize);
+    EXPECT_EQ(log->read(), nullptr);
+    delete log;
+    log = new Log(filePath, true, segmentSize);
+    EXPECT_EQ(log->read(), nullptr);
+    delete log;
+}
+
 }
@@ -0,0 +1,65 @@
+#include <gtest/gtest.h>
+#include "PriorityLanes.h"
+#include "WireFormat.h"
+#include "Exception.h"
+
+namespace Gungnir {
+
+class PriorityLanesTest : public ::testing::Test {
+
+};
+
+TEST_F(PriorityLanesTest, laneOf) {
+    EXPECT_EQ(READ_LANE, laneOf(WireFormat::GET));
+    EXPECT_EQ(WRITE_LANE, laneOf(WireFormat::PUT));
+    EXPECT_EQ(WRITE_LANE, laneOf(WireFormat::ERASE));
+    EXPECT_EQ(SCAN_LANE, laneOf(WireFormat::SCAN));
+}
+
+TEST_F(PriorityLanesTest, weights) {
+    LaneWeights weights("4,2");
+    EXPECT_EQ(4u, weights.weights[READ_LANE]);
+    EXPECT_EQ(2u, weights.weights[WRITE_LANE]);
+    EXPECT_EQ(1u, weights.weights[SCAN_LANE]);
+    EXPECT_THROW(LaneWeights("4,0,1"), FatalError);
+    EXPECT_THROW(LaneWeights("4,x"), FatalError);
+}
+
+TEST_F(PriorityLanesTest, weightedRoundRobin) {
+    PriorityLanes<int> lanes{LaneWeights("3,2,1")};
+    for (int i = 0; i < 6; i++) {
+        lanes.push(READ_LANE, i);
+        lanes.push(WRITE_LANE, 10 + i);
+        lanes.push(SCAN_LANE, 20 + i);
+    }
+    std::vector<int> order;
+    for (int i = 0; i < 12; i++)
+        order.push_back(lanes.pop());
+    EXPECT_EQ((std::vector<int>{0, 1, 2, 10, 11, 20, 3, 4, 5, 12, 13, 21}), order);
+    EXPECT_EQ(6u, lanes.size());
+
+    // Once the reads run out, the other lanes share the turns.
+    EXPECT_EQ(14, lanes.pop());
+    EXPECT_EQ(15, lanes.pop());
+    EXPECT_EQ(22, lanes.pop());
+    EXPECT_EQ(23, lanes.pop());
+}
+
+TEST_F(PriorityLanesTest, eraseIfAndAhead) {
+    PriorityLanes<int> lanes{LaneWeights("2,1,1")};
+    for (int i = 0; i < 4; i++) {
+        lanes.push(READ_LANE, i);
+        lanes.push(SCAN_LANE, 20 + i);
+    }
+    EXPECT_EQ(6u, lanes.ahead(READ_LANE));
+    EXPECT_EQ(8u, lanes.ahead(SCAN_LANE));
+    EXPECT_TRUE(lanes.eraseIf([](int item) { return item == 21; }));
+    EXPECT_FALSE(lanes.eraseIf([](int item) { return item == 21; }));
+    EXPECT_EQ(7u, lanes.size());
+    EXPECT_EQ(0, lanes.pop());
+    EXPECT_EQ(1, lanes.pop());
+    EXPECT_EQ(20, lanes.pop());
+    EXPECT_EQ(2, lanes.pop());
+}
+
+}
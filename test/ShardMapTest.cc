@@ -0,0 +1,52 @@
+#include <gtest/gtest.h>
+#include "ShardMap.h"
+
+namespace Gungnir {
+
+class ShardMapTest : public ::testing::Test {
+
+};
+
+TEST_F(ShardMapTest, hashing_spreadsKeys) {
+    ShardMap map(4);
+    uint32_t counts[4] = {0, 0, 0, 0};
+    for (uint64_t key = 0; key < 40000; key++) {
+        uint32_t shard = map.shardOf(key);
+        ASSERT_LT(shard, 4u);
+        counts[shard]++;
+    }
+    for (uint32_t count: counts) {
+        EXPECT_GT(count, 7000u);
+        EXPECT_LT(count, 13000u);
+    }
+    EXPECT_EQ(4u, map.shardsFor(10, 20).size());
+}
+
+TEST_F(ShardMapTest, hashing_addingShardOnlyMovesKeysToIt) {
+    ShardMap before(4);
+    ShardMap after(5);
+    uint32_t moved = 0;
+    for (uint64_t key = 0; key < 40000; key++) {
+        uint32_t shard = after.shardOf(key);
+        if (shard != before.shardOf(key)) {
+            EXPECT_EQ(4u, shard);
+            moved++;
+        }
+    }
+    EXPECT_GT(moved, 4000u);
+    EXPECT_LT(moved, 12000u);
+}
+
+TEST_F(ShardMapTest, ranges) {
+    ShardMap map(std::vector<uint64_t>{100, 200, 300});
+    EXPECT_TRUE(map.isRangeMap());
+    EXPECT_EQ(0u, map.shardOf(0));
+    EXPECT_EQ(0u, map.shardOf(199));
+    EXPECT_EQ(1u, map.shardOf(200));
+    EXPECT_EQ(2u, map.shardOf(~0ul));
+    EXPECT_EQ((std::vector<uint32_t>{1, 2}), map.shardsFor(250, 350));
+    EXPECT_EQ((std::vector<uint32_t>{0}), map.shardsFor(0, 10));
+    EXPECT_TRUE(map.shardsFor(20, 10).empty());
+}
+
+}
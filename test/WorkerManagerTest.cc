@@ -0,0 +1,396 @@
+#include <gtest/gtest.h>
+#include <unistd.h>
+#include "Worker.h"
+#include "WorkerManager.h"
+#include "ConcurrentSkipList.h"
+#include "Cycles.h"
+#include "LogCleaner.h"
+#include "Dispatch.h"
+#include "OptionConfig.h"
+
+namespace Gungnir {
+
+class RecordingRpc : public Transport::ServerRpc {
+public:
+    RecordingRpc() : replies(0) {}
+
+    void sendReply() override {
+        replies++;
+    }
+
+    std::string getClientServiceLocator() override {
+        return "test";
+    }
+
+    int replies;
+};
+
+/**
+ * Drives a WorkerManager from the test thread. Its one worker has no
+ * thread of its own: it starts and serves the RPCs handed to it only when
+ * the test says so, which decides whether later RPCs find them started.
+ */
+class WorkerManagerTest : public ::testing::Test {
+public:
+    OptionConfig optionConfig;
+    Context *context;
+    WorkerManager *manager;
+    Worker *worker;
+
+    WorkerManagerTest() : optionConfig(), context(), manager(), worker() {
+        context = new Context();
+        context->optionConfig = &optionConfig;
+        context->dispatch = new Dispatch(false);
+        context->skipList = new ConcurrentSkipList(context);
+        context->logCleaner = new LogCleaner(context);
+    }
+
+    ~WorkerManagerTest() override {
+        if (manager != nullptr) {
+            manager->busyThreads.clear();
+            manager->idleThreads.clear();
+            delete manager;
+        }
+        delete worker;
+        delete context;
+    }
+
+    /// Create the manager, once optionConfig is set up.
+    void start() {
+        manager = new WorkerManager(context, 0);
+        worker = new Worker(context);
+        manager->idleThreads.push_back(worker);
+    }
+
+    /// Let the worker start the RPCs handed to it, without serving them.
+    void startRpcs() {
+        while (Transport::ServerRpc *rpc = worker->popIncoming())
+            worker->startRpc(rpc);
+    }
+
+    /// Let the worker serve everything handed to it, and the manager send
+    /// the replies.
+    void run() {
+        startRpcs();
+        while (!worker->isIdle())
+            worker->performTask();
+        manager->poll();
+    }
+
+    size_t waiting() {
+        return manager->waitingRpcs.size();
+    }
+
+    /// Hand the worker as many distinct GETs as it takes, so that later
+    /// RPCs must wait.
+    void fillWorker() {
+        for (uint32_t key = 100; key < 100 + Worker::maxRpcs(READ_LANE); key++)
+            manager->handleRpc(getRpc(key));
+    }
+
+    RecordingRpc *getRpc(uint64_t key) {
+        auto rpc = new RecordingRpc();
+        auto reqHdr = rpc->requestPayload.emplaceAppend<WireFormat::Get::Request>();
+        reqHdr->common.opcode = WireFormat::GET;
+        reqHdr->key = key;
+        return rpc;
+    }
+
+    RecordingRpc *putRpc(uint64_t key, const std::string &value) {
+        auto rpc = new RecordingRpc();
+        auto reqHdr = rpc->requestPayload.emplaceAppend<WireFormat::Put::Request>();
+        reqHdr->common.opcode = WireFormat::PUT;
+        reqHdr->key = key;
+        reqHdr->length = value.length();
+        rpc->requestPayload.append(value.c_str(), value.length());
+        return rpc;
+    }
+
+    RecordingRpc *casRpc(uint64_t key, uint64_t version, const std::string &value) {
+        auto rpc = new RecordingRpc();
+        auto reqHdr = rpc->requestPayload.emplaceAppend<WireFormat::CompareAndSwap::Request>();
+        reqHdr->common.opcode = WireFormat::COMPARE_AND_SWAP;
+        reqHdr->key = key;
+        reqHdr->version = version;
+        reqHdr->length = static_cast<uint32_t>(value.length());
+        rpc->requestPayload.append(value.c_str(), value.length());
+        return rpc;
+    }
+
+    std::string getResult(RecordingRpc *rpc) {
+        auto respHdr = rpc->replyPayload.getStart<WireFormat::Get::Response>();
+        return std::string(rpc->replyPayload.getOffset<char>(sizeof(*respHdr)), respHdr->length);
+    }
+
+    uint64_t putVersion(RecordingRpc *rpc) {
+        return rpc->replyPayload.getStart<WireFormat::Put::Response>()->version;
+    }
+
+    Status status(RecordingRpc *rpc) {
+        return Status(rpc->replyPayload.getStart<WireFormat::ResponseCommon>()->status);
+    }
+
+    const WireFormat::RetryResponse *retryResponse(RecordingRpc *rpc) {
+        return rpc->replyPayload.getStart<WireFormat::RetryResponse>();
+    }
+
+    static uint64_t micros(uint64_t micros) {
+        return Cycles::fromMicroseconds(micros);
+    }
+
+    // The admission state, which only the fixture may reach.
+    void sampleDelay(uint64_t delay, uint64_t now) {
+        manager->sampleDelay(delay, now);
+    }
+
+    bool &overloaded() {
+        return manager->overloaded;
+    }
+
+    uint64_t &serviceTime() {
+        return manager->serviceTime;
+    }
+
+    uint64_t retryMicros() {
+        return manager->retryMicros;
+    }
+};
+
+TEST_F(WorkerManagerTest, coalesceGets) {
+    start();
+    manager->handleRpc(putRpc(1, "a"));
+    run();
+
+    RecordingRpc *first = getRpc(1);
+    RecordingRpc *second = getRpc(1);
+    RecordingRpc *other = getRpc(2);
+    manager->handleRpc(first);
+    manager->handleRpc(second);
+    manager->handleRpc(other);
+    EXPECT_EQ(1u, manager->coalescedGets);
+    run();
+    EXPECT_EQ(1, first->replies);
+    EXPECT_EQ(1, second->replies);
+    EXPECT_EQ(1, other->replies);
+    EXPECT_EQ("a", getResult(first));
+    EXPECT_EQ("a", getResult(second));
+    EXPECT_EQ(STATUS_OBJECT_DOESNT_EXIST, status(other));
+}
+
+TEST_F(WorkerManagerTest, coalescePuts) {
+    start();
+    RecordingRpc *puts[] = {putRpc(1, "a"), putRpc(1, "b"), putRpc(1, "c")};
+    for (RecordingRpc *put : puts)
+        manager->handleRpc(put);
+    EXPECT_EQ(2u, manager->coalescedPuts);
+    run();
+
+    // The replaced PUTs get versions of their own, which the applied one
+    // has passed.
+    for (uint64_t i = 0; i < 3; i++) {
+        EXPECT_EQ(1, puts[i]->replies);
+        EXPECT_EQ(STATUS_OK, status(puts[i]));
+        EXPECT_EQ(i + 1, putVersion(puts[i]));
+    }
+    RecordingRpc *get = getRpc(1);
+    manager->handleRpc(get);
+    run();
+    EXPECT_EQ("c", getResult(get));
+    EXPECT_EQ(3u, get->replyPayload.getStart<WireFormat::Get::Response>()->version);
+
+    RecordingRpc *cas = casRpc(1, putVersion(puts[1]), "d");
+    manager->handleRpc(cas);
+    run();
+    EXPECT_EQ(STATUS_WRONG_VERSION, status(cas));
+}
+
+TEST_F(WorkerManagerTest, coalesceAfterStart) {
+    start();
+    RecordingRpc *first = putRpc(1, "a");
+    manager->handleRpc(first);
+    startRpcs();
+    RecordingRpc *second = putRpc(1, "b");
+    manager->handleRpc(second);
+    EXPECT_EQ(0u, manager->coalescedPuts);
+    run();
+    EXPECT_EQ(1u, putVersion(first));
+    EXPECT_EQ(2u, putVersion(second));
+
+    RecordingRpc *get = getRpc(1);
+    manager->handleRpc(get);
+    startRpcs();
+    RecordingRpc *late = getRpc(1);
+    manager->handleRpc(late);
+    EXPECT_EQ(0u, manager->coalescedGets);
+    run();
+    EXPECT_EQ("b", getResult(get));
+    EXPECT_EQ("b", getResult(late));
+}
+
+TEST_F(WorkerManagerTest, shedFollowers) {
+    optionConfig.queueDelayTargetMicros = 10;
+    optionConfig.queueDelayIntervalMicros = 100;
+    start();
+    fillWorker();
+    RecordingRpc *first = getRpc(1);
+    RecordingRpc *second = getRpc(1);
+    manager->handleRpc(first);
+    manager->handleRpc(second);
+    EXPECT_EQ(1u, waiting());
+    EXPECT_EQ(1u, manager->coalescedGets);
+
+    // Waiting longer than the interval, the first is turned away, and its
+    // follower with it.
+    usleep(1000);
+    run();
+    EXPECT_EQ(1u, manager->shedRpcs);
+    EXPECT_EQ(0u, waiting());
+    EXPECT_EQ(1, first->replies);
+    EXPECT_EQ(1, second->replies);
+    EXPECT_EQ(STATUS_RETRY, status(first));
+    EXPECT_EQ(STATUS_RETRY, status(second));
+}
+
+TEST_F(WorkerManagerTest, overloaded) {
+    optionConfig.queueDelayTargetMicros = 10;
+    optionConfig.queueDelayIntervalMicros = 100;
+    start();
+    uint64_t interval = micros(100);
+    uint64_t now = Cycles::rdtsc();
+    sampleDelay(0, now);
+
+    // Every RPC of an interval waits longer than the target.
+    sampleDelay(micros(50), now + micros(50));
+    sampleDelay(micros(20), now + interval);
+    EXPECT_TRUE(overloaded());
+
+    // One RPC gets below the target, which is enough.
+    sampleDelay(micros(50), now + interval + micros(50));
+    sampleDelay(micros(5), now + interval + micros(80));
+    sampleDelay(micros(50), now + 2 * interval);
+    EXPECT_FALSE(overloaded());
+}
+
+TEST_F(WorkerManagerTest, serviceTime) {
+    optionConfig.queueDelayTargetMicros = 10;
+    optionConfig.queueDelayIntervalMicros = 100;
+    start();
+    uint64_t interval = micros(100);
+    uint64_t now = Cycles::rdtsc();
+    sampleDelay(0, now);
+    EXPECT_EQ(0u, serviceTime());
+
+    // The first interval with completions gives an estimate, though the
+    // workers weren't overloaded.
+    manager->completedRpcs += 10;
+    sampleDelay(0, now + interval);
+    EXPECT_FALSE(overloaded());
+    EXPECT_EQ(interval / 10, serviceTime());
+
+    // Later intervals that aren't overloaded leave it be.
+    manager->completedRpcs += 5;
+    sampleDelay(0, now + 2 * interval);
+    EXPECT_EQ(interval / 10, serviceTime());
+
+    // Overloaded ones measure it.
+    manager->completedRpcs += 20;
+    sampleDelay(micros(50), now + 2 * interval + micros(50));
+    sampleDelay(micros(50), now + 3 * interval);
+    EXPECT_TRUE(overloaded());
+    EXPECT_EQ(interval / 20, serviceTime());
+}
+
+TEST_F(WorkerManagerTest, shedOverTarget) {
+    optionConfig.queueDelayTargetMicros = 10;
+    optionConfig.queueDelayIntervalMicros = 1000000;
+    start();
+    fillWorker();
+    overloaded() = true;
+    RecordingRpc *rpc = getRpc(1);
+    manager->handleRpc(rpc);
+    EXPECT_EQ(1u, waiting());
+
+    // Waiting longer than the target while overloaded, though well within
+    // the interval, it is turned away.
+    usleep(1000);
+    run();
+    EXPECT_EQ(1u, manager->shedRpcs);
+    EXPECT_EQ(0u, waiting());
+    EXPECT_EQ(1, rpc->replies);
+    EXPECT_EQ(STATUS_RETRY, status(rpc));
+}
+
+TEST_F(WorkerManagerTest, maxWaitingRpcs) {
+    optionConfig.maxWaitingRpcs = 2;
+    optionConfig.queueDelayTargetMicros = 0;
+    start();
+    fillWorker();
+    RecordingRpc *rpcs[] = {getRpc(1), getRpc(2), getRpc(3)};
+    for (RecordingRpc *rpc : rpcs)
+        manager->handleRpc(rpc);
+    EXPECT_EQ(2u, waiting());
+    EXPECT_EQ(1u, manager->rejectedRpcs);
+    EXPECT_EQ(0, rpcs[0]->replies);
+    EXPECT_EQ(0, rpcs[1]->replies);
+    EXPECT_EQ(1, rpcs[2]->replies);
+    EXPECT_EQ(STATUS_RETRY, status(rpcs[2]));
+
+    // Served once the worker is done with the others.
+    run();
+    EXPECT_EQ(0u, waiting());
+    run();
+    EXPECT_EQ(1, rpcs[0]->replies);
+    EXPECT_EQ(STATUS_OBJECT_DOESNT_EXIST, status(rpcs[0]));
+}
+
+TEST_F(WorkerManagerTest, retryDelay) {
+    optionConfig.maxWaitingRpcs = 1;
+    optionConfig.queueDelayTargetMicros = 10;
+    optionConfig.queueDelayIntervalMicros = 100;
+    start();
+    uint32_t least = WorkerManager::MIN_RETRY_MICROS;
+    uint32_t most = WorkerManager::MAX_RETRY_MICROS;
+    uint64_t now = Cycles::rdtsc();
+    sampleDelay(0, now);
+    fillWorker();
+    manager->handleRpc(getRpc(1));
+
+    // Clients are told to come back in about the shortest delay at first.
+    RecordingRpc *rejected = getRpc(2);
+    manager->handleRpc(rejected);
+    EXPECT_EQ(STATUS_RETRY, status(rejected));
+    EXPECT_EQ(least / 2, retryResponse(rejected)->minDelayMicros);
+    EXPECT_EQ(least * 3 / 2, retryResponse(rejected)->maxDelayMicros);
+
+    // The delay doubles with each interval in which clients were turned
+    // away, up to the most...
+    for (uint64_t i = 1; i <= 20; i++) {
+        manager->rejectedRpcs++;
+        sampleDelay(0, now + i * micros(100));
+    }
+    EXPECT_EQ(most, retryMicros());
+    rejected = getRpc(3);
+    manager->handleRpc(rejected);
+    EXPECT_EQ(most / 2, retryResponse(rejected)->minDelayMicros);
+    EXPECT_EQ(most * 3 / 2, retryResponse(rejected)->maxDelayMicros);
+
+    // ... and halves with each in which none were, down to the least. The
+    // current one has just turned a client away.
+    sampleDelay(0, now + 21 * micros(100));
+    EXPECT_EQ(most, retryMicros());
+    sampleDelay(0, now + 22 * micros(100));
+    EXPECT_EQ(most / 2, retryMicros());
+    for (uint64_t i = 23; i <= 40; i++)
+        sampleDelay(0, now + i * micros(100));
+    EXPECT_EQ(least, retryMicros());
+
+    // A client isn't told to come back before the RPCs waiting now are
+    // likely to have been served.
+    serviceTime() = micros(1000);
+    rejected = getRpc(4);
+    manager->handleRpc(rejected);
+    EXPECT_NEAR(500, retryResponse(rejected)->minDelayMicros, 1);
+    EXPECT_NEAR(1500, retryResponse(rejected)->maxDelayMicros, 1);
+}
+
+}